@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_ARCHIVE_H)
+#define _ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARCHIVE_BLOCK 512
+/* The index member, last in the archive, lists the others sorted by name. */
+#define ARCHIVE_INDEX_NAME ".index"
+#define ARCHIVE_INDEX_MAGIC "IUTARIDX"
+/* "IUTARIDX <offset of the index header>\n", ending the index member. */
+#define ARCHIVE_FOOTER_SIZE 32
+/* Results reach the storage in writes of this size. */
+#define ARCHIVE_WRITE_BUFFER (256 * 1024)
+
+/*
+ * A POSIX ustar header. The archive is a plain uncompressed tar: any tar
+ * tool extracts it, and an archive cut short still reads up to the last
+ * complete member.
+ */
+typedef struct {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char checksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char padding[12];
+} archive_header;
+
+/* A member of an open archive; the pointers live as long as the archive. */
+typedef struct {
+	const char *name;
+	const unsigned char *data;
+	size_t length;
+} archive_view;
+
+typedef struct archive_writer archive_writer;
+typedef struct archive archive;
+
+int archive_create(const char *path, archive_writer **writer);
+int archive_add(archive_writer *writer, const char *name, const void *data,
+		size_t length);
+int archive_link(archive_writer *writer, const char *name,
+		const char *original);
+int archive_finish(archive_writer *writer);
+void archive_abort(archive_writer *writer);
+
+int archive_open(const char *path, archive **reader);
+void archive_close(archive *reader);
+unsigned int archive_count(const archive *reader);
+int archive_get(const archive *reader, unsigned int index,
+		archive_view *view);
+int archive_find(const archive *reader, const char *name,
+		archive_view *view);
+int archive_extract(const archive *reader, const char *directory);
+
+#endif
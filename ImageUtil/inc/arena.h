@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_ARENA_H)
+#define _ARENA_H
+
+#include "job.h"
+
+/* Default size of an arena's first chunk. */
+#define ARENA_CHUNK_SIZE (256 * 1024)
+/* Larger scratch comes from the buffer pool, whose budget bounds it. */
+#define ARENA_SCRATCH_LIMIT (1024 * 1024)
+/* Byte budget of the free large buffers kept by the buffer pool. */
+#define BUFFER_POOL_BUDGET (32 * 1024 * 1024)
+
+/*
+ * Bump allocator for per-job scratch memory. Allocations are only freed
+ * all at once by arena_reset(). Not thread-safe: each worker owns one.
+ */
+typedef struct arena arena;
+
+arena *arena_create(size_t chunk_size);
+void arena_destroy(arena *self);
+void *arena_alloc(arena *self, size_t size);
+void arena_reset(arena *self);
+arena *arena_current(void);
+void arena_set_current(arena *self);
+
+/*
+ * Scratch memory of a job: from the arena of the calling worker, up to
+ * ARENA_SCRATCH_LIMIT bytes, otherwise from the buffer pool. Give it back
+ * with scratch_put() before the job ends.
+ */
+void *scratch_get(size_t size);
+void scratch_put(void *data);
+
+/*
+ * Large buffers recycled by size class, for images that outlive a job.
+ * Free them with buffer_pool_put() or image_buffer_free().
+ */
+void *buffer_pool_get(size_t size);
+void buffer_pool_put(void *data);
+void buffer_pool_set_budget(size_t budget);
+void image_buffer_free(image_buffer *image);
+
+void arena_log_stats(void);
+
+#endif
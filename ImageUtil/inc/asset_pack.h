@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_ASSET_PACK_H)
+#define _ASSET_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <image_util.h>
+
+#define ASSET_PACK_MAGIC "IUPACK\r\n"
+#define ASSET_PACK_VERSION 1
+/* Stored natively: packs written with the other byte order are refused. */
+#define ASSET_PACK_BYTE_ORDER 0x01020304u
+/* Blobs start on cache lines, so mapped pixels can be read in place. */
+#define ASSET_PACK_ALIGN 64
+
+typedef enum {
+	ASSET_FORMAT_JPEG,
+	/* Raw pixels in the colorspace of the entry. */
+	ASSET_FORMAT_RAW
+} asset_format;
+
+/*
+ * The file is one header, the blobs, a string table of names and an index
+ * of entries sorted by name then width then height. Nothing needs to be
+ * parsed: a reader maps the file and binary searches the index in place.
+ */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t entry_count;
+	uint32_t reserved;
+	uint64_t index_offset;
+	uint64_t strings_offset;
+	uint64_t strings_size;
+	uint64_t file_size;
+} asset_pack_header;
+
+typedef struct {
+	/* The name, not terminated, in the string table. */
+	uint32_t name_offset;
+	uint32_t name_length;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint32_t colorspace;
+	uint64_t offset;
+	uint64_t length;
+} asset_pack_entry;
+
+/* An entry of a mapped pack; the pointers live as long as the pack. */
+typedef struct {
+	const char *name;
+	size_t name_length;
+	unsigned int width;
+	unsigned int height;
+	asset_format format;
+	image_util_colorspace_e colorspace;
+	const unsigned char *data;
+	size_t length;
+} asset_view;
+
+typedef struct asset_pack_writer asset_pack_writer;
+typedef struct asset_pack asset_pack;
+
+int asset_pack_create(const char *path, asset_pack_writer **writer);
+int asset_pack_add(asset_pack_writer *writer, const char *name,
+		unsigned int width, unsigned int height, asset_format format,
+		image_util_colorspace_e colorspace, const void *data, size_t length);
+int asset_pack_link(asset_pack_writer *writer, const char *name,
+		unsigned int width, unsigned int height, const char *original);
+int asset_pack_finish(asset_pack_writer *writer);
+void asset_pack_abort(asset_pack_writer *writer);
+
+int asset_pack_open(const char *path, asset_pack **pack);
+void asset_pack_close(asset_pack *pack);
+unsigned int asset_pack_count(const asset_pack *pack);
+int asset_pack_get(const asset_pack *pack, unsigned int index,
+		asset_view *view);
+int asset_pack_find(const asset_pack *pack, const char *name,
+		unsigned int width, unsigned int height, asset_view *view);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_ATLAS_H)
+#define _ATLAS_H
+
+#include "batch.h"
+
+/*
+ * Sprites are padded to whole 16x16 JPEG blocks, so that no block of a page
+ * holds two sprites and compression never bleeds from one to another.
+ */
+#define ATLAS_ALIGN 16
+#define ATLAS_MAX_PAGE 8192
+
+/*
+ * An atlas batch: every input is transformed to the size of the batch and
+ * packed with its category, the name of the file without its extension
+ * and trailing digits ("hat03.jpg" is a "hat"). Each category gets JPEG
+ * pages of at most req->atlas, "<category>.jpg" or "<category>_<n>.jpg"
+ * if it needs several, and an index "<category>.json":
+ *
+ *   {"pages": ["hat.jpg"], "sprites": {"hat01": [0, 0, 0, 64, 48], ...}}
+ *
+ * mapping each file name to its page, x, y, width and height. An input
+ * named like an earlier input of another image, in another directory,
+ * fails. Pages are composed in RGB888 and encoded at the quality of the
+ * batch.
+ */
+int atlas_submit(const batch_request *req, cancel_token *cancel,
+		batch_job_cb job_cb, batch_done_cb done_cb, void *user_data);
+
+#endif
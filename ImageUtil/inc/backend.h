@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_BACKEND_H)
+#define _BACKEND_H
+
+#include <stdint.h>
+#include <image_util.h>
+#include "job.h"
+
+/*
+ * Environment variable enabling the mock accelerator backend.
+ * Format: "<setup_us>:<ns_per_pixel>:<capacity>:<fail_every>", e.g. "500:1:2:0".
+ */
+#define BACKEND_MOCK_ENV "IMAGEUTIL_MOCK_ACCEL"
+
+typedef enum {
+	BACKEND_HW,
+	BACKEND_MOCK,
+	BACKEND_CPU,
+	BACKEND_COUNT
+} backend_id;
+
+typedef struct transform_backend transform_backend;
+
+/* A transformation engine together with its routing state. */
+struct transform_backend {
+	backend_id id;
+	const char *name;
+	bool available;
+
+	/* Jobs allowed in flight at once; 0 means unlimited. */
+	unsigned int capacity;
+	unsigned int inflight;
+
+	/* Cost model: cost_us = setup_us + pixels * ns_per_pixel / 1000. */
+	double setup_us;
+	double ns_per_pixel;
+
+	/* Circuit breaker. */
+	unsigned int consecutive_failures;
+	uint64_t disabled_until_us;
+
+	/* Statistics. */
+	unsigned int jobs;
+	unsigned int failures;
+	unsigned int skipped_saturated;
+
+	int (*probe)(transform_backend *self);
+	bool (*supports)(const transform_backend *self, const transform_job *job);
+	/* Runs the job synchronously. May set *device_us to a modelled run time. */
+	int (*run)(transform_backend *self, media_packet_h src,
+			const transform_job *job, media_packet_h *dst, uint64_t *device_us);
+};
+
+int backend_init(void);
+int backend_transform(media_packet_h src, const transform_job *job,
+		media_packet_h *dst, const char **backend_name);
+void backend_log_stats(void);
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_BATCH_H)
+#define _BATCH_H
+
+#include <app_control.h>
+#include "job.h"
+#include "pipeline.h"
+#include "scan.h"
+#include "composite.h"
+
+/* The app_control operation requesting a headless batch. */
+#define BATCH_APP_CONTROL_OPERATION \
+	"http://org.example.imageutil/appcontrol/operation/batch"
+
+#define BATCH_MAX_INPUTS 32
+#define BATCH_MAX_SIZES 8
+#define BATCH_MAX_RETRIES 5
+/* The JSON report written to the output directory unless told otherwise. */
+#define BATCH_REPORT_FILE "report.json"
+/* The backend named in the result of a job served by a duplicate. */
+#define BATCH_COPY_BACKEND "copy"
+
+typedef struct {
+	unsigned int width;
+	unsigned int height;
+} batch_size;
+
+/*
+ * A batch: every input file is transformed once per size and encoded to
+ * JPEG in the output directory. The keys accepted by batch_request_set()
+ * (and as app_control extras) are:
+ *
+ *   input       glob pattern or directory, repeatable
+ *   output_dir  directory receiving the results, created if needed; they
+ *               keep the subdirectories of their inputs below the
+ *               directory holding every input, see batch_output_path()
+ *   size        "WxH"; "0x0" keeps the source size; repeatable
+ *   colorspace  e.g. "RGB888" or "NV12"
+ *   format      "jpeg", the only format Image Util encodes
+ *   quality     JPEG quality, 1 to 100
+ *   rotation    0, 90, 180 or 270
+ *   flip        "none", "horizontal" or "vertical"
+ *   processes   worker processes for supervisor_run(), 0 for threads only
+ *   retries     times a job failing with a transient error is run again
+ *   stop_on_error  "1" to cancel the rest of the batch after a failure
+ *   report      path of the JSON report, "none" for no report
+ *   dedupe      "none", "exact" (the default) or "similar": inputs holding
+ *               the same image are transformed once and the results copied
+ *   atlas       "WxH": pack the inputs into atlas pages of at most that
+ *               size instead, see atlas.h; "0x0", the default, for none
+ *   pack        asset pack receiving every result instead of loose files,
+ *               see asset_pack.h; relative to output_dir unless absolute
+ *   archive     tar archive receiving every result instead of loose files,
+ *               under the names they would have had, see archive.h;
+ *               relative to output_dir unless absolute
+ *   overlay     "PATH@X,Y[,SCALE[,OPACITY]]": an image blended onto every
+ *               result, see composite_parse_layer(); repeatable
+ *   trace       Chrome trace of the stages of every job, written when the
+ *               batch ends, see trace.h; relative to output_dir unless
+ *               absolute
+ */
+typedef struct {
+	char inputs[BATCH_MAX_INPUTS][BUFLEN];
+	unsigned int input_count;
+	char output_dir[BUFLEN];
+	batch_size sizes[BATCH_MAX_SIZES];
+	unsigned int size_count;
+	image_util_colorspace_e colorspace;
+	int quality;
+	unsigned int rotation;
+	job_flip flip;
+	job_priority priority;
+	unsigned int processes;
+	unsigned int retries;
+	bool stop_on_error;
+	/* Empty for BATCH_REPORT_FILE in the output directory. */
+	char report_path[BUFLEN];
+	scan_dedupe dedupe;
+	batch_size atlas;
+	char pack_path[BUFLEN];
+	char archive_path[BUFLEN];
+	composite_spec overlays;
+	char trace_path[BUFLEN];
+} batch_request;
+
+typedef struct {
+	unsigned int submitted;
+	unsigned int succeeded;
+	unsigned int failed;
+	unsigned int cancelled;
+	/* Input files set aside for crashing their worker; see supervisor.h. */
+	unsigned int quarantined;
+	/* Runs repeated after a transient failure. */
+	unsigned int retried;
+	/* Jobs served by copying the result of the same image. */
+	unsigned int deduplicated;
+} batch_summary;
+
+/*
+ * Called on a worker thread for every finished job. The job and the result
+ * are only valid for the duration of the call.
+ */
+typedef void (*batch_job_cb)(const transform_job *job,
+		const pipeline_result *result, void *user_data);
+/* Called exactly once when the whole batch is over, on any thread. */
+typedef void (*batch_done_cb)(const batch_summary *summary, void *user_data);
+
+void batch_request_init(batch_request *req);
+int batch_request_set(batch_request *req, const char *key, const char *value);
+int batch_request_from_app_control(app_control_h app_control,
+		batch_request *req);
+int batch_request_validate(const batch_request *req);
+bool batch_path_confined(const char *path, const char *root, bool read);
+int batch_make_output_dir(const batch_request *req);
+int batch_prepare_outputs(const batch_request *req, const scan_list *files);
+void batch_job_init(const batch_request *req, transform_job *job);
+bool batch_report_path(const batch_request *req, char *path);
+bool batch_output_path(const batch_request *req, const char *input,
+		const batch_size *size, char *path);
+int batch_copy_output(const char *from, const char *to);
+
+int batch_init(void);
+void batch_shutdown(void);
+int batch_submit(const batch_request *req, cancel_token *cancel,
+		batch_job_cb job_cb, batch_done_cb done_cb, void *user_data);
+int batch_run(const batch_request *req, cancel_token *cancel,
+		batch_job_cb job_cb, void *user_data, batch_summary *summary);
+
+#endif
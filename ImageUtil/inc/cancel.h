@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_CANCEL_H)
+#define _CANCEL_H
+
+#include <stdbool.h>
+
+/*
+ * Reference-counted cancellation flag. A token created with a parent is
+ * also cancelled when the parent is, so one batch token can stop all the
+ * jobs of a batch while each job still has its own token.
+ */
+typedef struct cancel_token cancel_token;
+
+/*
+ * Decides whether a polled token is cancelled. Called on the checking
+ * thread every time the token is checked.
+ */
+typedef bool (*cancel_poll_cb)(void *user_data);
+
+cancel_token *cancel_token_create(cancel_token *parent);
+cancel_token *cancel_token_create_polled(cancel_poll_cb poll_cb,
+		void *user_data);
+cancel_token *cancel_token_ref(cancel_token *token);
+void cancel_token_unref(cancel_token *token);
+void cancel_token_cancel(cancel_token *token);
+bool cancel_token_is_cancelled(const cancel_token *token);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_CLI_H)
+#define _CLI_H
+
+#include <stdbool.h>
+
+/* Run from the command line, without creating the UI. */
+#define CLI_BATCH_OPTION "--batch"
+#define CLI_SERVE_OPTION "--serve"
+#define CLI_CLIENT_OPTION "--client"
+#define CLI_LIST_PACK_OPTION "--list-pack"
+#define CLI_LIST_ARCHIVE_OPTION "--list-archive"
+#define CLI_EXTRACT_OPTION "--extract"
+
+bool cli_requested(int argc, char *argv[]);
+int cli_main(int argc, char *argv[]);
+
+#endif
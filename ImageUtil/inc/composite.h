@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(_COMPOSITE_H)
+#define _COMPOSITE_H
+
+#include "job.h"
+
+#define COMPOSITE_MAX_LAYERS 8
+/* Rows of the base blended by every overlay in turn before moving on. */
+#define COMPOSITE_TILE_ROWS 64
+/*
+ * Color distance up to which a color-keyed pixel is transparent; its alpha
+ * then ramps up to opaque over as much again.
+ */
+#define COMPOSITE_KEY_TOLERANCE 24
+#define COMPOSITE_MAX_SCALE 16
+
+/* One overlay placed on a transformed image. */
+typedef struct {
+	char path[BUFLEN];
+	/*
+	 * Top left corner on the transformed image; a negative x or y centers
+	 * the overlay on that axis.
+	 */
+	int x;
+	int y;
+	/* Size relative to the decoded overlay. */
+	float scale;
+	/* 0 for transparent to 1 for opaque. */
+	float opacity;
+	/*
+	 * Treat the color of the top left pixel as transparent: the stickers
+	 * are JPEGs, which have no alpha channel.
+	 */
+	bool color_key;
+} composite_layer;
+
+/* The overlays of a job, blended in order. */
+typedef struct composite_spec {
+	composite_layer layers[COMPOSITE_MAX_LAYERS];
+	unsigned int count;
+} composite_spec;
+
+bool composite_supports(image_util_colorspace_e colorspace);
+bool composite_is_yuv(image_util_colorspace_e colorspace);
+int composite_parse_layer(const char *value, composite_layer *layer);
+int composite_apply(image_buffer *image, const composite_spec *spec);
+void composite_log_stats(void);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(_CONCURRENCY_H)
+#define _CONCURRENCY_H
+
+/* How often the controller measures the batch jobs. */
+#define CONCURRENCY_PERIOD_MS 500
+/* A measurement lasts until every allowed job ran once, or this many periods. */
+#define CONCURRENCY_MAX_PERIODS 8
+/* Batch jobs allowed at once when the controller starts. */
+#define CONCURRENCY_INITIAL_LIMIT 2
+/* Batch jobs allowed at once while the application is in the background. */
+#define CONCURRENCY_PAUSED_LIMIT 1
+/* Relative change in throughput below which two measurements are equal. */
+#define CONCURRENCY_TOLERANCE 0.1
+/* Times slower than the fastest seen a job may run before the limit drops. */
+#define CONCURRENCY_MAX_SLOWDOWN 2.5
+/* Measurements to wait after a decrease before adding a job again. */
+#define CONCURRENCY_HOLD 10
+
+int concurrency_start(void);
+void concurrency_stop(void);
+void concurrency_pause(void);
+void concurrency_resume(void);
+void concurrency_log_stats(void);
+
+#endif
@@ -20,6 +20,7 @@
 #include "view.h"
 
 void create_buttons_in_main_window(void);
+void release_data(void);
 void _image_util_clear_cb(void *data, Evas_Object *obj, void *event_info);
 
 #endif
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_FRAME_CACHE_H)
+#define _FRAME_CACHE_H
+
+#include "job.h"
+#include "lru.h"
+
+/* Default byte budget of the decoded frame cache. */
+#define FRAME_CACHE_BUDGET (32 * 1024 * 1024)
+
+/*
+ * A decoded RGB888 source frame, shared between all jobs using it. Valid
+ * until released with frame_cache_release().
+ */
+typedef struct lru_entry frame_handle;
+
+int frame_cache_init(size_t budget);
+void frame_cache_shutdown(void);
+int frame_cache_decode(const char *path, image_util_scale_e scale,
+		frame_handle **handle);
+const image_buffer *frame_cache_image(const frame_handle *handle);
+void frame_cache_release(frame_handle *handle);
+void frame_cache_set_budget(size_t budget);
+void frame_cache_log_stats(void);
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_HASH_H)
+#define _HASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Perceptual hash bits two images may differ in and still be near-duplicates. */
+#define HASH_SIMILAR_DISTANCE 4
+
+uint64_t hash_bytes(const void *data, size_t length, uint64_t seed);
+int hash_file(const char *path, uint64_t *digest);
+bool hash_same_content(const char *first, const char *second);
+int hash_perceptual(const char *path, uint64_t *dhash);
+unsigned int hash_distance(uint64_t first, uint64_t second);
+void hash_log_stats(void);
+
+#endif
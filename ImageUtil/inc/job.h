@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_JOB_H)
+#define _JOB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <image_util.h>
+#include "cancel.h"
+
+#define BUFLEN 256
+
+typedef enum {
+	JOB_PRIORITY_INTERACTIVE,
+	JOB_PRIORITY_BATCH,
+	JOB_PRIORITY_COUNT
+} job_priority;
+
+typedef enum {
+	/* Encode to output_path. */
+	JOB_OUTPUT_FILE,
+	/* Hand the transformed pixels (and optionally the JPEG) to the caller. */
+	JOB_OUTPUT_MEMORY
+} job_output;
+
+typedef enum {
+	JOB_FLIP_NONE,
+	/* Mirror left to right. */
+	JOB_FLIP_HORIZONTAL,
+	/* Mirror top to bottom. */
+	JOB_FLIP_VERTICAL
+} job_flip;
+
+/* An image held in memory, either raw pixels or an encoded JPEG. */
+typedef struct {
+	unsigned char *data;
+	size_t size;
+	int width;
+	int height;
+	image_util_colorspace_e colorspace;
+	/* Whether data comes from buffer_pool_get() rather than malloc(). */
+	bool pooled;
+} image_buffer;
+
+/* A single image transformation: one source file and what to make of it. */
+typedef struct {
+	char input_path[BUFLEN];
+	char output_path[BUFLEN];
+
+	/*
+	 * Source dimensions, known once the image is decoded (or probed): in
+	 * decoded pixels, so already divided by the decode scale.
+	 */
+	int src_width;
+	int src_height;
+	image_util_colorspace_e src_colorspace;
+	image_util_scale_e decode_scale;
+
+	/*
+	 * Geometry, applied to the decoded source in this order: crop, rotate,
+	 * flip. The crop rectangle is in decoded pixels and clamped to the
+	 * image; a zero width or height disables it and a negative x or y
+	 * centers it on that axis.
+	 */
+	int crop_x;
+	int crop_y;
+	unsigned int crop_width;
+	unsigned int crop_height;
+	/* Clockwise, in degrees: 0, 90, 180 or 270. */
+	unsigned int rotation;
+	job_flip flip;
+
+	/*
+	 * Requested output, after the geometry; a zero width or height keeps
+	 * the source size.
+	 */
+	unsigned int width;
+	unsigned int height;
+	image_util_colorspace_e colorspace;
+	int quality;
+	job_output output;
+	/* With JOB_OUTPUT_MEMORY, also encode the result to JPEG. */
+	bool encode;
+	/*
+	 * Overlays blended onto the result, see composite.h; may be NULL. Not
+	 * copied: they must outlive the job.
+	 */
+	const struct composite_spec *overlays;
+
+	/* Scheduling. */
+	job_priority priority;
+	/* Absolute monotonic_us() time the result is wanted by; 0 for none. */
+	uint64_t deadline_us;
+	/* Checked between pipeline stages; may be NULL. */
+	cancel_token *cancel;
+	/* Times the job was run again after a transient failure. */
+	unsigned int attempt;
+} transform_job;
+
+#endif
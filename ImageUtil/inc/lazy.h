@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_LAZY_H)
+#define _LAZY_H
+
+#include "job.h"
+
+/* Default byte budget of the result cache. */
+#define LAZY_CACHE_BUDGET (16 * 1024 * 1024)
+
+/* The preview of a progressive request: 1/8 of the size, at low quality. */
+#define LAZY_PREVIEW_DIVISOR 8
+#define LAZY_PREVIEW_QUALITY 50
+/* Deadline of the preview, so that it runs ahead of the final image. */
+#define LAZY_PREVIEW_DEADLINE_US (5 * 1000)
+
+/* What a caller wants: one image at one size in one color space. */
+typedef struct {
+	const char *path;
+	/* A zero width or height keeps the source size. */
+	unsigned int width;
+	unsigned int height;
+	image_util_colorspace_e colorspace;
+	/* Deliver a JPEG instead of raw pixels. */
+	bool encoded;
+	/* JPEG quality of an encoded result, 0 for the default. */
+	unsigned int quality;
+	job_priority priority;
+	uint64_t deadline_us;
+	/*
+	 * Cancels the delivery, and the computation unless another request
+	 * still waits for it.
+	 */
+	cancel_token *cancel;
+} lazy_spec;
+
+/*
+ * Called exactly once per request, on a worker thread or, for results
+ * already in the cache, on the requesting thread. The image is only valid
+ * for the duration of the call.
+ */
+typedef void (*lazy_result_cb)(int error_code, const image_buffer *image,
+		void *user_data);
+
+typedef enum {
+	LAZY_PHASE_PREVIEW,
+	LAZY_PHASE_FINAL
+} lazy_phase;
+
+/*
+ * Called for a progressive request: at most once with a successful
+ * LAZY_PHASE_PREVIEW, always before the final image, then exactly once with
+ * LAZY_PHASE_FINAL, whose error code is the outcome of the request. Same
+ * threads and lifetime of the image as lazy_result_cb.
+ */
+typedef void (*lazy_progress_cb)(int error_code, const image_buffer *image,
+		lazy_phase phase, void *user_data);
+
+int lazy_init(size_t cache_budget);
+void lazy_shutdown(void);
+void lazy_set_budget(size_t budget);
+int lazy_request(const lazy_spec *spec, lazy_result_cb result_cb,
+		void *user_data);
+int lazy_request_progressive(const lazy_spec *spec,
+		lazy_progress_cb progress_cb, void *user_data);
+void lazy_log_stats(void);
+
+#endif
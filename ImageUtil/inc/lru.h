@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_LRU_H)
+#define _LRU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Thread-safe least-recently-used cache with a byte budget. Values are
+ * reference counted: an entry returned by lru_get() stays valid until it
+ * is released, even if the cache evicts it in the meantime.
+ */
+typedef struct lru_cache lru_cache;
+typedef struct lru_entry lru_entry;
+typedef void (*lru_free_cb)(void *value);
+
+typedef struct {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int insertions;
+	unsigned int evictions;
+	unsigned int entries;
+	size_t bytes;
+	size_t budget;
+} lru_stats;
+
+lru_cache *lru_create(size_t budget, lru_free_cb free_value);
+void lru_destroy(lru_cache *cache);
+lru_entry *lru_get(lru_cache *cache, const char *key);
+lru_entry *lru_put(lru_cache *cache, const char *key, void *value, size_t bytes);
+void *lru_entry_value(const lru_entry *entry);
+void lru_release(lru_cache *cache, lru_entry *entry);
+void lru_set_budget(lru_cache *cache, size_t budget);
+void lru_clear(lru_cache *cache);
+void lru_get_stats(lru_cache *cache, lru_stats *stats);
+
+#endif
@@ -18,6 +18,8 @@
 #define _MAIN_H_
 
 #include <dlog.h>
+#include <stdint.h>
+#include <time.h>
 
 #if !defined(PACKAGE)
 #define PACKAGE "org.example.imageutil"
@@ -46,4 +48,16 @@
     return; \
     }
 
+/**
+ * @brief Returns a monotonic timestamp in microseconds.
+ * @details Used for job timings; not related to the wall clock.
+ */
+static inline uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 #endif
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(_MEMGOV_H)
+#define _MEMGOV_H
+
+#include "job.h"
+
+/* Default byte budget shared by the caches, the buffer pool and the jobs. */
+#define MEMGOV_BUDGET (128 * 1024 * 1024)
+/* Memory assumed for a job whose source size is not known yet. */
+#define MEMGOV_UNKNOWN_JOB_BYTES (8 * 1024 * 1024)
+
+/* How short of memory the device is, from APP_EVENT_LOW_MEMORY. */
+typedef enum {
+	MEMGOV_PRESSURE_NORMAL,
+	/* The system starts killing background applications. */
+	MEMGOV_PRESSURE_SOFT,
+	/* The application itself may be killed next. */
+	MEMGOV_PRESSURE_HARD,
+	MEMGOV_PRESSURE_COUNT
+} memgov_pressure;
+
+int memgov_start(size_t budget);
+void memgov_stop(void);
+void memgov_set_pressure(memgov_pressure pressure);
+size_t memgov_job_bytes(const transform_job *job);
+void memgov_log_stats(void);
+
+#endif
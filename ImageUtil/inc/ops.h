@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_OPS_H)
+#define _OPS_H
+
+#include "job.h"
+
+/*
+ * A view of one plane of pixels. Rows may be padded, and a negative
+ * stride walks the rows bottom-up, so crops and vertical flips are free.
+ */
+typedef struct {
+	unsigned char *data;
+	ptrdiff_t stride;
+	int width;
+	int height;
+	/* Bytes per element: 1 for Y, U and V, 2 for NV12 UV, 3 for RGB888. */
+	int bpp;
+} image_plane;
+
+/*
+ * An orientation as a mapping from output to source pixels: swap exchanges
+ * the axes, then rev_x and rev_y mirror the source x and y coordinates.
+ */
+typedef struct {
+	bool swap;
+	bool rev_x;
+	bool rev_y;
+} orientation;
+
+orientation ops_orientation(unsigned int rotation, job_flip flip);
+bool ops_job_has_geometry(const transform_job *job);
+bool ops_job_swaps_axes(const transform_job *job);
+void ops_crop_rect(const transform_job *job, int width, int height, int *x,
+		int *y, int *crop_width, int *crop_height);
+image_plane ops_crop_view(const image_plane *plane, const transform_job *job);
+void ops_orient_plane(const image_plane *src, const image_plane *dst,
+		unsigned int rotation, job_flip flip);
+bool ops_can_orient(image_util_colorspace_e colorspace, int width, int height);
+int ops_orient_image(const image_buffer *src, image_buffer *dst,
+		unsigned int rotation, job_flip flip);
+
+#endif
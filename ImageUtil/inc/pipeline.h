@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_PIPELINE_H)
+#define _PIPELINE_H
+
+#include <stdint.h>
+#include "job.h"
+
+typedef enum {
+	PIPELINE_STAGE_QUEUE,
+	PIPELINE_STAGE_DECODE,
+	PIPELINE_STAGE_TRANSFORM,
+	PIPELINE_STAGE_ENCODE,
+	PIPELINE_STAGE_DONE
+} pipeline_stage;
+
+/* Outcome of one job. */
+typedef struct {
+	int error_code;
+	/* The stage that failed or was cancelled, PIPELINE_STAGE_DONE on success. */
+	pipeline_stage stage;
+	bool cancelled;
+	const char *backend;
+	uint64_t queued_us;
+	uint64_t run_us;
+	/* Filled in for JOB_OUTPUT_MEMORY jobs; see pipeline_result_clear(). */
+	image_buffer raw;
+	image_buffer encoded;
+} pipeline_result;
+
+int pipeline_run(transform_job *job, pipeline_result *result);
+void pipeline_result_clear(pipeline_result *result);
+const char *pipeline_stage_name(pipeline_stage stage);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_PROBE_H)
+#define _PROBE_H
+
+#include "job.h"
+
+/* Sources above this many pixels are rejected before decoding. */
+#define PROBE_MAX_PIXELS (64 * 1024 * 1024)
+
+typedef enum {
+	PROBE_FORMAT_UNKNOWN,
+	PROBE_FORMAT_JPEG,
+	PROBE_FORMAT_PNG,
+	PROBE_FORMAT_WEBP
+} probe_format;
+
+/* What the header of an image file says, without decoding it. */
+typedef struct {
+	probe_format format;
+	unsigned int width;
+	unsigned int height;
+	unsigned int components;
+	unsigned int bits;
+	/* JPEG: largest sampling factors, 2x2 for 4:2:0, 2x1 for 4:2:2. */
+	unsigned int h_sampling;
+	unsigned int v_sampling;
+	bool progressive;
+} probe_info;
+
+int probe_file(const char *path, probe_info *info);
+image_util_scale_e probe_decode_scale(const probe_info *info,
+		const transform_job *job);
+int probe_plan_job(transform_job *job, const probe_info *info);
+int probe_job(transform_job *job);
+void probe_log_stats(void);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_REPORT_H)
+#define _REPORT_H
+
+#include <stdio.h>
+#include "job.h"
+#include "pipeline.h"
+#include "batch.h"
+
+typedef enum {
+	REPORT_OK,
+	REPORT_FAILED,
+	REPORT_CANCELLED,
+	/* Set aside after crashing its worker process. */
+	REPORT_QUARANTINED
+} report_status;
+
+/* The outcome of one job of a batch. */
+typedef struct {
+	char input_path[BUFLEN];
+	char output_path[BUFLEN];
+	report_status status;
+	int error_code;
+	pipeline_stage stage;
+	const char *backend;
+	/* 1 for a job that succeeded or failed the first time. */
+	unsigned int attempts;
+	uint64_t queued_us;
+	uint64_t run_us;
+} report_entry;
+
+/* Thread-safe collection of the outcomes of a batch. */
+typedef struct batch_report batch_report;
+
+batch_report *report_create(void);
+void report_destroy(batch_report *report);
+int report_add(batch_report *report, const report_entry *entry);
+int report_add_result(batch_report *report, const transform_job *job,
+		const pipeline_result *result);
+int report_write_json(batch_report *report, const batch_summary *summary,
+		const char *path);
+bool report_is_transient(int error_code);
+void report_write_string(FILE *file, const char *string);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_SCAN_H)
+#define _SCAN_H
+
+#include <time.h>
+#include <sys/types.h>
+#include "job.h"
+
+/* A regular file found by scan_inputs(). */
+typedef struct {
+	char path[BUFLEN];
+	off_t size;
+	time_t mtime;
+	/*
+	 * Set by scan_find_duplicates(): the index of the first entry with the
+	 * same image, or -1 for the first one, and the index of the next entry
+	 * with the same image, or -1 for the last one.
+	 */
+	int original;
+	int next_duplicate;
+} scan_entry;
+
+typedef enum {
+	SCAN_DEDUPE_NONE,
+	/* Files with the same bytes. */
+	SCAN_DEDUPE_EXACT,
+	/* Also JPEGs whose perceptual hashes are close, see hash.h. */
+	SCAN_DEDUPE_SIMILAR
+} scan_dedupe;
+
+typedef struct {
+	scan_entry *entries;
+	unsigned int count;
+	unsigned int size;
+} scan_list;
+
+int scan_inputs(const char (*patterns)[BUFLEN], unsigned int count,
+		scan_list *list);
+unsigned int scan_find_duplicates(scan_list *list, scan_dedupe dedupe);
+void scan_list_clear(scan_list *list);
+
+#endif
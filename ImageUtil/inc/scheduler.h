@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_SCHEDULER_H)
+#define _SCHEDULER_H
+
+#include "job.h"
+#include "pipeline.h"
+
+/*
+ * Called on a worker thread when a job is finished, failed or was
+ * cancelled. The job and the result are only valid for the duration of
+ * the call; to keep an in-memory buffer, take it and set it to NULL.
+ */
+typedef void (*scheduler_done_cb)(transform_job *job,
+		pipeline_result *result, void *user_data);
+
+/* The batch jobs of the scheduler, see scheduler_sample(). */
+typedef struct {
+	unsigned int workers;
+	unsigned int batch_limit;
+	unsigned int batch_running;
+	unsigned int batch_queued;
+	/* Memory held by the batch jobs running, see memgov_job_bytes(). */
+	size_t batch_bytes;
+	size_t memory_budget;
+	/* Times a batch job waited for memory to be freed. */
+	unsigned int memory_holds;
+	/* Totals over the batch jobs run so far. */
+	uint64_t finished;
+	uint64_t run_us;
+	/* Decoded source pixels, of the jobs whose size was probed. */
+	uint64_t pixels;
+} scheduler_load;
+
+int scheduler_init(unsigned int workers);
+void scheduler_shutdown(void);
+int scheduler_submit(const transform_job *job, scheduler_done_cb done_cb,
+		void *user_data);
+void scheduler_set_batch_limit(unsigned int limit);
+void scheduler_set_memory_budget(size_t budget);
+void scheduler_sample(scheduler_load *load);
+void scheduler_log_stats(void);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_SERVICE_H)
+#define _SERVICE_H
+
+#include <stdint.h>
+#include "job.h"
+
+#define SERVICE_PROTOCOL_VERSION 1
+#define SERVICE_MAX_CLIENTS 16
+
+/*
+ * One request, sent as a single SOCK_SEQPACKET message. The path must be
+ * absolute, as the service does not share the working directory of the
+ * client, and inside the root of the service.
+ */
+typedef struct {
+	uint32_t version;
+	char path[BUFLEN];
+	/* A zero width or height keeps the source size. */
+	uint32_t width;
+	uint32_t height;
+	int32_t colorspace;
+	/* Non-zero for a JPEG, zero for raw pixels in colorspace. */
+	uint32_t encoded;
+	/* Relative to the arrival of the request; 0 for none. */
+	uint32_t deadline_ms;
+} service_request;
+
+/*
+ * The answer to a request. On success, the message carries a sealed,
+ * read-only shared memory file descriptor holding size bytes of image.
+ */
+typedef struct {
+	int32_t error_code;
+	uint32_t width;
+	uint32_t height;
+	int32_t colorspace;
+	uint64_t size;
+	/* Time spent in the service, from request to reply. */
+	uint64_t service_us;
+} service_reply;
+
+int service_start(const char *socket_path, const char *root);
+void service_stop(void);
+void service_log_stats(void);
+
+int service_connect(const char *socket_path, int *fd);
+int service_call(int fd, const service_request *request, service_reply *reply,
+		int *image_fd);
+
+#endif
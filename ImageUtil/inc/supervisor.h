@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_SUPERVISOR_H)
+#define _SUPERVISOR_H
+
+#include "batch.h"
+
+#define SUPERVISOR_MAX_PROCESSES 64
+/* Crashes an input may cause before it is quarantined. */
+#define SUPERVISOR_MAX_ATTEMPTS 2
+/* A worker spending longer than this on one input is killed. */
+#if !defined(SUPERVISOR_INPUT_TIMEOUT_US)
+#define SUPERVISOR_INPUT_TIMEOUT_US (60 * 1000 * 1000)
+#endif
+/* Inputs listed in this file of the output directory are skipped. */
+#define SUPERVISOR_QUARANTINE_FILE "quarantine.txt"
+
+int supervisor_run(const batch_request *req, cancel_token *cancel,
+		batch_job_cb job_cb, void *user_data, batch_summary *summary);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(_TRACE_H)
+#define _TRACE_H
+
+#include "main.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Environment variable enabling tracing in the UI; see trace_start(). */
+#define TRACE_ENV "IMAGEUTIL_TRACE"
+/* The trace of the UI, next to the batch report in the data directory. */
+#define TRACE_FILE "trace.json"
+/* Spans kept per thread; older ones are overwritten. A power of two. */
+#define TRACE_RING_SPANS 8192
+#define TRACE_MAX_THREADS 64
+#define TRACE_DETAIL_LEN 48
+
+/* Sessions tracing; read through trace_begin(). */
+extern unsigned int trace_sessions;
+
+/**
+ * @brief Starts a span.
+ * @details Costs one relaxed load while nobody traces.
+ *
+ * @return The start of the span, to pass to trace_end(); 0 when not tracing
+ */
+static inline uint64_t trace_begin(void) {
+	return __atomic_load_n(&trace_sessions, __ATOMIC_RELAXED) ?
+			monotonic_us() : 0;
+}
+
+void trace_start(void);
+void trace_stop(void);
+void trace_end(const char *name, uint64_t start_us, const char *detail);
+void trace_counter(const char *name, int64_t value);
+void trace_thread_name(const char *name);
+int trace_write_json(const char *path, uint64_t since_us);
+void trace_log_stats(void);
+
+#endif
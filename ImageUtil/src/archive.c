@@ -0,0 +1,795 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "archive.h"
+#include "job.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The size field holds 11 octal digits. */
+#define ARCHIVE_MAX_MEMBER ((uint64_t) 1 << 33)
+#define ARCHIVE_LINELEN (BUFLEN + 48)
+
+/* A member with data; hard links share the data of their target. */
+typedef struct {
+	char *name;
+	uint64_t offset;
+	uint64_t length;
+	/* The order in the archive, in which later members replace earlier. */
+	unsigned int position;
+} archive_item;
+
+typedef struct {
+	archive_item *items;
+	unsigned int count;
+	unsigned int size;
+} archive_items;
+
+/* Thread-safe: the jobs of a batch add their results as they finish. */
+struct archive_writer {
+	pthread_mutex_t lock;
+	FILE *file;
+	char *buffer;
+	char path[BUFLEN];
+	char partial[BUFLEN];
+	/* Where the next header goes. */
+	uint64_t offset;
+	archive_items members;
+	/* The first error, after which nothing more is written. */
+	int error_code;
+};
+
+struct archive {
+	const unsigned char *data;
+	size_t size;
+	/* Sorted by name. */
+	archive_items members;
+};
+
+static uint64_t _blocks(uint64_t length) {
+	return (length + ARCHIVE_BLOCK - 1) / ARCHIVE_BLOCK * ARCHIVE_BLOCK;
+}
+
+static int _append(archive_items *members, const char *name, size_t length,
+		uint64_t offset, uint64_t size) {
+	if (members->count == members->size) {
+		unsigned int count = members->size ? members->size * 2 : 64;
+		archive_item *items = realloc(members->items,
+				count * sizeof(archive_item));
+
+		if (items == NULL)
+			return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+		members->items = items;
+		members->size = count;
+	}
+
+	char *copy = strndup(name, length);
+	if (copy == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	archive_item *item = &members->items[members->count];
+	item->name = copy;
+	item->offset = offset;
+	item->length = size;
+	item->position = members->count++;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+static void _clear(archive_items *members) {
+	for (unsigned int i = 0; i < members->count; ++i)
+		free(members->items[i].name);
+	free(members->items);
+	memset(members, 0, sizeof(archive_items));
+}
+
+static int _compare_items(const void *a, const void *b) {
+	const archive_item *first = a, *second = b;
+	int order = strcmp(first->name, second->name);
+
+	if (order != 0)
+		return order;
+	return (first->position > second->position)
+			- (first->position < second->position);
+}
+
+/**
+ * @brief Sorts members by name, keeping the last of several with one name,
+ *        as tar does when extracting.
+ */
+static void _sort(archive_items *members) {
+	unsigned int count = 0;
+
+	qsort(members->items, members->count, sizeof(archive_item),
+			_compare_items);
+	for (unsigned int i = 0; i < members->count; ++i) {
+		if (i + 1 < members->count
+				&& strcmp(members->items[i].name, members->items[i + 1].name)
+						== 0) {
+			dlog_print(DLOG_WARN, LOG_TAG, "%s is archived twice",
+					members->items[i].name);
+			free(members->items[i].name);
+			continue;
+		}
+		members->items[count++] = members->items[i];
+	}
+	members->count = count;
+}
+
+static unsigned int _checksum(const archive_header *header) {
+	const unsigned char *bytes = (const unsigned char *) header;
+	unsigned int sum = 0;
+
+	for (size_t i = 0; i < sizeof(archive_header); ++i)
+		sum += (i >= offsetof(archive_header, checksum)
+				&& i < offsetof(archive_header, typeflag)) ? ' ' : bytes[i];
+	return sum;
+}
+
+static void _octal(char *field, size_t size, uint64_t value) {
+	snprintf(field, size, "%0*llo", (int) size - 1, (unsigned long long) value);
+}
+
+/**
+ * @brief Fills in a header.
+ * @details Names longer than the name field are split at a slash into the
+ *          prefix field.
+ *
+ * @return @c false if the name or the link target does not fit
+ */
+static bool _fill_header(archive_header *header, const char *name,
+		uint64_t length, char typeflag, const char *linkname) {
+	size_t name_length = strlen(name);
+	size_t split = 0;
+
+	memset(header, 0, sizeof(archive_header));
+	if (name_length > sizeof(header->name)) {
+		const char *slash;
+
+		/* The first slash leaving a short enough name. */
+		for (slash = strchr(name, '/'); slash != NULL;
+				slash = strchr(slash + 1, '/'))
+			if (name_length - (slash - name) - 1 <= sizeof(header->name))
+				break;
+		if (slash == NULL || slash == name
+				|| (size_t) (slash - name) > sizeof(header->prefix))
+			return false;
+		split = slash - name;
+		memcpy(header->prefix, name, split);
+		split++;
+	}
+	memcpy(header->name, name + split, name_length - split);
+
+	if (linkname != NULL) {
+		if (strlen(linkname) > sizeof(header->linkname))
+			return false;
+		memcpy(header->linkname, linkname, strlen(linkname));
+	}
+
+	_octal(header->mode, sizeof(header->mode), 0644);
+	_octal(header->uid, sizeof(header->uid), 0);
+	_octal(header->gid, sizeof(header->gid), 0);
+	_octal(header->size, sizeof(header->size), length);
+	_octal(header->mtime, sizeof(header->mtime), time(NULL));
+	header->typeflag = typeflag;
+	memcpy(header->magic, "ustar", sizeof(header->magic));
+	memcpy(header->version, "00", sizeof(header->version));
+	_octal(header->devmajor, sizeof(header->devmajor), 0);
+	_octal(header->devminor, sizeof(header->devminor), 0);
+
+	snprintf(header->checksum, sizeof(header->checksum), "%06o",
+			_checksum(header));
+	header->checksum[7] = ' ';
+	return true;
+}
+
+/**
+ * @brief Writes a header and its data, padded to a whole block.
+ * @remarks Must be called with writer->lock held.
+ */
+static bool _write_member(archive_writer *writer, const archive_header *header,
+		const void *data, uint64_t length) {
+	static const unsigned char zeros[ARCHIVE_BLOCK];
+	uint64_t padding = _blocks(length) - length;
+
+	if (fwrite(header, sizeof(archive_header), 1, writer->file) != 1
+			|| (length > 0 && fwrite(data, 1, length, writer->file) != length)
+			|| (padding > 0 && fwrite(zeros, 1, padding, writer->file)
+					!= padding))
+		return false;
+	writer->offset += sizeof(archive_header) + _blocks(length);
+	return true;
+}
+
+static bool _valid_name(const char *name) {
+	return name != NULL && *name != '\0' && strlen(name) < BUFLEN
+			&& strchr(name, '\n') == NULL
+			&& strcmp(name, ARCHIVE_INDEX_NAME) != 0;
+}
+
+/**
+ * @brief Starts writing an archive.
+ * @details The archive is written next to its path and renamed by
+ *          archive_finish(). Members are written through a large buffer,
+ *          so that many small results make few large sequential writes.
+ *
+ * @param path The path of the archive
+ * @param writer Receives the writer, to be ended with archive_finish() or
+ *               archive_abort()
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int archive_create(const char *path, archive_writer **writer) {
+	archive_writer *created = calloc(1, sizeof(archive_writer));
+	if (created == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	if (snprintf(created->path, BUFLEN, "%s", path) >= BUFLEN
+			|| snprintf(created->partial, BUFLEN, "%s.part", path) >= BUFLEN) {
+		free(created);
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	}
+
+	created->file = fopen(created->partial, "wb");
+	if (created->file == NULL) {
+		free(created);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+
+	/* Without the buffer, the default one still works, in smaller writes. */
+	created->buffer = malloc(ARCHIVE_WRITE_BUFFER);
+	if (created->buffer != NULL)
+		setvbuf(created->file, created->buffer, _IOFBF, ARCHIVE_WRITE_BUFFER);
+	pthread_mutex_init(&created->lock, NULL);
+
+	*writer = created;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Appends a file to an archive.
+ *
+ * @param writer The archive being written
+ * @param name The name of the file
+ * @param data The content of the file
+ * @param length The size of the file in bytes
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_INVALID_PARAMETER for a name that cannot be
+ *         archived, otherwise an error code
+ */
+int archive_add(archive_writer *writer, const char *name, const void *data,
+		size_t length) {
+	archive_header header;
+
+	if (!_valid_name(name) || length >= ARCHIVE_MAX_MEMBER
+			|| !_fill_header(&header, name, length, '0', NULL))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&writer->lock);
+	int error_code = writer->error_code;
+	uint64_t offset = writer->offset + sizeof(archive_header);
+
+	if (error_code == IMAGE_UTIL_ERROR_NONE
+			&& !_write_member(writer, &header, data, length))
+		error_code = writer->error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	if (error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = _append(&writer->members, name, strlen(name), offset,
+				length);
+	pthread_mutex_unlock(&writer->lock);
+	return error_code;
+}
+
+/**
+ * @brief Adds a name for a file already in an archive.
+ * @details The name is written as a hard link to the original, so the data
+ *          is not written twice.
+ *
+ * @param writer The archive being written
+ * @param name The new name
+ * @param original The name the file was added with
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_INVALID_PARAMETER if the original is not in the
+ *         archive, otherwise an error code
+ */
+int archive_link(archive_writer *writer, const char *name,
+		const char *original) {
+	archive_header header;
+
+	if (!_valid_name(name) || original == NULL
+			|| !_fill_header(&header, name, 0, '1', original))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&writer->lock);
+	int error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	/* Most likely just added. */
+	for (unsigned int i = writer->members.count; i-- > 0;) {
+		archive_item target = writer->members.items[i];
+
+		if (strcmp(target.name, original) != 0)
+			continue;
+
+		error_code = writer->error_code;
+		if (error_code == IMAGE_UTIL_ERROR_NONE
+				&& !_write_member(writer, &header, NULL, 0))
+			error_code = writer->error_code =
+					IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+		if (error_code == IMAGE_UTIL_ERROR_NONE)
+			error_code = _append(&writer->members, name, strlen(name),
+					target.offset, target.length);
+		break;
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return error_code;
+}
+
+static void _free_writer(archive_writer *writer) {
+	_clear(&writer->members);
+	free(writer->buffer);
+	pthread_mutex_destroy(&writer->lock);
+	free(writer);
+}
+
+/**
+ * @brief Stops writing an archive and deletes it.
+ */
+void archive_abort(archive_writer *writer) {
+	if (writer == NULL)
+		return;
+
+	fclose(writer->file);
+	remove(writer->partial);
+	_free_writer(writer);
+}
+
+/**
+ * @brief Builds the content of the index member.
+ * @details One "OFFSET LENGTH NAME" line per member, sorted by name, padded
+ *          with empty lines so that the footer ends the last block.
+ *
+ * @param writer The archive being written, its members sorted
+ * @param length Receives the size of the index
+ * @return The index, to be freed, or NULL
+ */
+static char *_build_index(const archive_writer *writer, size_t *length) {
+	char footer[ARCHIVE_FOOTER_SIZE + 1];
+	size_t size = ARCHIVE_FOOTER_SIZE;
+
+	for (unsigned int i = 0; i < writer->members.count; ++i)
+		size += strlen(writer->members.items[i].name) + 2 * 21 + 1;
+	size = _blocks(size);
+
+	char *index = malloc(size);
+	if (index == NULL)
+		return NULL;
+
+	size_t used = 0;
+	for (unsigned int i = 0; i < writer->members.count; ++i) {
+		const archive_item *item = &writer->members.items[i];
+
+		used += sprintf(index + used, "%llu %llu %s\n",
+				(unsigned long long) item->offset,
+				(unsigned long long) item->length, item->name);
+	}
+
+	*length = _blocks(used + ARCHIVE_FOOTER_SIZE);
+	memset(index + used, '\n', *length - used - ARCHIVE_FOOTER_SIZE);
+	snprintf(footer, sizeof(footer), ARCHIVE_INDEX_MAGIC " %022llu\n",
+			(unsigned long long) writer->offset);
+	memcpy(index + *length - ARCHIVE_FOOTER_SIZE, footer,
+			ARCHIVE_FOOTER_SIZE);
+	return index;
+}
+
+/**
+ * @brief Writes the index and the end of an archive and puts it in place.
+ * @details The data reaches the storage once, here. Of several files with
+ *          the same name, the last one is kept. The writer is freed in any
+ *          case.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int archive_finish(archive_writer *writer) {
+	static const unsigned char end[2 * ARCHIVE_BLOCK];
+	archive_header header;
+	size_t length = 0;
+	int error_code = writer->error_code;
+
+	_sort(&writer->members);
+
+	char *index = _build_index(writer, &length);
+	if (index == NULL && error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	if (error_code == IMAGE_UTIL_ERROR_NONE
+			&& (!_fill_header(&header, ARCHIVE_INDEX_NAME, length, '0', NULL)
+					|| !_write_member(writer, &header, index, length)
+					|| fwrite(end, sizeof(end), 1, writer->file) != 1
+					|| fflush(writer->file) != 0
+					|| fsync(fileno(writer->file)) != 0))
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	free(index);
+
+	if (fclose(writer->file) != 0 && error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	if (error_code == IMAGE_UTIL_ERROR_NONE
+			&& rename(writer->partial, writer->path) != 0)
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		remove(writer->partial);
+	else
+		dlog_print(DLOG_INFO, LOG_TAG, "Archived %u files in %s, %llu bytes",
+				writer->members.count, writer->path,
+				(unsigned long long) (writer->offset + sizeof(end)));
+
+	_free_writer(writer);
+	return error_code;
+}
+
+/**
+ * @brief Reads an octal field, which may end with a NUL or spaces.
+ */
+static bool _parse_octal(const char *field, size_t size, uint64_t *value) {
+	size_t i = 0;
+
+	while (i < size && field[i] == ' ')
+		i++;
+	if (i == size || field[i] < '0' || field[i] > '7')
+		return false;
+
+	*value = 0;
+	for (; i < size && field[i] >= '0' && field[i] <= '7'; ++i)
+		*value = *value * 8 + (field[i] - '0');
+	return i == size || field[i] == '\0' || field[i] == ' ';
+}
+
+static bool _valid_header(const archive_header *header, uint64_t *length) {
+	uint64_t checksum;
+
+	return _parse_octal(header->checksum, sizeof(header->checksum), &checksum)
+			&& checksum == _checksum(header)
+			&& _parse_octal(header->size, sizeof(header->size), length);
+}
+
+static bool _is_zero_block(const unsigned char *block) {
+	for (size_t i = 0; i < ARCHIVE_BLOCK; ++i)
+		if (block[i] != 0)
+			return false;
+	return true;
+}
+
+/**
+ * @brief Reads the members from the index at the end of the archive.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT if there is no valid index
+ */
+static int _read_index(archive *opened) {
+	char line[ARCHIVE_LINELEN];
+	uint64_t offset, length;
+
+	if (opened->size < 4 * ARCHIVE_BLOCK)
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+
+	/* The footer ends the block before the two zero blocks. */
+	size_t end = opened->size - 2 * ARCHIVE_BLOCK;
+	const char *footer = (const char *) opened->data + end
+			- ARCHIVE_FOOTER_SIZE;
+	memcpy(line, footer, ARCHIVE_FOOTER_SIZE);
+	line[ARCHIVE_FOOTER_SIZE] = '\0';
+	if (strncmp(line, ARCHIVE_INDEX_MAGIC " ", sizeof(ARCHIVE_INDEX_MAGIC))
+			!= 0)
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+
+	offset = strtoull(line + sizeof(ARCHIVE_INDEX_MAGIC), NULL, 10);
+	if (offset % ARCHIVE_BLOCK != 0 || offset >= end - ARCHIVE_BLOCK)
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+
+	const archive_header *header = (const archive_header *) (opened->data
+			+ offset);
+	if (!_valid_header(header, &length)
+			|| strncmp(header->name, ARCHIVE_INDEX_NAME, sizeof(header->name))
+					!= 0
+			|| offset + ARCHIVE_BLOCK + length != end)
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+
+	const char *text = (const char *) opened->data + offset + ARCHIVE_BLOCK;
+	const char *stop = text + length - ARCHIVE_FOOTER_SIZE;
+
+	while (text < stop) {
+		const char *newline = memchr(text, '\n', stop - text);
+		size_t line_length = (newline != NULL) ? newline - text : 0;
+		unsigned long long member_offset, member_length;
+		int name_start = 0;
+
+		if (newline == NULL || line_length >= sizeof(line))
+			return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+		memcpy(line, text, line_length);
+		line[line_length] = '\0';
+		text = newline + 1;
+		if (line_length == 0)
+			continue;
+
+		if (sscanf(line, "%llu %llu %n", &member_offset, &member_length,
+				&name_start) != 2 || name_start == 0
+				|| line[name_start] == '\0' || member_offset > opened->size
+				|| member_length > opened->size - member_offset)
+			return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+
+		int error_code = _append(&opened->members, line + name_start,
+				line_length - name_start, member_offset, member_length);
+		if (error_code != IMAGE_UTIL_ERROR_NONE)
+			return error_code;
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Reads the members by walking the headers of the archive.
+ * @details For archives without an index, such as one cut short or
+ *          written by another tool. The walk stops at the end of the
+ *          archive or at the first incomplete member. Only files and hard
+ *          links to them are kept.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT if it is not a tar archive
+ */
+static int _scan(archive *opened) {
+	char name[sizeof(((archive_header *) 0)->prefix) + 1
+			+ sizeof(((archive_header *) 0)->name) + 1];
+	uint64_t offset = 0;
+
+	while (offset + ARCHIVE_BLOCK <= opened->size) {
+		const archive_header *header = (const archive_header *) (opened->data
+				+ offset);
+		uint64_t length;
+
+		if (_is_zero_block(opened->data + offset))
+			break;
+		if (!_valid_header(header, &length)
+				|| length > opened->size - offset - ARCHIVE_BLOCK) {
+			if (offset == 0)
+				return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+			dlog_print(DLOG_WARN, LOG_TAG,
+					"Archive ends with an incomplete member at %llu",
+					(unsigned long long) offset);
+			break;
+		}
+
+		int prefix = strnlen(header->prefix, sizeof(header->prefix));
+		int length_name = strnlen(header->name, sizeof(header->name));
+		snprintf(name, sizeof(name), "%.*s%s%.*s", prefix, header->prefix,
+				prefix ? "/" : "", length_name, header->name);
+
+		int error_code = IMAGE_UTIL_ERROR_NONE;
+		if ((header->typeflag == '0' || header->typeflag == '\0')
+				&& strcmp(name, ARCHIVE_INDEX_NAME) != 0) {
+			error_code = _append(&opened->members, name, strlen(name),
+					offset + ARCHIVE_BLOCK, length);
+		} else if (header->typeflag == '1') {
+			int link_length = strnlen(header->linkname,
+					sizeof(header->linkname));
+
+			for (unsigned int i = opened->members.count; i-- > 0;) {
+				const archive_item *target = &opened->members.items[i];
+
+				if (strncmp(target->name, header->linkname, link_length) == 0
+						&& target->name[link_length] == '\0') {
+					error_code = _append(&opened->members, name, strlen(name),
+							target->offset, target->length);
+					break;
+				}
+			}
+		}
+		if (error_code != IMAGE_UTIL_ERROR_NONE)
+			return error_code;
+
+		offset += ARCHIVE_BLOCK + _blocks(length);
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Maps an archive and reads its members.
+ * @details The index at the end is used when there is one; otherwise the
+ *          headers are walked.
+ *
+ * @param path The archive
+ * @param reader Receives the archive, to be closed with archive_close()
+ * @return IMAGE_UTIL_ERROR_NONE on success, IMAGE_UTIL_ERROR_NO_SUCH_FILE
+ *         if the file cannot be read, IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT
+ *         if it is not a tar archive
+ */
+int archive_open(const char *path, archive **reader) {
+	struct stat st;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+	if (fstat(fd, &st) != 0 || st.st_size < ARCHIVE_BLOCK) {
+		close(fd);
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	archive *opened = calloc(1, sizeof(archive));
+	if (opened == NULL) {
+		munmap(data, st.st_size);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+	opened->data = data;
+	opened->size = st.st_size;
+
+	int error_code = _read_index(opened);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		_clear(&opened->members);
+		error_code = _scan(opened);
+	}
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		archive_close(opened);
+		return error_code;
+	}
+	_sort(&opened->members);
+
+	*reader = opened;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+void archive_close(archive *reader) {
+	if (reader == NULL)
+		return;
+
+	munmap((void *) reader->data, reader->size);
+	_clear(&reader->members);
+	free(reader);
+}
+
+unsigned int archive_count(const archive *reader) {
+	return reader->members.count;
+}
+
+/**
+ * @brief Gets a member of an archive.
+ *
+ * @param reader The archive
+ * @param index The index of the member, in name order
+ * @param view Receives the member
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_INVALID_PARAMETER for an index out of range
+ */
+int archive_get(const archive *reader, unsigned int index,
+		archive_view *view) {
+	if (index >= reader->members.count)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	const archive_item *item = &reader->members.items[index];
+	view->name = item->name;
+	view->data = reader->data + item->offset;
+	view->length = item->length;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+static int _compare_name(const void *name, const void *item) {
+	return strcmp(name, ((const archive_item *) item)->name);
+}
+
+/**
+ * @brief Looks up a member by name.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, IMAGE_UTIL_ERROR_NO_SUCH_FILE
+ *         if the archive has no such member
+ */
+int archive_find(const archive *reader, const char *name,
+		archive_view *view) {
+	const archive_item *item = bsearch(name, reader->members.items,
+			reader->members.count, sizeof(archive_item), _compare_name);
+
+	if (item == NULL)
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+	return archive_get(reader, item - reader->members.items, view);
+}
+
+/**
+ * @brief Checks that a member name stays inside the extraction directory.
+ */
+static bool _relative_name(const char *name) {
+	if (*name == '/')
+		return false;
+
+	for (const char *part = name; part != NULL;) {
+		const char *slash = strchr(part, '/');
+		size_t length = (slash != NULL) ? (size_t) (slash - part) : strlen(part);
+
+		if (length == 0 || (length == 1 && part[0] == '.')
+				|| (length == 2 && part[0] == '.' && part[1] == '.'))
+			return false;
+		part = (slash != NULL) ? slash + 1 : NULL;
+	}
+	return true;
+}
+
+/**
+ * @brief Creates the missing directories of a member's path.
+ *
+ * @param path The path of the member; changed while running, then restored
+ * @param first The first slash after the existing directory
+ */
+static bool _make_parents(char *path, char *first) {
+	for (char *slash = first; slash != NULL; slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+		*slash = '/';
+		if (!made)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Writes every member of an archive to a directory.
+ * @details Members in subdirectories are written to the same
+ *          subdirectories, created if needed. Members whose name is
+ *          absolute or has an empty, "." or ".." component are skipped, so
+ *          that nothing is written outside of the directory. The other
+ *          members are still extracted after a failure.
+ *
+ * @param reader The archive
+ * @param directory The existing directory receiving the files
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise the first error
+ */
+int archive_extract(const archive *reader, const char *directory) {
+	char path[BUFLEN];
+	int first_error = IMAGE_UTIL_ERROR_NONE;
+
+	for (unsigned int i = 0; i < reader->members.count; ++i) {
+		const archive_item *item = &reader->members.items[i];
+		int error_code = IMAGE_UTIL_ERROR_NONE;
+
+		if (!_relative_name(item->name)
+				|| snprintf(path, BUFLEN, "%s/%s", directory, item->name)
+						>= BUFLEN) {
+			dlog_print(DLOG_WARN, LOG_TAG, "Not extracting %s", item->name);
+			error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		} else {
+			FILE *file = _make_parents(path, strchr(path + strlen(directory)
+					+ 1, '/')) ? fopen(path, "wb") : NULL;
+
+			if (file == NULL) {
+				error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+			} else {
+				bool written = fwrite(reader->data + item->offset, 1,
+						item->length, file) == item->length;
+
+				if (fclose(file) != 0 || !written)
+					error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+			}
+		}
+
+		if (first_error == IMAGE_UTIL_ERROR_NONE)
+			first_error = error_code;
+	}
+	return first_error;
+}
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "arena.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGN 16
+#define ALIGN_UP(n, a) (((n) + (a) - 1) & ~((size_t) (a) - 1))
+
+/* Buffer pool size classes: 64 KiB, 96 KiB, 128 KiB, 192 KiB, ... */
+#define POOL_MIN_SIZE (64 * 1024)
+#define POOL_CLASSES 24
+#define POOL_UNPOOLED POOL_CLASSES
+
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+} arena_chunk;
+
+struct arena {
+	/* The chunk allocations are served from comes first. */
+	arena_chunk *chunks;
+	size_t chunk_size;
+	/* Bytes handed out since the last reset. */
+	size_t used;
+};
+
+/* Precedes every pool buffer; next links the free buffers of a class. */
+typedef struct pool_header {
+	struct pool_header *next;
+	size_t size_class;
+} __attribute__((aligned(ARENA_ALIGN))) pool_header;
+
+static struct {
+	unsigned int allocations;
+	unsigned int system_allocations;
+	unsigned int resets;
+	size_t high_water;
+} arena_stats;
+
+static struct {
+	pthread_mutex_t lock;
+	pool_header *free[POOL_CLASSES];
+	size_t budget;
+	size_t cached_bytes;
+	unsigned int cached;
+	unsigned int requests;
+	unsigned int reused;
+	unsigned int system_allocations;
+	unsigned int dropped;
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .budget = BUFFER_POOL_BUDGET };
+
+static __thread arena *current_arena;
+
+#define CHUNK_HEADER ALIGN_UP(sizeof(arena_chunk), ARENA_ALIGN)
+#define CHUNK_DATA(chunk) ((unsigned char *) (chunk) + CHUNK_HEADER)
+
+/**
+ * @brief Creates an empty arena.
+ * @details No memory is reserved until the first allocation.
+ *
+ * @param chunk_size The size of the first chunk, 0 for the default
+ * @return The arena, or NULL if out of memory
+ */
+arena *arena_create(size_t chunk_size) {
+	arena *self = calloc(1, sizeof(arena));
+
+	if (self != NULL)
+		self->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+	return self;
+}
+
+static void _free_chunks(arena *self) {
+	while (self->chunks != NULL) {
+		arena_chunk *chunk = self->chunks;
+
+		self->chunks = chunk->next;
+		free(chunk);
+	}
+}
+
+void arena_destroy(arena *self) {
+	if (self == NULL)
+		return;
+
+	if (current_arena == self)
+		current_arena = NULL;
+	_free_chunks(self);
+	free(self);
+}
+
+/**
+ * @brief Allocates scratch memory valid until the next arena_reset().
+ *
+ * @param self The arena
+ * @param size The number of bytes
+ * @return 16-byte aligned memory, or NULL if out of memory
+ */
+void *arena_alloc(arena *self, size_t size) {
+	arena_chunk *chunk = self->chunks;
+
+	size = ALIGN_UP(size, ARENA_ALIGN);
+	__atomic_add_fetch(&arena_stats.allocations, 1, __ATOMIC_RELAXED);
+
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		size_t chunk_size = (size > self->chunk_size) ? size : self->chunk_size;
+
+		chunk = malloc(CHUNK_HEADER + chunk_size);
+		if (chunk == NULL)
+			return NULL;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = self->chunks;
+		self->chunks = chunk;
+		__atomic_add_fetch(&arena_stats.system_allocations, 1,
+				__ATOMIC_RELAXED);
+	}
+
+	void *data = CHUNK_DATA(chunk) + chunk->used;
+	chunk->used += size;
+	self->used += size;
+	return data;
+}
+
+/**
+ * @brief Frees everything allocated from the arena at once.
+ * @details If the last job needed more than one chunk, the chunks are
+ *          replaced by a single chunk as large as all of them, so the same
+ *          job does not allocate from the system again.
+ *
+ * @param self The arena
+ */
+void arena_reset(arena *self) {
+	if (self == NULL)
+		return;
+
+	size_t high_water = __atomic_load_n(&arena_stats.high_water,
+			__ATOMIC_RELAXED);
+	while (self->used > high_water
+			&& !__atomic_compare_exchange_n(&arena_stats.high_water,
+					&high_water, self->used, true, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+		;
+	__atomic_add_fetch(&arena_stats.resets, 1, __ATOMIC_RELAXED);
+
+	if (self->chunks != NULL && self->chunks->next != NULL) {
+		if (self->used > self->chunk_size)
+			self->chunk_size = ALIGN_UP(self->used, POOL_MIN_SIZE);
+		_free_chunks(self);
+	} else if (self->chunks != NULL) {
+		self->chunks->used = 0;
+	}
+	self->used = 0;
+}
+
+/**
+ * @brief Returns the arena of the calling worker thread.
+ *
+ * @return The arena, or NULL outside of a scheduler worker
+ */
+arena *arena_current(void) {
+	return current_arena;
+}
+
+void arena_set_current(arena *self) {
+	current_arena = self;
+}
+
+static bool _owns(const arena *self, const void *data) {
+	for (arena_chunk *chunk = self->chunks; chunk != NULL; chunk = chunk->next) {
+		const unsigned char *start = CHUNK_DATA(chunk);
+
+		if ((const unsigned char *) data >= start
+				&& (const unsigned char *) data < start + chunk->size)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Allocates scratch memory for the job being run.
+ * @details Small buffers come from the arena of the worker thread, so a
+ *          job repeated on a worker does not allocate from the system.
+ *          Larger ones, and those of threads without an arena, come from
+ *          the buffer pool.
+ *
+ * @param size The number of bytes
+ * @return 16-byte aligned memory, or NULL if out of memory
+ */
+void *scratch_get(size_t size) {
+	arena *current = current_arena;
+
+	if (current != NULL && size <= ARENA_SCRATCH_LIMIT)
+		return arena_alloc(current, size);
+	return buffer_pool_get(size);
+}
+
+/**
+ * @brief Gives back memory from scratch_get().
+ * @details Arena memory is freed with the arena's next reset, so only pool
+ *          buffers are returned here.
+ *
+ * @param data The memory, may be NULL
+ */
+void scratch_put(void *data) {
+	if (data == NULL)
+		return;
+
+	if (current_arena == NULL || !_owns(current_arena, data))
+		buffer_pool_put(data);
+}
+
+static size_t _class_size(size_t size_class) {
+	size_t base = (size_t) POOL_MIN_SIZE << (size_class / 2);
+
+	return (size_class % 2) ? base + base / 2 : base;
+}
+
+static size_t _size_class(size_t size) {
+	for (size_t size_class = 0; size_class < POOL_CLASSES; ++size_class)
+		if (_class_size(size_class) >= size)
+			return size_class;
+	return POOL_UNPOOLED;
+}
+
+/**
+ * @brief Takes a large buffer from the pool, or allocates one.
+ * @details Sizes are rounded up to a size class, so that buffers freed by
+ *          one job fit the next job of a similar size.
+ *
+ * @param size The number of bytes needed
+ * @return 16-byte aligned memory, or NULL if out of memory
+ */
+void *buffer_pool_get(size_t size) {
+	size_t size_class = _size_class(size);
+	pool_header *header = NULL;
+	uint64_t span = trace_begin();
+
+	pthread_mutex_lock(&pool.lock);
+	pool.requests++;
+	if (size_class != POOL_UNPOOLED && pool.free[size_class] != NULL) {
+		header = pool.free[size_class];
+		pool.free[size_class] = header->next;
+		pool.cached_bytes -= _class_size(size_class);
+		pool.cached--;
+		pool.reused++;
+	} else {
+		pool.system_allocations++;
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	if (header == NULL) {
+		size_t bytes = (size_class != POOL_UNPOOLED) ?
+				_class_size(size_class) : size;
+
+		header = malloc(sizeof(pool_header) + bytes);
+		if (header != NULL)
+			header->size_class = size_class;
+	}
+
+	trace_end("pool acquire", span, NULL);
+	if (header == NULL)
+		return NULL;
+	header->next = NULL;
+	return header + 1;
+}
+
+/**
+ * @brief Frees the pool buffers beyond the budget, largest first.
+ * @remarks Must be called with pool.lock held.
+ *
+ * @param drop Receives the list of buffers to free outside the lock
+ */
+static void _trim(pool_header **drop) {
+	for (size_t size_class = POOL_CLASSES; size_class-- > 0;) {
+		while (pool.cached_bytes > pool.budget && pool.free[size_class] != NULL) {
+			pool_header *header = pool.free[size_class];
+
+			pool.free[size_class] = header->next;
+			pool.cached_bytes -= _class_size(size_class);
+			pool.cached--;
+			pool.dropped++;
+
+			header->next = *drop;
+			*drop = header;
+		}
+	}
+}
+
+static void _free_list(pool_header *list) {
+	while (list != NULL) {
+		pool_header *next = list->next;
+
+		free(list);
+		list = next;
+	}
+}
+
+/**
+ * @brief Returns a buffer from buffer_pool_get() to the pool.
+ * @details The buffer is freed instead if keeping it would exceed the
+ *          pool's budget.
+ *
+ * @param data The buffer, may be NULL
+ */
+void buffer_pool_put(void *data) {
+	if (data == NULL)
+		return;
+
+	pool_header *header = (pool_header *) data - 1;
+	if (header->size_class == POOL_UNPOOLED) {
+		free(header);
+		return;
+	}
+
+	size_t bytes = _class_size(header->size_class);
+	pool_header *drop = NULL;
+
+	pthread_mutex_lock(&pool.lock);
+	if (bytes > pool.budget) {
+		pool.dropped++;
+		drop = header;
+	} else {
+		header->next = pool.free[header->size_class];
+		pool.free[header->size_class] = header;
+		pool.cached_bytes += bytes;
+		pool.cached++;
+		_trim(&drop);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	_free_list(drop);
+}
+
+/**
+ * @brief Changes how many bytes of free buffers the pool keeps.
+ *
+ * @param budget The new budget; 0 frees every cached buffer
+ */
+void buffer_pool_set_budget(size_t budget) {
+	pool_header *drop = NULL;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.budget = budget;
+	_trim(&drop);
+	pthread_mutex_unlock(&pool.lock);
+
+	_free_list(drop);
+}
+
+/**
+ * @brief Frees the pixels of an image, whichever allocator they came from.
+ *
+ * @param image The image; its data is set to NULL
+ */
+void image_buffer_free(image_buffer *image) {
+	if (image->pooled)
+		buffer_pool_put(image->data);
+	else
+		free(image->data);
+	image->data = NULL;
+	image->pooled = false;
+}
+
+/**
+ * @brief Prints the arena and buffer pool statistics to the log.
+ */
+void arena_log_stats(void) {
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Arenas: %u allocations, %u system allocations, %u resets, high water %zu bytes",
+			__atomic_load_n(&arena_stats.allocations, __ATOMIC_RELAXED),
+			__atomic_load_n(&arena_stats.system_allocations, __ATOMIC_RELAXED),
+			__atomic_load_n(&arena_stats.resets, __ATOMIC_RELAXED),
+			__atomic_load_n(&arena_stats.high_water, __ATOMIC_RELAXED));
+
+	pthread_mutex_lock(&pool.lock);
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Buffer pool: %u requests, %u reused, %u system allocations, %u dropped, %u buffers (%zu of %zu bytes) cached",
+			pool.requests, pool.reused, pool.system_allocations, pool.dropped,
+			pool.cached, pool.cached_bytes, pool.budget);
+	pthread_mutex_unlock(&pool.lock);
+}
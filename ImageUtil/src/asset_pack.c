@@ -0,0 +1,558 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "asset_pack.h"
+#include "job.h"
+#include "hash.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* An entry being written, named until the string table is laid out. */
+typedef struct {
+	char *name;
+	asset_pack_entry entry;
+} pending_entry;
+
+/* Thread-safe: the jobs of a batch add their results as they finish. */
+struct asset_pack_writer {
+	pthread_mutex_t lock;
+	FILE *file;
+	char path[BUFLEN];
+	char partial[BUFLEN];
+	/* Where the next blob goes. */
+	uint64_t offset;
+	pending_entry *entries;
+	unsigned int count;
+	unsigned int size;
+	/* Open addressing table of entry indexes + 1, by name and size. */
+	unsigned int *slots;
+	unsigned int slot_count;
+	/* The first error, after which nothing more is written. */
+	int error_code;
+};
+
+struct asset_pack {
+	const unsigned char *data;
+	size_t size;
+	const asset_pack_header *header;
+	const asset_pack_entry *entries;
+	const char *strings;
+};
+
+static uint64_t _align(uint64_t offset, uint64_t alignment) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @brief Writes zeros up to an alignment.
+ */
+static bool _pad(asset_pack_writer *writer, uint64_t alignment) {
+	static const unsigned char zeros[ASSET_PACK_ALIGN];
+	uint64_t padding = _align(writer->offset, alignment) - writer->offset;
+
+	if (padding > 0 && fwrite(zeros, 1, padding, writer->file) != padding)
+		return false;
+	writer->offset += padding;
+	return true;
+}
+
+/**
+ * @brief Starts writing a pack.
+ * @details The pack is written next to its path and renamed by
+ *          asset_pack_finish(), so readers never map a partial pack.
+ *
+ * @param path The path of the pack
+ * @param writer Receives the writer, to be ended with asset_pack_finish()
+ *               or asset_pack_abort()
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int asset_pack_create(const char *path, asset_pack_writer **writer) {
+	asset_pack_header header = { .version = 0 };
+
+	asset_pack_writer *created = calloc(1, sizeof(asset_pack_writer));
+	if (created == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	if (snprintf(created->path, BUFLEN, "%s", path) >= BUFLEN
+			|| snprintf(created->partial, BUFLEN, "%s.part", path) >= BUFLEN) {
+		free(created);
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	}
+
+	created->file = fopen(created->partial, "wb");
+	if (created->file == NULL) {
+		free(created);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+
+	/* The header is rewritten once the index is known. */
+	if (fwrite(&header, sizeof(header), 1, created->file) != 1) {
+		fclose(created->file);
+		remove(created->partial);
+		free(created);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+	created->offset = sizeof(header);
+	pthread_mutex_init(&created->lock, NULL);
+
+	*writer = created;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+static size_t _slot(const asset_pack_writer *writer, const char *name,
+		unsigned int width, unsigned int height) {
+	uint64_t hash = hash_bytes(name, strlen(name),
+			(uint64_t) width << 32 | height);
+
+	return hash & (writer->slot_count - 1);
+}
+
+/**
+ * @brief Finds an entry being written by its name and size.
+ *
+ * @return The index of the entry, or -1 if there is none
+ */
+static int _find(const asset_pack_writer *writer, const char *name,
+		unsigned int width, unsigned int height) {
+	if (writer->slot_count == 0)
+		return -1;
+
+	for (size_t slot = _slot(writer, name, width, height);
+			writer->slots[slot] != 0;
+			slot = (slot + 1) & (writer->slot_count - 1)) {
+		const pending_entry *pending = &writer->entries[writer->slots[slot] - 1];
+
+		if (pending->entry.width == width && pending->entry.height == height
+				&& strcmp(pending->name, name) == 0)
+			return writer->slots[slot] - 1;
+	}
+	return -1;
+}
+
+/**
+ * @brief Makes room in the table of entries for one more, at most half
+ *        full.
+ *
+ * @return @c false if out of memory
+ */
+static bool _reserve_slot(asset_pack_writer *writer) {
+	if (2 * (writer->count + 1) <= writer->slot_count)
+		return true;
+
+	unsigned int slot_count = writer->slot_count ? writer->slot_count * 2 : 128;
+	unsigned int *slots = calloc(slot_count, sizeof(unsigned int));
+	if (slots == NULL)
+		return false;
+
+	free(writer->slots);
+	writer->slots = slots;
+	writer->slot_count = slot_count;
+	for (unsigned int i = 0; i < writer->count; ++i) {
+		const pending_entry *pending = &writer->entries[i];
+		size_t slot = _slot(writer, pending->name, pending->entry.width,
+				pending->entry.height);
+
+		while (slots[slot] != 0)
+			slot = (slot + 1) & (slot_count - 1);
+		slots[slot] = i + 1;
+	}
+	return true;
+}
+
+static int _append(asset_pack_writer *writer, const char *name,
+		const asset_pack_entry *entry) {
+	if (!_reserve_slot(writer))
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	if (writer->count == writer->size) {
+		unsigned int size = writer->size ? writer->size * 2 : 64;
+		pending_entry *entries = realloc(writer->entries,
+				size * sizeof(pending_entry));
+
+		if (entries == NULL)
+			return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+		writer->entries = entries;
+		writer->size = size;
+	}
+
+	char *copy = strdup(name);
+	if (copy == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	size_t slot = _slot(writer, name, entry->width, entry->height);
+	while (writer->slots[slot] != 0)
+		slot = (slot + 1) & (writer->slot_count - 1);
+
+	writer->entries[writer->count].name = copy;
+	writer->entries[writer->count].entry = *entry;
+	writer->slots[slot] = ++writer->count;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Appends an image to a pack.
+ *
+ * @param writer The pack being written
+ * @param name The name the image is looked up by
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param format How the image is stored
+ * @param colorspace The colorspace of raw pixels
+ * @param data The image
+ * @param length The size of the image in bytes
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_INVALID_OPERATION if the pack already has an
+ *         image of that name and size, otherwise an error code
+ */
+int asset_pack_add(asset_pack_writer *writer, const char *name,
+		unsigned int width, unsigned int height, asset_format format,
+		image_util_colorspace_e colorspace, const void *data, size_t length) {
+	asset_pack_entry entry = { .width = width, .height = height, .format =
+			format, .colorspace = colorspace, .length = length };
+
+	if (name == NULL || *name == '\0' || strlen(name) >= BUFLEN)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&writer->lock);
+	int error_code = writer->error_code;
+
+	if (error_code == IMAGE_UTIL_ERROR_NONE
+			&& _find(writer, name, width, height) >= 0)
+		error_code = IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	else if (error_code == IMAGE_UTIL_ERROR_NONE) {
+		if (!_pad(writer, ASSET_PACK_ALIGN)
+				|| fwrite(data, 1, length, writer->file) != length)
+			error_code = writer->error_code =
+					IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+	if (error_code == IMAGE_UTIL_ERROR_NONE) {
+		entry.offset = writer->offset;
+		writer->offset += length;
+		error_code = _append(writer, name, &entry);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return error_code;
+}
+
+/**
+ * @brief Adds a name for an image already in a pack.
+ * @details The new entry shares the blob of the original; nothing is
+ *          written twice.
+ *
+ * @param writer The pack being written
+ * @param name The new name
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param original The name the image was added with
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_INVALID_PARAMETER if the original is not in the
+ *         pack, IMAGE_UTIL_ERROR_INVALID_OPERATION if the pack already has
+ *         an image of the new name and that size, otherwise an error code
+ */
+int asset_pack_link(asset_pack_writer *writer, const char *name,
+		unsigned int width, unsigned int height, const char *original) {
+	if (name == NULL || *name == '\0' || strlen(name) >= BUFLEN)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&writer->lock);
+	int error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	int index = _find(writer, original, width, height);
+
+	if (_find(writer, name, width, height) >= 0) {
+		error_code = IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	} else if (index >= 0) {
+		asset_pack_entry entry = writer->entries[index].entry;
+
+		error_code = _append(writer, name, &entry);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return error_code;
+}
+
+static void _free_writer(asset_pack_writer *writer) {
+	for (unsigned int i = 0; i < writer->count; ++i)
+		free(writer->entries[i].name);
+	free(writer->entries);
+	free(writer->slots);
+	pthread_mutex_destroy(&writer->lock);
+	free(writer);
+}
+
+/**
+ * @brief Stops writing a pack and deletes it.
+ */
+void asset_pack_abort(asset_pack_writer *writer) {
+	if (writer == NULL)
+		return;
+
+	fclose(writer->file);
+	remove(writer->partial);
+	_free_writer(writer);
+}
+
+static int _compare_pending(const void *a, const void *b) {
+	const pending_entry *first = a, *second = b;
+	int order = strcmp(first->name, second->name);
+
+	if (order != 0)
+		return order;
+	if (first->entry.width != second->entry.width)
+		return (first->entry.width < second->entry.width) ? -1 : 1;
+	if (first->entry.height != second->entry.height)
+		return (first->entry.height < second->entry.height) ? -1 : 1;
+	return 0;
+}
+
+/**
+ * @brief Writes the index of a pack and puts it in place.
+ * @details The entries are sorted by name and size, which are unique:
+ *          asset_pack_add() and asset_pack_link() refuse a second image of
+ *          the same name and size. The writer is freed in any case.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int asset_pack_finish(asset_pack_writer *writer) {
+	asset_pack_header header = { .magic = ASSET_PACK_MAGIC, .version =
+			ASSET_PACK_VERSION, .byte_order = ASSET_PACK_BYTE_ORDER };
+	int error_code = writer->error_code;
+	unsigned int count = writer->count;
+
+	qsort(writer->entries, count, sizeof(pending_entry), _compare_pending);
+
+	/* The string table, then the index. */
+	header.strings_offset = writer->offset;
+	for (unsigned int i = 0; i < count && error_code == IMAGE_UTIL_ERROR_NONE;
+			++i) {
+		pending_entry *pending = &writer->entries[i];
+		size_t length = strlen(pending->name);
+
+		pending->entry.name_offset = header.strings_size;
+		pending->entry.name_length = length;
+		if (fwrite(pending->name, 1, length, writer->file) != length)
+			error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+		header.strings_size += length;
+	}
+	writer->offset += header.strings_size;
+
+	if (error_code == IMAGE_UTIL_ERROR_NONE && !_pad(writer, sizeof(uint64_t)))
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	header.index_offset = writer->offset;
+	for (unsigned int i = 0; i < count && error_code == IMAGE_UTIL_ERROR_NONE;
+			++i)
+		if (fwrite(&writer->entries[i].entry, sizeof(asset_pack_entry), 1,
+				writer->file) != 1)
+			error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	writer->offset += (uint64_t) count * sizeof(asset_pack_entry);
+
+	header.entry_count = count;
+	header.file_size = writer->offset;
+	if (error_code == IMAGE_UTIL_ERROR_NONE
+			&& (fseek(writer->file, 0, SEEK_SET) != 0
+					|| fwrite(&header, sizeof(header), 1, writer->file) != 1))
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+
+	if (fclose(writer->file) != 0 && error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	if (error_code == IMAGE_UTIL_ERROR_NONE
+			&& rename(writer->partial, writer->path) != 0)
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		remove(writer->partial);
+	else
+		dlog_print(DLOG_INFO, LOG_TAG, "Packed %u images in %s, %llu bytes",
+				count, writer->path, (unsigned long long) header.file_size);
+
+	_free_writer(writer);
+	return error_code;
+}
+
+/**
+ * @brief Maps a pack.
+ * @details Only the header is checked; entries are checked when read.
+ *
+ * @param path The pack
+ * @param pack Receives the pack, to be closed with asset_pack_close()
+ * @return IMAGE_UTIL_ERROR_NONE on success, IMAGE_UTIL_ERROR_NO_SUCH_FILE
+ *         if the file cannot be read, IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT
+ *         if it is not a pack this version can read
+ */
+int asset_pack_open(const char *path, asset_pack **pack) {
+	struct stat st;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(asset_pack_header)) {
+		close(fd);
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	const asset_pack_header *header = data;
+	uint64_t size = st.st_size;
+	if (memcmp(header->magic, ASSET_PACK_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != ASSET_PACK_VERSION
+			|| header->byte_order != ASSET_PACK_BYTE_ORDER
+			|| header->file_size != size
+			|| header->strings_offset > size
+			|| header->strings_size > size - header->strings_offset
+			|| header->index_offset % sizeof(uint64_t) != 0
+			|| header->index_offset > size
+			|| header->entry_count
+					> (size - header->index_offset) / sizeof(asset_pack_entry)) {
+		munmap(data, st.st_size);
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+	}
+
+	asset_pack *opened = malloc(sizeof(asset_pack));
+	if (opened == NULL) {
+		munmap(data, st.st_size);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+	opened->data = data;
+	opened->size = st.st_size;
+	opened->header = header;
+	opened->entries = (const asset_pack_entry *) (opened->data
+			+ header->index_offset);
+	opened->strings = (const char *) opened->data + header->strings_offset;
+
+	*pack = opened;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+void asset_pack_close(asset_pack *pack) {
+	if (pack == NULL)
+		return;
+
+	munmap((void *) pack->data, pack->size);
+	free(pack);
+}
+
+unsigned int asset_pack_count(const asset_pack *pack) {
+	return pack->header->entry_count;
+}
+
+/**
+ * @brief Gets an entry of a pack.
+ *
+ * @param pack The pack
+ * @param index The index of the entry, in name then size order
+ * @param view Receives the entry
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_INVALID_PARAMETER for an index out of range,
+ *         IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT for a corrupt entry
+ */
+int asset_pack_get(const asset_pack *pack, unsigned int index,
+		asset_view *view) {
+	if (index >= pack->header->entry_count)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	const asset_pack_entry *entry = &pack->entries[index];
+	if (entry->name_offset > pack->header->strings_size
+			|| entry->name_length
+					> pack->header->strings_size - entry->name_offset
+			|| entry->offset > pack->size
+			|| entry->length > pack->size - entry->offset)
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+
+	view->name = pack->strings + entry->name_offset;
+	view->name_length = entry->name_length;
+	view->width = entry->width;
+	view->height = entry->height;
+	view->format = entry->format;
+	view->colorspace = entry->colorspace;
+	view->data = pack->data + entry->offset;
+	view->length = entry->length;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/* Orders a name against the name of an entry, like strcmp(). */
+static int _compare_name(const asset_pack *pack, const char *name,
+		size_t length, const asset_pack_entry *entry) {
+	size_t entry_length = entry->name_length;
+
+	if (entry->name_offset > pack->header->strings_size
+			|| entry_length > pack->header->strings_size - entry->name_offset)
+		entry_length = 0;
+
+	int order = memcmp(name, pack->strings + entry->name_offset,
+			(length < entry_length) ? length : entry_length);
+	if (order != 0)
+		return order;
+	return (length > entry_length) - (length < entry_length);
+}
+
+/**
+ * @brief Looks up an image by name and size.
+ * @details The index is binary searched in place. Of the sizes of the
+ *          image, the smallest one covering width x height is picked, else
+ *          the largest one; a zero width or height asks for the largest.
+ *
+ * @param pack The pack
+ * @param name The name of the image
+ * @param width The wanted width
+ * @param height The wanted height
+ * @param view Receives the entry
+ * @return IMAGE_UTIL_ERROR_NONE on success, IMAGE_UTIL_ERROR_NO_SUCH_FILE
+ *         if the pack has no such image, otherwise an error code
+ */
+int asset_pack_find(const asset_pack *pack, const char *name,
+		unsigned int width, unsigned int height, asset_view *view) {
+	size_t length = strlen(name);
+	unsigned int low = 0, high = pack->header->entry_count;
+
+	while (low < high) {
+		unsigned int middle = low + (high - low) / 2;
+
+		if (_compare_name(pack, name, length, &pack->entries[middle]) > 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	int covering = -1, largest = -1;
+	uint64_t covering_area = UINT64_MAX, largest_area = 0;
+
+	for (unsigned int i = low; i < pack->header->entry_count
+			&& _compare_name(pack, name, length, &pack->entries[i]) == 0; ++i) {
+		const asset_pack_entry *entry = &pack->entries[i];
+		uint64_t area = (uint64_t) entry->width * entry->height;
+
+		if (largest < 0 || area > largest_area) {
+			largest = i;
+			largest_area = area;
+		}
+		if (width > 0 && height > 0 && entry->width >= width
+				&& entry->height >= height && area < covering_area) {
+			covering = i;
+			covering_area = area;
+		}
+	}
+
+	if (largest < 0)
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+	return asset_pack_get(pack, (covering >= 0) ? covering : largest, view);
+}
@@ -0,0 +1,799 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "atlas.h"
+#include "scheduler.h"
+#include "scan.h"
+#include "report.h"
+#include "probe.h"
+#include "arena.h"
+#include <tizen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ATLAS_INDEX_EXTENSION ".json"
+
+/* An area of a page, in pixels. */
+typedef struct {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+} atlas_rect;
+
+/*
+ * A page being packed with MaxRects: free_rects holds every maximal free
+ * rectangle, so they overlap each other.
+ */
+typedef struct {
+	unsigned int width;
+	unsigned int height;
+	unsigned int used_width;
+	unsigned int used_height;
+	atlas_rect *free_rects;
+	unsigned int free_count;
+	unsigned int free_size;
+} atlas_page;
+
+typedef struct atlas_context atlas_context;
+
+/* One input of an atlas. */
+typedef struct {
+	atlas_context *ctx;
+	char name[BUFLEN];
+	char category[BUFLEN];
+	/* The index of the first sprite with the same image, -1 for none. */
+	int original;
+	transform_job job;
+	/* The raw pixels are kept until the page is composed. */
+	pipeline_result result;
+	bool placed;
+	unsigned int page;
+	/* The cell of the sprite, padded to ATLAS_ALIGN. */
+	atlas_rect cell;
+} atlas_sprite;
+
+/* The state of an atlas batch, shared by all its jobs. */
+struct atlas_context {
+	pthread_mutex_t lock;
+	/* Jobs not over yet, plus one while jobs are still being submitted. */
+	unsigned int remaining;
+	atlas_sprite *sprites;
+	unsigned int count;
+	batch_request req;
+	cancel_token *cancel;
+	batch_report *report;
+	char report_path[BUFLEN];
+	batch_summary summary;
+	batch_job_cb job_cb;
+	batch_done_cb done_cb;
+	void *user_data;
+};
+
+static unsigned int _align(unsigned int value) {
+	return (value + ATLAS_ALIGN - 1) / ATLAS_ALIGN * ATLAS_ALIGN;
+}
+
+static bool _overlaps(const atlas_rect *a, const atlas_rect *b) {
+	return a->x < b->x + b->width && b->x < a->x + a->width
+			&& a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+static bool _contains(const atlas_rect *outer, const atlas_rect *inner) {
+	return inner->x >= outer->x && inner->y >= outer->y
+			&& inner->x + inner->width <= outer->x + outer->width
+			&& inner->y + inner->height <= outer->y + outer->height;
+}
+
+static bool _add_free(atlas_rect **rects, unsigned int *count,
+		unsigned int *size, atlas_rect rect) {
+	if (*count == *size) {
+		unsigned int grown = *size ? *size * 2 : 16;
+		atlas_rect *array = realloc(*rects, grown * sizeof(atlas_rect));
+
+		if (array == NULL)
+			return false;
+		*rects = array;
+		*size = grown;
+	}
+	(*rects)[(*count)++] = rect;
+	return true;
+}
+
+static bool _page_init(atlas_page *page, unsigned int width,
+		unsigned int height) {
+	memset(page, 0, sizeof(atlas_page));
+	page->width = width;
+	page->height = height;
+	return _add_free(&page->free_rects, &page->free_count, &page->free_size,
+			(atlas_rect) { 0, 0, width, height });
+}
+
+/**
+ * @brief Places a rectangle on a page with MaxRects.
+ * @details The free rectangle leaving the shortest side is picked (best
+ *          short side fit). Every free rectangle overlapping the placed one
+ *          is then split into the up to four maximal rectangles around it,
+ *          and rectangles contained in another are dropped.
+ *
+ * @return @c false if the rectangle does not fit or out of memory
+ */
+static bool _page_insert(atlas_page *page, unsigned int width,
+		unsigned int height, atlas_rect *placed) {
+	unsigned int best_short = UINT_MAX, best_long = UINT_MAX;
+	int best = -1;
+
+	for (unsigned int i = 0; i < page->free_count; ++i) {
+		const atlas_rect *free_rect = &page->free_rects[i];
+
+		if (free_rect->width < width || free_rect->height < height)
+			continue;
+
+		unsigned int left_x = free_rect->width - width;
+		unsigned int left_y = free_rect->height - height;
+		unsigned int short_side = (left_x < left_y) ? left_x : left_y;
+		unsigned int long_side = (left_x < left_y) ? left_y : left_x;
+
+		if (short_side < best_short
+				|| (short_side == best_short && long_side < best_long)) {
+			best = i;
+			best_short = short_side;
+			best_long = long_side;
+		}
+	}
+	if (best < 0)
+		return false;
+
+	*placed = (atlas_rect) { page->free_rects[best].x,
+			page->free_rects[best].y, width, height };
+
+	atlas_rect *rects = NULL;
+	unsigned int count = 0, size = 0;
+	bool ok = true;
+
+	for (unsigned int i = 0; i < page->free_count && ok; ++i) {
+		const atlas_rect r = page->free_rects[i];
+
+		if (!_overlaps(&r, placed)) {
+			ok = _add_free(&rects, &count, &size, r);
+			continue;
+		}
+		if (placed->x > r.x)
+			ok = ok && _add_free(&rects, &count, &size,
+					(atlas_rect) { r.x, r.y, placed->x - r.x, r.height });
+		if (placed->x + placed->width < r.x + r.width)
+			ok = ok && _add_free(&rects, &count, &size,
+					(atlas_rect) { placed->x + placed->width, r.y, r.x + r.width
+							- placed->x - placed->width, r.height });
+		if (placed->y > r.y)
+			ok = ok && _add_free(&rects, &count, &size,
+					(atlas_rect) { r.x, r.y, r.width, placed->y - r.y });
+		if (placed->y + placed->height < r.y + r.height)
+			ok = ok && _add_free(&rects, &count, &size,
+					(atlas_rect) { r.x, placed->y + placed->height, r.width, r.y
+							+ r.height - placed->y - placed->height });
+	}
+	if (!ok) {
+		free(rects);
+		return false;
+	}
+
+	/* Drop the rectangles contained in another; of equal ones, the last. */
+	unsigned int kept = 0;
+	for (unsigned int i = 0; i < count; ++i) {
+		bool contained = false;
+
+		for (unsigned int j = 0; j < count && !contained; ++j)
+			contained = (j != i) && _contains(&rects[j], &rects[i])
+					&& (j < i || !_contains(&rects[i], &rects[j]));
+		if (!contained)
+			rects[kept++] = rects[i];
+	}
+
+	free(page->free_rects);
+	page->free_rects = rects;
+	page->free_count = kept;
+	page->free_size = size;
+
+	if (placed->x + width > page->used_width)
+		page->used_width = placed->x + width;
+	if (placed->y + height > page->used_height)
+		page->used_height = placed->y + height;
+	return true;
+}
+
+/**
+ * @brief Gets the category of an input: its name without trailing digits.
+ */
+static void _categorize(const char *path, char *name, char *category) {
+	const char *base = strrchr(path, '/');
+	base = (base != NULL) ? base + 1 : path;
+
+	const char *dot = strrchr(base, '.');
+	int stem = (dot != NULL && dot != base) ? dot - base : (int) strlen(base);
+	snprintf(name, BUFLEN, "%.*s", stem, base);
+
+	while (stem > 0 && strchr("0123456789_-. ", base[stem - 1]) != NULL)
+		stem--;
+	if (stem > 0)
+		snprintf(category, BUFLEN, "%.*s", stem, base);
+	else
+		snprintf(category, BUFLEN, "atlas");
+}
+
+static bool _page_path(const atlas_context *ctx, const char *category,
+		unsigned int page, unsigned int pages, char *path) {
+	int length;
+
+	if (pages > 1)
+		length = snprintf(path, BUFLEN, "%s/%s_%u.jpg", ctx->req.output_dir,
+				category, page);
+	else
+		length = snprintf(path, BUFLEN, "%s/%s.jpg", ctx->req.output_dir,
+				category);
+	return length < BUFLEN;
+}
+
+/**
+ * @brief Copies a sprite into its cell of a page.
+ * @details The last column and row are repeated over the padding, so that
+ *          the edge blocks of the sprite compress as if it were alone.
+ */
+static void _blit(unsigned char *canvas, unsigned int canvas_width,
+		const atlas_sprite *sprite) {
+	const image_buffer *image = &sprite->result.raw;
+	const atlas_rect *cell = &sprite->cell;
+	size_t row_size = (size_t) image->width * 3;
+
+	for (unsigned int y = 0; y < cell->height; ++y) {
+		unsigned int source_y = (y < (unsigned int) image->height) ?
+				y : (unsigned int) image->height - 1;
+		const unsigned char *source = image->data + source_y * row_size;
+		unsigned char *target = canvas
+				+ ((size_t) (cell->y + y) * canvas_width + cell->x) * 3;
+
+		memcpy(target, source, row_size);
+		for (unsigned int x = image->width; x < cell->width; ++x)
+			memcpy(target + x * 3, source + row_size - 3, 3);
+	}
+}
+
+static bool _is_ok(const pipeline_result *result) {
+	return !result->cancelled && result->error_code == IMAGE_UTIL_ERROR_NONE;
+}
+
+static void _fail(atlas_sprite *sprite, int error_code) {
+	sprite->result.error_code = error_code;
+	sprite->result.stage = PIPELINE_STAGE_ENCODE;
+	sprite->placed = false;
+}
+
+/* Largest side first, then largest area: the usual MaxRects order. */
+static int _compare_cells(const void *a, const void *b) {
+	const atlas_sprite *first = *(atlas_sprite * const *) a;
+	const atlas_sprite *second = *(atlas_sprite * const *) b;
+	unsigned int first_side = (first->cell.width > first->cell.height) ?
+			first->cell.width : first->cell.height;
+	unsigned int second_side = (second->cell.width > second->cell.height) ?
+			second->cell.width : second->cell.height;
+
+	if (first_side != second_side)
+		return (first_side < second_side) ? 1 : -1;
+	if (first->cell.width * first->cell.height
+			!= second->cell.width * second->cell.height)
+		return (first->cell.width * first->cell.height
+				< second->cell.width * second->cell.height) ? 1 : -1;
+	return strcmp(first->name, second->name);
+}
+
+/**
+ * @brief Packs the sprites of a category and writes its pages.
+ *
+ * @return The number of pages
+ */
+static unsigned int _write_pages(atlas_context *ctx, atlas_sprite **members,
+		unsigned int count, const char *category) {
+	unsigned int page_width = ctx->req.atlas.width / ATLAS_ALIGN * ATLAS_ALIGN;
+	unsigned int page_height = ctx->req.atlas.height / ATLAS_ALIGN
+			* ATLAS_ALIGN;
+	atlas_sprite **order = scratch_get(count * sizeof(atlas_sprite *));
+	atlas_page *pages = NULL;
+	unsigned int packed = 0, page_count = 0;
+	uint64_t used_pixels = 0, page_pixels = 0;
+
+	if (order == NULL) {
+		for (unsigned int i = 0; i < count; ++i)
+			if (members[i]->original < 0 && _is_ok(&members[i]->result))
+				_fail(members[i], IMAGE_UTIL_ERROR_OUT_OF_MEMORY);
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < count; ++i) {
+		atlas_sprite *sprite = members[i];
+		const image_buffer *image = &sprite->result.raw;
+
+		if (sprite->original >= 0 || !_is_ok(&sprite->result))
+			continue;
+		if (image->data == NULL || image->width <= 0 || image->height <= 0
+				|| image->colorspace != IMAGE_UTIL_COLORSPACE_RGB888
+				|| image->size < (size_t) image->width * image->height * 3) {
+			_fail(sprite, IMAGE_UTIL_ERROR_INVALID_OPERATION);
+			continue;
+		}
+		sprite->cell.width = _align(image->width);
+		sprite->cell.height = _align(image->height);
+		if (sprite->cell.width > page_width
+				|| sprite->cell.height > page_height) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "%s does not fit a %ux%u page",
+					sprite->job.input_path, page_width, page_height);
+			_fail(sprite, IMAGE_UTIL_ERROR_INVALID_PARAMETER);
+			continue;
+		}
+		order[packed++] = sprite;
+	}
+	qsort(order, packed, sizeof(atlas_sprite *), _compare_cells);
+
+	/* Each sprite goes on the first page it fits, or on a new one. */
+	for (unsigned int i = 0; i < packed; ++i) {
+		atlas_sprite *sprite = order[i];
+		unsigned int p;
+
+		for (p = 0; p < page_count; ++p)
+			if (_page_insert(&pages[p], sprite->cell.width, sprite->cell.height,
+					&sprite->cell))
+				break;
+
+		if (p == page_count) {
+			atlas_page *grown = realloc(pages,
+					(page_count + 1) * sizeof(atlas_page));
+
+			if (grown == NULL || !_page_init(&grown[page_count], page_width,
+					page_height)) {
+				if (grown != NULL)
+					pages = grown;
+				_fail(sprite, IMAGE_UTIL_ERROR_OUT_OF_MEMORY);
+				continue;
+			}
+			pages = grown;
+			page_count++;
+			_page_insert(&pages[p], sprite->cell.width, sprite->cell.height,
+					&sprite->cell);
+		}
+		sprite->page = p;
+		sprite->placed = true;
+		used_pixels += (uint64_t) sprite->result.raw.width
+				* sprite->result.raw.height;
+	}
+
+	for (unsigned int p = 0; p < page_count; ++p) {
+		const atlas_page *page = &pages[p];
+		char path[BUFLEN];
+		int error_code = IMAGE_UTIL_ERROR_NONE;
+
+		size_t canvas_size = (size_t) page->used_width * page->used_height * 3;
+		unsigned char *canvas = scratch_get(canvas_size);
+		if (canvas == NULL)
+			error_code = IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+		else if (!_page_path(ctx, category, p, page_count, path))
+			error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+		if (error_code == IMAGE_UTIL_ERROR_NONE) {
+			memset(canvas, 0, canvas_size);
+			for (unsigned int i = 0; i < packed; ++i)
+				if (order[i]->placed && order[i]->page == p)
+					_blit(canvas, page->used_width, order[i]);
+			error_code = image_util_encode_jpeg(canvas, page->used_width,
+					page->used_height, IMAGE_UTIL_COLORSPACE_RGB888,
+					ctx->req.quality, path);
+			if (error_code != IMAGE_UTIL_ERROR_NONE)
+				DLOG_PRINT_ERROR("image_util_encode_jpeg", error_code);
+		}
+		scratch_put(canvas);
+
+		for (unsigned int i = 0; i < packed; ++i) {
+			if (!order[i]->placed || order[i]->page != p)
+				continue;
+			if (error_code != IMAGE_UTIL_ERROR_NONE)
+				_fail(order[i], error_code);
+			else
+				snprintf(order[i]->job.output_path, BUFLEN, "%s", path);
+		}
+		page_pixels += (uint64_t) page->used_width * page->used_height;
+		free(page->free_rects);
+	}
+	free(pages);
+	scratch_put(order);
+
+	if (page_count > 0)
+		dlog_print(DLOG_INFO, LOG_TAG,
+				"Atlas %s: %u sprites on %u pages, %llu%% filled", category,
+				packed, page_count,
+				(unsigned long long) (used_pixels * 100 / page_pixels));
+	return page_count;
+}
+
+/**
+ * @brief Writes the index of a category, next to its pages.
+ * @details Sprites sharing a name, such as copies of one file in two
+ *          directories, are listed once; those of different images were
+ *          failed by _check_names().
+ */
+static int _write_index(const atlas_context *ctx, atlas_sprite **members,
+		unsigned int count, const char *category, unsigned int pages) {
+	char path[BUFLEN], partial[BUFLEN], page_path[BUFLEN];
+	const char *last_name = NULL;
+
+	if (snprintf(path, BUFLEN, "%s/%s" ATLAS_INDEX_EXTENSION,
+			ctx->req.output_dir, category) >= BUFLEN
+			|| snprintf(partial, BUFLEN, "%s.part", path) >= BUFLEN)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	FILE *file = fopen(partial, "w");
+	if (file == NULL)
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+
+	fprintf(file, "{\"pages\": [");
+	for (unsigned int p = 0; p < pages; ++p) {
+		_page_path(ctx, category, p, pages, page_path);
+		fprintf(file, "%s", p ? ", " : "");
+		report_write_string(file, strrchr(page_path, '/') + 1);
+	}
+
+	fprintf(file, "], \"sprites\": {");
+	for (unsigned int i = 0; i < count; ++i) {
+		const atlas_sprite *sprite = members[i];
+
+		if (!sprite->placed || !_is_ok(&sprite->result)
+				|| (last_name != NULL && strcmp(last_name, sprite->name) == 0))
+			continue;
+
+		fprintf(file, "%s\n  ", last_name ? "," : "");
+		report_write_string(file, sprite->name);
+		fprintf(file, ": [%u, %u, %u, %d, %d]", sprite->page, sprite->cell.x,
+				sprite->cell.y, sprite->result.raw.width,
+				sprite->result.raw.height);
+		last_name = sprite->name;
+	}
+	fprintf(file, "\n}}\n");
+
+	bool written = !ferror(file);
+	if (fclose(file) != 0 || !written || rename(partial, path) != 0) {
+		remove(partial);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Counts, reports and hands over the outcome of a sprite.
+ */
+static void _account(atlas_context *ctx, atlas_sprite *sprite) {
+	const pipeline_result *result = &sprite->result;
+
+	if (result->cancelled)
+		ctx->summary.cancelled++;
+	else if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+		ctx->summary.failed++;
+	else
+		ctx->summary.succeeded++;
+
+	if (ctx->report != NULL)
+		report_add_result(ctx->report, &sprite->job, result);
+	if (ctx->job_cb != NULL)
+		ctx->job_cb(&sprite->job, result, ctx->user_data);
+}
+
+/**
+ * @brief Gets the index of the first sprite holding the image of a sprite.
+ */
+static int _image_of(const atlas_context *ctx, const atlas_sprite *sprite) {
+	return (sprite->original >= 0) ?
+			sprite->original : (int) (sprite - ctx->sprites);
+}
+
+/**
+ * @brief Fails the sprites named like an earlier sprite of another image.
+ * @details The index lists each name once, so such a sprite, say hat01.jpg
+ *          of a second directory, could not be found on the pages.
+ *
+ * @param members The sprites of a category, sorted by name and then input
+ */
+static void _check_names(const atlas_context *ctx, atlas_sprite **members,
+		unsigned int count) {
+	for (unsigned int first = 0, i = 1; i < count; ++i) {
+		if (strcmp(members[i]->name, members[first]->name) != 0) {
+			first = i;
+			continue;
+		}
+		if (_image_of(ctx, members[i]) == _image_of(ctx, members[first]))
+			continue;
+
+		dlog_print(DLOG_ERROR, LOG_TAG, "%s and %s have the same sprite name %s",
+				members[first]->job.input_path, members[i]->job.input_path,
+				members[i]->name);
+		if (_is_ok(&members[i]->result))
+			_fail(members[i], IMAGE_UTIL_ERROR_INVALID_PARAMETER);
+	}
+}
+
+/**
+ * @brief Builds the atlas of one category.
+ */
+static void _build_category(atlas_context *ctx, atlas_sprite **members,
+		unsigned int count) {
+	const char *category = members[0]->category;
+
+	_check_names(ctx, members, count);
+	unsigned int pages = _write_pages(ctx, members, count, category);
+
+	/* Duplicates share the cell of their original. */
+	for (unsigned int i = 0; i < count; ++i) {
+		atlas_sprite *sprite = members[i];
+
+		/* A failed duplicate clashed with the name of another image. */
+		if (sprite->original < 0 || !_is_ok(&sprite->result))
+			continue;
+
+		const atlas_sprite *original = &ctx->sprites[sprite->original];
+		sprite->result = original->result;
+		sprite->result.raw.data = NULL;
+		sprite->result.raw.pooled = false;
+		sprite->placed = original->placed;
+		sprite->page = original->page;
+		sprite->cell = original->cell;
+		snprintf(sprite->job.output_path, BUFLEN, "%s",
+				original->job.output_path);
+		if (_is_ok(&sprite->result)) {
+			sprite->result.backend = BATCH_COPY_BACKEND;
+			sprite->result.queued_us = sprite->result.run_us = 0;
+		}
+		ctx->summary.deduplicated++;
+	}
+
+	int error_code = _write_index(ctx, members, count, category, pages);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		DLOG_PRINT_ERROR("_write_index", error_code);
+		for (unsigned int i = 0; i < count; ++i)
+			if (_is_ok(&members[i]->result))
+				_fail(members[i], error_code);
+	}
+
+	for (unsigned int i = 0; i < count; ++i)
+		_account(ctx, members[i]);
+}
+
+static int _compare_members(const void *a, const void *b) {
+	const atlas_sprite *first = *(atlas_sprite * const *) a;
+	const atlas_sprite *second = *(atlas_sprite * const *) b;
+	int order = strcmp(first->category, second->category);
+
+	if (order == 0)
+		order = strcmp(first->name, second->name);
+	return order ? order : (first < second ? -1 : first > second);
+}
+
+/**
+ * @brief Builds every atlas once the last sprite is transformed.
+ * @details Duplicates must come after their original, so that its cell is
+ *          known: categories are built in turn, originals before copies.
+ */
+static void _build(atlas_context *ctx) {
+	atlas_sprite **members = malloc(ctx->count * sizeof(atlas_sprite *));
+
+	if (members == NULL) {
+		for (unsigned int i = 0; i < ctx->count; ++i) {
+			if (_is_ok(&ctx->sprites[i].result))
+				_fail(&ctx->sprites[i], IMAGE_UTIL_ERROR_OUT_OF_MEMORY);
+			_account(ctx, &ctx->sprites[i]);
+		}
+		return;
+	}
+
+	for (unsigned int i = 0; i < ctx->count; ++i)
+		members[i] = &ctx->sprites[i];
+	qsort(members, ctx->count, sizeof(atlas_sprite *), _compare_members);
+
+	for (unsigned int start = 0, end; start < ctx->count; start = end) {
+		for (end = start + 1; end < ctx->count
+				&& strcmp(members[end]->category, members[start]->category)
+						== 0; ++end)
+			;
+		_build_category(ctx, members + start, end - start);
+	}
+	free(members);
+}
+
+/**
+ * @brief Counts one job as over; the last one builds the atlases.
+ */
+static void _finish_one(atlas_context *ctx) {
+	pthread_mutex_lock(&ctx->lock);
+	bool last = (--ctx->remaining == 0);
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (!last)
+		return;
+
+	_build(ctx);
+
+	if (ctx->report != NULL) {
+		int error_code = report_write_json(ctx->report, &ctx->summary,
+				ctx->report_path);
+		if (error_code != IMAGE_UTIL_ERROR_NONE)
+			DLOG_PRINT_ERROR("report_write_json", error_code);
+		report_destroy(ctx->report);
+	}
+
+	if (ctx->done_cb != NULL)
+		ctx->done_cb(&ctx->summary, ctx->user_data);
+
+	for (unsigned int i = 0; i < ctx->count; ++i)
+		pipeline_result_clear(&ctx->sprites[i].result);
+	free(ctx->sprites);
+	cancel_token_unref(ctx->cancel);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+/**
+ * @brief Keeps the pixels of a transformed sprite, or runs it again.
+ * @remarks This function matches the scheduler_done_cb() type signature;
+ *          it is called on a worker thread.
+ */
+static void _sprite_done_cb(transform_job *job, pipeline_result *result,
+		void *user_data) {
+	atlas_sprite *sprite = user_data;
+	atlas_context *ctx = sprite->ctx;
+	bool failed = !result->cancelled
+			&& result->error_code != IMAGE_UTIL_ERROR_NONE;
+
+	if (failed && report_is_transient(result->error_code)
+			&& job->attempt < ctx->req.retries
+			&& !cancel_token_is_cancelled(ctx->cancel)) {
+		transform_job retry = *job;
+
+		retry.attempt++;
+		if (scheduler_submit(&retry, _sprite_done_cb, sprite)
+				== IMAGE_UTIL_ERROR_NONE) {
+			pthread_mutex_lock(&ctx->lock);
+			ctx->summary.retried++;
+			pthread_mutex_unlock(&ctx->lock);
+			return;
+		}
+	}
+
+	sprite->job = *job;
+	sprite->result = *result;
+	memset(&result->raw, 0, sizeof(image_buffer));
+	memset(&result->encoded, 0, sizeof(image_buffer));
+
+	if (failed && ctx->req.stop_on_error)
+		cancel_token_cancel(ctx->cancel);
+	_finish_one(ctx);
+}
+
+/**
+ * @brief Transforms the inputs of a batch and packs them into atlases.
+ * @details Every input is transformed in memory to the size of the batch,
+ *          then the inputs of each category are packed on as few pages as
+ *          possible, see atlas.h. Inputs holding the same image share one
+ *          cell. Once the pages and indexes are written, job_cb is called
+ *          for every input, with the page as its output, then done_cb,
+ *          both on a worker thread, or on the calling thread if there is
+ *          nothing to do. Neither happens if this function fails.
+ *
+ * @param req The batch, with req->atlas set
+ * @param cancel Cancels the whole batch; may be NULL
+ * @param job_cb The function called for every input, may be NULL
+ * @param done_cb The function called when the batch is over, may be NULL
+ * @param user_data The user data passed to job_cb and done_cb
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int atlas_submit(const batch_request *req, cancel_token *cancel,
+		batch_job_cb job_cb, batch_done_cb done_cb, void *user_data) {
+	if (req->atlas.width < ATLAS_ALIGN || req->atlas.height < ATLAS_ALIGN)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	scan_list files;
+	int error_code = scan_inputs((const char (*)[BUFLEN]) req->inputs,
+			req->input_count, &files);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+	scan_find_duplicates(&files, req->dedupe);
+
+	error_code = batch_make_output_dir(req);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		scan_list_clear(&files);
+		return error_code;
+	}
+
+	atlas_context *ctx = calloc(1, sizeof(atlas_context));
+	atlas_sprite *sprites = calloc(files.count ? files.count : 1,
+			sizeof(atlas_sprite));
+	if (ctx == NULL || sprites == NULL) {
+		free(ctx);
+		free(sprites);
+		scan_list_clear(&files);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+	pthread_mutex_init(&ctx->lock, NULL);
+	ctx->remaining = 1;
+	ctx->sprites = sprites;
+	ctx->count = files.count;
+	ctx->req = *req;
+	ctx->cancel = cancel_token_create(cancel);
+	if (batch_report_path(req, ctx->report_path))
+		ctx->report = report_create();
+	ctx->job_cb = job_cb;
+	ctx->done_cb = done_cb;
+	ctx->user_data = user_data;
+	ctx->summary.submitted = files.count;
+
+	for (unsigned int i = 0; i < files.count; ++i) {
+		atlas_sprite *sprite = &sprites[i];
+
+		sprite->ctx = ctx;
+		sprite->original = files.entries[i].original;
+		_categorize(files.entries[i].path, sprite->name, sprite->category);
+		/* A cell is only shared within a category. */
+		if (sprite->original >= 0 && strcmp(sprite->category,
+				sprites[sprite->original].category) != 0)
+			sprite->original = -1;
+
+		batch_job_init(req, &sprite->job);
+		snprintf(sprite->job.input_path, BUFLEN, "%s", files.entries[i].path);
+		if (req->size_count > 0) {
+			sprite->job.width = req->sizes[0].width;
+			sprite->job.height = req->sizes[0].height;
+		}
+		sprite->job.colorspace = IMAGE_UTIL_COLORSPACE_RGB888;
+		sprite->job.output = JOB_OUTPUT_MEMORY;
+		sprite->job.cancel = ctx->cancel;
+		sprite->result.stage = PIPELINE_STAGE_QUEUE;
+		if (sprite->original >= 0)
+			continue;
+
+		error_code = probe_job(&sprite->job);
+		if (error_code == IMAGE_UTIL_ERROR_NONE) {
+			pthread_mutex_lock(&ctx->lock);
+			ctx->remaining++;
+			pthread_mutex_unlock(&ctx->lock);
+
+			error_code = scheduler_submit(&sprite->job, _sprite_done_cb,
+					sprite);
+			if (error_code != IMAGE_UTIL_ERROR_NONE) {
+				DLOG_PRINT_ERROR("scheduler_submit", error_code);
+				pthread_mutex_lock(&ctx->lock);
+				ctx->remaining--;
+				pthread_mutex_unlock(&ctx->lock);
+			}
+		}
+		if (error_code != IMAGE_UTIL_ERROR_NONE)
+			sprite->result.error_code = error_code;
+	}
+
+	dlog_print(DLOG_INFO, LOG_TAG, "Atlas: %u files, pages up to %ux%u",
+			files.count, req->atlas.width, req->atlas.height);
+	scan_list_clear(&files);
+
+	/* Drop the submission guard; this may build the atlases right away. */
+	_finish_one(ctx);
+	return IMAGE_UTIL_ERROR_NONE;
+}
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "backend.h"
+#include <tizen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Consecutive failures after which a backend is taken out of rotation. */
+#define BACKEND_MAX_FAILURES 3
+/* How long a failing backend stays out of rotation. */
+#define BACKEND_COOLDOWN_US (5 * 1000000)
+/* Weight of a new sample in the per-pixel cost average. */
+#define BACKEND_EWMA_WEIGHT 0.2
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+	int error_code;
+	media_packet_h dst;
+} transform_wait;
+
+typedef struct {
+	unsigned int setup_us;
+	unsigned int ns_per_pixel;
+	unsigned int capacity;
+	unsigned int fail_every;
+	unsigned int runs;
+} mock_config;
+
+static transform_backend backends[BACKEND_COUNT];
+static pthread_mutex_t backend_lock = PTHREAD_MUTEX_INITIALIZER;
+static mock_config mock;
+static bool initialized = false;
+
+/**
+ * @brief Wakes up the thread waiting in _image_util_run().
+ * @remarks This function matches the image_util_transform_completed_cb()
+ *          type signature defined in the Image Util API.
+ *
+ * @param dst The result buffer of image util transform
+ * @param error_code The error code of image util transform
+ * @param user_data The transform_wait structure of the waiting thread
+ */
+static void _transform_completed_cb(media_packet_h *dst, int error_code,
+		void *user_data) {
+	transform_wait *wait = user_data;
+
+	pthread_mutex_lock(&wait->lock);
+	wait->error_code = error_code;
+	wait->dst = (dst != NULL) ? *dst : NULL;
+	wait->done = true;
+	pthread_cond_signal(&wait->cond);
+	pthread_mutex_unlock(&wait->lock);
+}
+
+/**
+ * @brief Runs the job through Image Util and waits for the result.
+ *
+ * @param hardware Whether to request hardware acceleration
+ * @param src The source media packet
+ * @param job The job describing the requested output
+ * @param dst The resulting media packet, owned by the caller on success
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+static int _image_util_run(bool hardware, media_packet_h src,
+		const transform_job *job, media_packet_h *dst) {
+	transformation_h handle = NULL;
+	transform_wait wait = { .done = false, .error_code =
+			IMAGE_UTIL_ERROR_NONE, .dst = NULL };
+
+	int error_code = image_util_transform_create(&handle);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		DLOG_PRINT_ERROR("image_util_transform_create", error_code);
+		return error_code;
+	}
+
+	error_code = image_util_transform_set_hardware_acceleration(handle,
+			hardware);
+	if (error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = image_util_transform_set_colorspace(handle,
+				job->colorspace);
+	if (error_code == IMAGE_UTIL_ERROR_NONE && job->width > 0
+			&& job->height > 0)
+		error_code = image_util_transform_set_resolution(handle, job->width,
+				job->height);
+
+	if (error_code == IMAGE_UTIL_ERROR_NONE) {
+		pthread_mutex_init(&wait.lock, NULL);
+		pthread_cond_init(&wait.cond, NULL);
+
+		error_code = image_util_transform_run(handle, src,
+				_transform_completed_cb, &wait);
+		if (error_code == IMAGE_UTIL_ERROR_NONE) {
+			pthread_mutex_lock(&wait.lock);
+			while (!wait.done)
+				pthread_cond_wait(&wait.cond, &wait.lock);
+			pthread_mutex_unlock(&wait.lock);
+
+			error_code = wait.error_code;
+			if (error_code == IMAGE_UTIL_ERROR_NONE && wait.dst == NULL)
+				error_code = IMAGE_UTIL_ERROR_INVALID_OPERATION;
+		}
+
+		pthread_cond_destroy(&wait.cond);
+		pthread_mutex_destroy(&wait.lock);
+	}
+
+	image_util_transform_destroy(handle);
+
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		if (wait.dst != NULL)
+			media_packet_destroy(wait.dst);
+		return error_code;
+	}
+
+	*dst = wait.dst;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Returns the number of pixels the job reads and writes.
+ *
+ * @param job The job
+ * @return The pixel count used by the cost model
+ */
+static double _job_pixels(const transform_job *job) {
+	double src = (double) job->src_width * job->src_height;
+	double dst = (job->width > 0 && job->height > 0) ?
+			(double) job->width * job->height : src;
+
+	return src + dst;
+}
+
+/**
+ * @brief Estimates how long the backend would take for the job.
+ *
+ * @param backend The backend
+ * @param job The job
+ * @return The estimated cost in microseconds
+ */
+static double _estimate_us(const transform_backend *backend,
+		const transform_job *job) {
+	return backend->setup_us + _job_pixels(job) * backend->ns_per_pixel / 1000.0;
+}
+
+static int _cpu_probe(transform_backend *self) {
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+static bool _cpu_supports(const transform_backend *self,
+		const transform_job *job) {
+	return true;
+}
+
+static int _cpu_run(transform_backend *self, media_packet_h src,
+		const transform_job *job, media_packet_h *dst, uint64_t *device_us) {
+	return _image_util_run(false, src, job, dst);
+}
+
+/**
+ * @brief Checks whether Image Util accepts hardware acceleration on this device.
+ */
+static int _hw_probe(transform_backend *self) {
+	transformation_h handle = NULL;
+
+	int error_code = image_util_transform_create(&handle);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+
+	error_code = image_util_transform_set_hardware_acceleration(handle, true);
+	image_util_transform_destroy(handle);
+
+	return error_code;
+}
+
+static bool _hw_supports(const transform_backend *self,
+		const transform_job *job) {
+	/* Accelerators handle the common YUV and 24/32-bit RGB layouts only. */
+	switch (job->colorspace) {
+	case IMAGE_UTIL_COLORSPACE_NV12:
+	case IMAGE_UTIL_COLORSPACE_NV21:
+	case IMAGE_UTIL_COLORSPACE_I420:
+	case IMAGE_UTIL_COLORSPACE_YV12:
+	case IMAGE_UTIL_COLORSPACE_RGB888:
+	case IMAGE_UTIL_COLORSPACE_RGBA8888:
+	case IMAGE_UTIL_COLORSPACE_BGRA8888:
+	case IMAGE_UTIL_COLORSPACE_ARGB8888:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int _hw_run(transform_backend *self, media_packet_h src,
+		const transform_job *job, media_packet_h *dst, uint64_t *device_us) {
+	return _image_util_run(true, src, job, dst);
+}
+
+/**
+ * @brief Enables the mock accelerator if BACKEND_MOCK_ENV is set.
+ */
+static int _mock_probe(transform_backend *self) {
+	const char *config = getenv(BACKEND_MOCK_ENV);
+
+	if (config == NULL)
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED;
+
+	if (sscanf(config, "%u:%u:%u:%u", &mock.setup_us, &mock.ns_per_pixel,
+			&mock.capacity, &mock.fail_every) < 3) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Malformed %s: %s", BACKEND_MOCK_ENV,
+				config);
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	}
+
+	self->setup_us = mock.setup_us;
+	self->ns_per_pixel = mock.ns_per_pixel;
+	self->capacity = mock.capacity;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+static bool _mock_supports(const transform_backend *self,
+		const transform_job *job) {
+	return _hw_supports(self, job);
+}
+
+/**
+ * @brief Emulates an accelerator on top of the software path.
+ * @details The pixels are produced by the CPU, but the job occupies its
+ *          slot for the modelled device time and reports that time to the
+ *          router, so that routing, saturation and fallback behave as they
+ *          would with a real device. Every fail_every-th run fails.
+ */
+static int _mock_run(transform_backend *self, media_packet_h src,
+		const transform_job *job, media_packet_h *dst, uint64_t *device_us) {
+	unsigned int run = __atomic_add_fetch(&mock.runs, 1, __ATOMIC_RELAXED);
+
+	if (mock.fail_every > 0 && run % mock.fail_every == 0)
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+
+	uint64_t start = monotonic_us();
+	uint64_t modelled = mock.setup_us
+			+ (uint64_t) (_job_pixels(job) * mock.ns_per_pixel / 1000.0);
+
+	int error_code = _image_util_run(false, src, job, dst);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+
+	uint64_t elapsed = monotonic_us() - start;
+	if (elapsed < modelled)
+		usleep(modelled - elapsed);
+
+	*device_us = modelled;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Probes all backends. Safe to call more than once.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE; the CPU backend is always available
+ */
+int backend_init(void) {
+	pthread_mutex_lock(&backend_lock);
+	if (initialized) {
+		pthread_mutex_unlock(&backend_lock);
+		return IMAGE_UTIL_ERROR_NONE;
+	}
+
+	/* Priors; refined from measured run times. */
+	backends[BACKEND_HW] = (transform_backend) { .id = BACKEND_HW, .name =
+			"hw", .capacity = 2, .setup_us = 3000, .ns_per_pixel = 2,
+			.probe = _hw_probe, .supports = _hw_supports, .run = _hw_run };
+	backends[BACKEND_MOCK] = (transform_backend) { .id = BACKEND_MOCK,
+			.name = "mock", .probe = _mock_probe, .supports = _mock_supports,
+			.run = _mock_run };
+	backends[BACKEND_CPU] = (transform_backend) { .id = BACKEND_CPU, .name =
+			"cpu", .capacity = 0, .setup_us = 200, .ns_per_pixel = 8,
+			.probe = _cpu_probe, .supports = _cpu_supports, .run = _cpu_run };
+
+	for (backend_id i = 0; i < BACKEND_COUNT; ++i) {
+		int error_code = backends[i].probe(&backends[i]);
+		backends[i].available = (error_code == IMAGE_UTIL_ERROR_NONE);
+		dlog_print(DLOG_INFO, LOG_TAG, "Backend %s: %s", backends[i].name,
+				backends[i].available ? "available" : "not available");
+	}
+
+	initialized = true;
+	pthread_mutex_unlock(&backend_lock);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Orders the usable backends by estimated cost for the job.
+ * @remarks Must be called with backend_lock held.
+ *
+ * @param job The job
+ * @param order The array receiving the backends, cheapest first
+ * @return The number of backends stored in order
+ */
+static int _rank_backends(const transform_job *job,
+		transform_backend *order[BACKEND_COUNT]) {
+	uint64_t now = monotonic_us();
+	int count = 0;
+
+	for (backend_id i = 0; i < BACKEND_COUNT; ++i) {
+		transform_backend *backend = &backends[i];
+
+		if (!backend->available || !backend->supports(backend, job))
+			continue;
+		if (backend->id != BACKEND_CPU && backend->disabled_until_us > now)
+			continue;
+
+		/* Insertion sort; there are only a handful of backends. */
+		double cost = _estimate_us(backend, job);
+		int pos = count++;
+		while (pos > 0 && _estimate_us(order[pos - 1], job) > cost) {
+			order[pos] = order[pos - 1];
+			--pos;
+		}
+		order[pos] = backend;
+	}
+
+	return count;
+}
+
+/**
+ * @brief Records the outcome of a run in the backend's routing state.
+ * @remarks Must be called with backend_lock held.
+ */
+static void _record_run(transform_backend *backend, const transform_job *job,
+		int error_code, uint64_t elapsed_us) {
+	backend->inflight--;
+	backend->jobs++;
+
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		backend->failures++;
+		if (++backend->consecutive_failures >= BACKEND_MAX_FAILURES) {
+			backend->disabled_until_us = monotonic_us() + BACKEND_COOLDOWN_US;
+			backend->consecutive_failures = 0;
+			dlog_print(DLOG_WARN, LOG_TAG,
+					"Backend %s disabled after repeated failures",
+					backend->name);
+		}
+		return;
+	}
+
+	backend->consecutive_failures = 0;
+
+	double pixels = _job_pixels(job);
+	if (pixels <= 0)
+		return;
+
+	double sample = ((double) elapsed_us - backend->setup_us) * 1000.0 / pixels;
+	if (sample < 0.1)
+		sample = 0.1;
+	backend->ns_per_pixel = (1.0 - BACKEND_EWMA_WEIGHT) * backend->ns_per_pixel
+			+ BACKEND_EWMA_WEIGHT * sample;
+}
+
+/**
+ * @brief Transforms the source packet on the fastest usable backend.
+ * @details Backends are tried cheapest first. A backend whose queue is full
+ *          is skipped, and a failing backend falls through to the next one,
+ *          so the job ends up on the CPU path if nothing else can take it.
+ *          Blocks until the result is ready.
+ *
+ * @param src The source media packet in job->src_colorspace
+ * @param job The job describing the requested output
+ * @param dst The resulting media packet, owned by the caller on success
+ * @param backend_name If not NULL, receives the name of the backend used
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise the last error code
+ */
+int backend_transform(media_packet_h src, const transform_job *job,
+		media_packet_h *dst, const char **backend_name) {
+	transform_backend *order[BACKEND_COUNT];
+	int error_code = IMAGE_UTIL_ERROR_NOT_SUPPORTED;
+
+	backend_init();
+
+	pthread_mutex_lock(&backend_lock);
+	int count = _rank_backends(job, order);
+	pthread_mutex_unlock(&backend_lock);
+
+	for (int i = 0; i < count; ++i) {
+		transform_backend *backend = order[i];
+
+		pthread_mutex_lock(&backend_lock);
+		if (backend->capacity > 0 && backend->inflight >= backend->capacity) {
+			backend->skipped_saturated++;
+			pthread_mutex_unlock(&backend_lock);
+			continue;
+		}
+		backend->inflight++;
+		pthread_mutex_unlock(&backend_lock);
+
+		uint64_t device_us = 0;
+		uint64_t start = monotonic_us();
+
+		error_code = backend->run(backend, src, job, dst, &device_us);
+
+		uint64_t elapsed = (device_us > 0) ? device_us : monotonic_us() - start;
+
+		pthread_mutex_lock(&backend_lock);
+		_record_run(backend, job, error_code, elapsed);
+		pthread_mutex_unlock(&backend_lock);
+
+		if (error_code == IMAGE_UTIL_ERROR_NONE) {
+			if (backend_name != NULL)
+				*backend_name = backend->name;
+			return IMAGE_UTIL_ERROR_NONE;
+		}
+
+		dlog_print(DLOG_WARN, LOG_TAG, "Backend %s failed (%d), falling back",
+				backend->name, error_code);
+	}
+
+	return error_code;
+}
+
+/**
+ * @brief Prints the per-backend routing statistics to the log.
+ */
+void backend_log_stats(void) {
+	pthread_mutex_lock(&backend_lock);
+	for (backend_id i = 0; i < BACKEND_COUNT; ++i) {
+		const transform_backend *backend = &backends[i];
+
+		if (!backend->available)
+			continue;
+
+		dlog_print(DLOG_INFO, LOG_TAG,
+				"Backend %s: jobs %u failures %u saturated %u cost %.2f ns/px",
+				backend->name, backend->jobs, backend->failures,
+				backend->skipped_saturated, backend->ns_per_pixel);
+	}
+	pthread_mutex_unlock(&backend_lock);
+}
@@ -0,0 +1,1358 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "batch.h"
+#include "backend.h"
+#include "scheduler.h"
+#include "concurrency.h"
+#include "memgov.h"
+#include "frame_cache.h"
+#include "arena.h"
+#include "scan.h"
+#include "supervisor.h"
+#include "report.h"
+#include "probe.h"
+#include "atlas.h"
+#include "asset_pack.h"
+#include "archive.h"
+#include "trace.h"
+#include <tizen.h>
+#include <app_common.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#define COLORSPACE_PREFIX "IMAGE_UTIL_COLORSPACE_"
+
+/* The state of a submitted batch, shared by all its jobs. */
+typedef struct {
+	pthread_mutex_t lock;
+	/* Jobs not over yet, plus one while jobs are still being submitted. */
+	unsigned int remaining;
+	batch_summary summary;
+	/* Child of the token of the caller, cancelled on stop_on_error. */
+	cancel_token *cancel;
+	unsigned int retries;
+	bool stop_on_error;
+	batch_report *report;
+	char report_path[BUFLEN];
+	/* The inputs, to find the duplicates of a finished job. */
+	scan_list files;
+	batch_request req;
+	/* Receives the results instead of the output directory, if set. */
+	asset_pack_writer *pack;
+	char pack_path[BUFLEN];
+	archive_writer *archive;
+	char archive_path[BUFLEN];
+	/* With req.trace_path, the events of the batch start here. */
+	uint64_t trace_since;
+	batch_job_cb job_cb;
+	batch_done_cb done_cb;
+	void *user_data;
+} batch_context;
+
+/* Lets batch_run() wait for a batch. */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+	batch_summary summary;
+	batch_job_cb job_cb;
+	void *user_data;
+} batch_waiter;
+
+static const struct {
+	const char *name;
+	image_util_colorspace_e colorspace;
+} colorspaces[] = {
+	{ "YV12", IMAGE_UTIL_COLORSPACE_YV12 },
+	{ "YUV422", IMAGE_UTIL_COLORSPACE_YUV422 },
+	{ "I420", IMAGE_UTIL_COLORSPACE_I420 },
+	{ "NV12", IMAGE_UTIL_COLORSPACE_NV12 },
+	{ "UYVY", IMAGE_UTIL_COLORSPACE_UYVY },
+	{ "YUYV", IMAGE_UTIL_COLORSPACE_YUYV },
+	{ "RGB565", IMAGE_UTIL_COLORSPACE_RGB565 },
+	{ "RGB888", IMAGE_UTIL_COLORSPACE_RGB888 },
+	{ "ARGB8888", IMAGE_UTIL_COLORSPACE_ARGB8888 },
+	{ "BGRA8888", IMAGE_UTIL_COLORSPACE_BGRA8888 },
+	{ "RGBA8888", IMAGE_UTIL_COLORSPACE_RGBA8888 },
+	{ "BGRX8888", IMAGE_UTIL_COLORSPACE_BGRX8888 },
+	{ "NV21", IMAGE_UTIL_COLORSPACE_NV21 },
+	{ "NV16", IMAGE_UTIL_COLORSPACE_NV16 },
+	{ "NV61", IMAGE_UTIL_COLORSPACE_NV61 }
+};
+
+/**
+ * @brief Fills in a request with the defaults: source size, RGB888,
+ *        quality 90, no geometry, batch priority, exact duplicates
+ *        transformed once.
+ */
+void batch_request_init(batch_request *req) {
+	memset(req, 0, sizeof(batch_request));
+	req->colorspace = IMAGE_UTIL_COLORSPACE_RGB888;
+	req->quality = 90;
+	req->flip = JOB_FLIP_NONE;
+	req->priority = JOB_PRIORITY_BATCH;
+	req->dedupe = SCAN_DEDUPE_EXACT;
+}
+
+static bool _parse_uint(const char *value, unsigned int *number) {
+	char *end;
+
+	errno = 0;
+	unsigned long parsed = strtoul(value, &end, 10);
+	if (errno != 0 || end == value || *end != '\0' || parsed > 65535)
+		return false;
+
+	*number = parsed;
+	return true;
+}
+
+static bool _parse_size(const char *value, batch_size *size) {
+	char width[16];
+	const char *x = strpbrk(value, "xX");
+
+	if (x == NULL || x == value || x - value >= (ptrdiff_t) sizeof(width))
+		return false;
+
+	memcpy(width, value, x - value);
+	width[x - value] = '\0';
+	return _parse_uint(width, &size->width)
+			&& _parse_uint(x + 1, &size->height);
+}
+
+static bool _parse_colorspace(const char *value,
+		image_util_colorspace_e *colorspace) {
+	if (strncasecmp(value, COLORSPACE_PREFIX, strlen(COLORSPACE_PREFIX)) == 0)
+		value += strlen(COLORSPACE_PREFIX);
+
+	for (size_t i = 0; i < sizeof(colorspaces) / sizeof(colorspaces[0]); ++i) {
+		if (strcasecmp(value, colorspaces[i].name) == 0) {
+			*colorspace = colorspaces[i].colorspace;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Sets one field of a request.
+ *
+ * @param req The request, initialized with batch_request_init()
+ * @param key The key, see batch_request
+ * @param value The value
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT for an output format other
+ *         than JPEG, otherwise IMAGE_UTIL_ERROR_INVALID_PARAMETER
+ */
+int batch_request_set(batch_request *req, const char *key, const char *value) {
+	unsigned int number;
+
+	if (key == NULL || value == NULL)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	if (strcmp(key, "input") == 0) {
+		if (req->input_count == BATCH_MAX_INPUTS || strlen(value) >= BUFLEN)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		snprintf(req->inputs[req->input_count++], BUFLEN, "%s", value);
+
+	} else if (strcmp(key, "output_dir") == 0) {
+		if (*value == '\0' || strlen(value) >= BUFLEN)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		snprintf(req->output_dir, BUFLEN, "%s", value);
+
+	} else if (strcmp(key, "size") == 0) {
+		if (req->size_count == BATCH_MAX_SIZES
+				|| !_parse_size(value, &req->sizes[req->size_count]))
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		req->size_count++;
+
+	} else if (strcmp(key, "colorspace") == 0) {
+		if (!_parse_colorspace(value, &req->colorspace))
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	} else if (strcmp(key, "format") == 0) {
+		if (strcasecmp(value, "jpeg") != 0 && strcasecmp(value, "jpg") != 0)
+			return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+
+	} else if (strcmp(key, "quality") == 0) {
+		if (!_parse_uint(value, &number) || number < 1 || number > 100)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		req->quality = number;
+
+	} else if (strcmp(key, "rotation") == 0) {
+		if (!_parse_uint(value, &number) || number % 90 != 0 || number >= 360)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		req->rotation = number;
+
+	} else if (strcmp(key, "flip") == 0) {
+		if (strcmp(value, "none") == 0)
+			req->flip = JOB_FLIP_NONE;
+		else if (strcmp(value, "horizontal") == 0)
+			req->flip = JOB_FLIP_HORIZONTAL;
+		else if (strcmp(value, "vertical") == 0)
+			req->flip = JOB_FLIP_VERTICAL;
+		else
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	} else if (strcmp(key, "retries") == 0) {
+		if (!_parse_uint(value, &number) || number > BATCH_MAX_RETRIES)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		req->retries = number;
+
+	} else if (strcmp(key, "stop_on_error") == 0) {
+		if (!_parse_uint(value, &number) || number > 1)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		req->stop_on_error = number;
+
+	} else if (strcmp(key, "report") == 0) {
+		if (*value == '\0' || strlen(value) >= BUFLEN)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		snprintf(req->report_path, BUFLEN, "%s", value);
+
+	} else if (strcmp(key, "dedupe") == 0) {
+		if (strcmp(value, "none") == 0)
+			req->dedupe = SCAN_DEDUPE_NONE;
+		else if (strcmp(value, "exact") == 0)
+			req->dedupe = SCAN_DEDUPE_EXACT;
+		else if (strcmp(value, "similar") == 0)
+			req->dedupe = SCAN_DEDUPE_SIMILAR;
+		else
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	} else if (strcmp(key, "atlas") == 0) {
+		batch_size atlas;
+
+		if (!_parse_size(value, &atlas)
+				|| (atlas.width != 0 && (atlas.width < ATLAS_ALIGN
+						|| atlas.width > ATLAS_MAX_PAGE
+						|| atlas.height < ATLAS_ALIGN
+						|| atlas.height > ATLAS_MAX_PAGE)))
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		req->atlas = atlas;
+
+	} else if (strcmp(key, "pack") == 0) {
+		if (*value == '\0' || strlen(value) >= BUFLEN)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		snprintf(req->pack_path, BUFLEN, "%s", value);
+
+	} else if (strcmp(key, "archive") == 0) {
+		if (*value == '\0' || strlen(value) >= BUFLEN)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		snprintf(req->archive_path, BUFLEN, "%s", value);
+
+	} else if (strcmp(key, "trace") == 0) {
+		if (*value == '\0' || strlen(value) >= BUFLEN)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		snprintf(req->trace_path, BUFLEN, "%s", value);
+
+	} else if (strcmp(key, "overlay") == 0) {
+		if (req->overlays.count == COMPOSITE_MAX_LAYERS
+				|| composite_parse_layer(value,
+						&req->overlays.layers[req->overlays.count])
+						!= IMAGE_UTIL_ERROR_NONE)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		req->overlays.count++;
+
+	} else if (strcmp(key, "processes") == 0) {
+		if (!_parse_uint(value, &number) || number > SUPERVISOR_MAX_PROCESSES)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		req->processes = number;
+
+	} else {
+		dlog_print(DLOG_WARN, LOG_TAG, "Unknown batch key %s", key);
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Sets a field from an app_control extra, which may be an array.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE if the extra is missing or valid
+ */
+static int _set_from_extra(app_control_h app_control, batch_request *req,
+		const char *key) {
+	bool is_array = false;
+	int error_code = app_control_is_extra_data_array(app_control, key,
+			&is_array);
+
+	if (error_code == APP_CONTROL_ERROR_KEY_NOT_FOUND)
+		return IMAGE_UTIL_ERROR_NONE;
+	if (error_code != APP_CONTROL_ERROR_NONE)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	if (!is_array) {
+		char *value = NULL;
+
+		if (app_control_get_extra_data(app_control, key, &value)
+				!= APP_CONTROL_ERROR_NONE)
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		error_code = batch_request_set(req, key, value);
+		free(value);
+		return error_code;
+	}
+
+	char **values = NULL;
+	int length = 0;
+
+	if (app_control_get_extra_data_array(app_control, key, &values, &length)
+			!= APP_CONTROL_ERROR_NONE)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	error_code = IMAGE_UTIL_ERROR_NONE;
+	for (int i = 0; i < length; ++i) {
+		if (error_code == IMAGE_UTIL_ERROR_NONE)
+			error_code = batch_request_set(req, key, values[i]);
+		free(values[i]);
+	}
+	free(values);
+	return error_code;
+}
+
+/**
+ * @brief Checks that a path has no "." or ".." component.
+ */
+static bool _plain_path(const char *path) {
+	for (const char *part = path; part != NULL;) {
+		const char *slash = strchr(part, '/');
+		size_t length = (slash != NULL) ? (size_t) (slash - part) : strlen(part);
+
+		if ((length == 1 && part[0] == '.')
+				|| (length == 2 && part[0] == '.' && part[1] == '.'))
+			return false;
+		part = (slash != NULL) ? slash + 1 : NULL;
+	}
+	return true;
+}
+
+/**
+ * @brief Checks that a path is inside a directory.
+ *
+ * @param root The directory, may be NULL
+ */
+static bool _below(const char *path, const char *root) {
+	size_t length = (root != NULL) ? strlen(root) : 0;
+
+	while (length > 1 && root[length - 1] == '/')
+		length--;
+	return length > 0 && strncmp(path, root, length) == 0
+			&& path[length] == '/';
+}
+
+/**
+ * @brief Checks that a path is inside a directory of the application.
+ *
+ * @param root The directory, from app_get_data_path() and the like; freed
+ */
+static bool _below_app(const char *path, char *root) {
+	bool below = _below(path, root);
+
+	free(root);
+	return below;
+}
+
+/**
+ * @brief Checks a path sent by another application or client.
+ * @details The path must be absolute, without "." or ".." components, and
+ *          inside root or, without one, in the data or shared directories
+ *          of this application; inputs may also be its resources.
+ *
+ * @param path The path or glob pattern
+ * @param root The directory the path must be in, or NULL
+ * @param read @c true for an input, @c false for an output
+ * @return @c true if the path may be used
+ */
+bool batch_path_confined(const char *path, const char *root, bool read) {
+	if (path[0] != '/' || !_plain_path(path))
+		return false;
+	if (root != NULL)
+		return _below(path, root);
+
+	return _below_app(path, app_get_data_path())
+			|| _below_app(path, app_get_shared_data_path())
+			|| _below_app(path, app_get_shared_trusted_path())
+			|| (read && _below_app(path, app_get_resource_path()));
+}
+
+/**
+ * @brief Checks a pack, archive or trace path of a request sent by another
+ *        application, see _sink_path().
+ */
+static bool _confined_sink(const char *value) {
+	if (value[0] == '\0')
+		return true;
+	return (value[0] == '/') ?
+			batch_path_confined(value, NULL, false) : _plain_path(value);
+}
+
+/**
+ * @brief Checks that a request sent by another application only reads and
+ *        writes the directories of this application.
+ */
+static bool _request_confined(const batch_request *req) {
+	for (unsigned int i = 0; i < req->input_count; ++i)
+		if (!batch_path_confined(req->inputs[i], NULL, true))
+			return false;
+	for (unsigned int i = 0; i < req->overlays.count; ++i)
+		if (!batch_path_confined(req->overlays.layers[i].path, NULL, true))
+			return false;
+
+	return batch_path_confined(req->output_dir, NULL, false)
+			&& (req->report_path[0] == '\0'
+					|| strcmp(req->report_path, "none") == 0
+					|| batch_path_confined(req->report_path, NULL, false))
+			&& _confined_sink(req->pack_path)
+			&& _confined_sink(req->archive_path)
+			&& _confined_sink(req->trace_path);
+}
+
+/**
+ * @brief Reads a request from the extras of a launch request.
+ * @details Each key of batch_request is an extra; input and size may also
+ *          be string arrays. Any application may send the request, so it
+ *          may only name files in the data and shared directories of this
+ *          application, and read its resources.
+ *
+ * @param app_control The launch request
+ * @param req The request to fill in
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int batch_request_from_app_control(app_control_h app_control,
+		batch_request *req) {
+	static const char *keys[] = { "input", "output_dir", "size", "colorspace",
+			"format", "quality", "rotation", "flip", "retries", "stop_on_error",
+			"report", "dedupe", "atlas", "pack", "archive", "overlay", "trace" };
+
+	batch_request_init(req);
+	for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+		int error_code = _set_from_extra(app_control, req, keys[i]);
+		if (error_code != IMAGE_UTIL_ERROR_NONE) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Invalid batch extra %s", keys[i]);
+			return error_code;
+		}
+	}
+	if (req->output_dir[0] != '\0' && !_request_confined(req)) {
+		dlog_print(DLOG_ERROR, LOG_TAG,
+				"Batch paths outside of the application directories");
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+	return batch_request_validate(req);
+}
+
+/**
+ * @brief Checks that a request names inputs and an output directory.
+ * @details An atlas takes at most one size and runs in this process; so
+ *          does a batch writing an asset pack or an archive, which cannot
+ *          be an atlas, nor both.
+ *          Overlays need a color space they can be blended in and are not
+ *          put on atlases. Only batches of jobs run in this process are
+ *          traced.
+ */
+int batch_request_validate(const batch_request *req) {
+	if (req->input_count == 0 || req->output_dir[0] == '\0')
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (req->atlas.width != 0 && (req->size_count > 1 || req->processes > 0))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (req->pack_path[0] != '\0'
+			&& (req->atlas.width != 0 || req->processes > 0))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (req->archive_path[0] != '\0' && (req->atlas.width != 0
+			|| req->processes > 0 || req->pack_path[0] != '\0'))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (req->overlays.count > 0 && (req->atlas.width != 0
+			|| !composite_supports(req->colorspace)))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (req->trace_path[0] != '\0'
+			&& (req->atlas.width != 0 || req->processes > 0))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Starts the backends and the workers. Safe to call more than once.
+ * @details Unlike the UI, a batch needs neither the window nor the result
+ *          cache.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int batch_init(void) {
+	backend_init();
+
+	int error_code = frame_cache_init(FRAME_CACHE_BUDGET);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+
+	error_code = scheduler_init(0);
+	if (error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = memgov_start(0);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+
+	return concurrency_start();
+}
+
+/**
+ * @brief Stops the workers and drops the caches.
+ * @details Batches still running are reported as cancelled.
+ */
+void batch_shutdown(void) {
+	memgov_stop();
+	concurrency_stop();
+	scheduler_shutdown();
+	frame_cache_shutdown();
+	buffer_pool_set_budget(0);
+}
+
+/**
+ * @brief Creates the output directory of a batch and its missing parents.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int batch_make_output_dir(const batch_request *req) {
+	char partial[BUFLEN];
+
+	snprintf(partial, BUFLEN, "%s", req->output_dir);
+	for (char *slash = strchr(partial + 1, '/'); slash != NULL;
+			slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		if (mkdir(partial, 0755) != 0 && errno != EEXIST)
+			return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+		*slash = '/';
+	}
+	if (mkdir(partial, 0755) != 0 && errno != EEXIST) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot create %s", req->output_dir);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Gets the directory a pattern lists files from.
+ * @details The part before the first wildcard up to its last slash, or the
+ *          pattern itself for a directory.
+ *
+ * @return The length of the directory, 0 for the current one
+ */
+static size_t _pattern_root(const char *pattern) {
+	size_t length = strcspn(pattern, "*?[");
+	struct stat st;
+
+	if (pattern[length] != '\0' || stat(pattern, &st) != 0
+			|| !S_ISDIR(st.st_mode))
+		while (length > 0 && pattern[length - 1] != '/')
+			length--;
+	while (length > 0 && pattern[length - 1] == '/')
+		length--;
+	return length;
+}
+
+/**
+ * @brief Gets the deepest directory holding every input of a batch.
+ * @details Output names are relative to it, so that inputs of the same
+ *          name in different directories do not share their outputs.
+ *
+ * @param req The batch
+ * @return The length of the directory, a prefix of the first input
+ */
+static size_t _input_root(const batch_request *req) {
+	const char *root = req->inputs[0];
+	size_t length = _pattern_root(root);
+
+	for (unsigned int i = 1; i < req->input_count && length > 0; ++i) {
+		const char *other = req->inputs[i];
+		size_t other_length = _pattern_root(other);
+		size_t common = 0;
+
+		while (common < length && common < other_length
+				&& root[common] == other[common])
+			common++;
+		/* Only whole directory names are shared. */
+		if ((common < length && root[common] != '/')
+				|| (common < other_length && other[common] != '/'))
+			while (common > 0 && root[common - 1] != '/')
+				common--;
+		while (common > 0 && root[common - 1] == '/')
+			common--;
+		length = common;
+	}
+	return length;
+}
+
+/**
+ * @brief Gets the name of an input relative to the inputs of its batch,
+ *        without its extension.
+ *
+ * @param length Receives the length of the name
+ */
+static const char *_relative_stem(const batch_request *req, const char *input,
+		int *length) {
+	size_t root = (req->input_count > 0) ? _input_root(req) : 0;
+	const char *name = input + root;
+
+	if (root > 0 && (strncmp(input, req->inputs[0], root) != 0
+			|| input[root] != '/')) {
+		/* Not below the inputs: only the file name is kept. */
+		name = strrchr(input, '/');
+		name = (name != NULL) ? name + 1 : input;
+	}
+	while (*name == '/')
+		name++;
+
+	const char *base = strrchr(name, '/');
+	base = (base != NULL) ? base + 1 : name;
+	const char *dot = strrchr(base, '.');
+	*length = (dot != NULL && dot != base) ? dot - name : (int) strlen(name);
+	return name;
+}
+
+/**
+ * @brief Builds the output path of one input at one size.
+ * @details "<name>.jpg" when the batch has a single size,
+ *          "<name>_<W>x<H>.jpg" otherwise. The name is the path of the
+ *          input below the directory holding every input, without its
+ *          extension: inputs in subdirectories of it have their results in
+ *          the same subdirectories of the output directory.
+ *
+ * @param req The batch
+ * @param input The input file
+ * @param size The size, one of the sizes of the batch
+ * @param path The buffer of BUFLEN bytes receiving the path
+ * @return @c false if the path does not fit
+ */
+bool batch_output_path(const batch_request *req, const char *input,
+		const batch_size *size, char *path) {
+	int stem;
+	const char *name = _relative_stem(req, input, &stem);
+	int length;
+
+	if (req->size_count > 1)
+		length = snprintf(path, BUFLEN, "%s/%.*s_%ux%u.jpg", req->output_dir,
+				stem, name, size->width, size->height);
+	else
+		length = snprintf(path, BUFLEN, "%s/%.*s.jpg", req->output_dir, stem,
+				name);
+	return length < BUFLEN;
+}
+
+/* The output name of an input, see _check_names(). */
+typedef struct {
+	const char *name;
+	int length;
+	const char *input;
+} output_name;
+
+static int _compare_output_names(const void *a, const void *b) {
+	const output_name *first = a, *second = b;
+	int length = (first->length < second->length) ?
+			first->length : second->length;
+	int order = strncmp(first->name, second->name, length);
+
+	return order ? order : first->length - second->length;
+}
+
+/**
+ * @brief Checks that no two inputs of a batch share their outputs.
+ * @details Inputs differing only by their extension, such as a.jpg and
+ *          a.png, would be written to the same files.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise
+ *         IMAGE_UTIL_ERROR_INVALID_PARAMETER
+ */
+static int _check_names(const batch_request *req, const scan_list *files) {
+	if (files->count < 2)
+		return IMAGE_UTIL_ERROR_NONE;
+
+	output_name *names = malloc(files->count * sizeof(output_name));
+	if (names == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	for (unsigned int i = 0; i < files->count; ++i) {
+		names[i].input = files->entries[i].path;
+		names[i].name = _relative_stem(req, names[i].input, &names[i].length);
+	}
+	qsort(names, files->count, sizeof(output_name), _compare_output_names);
+
+	int error_code = IMAGE_UTIL_ERROR_NONE;
+	for (unsigned int i = 1; i < files->count; ++i) {
+		if (_compare_output_names(&names[i - 1], &names[i]) == 0) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "%s and %s have the same output %.*s",
+					names[i - 1].input, names[i].input, names[i].length,
+					names[i].name);
+			error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+			break;
+		}
+	}
+	free(names);
+	return error_code;
+}
+
+/**
+ * @brief Creates a directory and its missing parents.
+ *
+ * @param path The directory; changed while running, then restored
+ */
+static bool _make_dirs(char *path) {
+	for (char *slash = strchr(path + 1, '/'); slash != NULL;
+			slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+		*slash = '/';
+		if (!made)
+			return false;
+	}
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+/**
+ * @brief Prepares the outputs of the inputs of a batch.
+ * @details Fails if two inputs would share their outputs. When the results
+ *          are loose files, creates the subdirectories of the output
+ *          directory they go to.
+ *
+ * @param req The batch, whose output directory exists
+ * @param files The inputs of the batch
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int batch_prepare_outputs(const batch_request *req, const scan_list *files) {
+	static const batch_size source_size = { 0, 0 };
+	char path[BUFLEN];
+	char made[BUFLEN] = "";
+
+	int error_code = _check_names(req, files);
+	if (error_code != IMAGE_UTIL_ERROR_NONE || req->pack_path[0] != '\0'
+			|| req->archive_path[0] != '\0')
+		return error_code;
+
+	for (unsigned int i = 0; i < files->count; ++i) {
+		if (!batch_output_path(req, files->entries[i].path,
+				req->size_count ? &req->sizes[0] : &source_size, path))
+			continue;
+		*strrchr(path, '/') = '\0';
+		/* The inputs are sorted, so those of a directory follow each other. */
+		if (strcmp(path, req->output_dir) == 0 || strcmp(path, made) == 0)
+			continue;
+		if (!_make_dirs(path)) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Cannot create %s", path);
+			return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+		}
+		snprintf(made, BUFLEN, "%s", path);
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Copies the result of a job to the output of a duplicate input.
+ * @details The copy is written next to its destination and renamed over
+ *          it, so that no reader sees a partial file. A file is not
+ *          copied onto itself: each duplicate has its own output.
+ *
+ * @param from The output of the job
+ * @param to The output of the duplicate
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int batch_copy_output(const char *from, const char *to) {
+	char partial[BUFLEN];
+	char chunk[8 * 1024];
+	size_t length;
+	bool written = true;
+
+	if (strcmp(from, to) == 0
+			|| snprintf(partial, BUFLEN, "%s.part", to) >= BUFLEN)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	FILE *source = fopen(from, "rb");
+	if (source == NULL)
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+
+	FILE *copy = fopen(partial, "wb");
+	if (copy == NULL) {
+		fclose(source);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+
+	while (written && (length = fread(chunk, 1, sizeof(chunk), source)) > 0)
+		written = fwrite(chunk, 1, length, copy) == length;
+	written = written && !ferror(source);
+	fclose(source);
+
+	if (fclose(copy) != 0 || !written || rename(partial, to) != 0) {
+		remove(partial);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Fills in the settings shared by all the jobs of a batch.
+ * @details The paths and the size are left for the caller. The jobs
+ *          point to the overlays of the request, which must outlive them.
+ */
+void batch_job_init(const batch_request *req, transform_job *job) {
+	memset(job, 0, sizeof(transform_job));
+	job->colorspace = req->colorspace;
+	job->quality = req->quality;
+	job->rotation = req->rotation;
+	job->flip = req->flip;
+	job->priority = req->priority;
+	if (req->overlays.count > 0)
+		job->overlays = &req->overlays;
+}
+
+/**
+ * @brief Gets the path of the JSON report of a batch.
+ *
+ * @param req The batch
+ * @param path The buffer of BUFLEN bytes receiving the path
+ * @return @c false if the batch has no report
+ */
+bool batch_report_path(const batch_request *req, char *path) {
+	if (strcmp(req->report_path, "none") == 0)
+		return false;
+	if (req->report_path[0] != '\0')
+		return snprintf(path, BUFLEN, "%s", req->report_path) < BUFLEN;
+	return snprintf(path, BUFLEN, "%s/" BATCH_REPORT_FILE, req->output_dir)
+			< BUFLEN;
+}
+
+/**
+ * @brief Gets the name of an input in an asset pack, see
+ *        batch_output_path().
+ */
+static void _pack_name(const batch_request *req, const char *input,
+		char *name) {
+	int length;
+	const char *stem = _relative_stem(req, input, &length);
+
+	snprintf(name, BUFLEN, "%.*s", length, stem);
+}
+
+/**
+ * @brief Gets the name of a result in an archive: the path of the file it
+ *        is written to without one, relative to the output directory.
+ */
+static bool _archive_name(const batch_request *req, const char *input,
+		const batch_size *size, char *name) {
+	char path[BUFLEN];
+
+	if (!batch_output_path(req, input, size, path))
+		return false;
+	snprintf(name, BUFLEN, "%s", path + strlen(req->output_dir) + 1);
+	return true;
+}
+
+/**
+ * @brief Resolves the path of a pack or an archive.
+ */
+static bool _sink_path(const batch_request *req, const char *value,
+		char *path) {
+	if (value[0] == '/')
+		return snprintf(path, BUFLEN, "%s", value) < BUFLEN;
+	return snprintf(path, BUFLEN, "%s/%s", req->output_dir, value) < BUFLEN;
+}
+
+/**
+ * @brief Gets where a job writes: its own file, the asset pack or the
+ *        archive.
+ */
+static bool _output_path(const batch_context *ctx, const char *input,
+		const batch_size *size, char *path) {
+	if (ctx->pack != NULL)
+		return snprintf(path, BUFLEN, "%s", ctx->pack_path) < BUFLEN;
+	if (ctx->archive != NULL)
+		return snprintf(path, BUFLEN, "%s", ctx->archive_path) < BUFLEN;
+	return batch_output_path(&ctx->req, input, size, path);
+}
+
+/**
+ * @brief Counts one job as over and ends the batch after the last one.
+ * @details A pack or an archive that cannot be finished loses every
+ *          result in it, so the jobs that went to it count as failed.
+ */
+static void _finish_one(batch_context *ctx) {
+	pthread_mutex_lock(&ctx->lock);
+	bool last = (--ctx->remaining == 0);
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (!last)
+		return;
+
+	if (ctx->pack != NULL) {
+		int error_code = asset_pack_finish(ctx->pack);
+		if (error_code != IMAGE_UTIL_ERROR_NONE) {
+			DLOG_PRINT_ERROR("asset_pack_finish", error_code);
+			ctx->summary.failed += ctx->summary.succeeded;
+			ctx->summary.succeeded = 0;
+		}
+	}
+	if (ctx->archive != NULL) {
+		int error_code = archive_finish(ctx->archive);
+		if (error_code != IMAGE_UTIL_ERROR_NONE) {
+			DLOG_PRINT_ERROR("archive_finish", error_code);
+			ctx->summary.failed += ctx->summary.succeeded;
+			ctx->summary.succeeded = 0;
+		}
+	}
+
+	if (ctx->report != NULL) {
+		uint64_t span = trace_begin();
+		int error_code = report_write_json(ctx->report, &ctx->summary,
+				ctx->report_path);
+		trace_end("report", span, ctx->report_path);
+		if (error_code != IMAGE_UTIL_ERROR_NONE)
+			DLOG_PRINT_ERROR("report_write_json", error_code);
+		report_destroy(ctx->report);
+	}
+	scan_list_clear(&ctx->files);
+
+	if (ctx->req.trace_path[0] != '\0') {
+		char path[BUFLEN];
+		int error_code = _sink_path(&ctx->req, ctx->req.trace_path, path) ?
+				trace_write_json(path, ctx->trace_since) :
+				IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		if (error_code != IMAGE_UTIL_ERROR_NONE)
+			DLOG_PRINT_ERROR("trace_write_json", error_code);
+		trace_stop();
+	}
+
+	if (ctx->done_cb != NULL)
+		ctx->done_cb(&ctx->summary, ctx->user_data);
+	cancel_token_unref(ctx->cancel);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+/**
+ * @brief Counts, reports and hands over the outcome of a job.
+ */
+static void _account(batch_context *ctx, const transform_job *job,
+		const pipeline_result *result) {
+	bool failed = !result->cancelled
+			&& result->error_code != IMAGE_UTIL_ERROR_NONE;
+
+	pthread_mutex_lock(&ctx->lock);
+	if (result->cancelled)
+		ctx->summary.cancelled++;
+	else if (failed)
+		ctx->summary.failed++;
+	else
+		ctx->summary.succeeded++;
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (ctx->report != NULL)
+		report_add_result(ctx->report, job, result);
+	if (failed && ctx->stop_on_error)
+		cancel_token_cancel(ctx->cancel);
+
+	if (ctx->job_cb != NULL)
+		ctx->job_cb(job, result, ctx->user_data);
+}
+
+/**
+ * @brief Names the packed result of a job after a duplicate input too.
+ */
+static int _pack_link(batch_context *ctx, const transform_job *job,
+		const char *input, const pipeline_result *result) {
+	char name[BUFLEN], original[BUFLEN];
+
+	_pack_name(&ctx->req, input, name);
+	_pack_name(&ctx->req, job->input_path, original);
+	/* batch_prepare_outputs() keeps the names of the inputs apart. */
+	if (strcmp(name, original) == 0)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	return asset_pack_link(ctx->pack, name, result->encoded.width,
+			result->encoded.height, original);
+}
+
+/**
+ * @brief Archives the result of a job under the name of a duplicate too.
+ */
+static int _archive_link(batch_context *ctx, const transform_job *job,
+		const char *input) {
+	char name[BUFLEN], original[BUFLEN];
+	batch_size size = { job->width, job->height };
+
+	if (!_archive_name(&ctx->req, input, &size, name)
+			|| !_archive_name(&ctx->req, job->input_path, &size, original)
+			|| strcmp(name, original) == 0)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	return archive_link(ctx->archive, name, original);
+}
+
+static int _compare_input(const void *path, const void *entry) {
+	return strcmp(path, ((const scan_entry *) entry)->path);
+}
+
+/**
+ * @brief Gives the outcome of a job to the duplicates of its input.
+ * @details The output of a successful job is copied for every duplicate;
+ *          a failure or a cancellation is theirs as well.
+ */
+static void _fan_out(batch_context *ctx, const transform_job *job,
+		const pipeline_result *result) {
+	const scan_entry *original = bsearch(job->input_path, ctx->files.entries,
+			ctx->files.count, sizeof(scan_entry), _compare_input);
+	if (original == NULL)
+		return;
+
+	batch_size size = { job->width, job->height };
+	bool copy_output = !result->cancelled
+			&& result->error_code == IMAGE_UTIL_ERROR_NONE;
+
+	for (int i = original->next_duplicate; i >= 0;
+			i = ctx->files.entries[i].next_duplicate) {
+		pipeline_result copy_result = { .error_code = result->error_code,
+				.stage = result->stage, .cancelled = result->cancelled,
+				.backend = result->backend };
+		transform_job copy = *job;
+
+		snprintf(copy.input_path, BUFLEN, "%s", ctx->files.entries[i].path);
+		if (!_output_path(ctx, copy.input_path, &size, copy.output_path)) {
+			copy_result.error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+			copy_result.stage = PIPELINE_STAGE_QUEUE;
+		} else if (copy_output) {
+			uint64_t start_us = monotonic_us();
+			uint64_t span = trace_begin();
+
+			if (ctx->pack != NULL)
+				copy_result.error_code = _pack_link(ctx, job, copy.input_path,
+						result);
+			else if (ctx->archive != NULL)
+				copy_result.error_code = _archive_link(ctx, job,
+						copy.input_path);
+			else
+				copy_result.error_code = batch_copy_output(job->output_path,
+						copy.output_path);
+			copy_result.backend = BATCH_COPY_BACKEND;
+			copy_result.run_us = monotonic_us() - start_us;
+			trace_end("copy", span, copy.input_path);
+		}
+
+		pthread_mutex_lock(&ctx->lock);
+		ctx->summary.submitted++;
+		ctx->summary.deduplicated++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		_account(ctx, &copy, &copy_result);
+	}
+}
+
+/**
+ * @brief Accounts for a finished job, or runs it again.
+ * @details A job failing with a transient error is queued again, behind
+ *          the jobs already waiting, up to the retries of the batch.
+ * @remarks This function matches the scheduler_done_cb() type signature;
+ *          it is called on a worker thread.
+ */
+static void _job_done_cb(transform_job *job, pipeline_result *result,
+		void *user_data) {
+	batch_context *ctx = user_data;
+	bool failed = !result->cancelled
+			&& result->error_code != IMAGE_UTIL_ERROR_NONE;
+
+	if (failed && report_is_transient(result->error_code)
+			&& job->attempt < ctx->retries
+			&& !cancel_token_is_cancelled(ctx->cancel)) {
+		transform_job retry = *job;
+
+		retry.attempt++;
+		if (scheduler_submit(&retry, _job_done_cb, ctx)
+				== IMAGE_UTIL_ERROR_NONE) {
+			dlog_print(DLOG_WARN, LOG_TAG, "Retrying %s: %s", job->input_path,
+					get_error_message(result->error_code));
+			pthread_mutex_lock(&ctx->lock);
+			ctx->summary.retried++;
+			pthread_mutex_unlock(&ctx->lock);
+			return;
+		}
+	}
+
+	if (ctx->pack != NULL && !result->cancelled
+			&& result->error_code == IMAGE_UTIL_ERROR_NONE) {
+		char name[BUFLEN];
+		uint64_t span = trace_begin();
+
+		_pack_name(&ctx->req, job->input_path, name);
+		result->error_code = asset_pack_add(ctx->pack, name,
+				result->encoded.width, result->encoded.height,
+				ASSET_FORMAT_JPEG, result->encoded.colorspace,
+				result->encoded.data, result->encoded.size);
+		trace_end("write", span, job->input_path);
+		if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+			result->stage = PIPELINE_STAGE_ENCODE;
+	}
+
+	if (ctx->archive != NULL && !result->cancelled
+			&& result->error_code == IMAGE_UTIL_ERROR_NONE) {
+		char name[BUFLEN];
+		batch_size size = { job->width, job->height };
+		uint64_t span = trace_begin();
+
+		result->error_code = _archive_name(&ctx->req, job->input_path, &size,
+				name) ?
+				archive_add(ctx->archive, name, result->encoded.data,
+						result->encoded.size) :
+				IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		trace_end("write", span, job->input_path);
+		if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+			result->stage = PIPELINE_STAGE_ENCODE;
+	}
+
+	_account(ctx, job, result);
+	_fan_out(ctx, job, result);
+	_finish_one(ctx);
+}
+
+/**
+ * @brief Accounts for a job that could not be queued.
+ * @details It is reported like a job failing before its first stage, and
+ *          so are the duplicates of its input.
+ */
+static void _reject(batch_context *ctx, const transform_job *job,
+		int error_code) {
+	pipeline_result result = { .error_code = error_code, .stage =
+			PIPELINE_STAGE_QUEUE };
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->summary.submitted++;
+	pthread_mutex_unlock(&ctx->lock);
+
+	_account(ctx, job, &result);
+	_fan_out(ctx, job, &result);
+}
+
+/**
+ * @brief Queues the jobs of a batch that is not an atlas; see batch_submit().
+ */
+static int _submit(const batch_request *req, cancel_token *cancel,
+		batch_job_cb job_cb, batch_done_cb done_cb, void *user_data) {
+	uint64_t start_us = monotonic_us();
+	uint64_t span = trace_begin();
+
+	scan_list files;
+	int error_code = scan_inputs((const char (*)[BUFLEN]) req->inputs,
+			req->input_count, &files);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		trace_end("scan", span, NULL);
+		return error_code;
+	}
+	unsigned int duplicates = scan_find_duplicates(&files, req->dedupe);
+	trace_end("scan", span, NULL);
+
+	error_code = batch_make_output_dir(req);
+	if (error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = batch_prepare_outputs(req, &files);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		scan_list_clear(&files);
+		return error_code;
+	}
+
+	batch_context *ctx = calloc(1, sizeof(batch_context));
+	if (ctx == NULL) {
+		scan_list_clear(&files);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+	pthread_mutex_init(&ctx->lock, NULL);
+	ctx->remaining = 1;
+	ctx->cancel = cancel_token_create(cancel);
+	ctx->retries = req->retries;
+	ctx->stop_on_error = req->stop_on_error;
+	if (batch_report_path(req, ctx->report_path))
+		ctx->report = report_create();
+	ctx->files = files;
+	ctx->req = *req;
+	ctx->trace_since = start_us;
+	if (req->pack_path[0] != '\0')
+		error_code = _sink_path(req, req->pack_path, ctx->pack_path) ?
+				asset_pack_create(ctx->pack_path, &ctx->pack) :
+				IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	else if (req->archive_path[0] != '\0')
+		error_code = _sink_path(req, req->archive_path, ctx->archive_path) ?
+				archive_create(ctx->archive_path, &ctx->archive) :
+				IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		report_destroy(ctx->report);
+		cancel_token_unref(ctx->cancel);
+		pthread_mutex_destroy(&ctx->lock);
+		free(ctx);
+		scan_list_clear(&files);
+		return error_code;
+	}
+	ctx->job_cb = job_cb;
+	ctx->done_cb = done_cb;
+	ctx->user_data = user_data;
+
+	static const batch_size source_size = { 0, 0 };
+	const batch_size *sizes = (req->size_count > 0) ? req->sizes : &source_size;
+	unsigned int size_count = (req->size_count > 0) ? req->size_count : 1;
+	transform_job job;
+
+	/* The jobs point to the overlays of the copy. */
+	batch_job_init(&ctx->req, &job);
+	job.cancel = ctx->cancel;
+	if (ctx->pack != NULL || ctx->archive != NULL) {
+		job.output = JOB_OUTPUT_MEMORY;
+		job.encode = true;
+	}
+
+	for (unsigned int i = 0; i < files.count; ++i) {
+		if (files.entries[i].original >= 0)
+			continue;
+
+		probe_info info;
+		span = trace_begin();
+		int probed = probe_file(files.entries[i].path, &info);
+		trace_end("probe", span, files.entries[i].path);
+
+		for (unsigned int s = 0; s < size_count; ++s) {
+			snprintf(job.input_path, BUFLEN, "%s", files.entries[i].path);
+			job.width = sizes[s].width;
+			job.height = sizes[s].height;
+			job.decode_scale = IMAGE_UTIL_DOWNSCALE_1_1;
+
+			error_code = probed;
+			if (error_code == IMAGE_UTIL_ERROR_NONE)
+				error_code = probe_plan_job(&job, &info);
+			if (error_code == IMAGE_UTIL_ERROR_NONE
+					&& !_output_path(ctx, job.input_path, &sizes[s],
+							job.output_path))
+				error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+			if (error_code == IMAGE_UTIL_ERROR_NONE) {
+				pthread_mutex_lock(&ctx->lock);
+				ctx->remaining++;
+				pthread_mutex_unlock(&ctx->lock);
+
+				error_code = scheduler_submit(&job, _job_done_cb, ctx);
+				if (error_code != IMAGE_UTIL_ERROR_NONE) {
+					DLOG_PRINT_ERROR("scheduler_submit", error_code);
+					pthread_mutex_lock(&ctx->lock);
+					ctx->remaining--;
+					pthread_mutex_unlock(&ctx->lock);
+				}
+			}
+
+			if (error_code == IMAGE_UTIL_ERROR_NONE) {
+				pthread_mutex_lock(&ctx->lock);
+				ctx->summary.submitted++;
+				pthread_mutex_unlock(&ctx->lock);
+			} else {
+				_reject(ctx, &job, error_code);
+			}
+		}
+	}
+
+	dlog_print(DLOG_INFO, LOG_TAG, "Batch: %u files (%u duplicates), %u sizes",
+			files.count, duplicates, size_count);
+
+	/* Drop the submission guard; this may end the batch right away. */
+	_finish_one(ctx);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Queues every job of a batch.
+ * @details Inputs holding the same image as an earlier one, as told by
+ *          req->dedupe, are not transformed: the results are copied to
+ *          their outputs. Every input is probed first: sources that cannot
+ *          be decoded are rejected up front, the others get the smallest
+ *          decode scale covering each size and run largest first. Failed
+ *          jobs do not stop the others unless req->stop_on_error is set.
+ *          With req->atlas set, the inputs go to atlas_submit() instead;
+ *          with req->pack_path or req->archive_path set, the results are
+ *          encoded in memory and added to an asset pack or streamed to an
+ *          archive as they finish, rather than written one per file.
+ *          With req->trace_path set, the batch is traced. Once the last
+ *          job is over, the report and the trace are written and done_cb
+ *          is called exactly once, on a worker thread, or on the calling
+ *          thread if there is nothing to do. Neither happens if this
+ *          function fails.
+ *
+ * @param req The batch
+ * @param cancel Cancels the whole batch; may be NULL
+ * @param job_cb The function called for every finished job, may be NULL
+ * @param done_cb The function called when the batch is over, may be NULL
+ * @param user_data The user data passed to job_cb and done_cb
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int batch_submit(const batch_request *req, cancel_token *cancel,
+		batch_job_cb job_cb, batch_done_cb done_cb, void *user_data) {
+	int error_code = batch_request_validate(req);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+	if (req->atlas.width != 0)
+		return atlas_submit(req, cancel, job_cb, done_cb, user_data);
+
+	bool traced = (req->trace_path[0] != '\0');
+	if (traced)
+		trace_start();
+	error_code = _submit(req, cancel, job_cb, done_cb, user_data);
+	if (error_code != IMAGE_UTIL_ERROR_NONE && traced)
+		trace_stop();
+	return error_code;
+}
+
+static void _waiter_job_cb(const transform_job *job,
+		const pipeline_result *result, void *user_data) {
+	batch_waiter *waiter = user_data;
+
+	if (waiter->job_cb != NULL)
+		waiter->job_cb(job, result, waiter->user_data);
+}
+
+static void _wake_waiter_cb(const batch_summary *summary, void *user_data) {
+	batch_waiter *waiter = user_data;
+
+	pthread_mutex_lock(&waiter->lock);
+	waiter->summary = *summary;
+	waiter->done = true;
+	pthread_cond_signal(&waiter->cond);
+	pthread_mutex_unlock(&waiter->lock);
+}
+
+/**
+ * @brief Runs a batch and waits for it.
+ *
+ * @param req The batch
+ * @param cancel Cancels the whole batch; may be NULL
+ * @param job_cb The function called for every finished job, may be NULL
+ * @param user_data The user data passed to job_cb
+ * @param summary Receives the outcome of the batch
+ * @return IMAGE_UTIL_ERROR_NONE if the batch ran, otherwise an error code
+ */
+int batch_run(const batch_request *req, cancel_token *cancel,
+		batch_job_cb job_cb, void *user_data, batch_summary *summary) {
+	batch_waiter waiter = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond =
+			PTHREAD_COND_INITIALIZER, .job_cb = job_cb, .user_data = user_data };
+
+	int error_code = batch_submit(req, cancel, _waiter_job_cb,
+			_wake_waiter_cb, &waiter);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+
+	pthread_mutex_lock(&waiter.lock);
+	while (!waiter.done)
+		pthread_cond_wait(&waiter.cond, &waiter.lock);
+	pthread_mutex_unlock(&waiter.lock);
+
+	*summary = waiter.summary;
+	return IMAGE_UTIL_ERROR_NONE;
+}
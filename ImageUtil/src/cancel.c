@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cancel.h"
+#include <stdlib.h>
+
+struct cancel_token {
+	int refcount;
+	int cancelled;
+	cancel_token *parent;
+	cancel_poll_cb poll_cb;
+	void *user_data;
+};
+
+/**
+ * @brief Creates a new token.
+ *
+ * @param parent The token this one inherits cancellation from, or NULL
+ * @return The new token with a reference count of one, or NULL
+ */
+cancel_token *cancel_token_create(cancel_token *parent) {
+	cancel_token *token = calloc(1, sizeof(cancel_token));
+
+	if (token == NULL)
+		return NULL;
+
+	token->refcount = 1;
+	token->parent = (parent != NULL) ? cancel_token_ref(parent) : NULL;
+	return token;
+}
+
+/**
+ * @brief Creates a token that also asks a function whether it is cancelled.
+ * @details For work shared by several callers, which is only cancelled once
+ *          all of them gave up. The function must stay callable as long as
+ *          someone may check the token.
+ *
+ * @param poll_cb The function consulted by every check
+ * @param user_data The user data passed to poll_cb
+ * @return The new token with a reference count of one, or NULL
+ */
+cancel_token *cancel_token_create_polled(cancel_poll_cb poll_cb,
+		void *user_data) {
+	cancel_token *token = cancel_token_create(NULL);
+
+	if (token != NULL) {
+		token->poll_cb = poll_cb;
+		token->user_data = user_data;
+	}
+	return token;
+}
+
+/**
+ * @brief Takes a reference to the token.
+ *
+ * @param token The token, may be NULL
+ * @return The token
+ */
+cancel_token *cancel_token_ref(cancel_token *token) {
+	if (token != NULL)
+		__atomic_add_fetch(&token->refcount, 1, __ATOMIC_RELAXED);
+	return token;
+}
+
+/**
+ * @brief Drops a reference and frees the token with the last one.
+ *
+ * @param token The token, may be NULL
+ */
+void cancel_token_unref(cancel_token *token) {
+	while (token != NULL
+			&& __atomic_sub_fetch(&token->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		cancel_token *parent = token->parent;
+
+		free(token);
+		token = parent;
+	}
+}
+
+/**
+ * @brief Requests cancellation. Work in progress stops at the next check.
+ *
+ * @param token The token, may be NULL
+ */
+void cancel_token_cancel(cancel_token *token) {
+	if (token != NULL)
+		__atomic_store_n(&token->cancelled, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Checks the token and all its ancestors.
+ *
+ * @param token The token, may be NULL
+ * @return @c true if the token or any of its parents is cancelled
+ */
+bool cancel_token_is_cancelled(const cancel_token *token) {
+	for (; token != NULL; token = token->parent)
+		if (__atomic_load_n(&token->cancelled, __ATOMIC_ACQUIRE)
+				|| (token->poll_cb != NULL && token->poll_cb(token->user_data)))
+			return true;
+	return false;
+}
@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "cli.h"
+#include "batch.h"
+#include "service.h"
+#include "scan.h"
+#include "lazy.h"
+#include "frame_cache.h"
+#include "scheduler.h"
+#include "concurrency.h"
+#include "memgov.h"
+#include "arena.h"
+#include "supervisor.h"
+#include "asset_pack.h"
+#include "archive.h"
+#include "trace.h"
+#include <tizen.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static cancel_token *cli_token = NULL;
+
+static void _usage(const char *program) {
+	fprintf(stderr, "Usage: %s " CLI_BATCH_OPTION " --input PATTERN... "
+			"--output-dir DIR [--size WxH]... [--colorspace NAME]\n"
+			"       [--format jpeg] [--quality 1-100] [--rotation 0|90|180|270]"
+			" [--flip none|horizontal|vertical] [--processes N]\n"
+			"       [--retries N] [--stop-on-error 0|1] [--report PATH|none]"
+			" [--dedupe none|exact|similar]\n"
+			"       [--atlas WxH] [--pack PATH] [--archive PATH] [--trace PATH]"
+			" [--overlay PATH@X,Y[,SCALE[,OPACITY[,nokey]]]]...\n"
+			"       %s " CLI_SERVE_OPTION " SOCKET [ROOT]\n"
+			"       %s " CLI_CLIENT_OPTION " SOCKET --input PATTERN... "
+			"[--size WxH]... [--colorspace NAME] [--output-dir DIR]\n"
+			"       %s " CLI_LIST_PACK_OPTION " PACK [NAME [WxH]]\n"
+			"       %s " CLI_LIST_ARCHIVE_OPTION " ARCHIVE [NAME]\n"
+			"       %s " CLI_EXTRACT_OPTION " ARCHIVE DIR\n",
+			program, program, program, program, program, program);
+}
+
+/**
+ * @brief Cancels the batch on SIGINT and SIGTERM.
+ * @details Queued jobs are dropped and running jobs stop after their
+ *          current stage, so the summary is still printed.
+ */
+static void _signal_cb(int signum) {
+	cancel_token_cancel(cli_token);
+}
+
+/**
+ * @brief Prints the outcome of a job.
+ * @remarks This function matches the batch_job_cb() type signature;
+ *          it is called on a worker thread.
+ */
+static void _job_done_cb(const transform_job *job,
+		const pipeline_result *result, void *user_data) {
+	if (result->cancelled)
+		printf("cancelled %s\n", job->input_path);
+	else if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+		printf("failed    %s: %s in %s\n", job->input_path,
+				get_error_message(result->error_code),
+				pipeline_stage_name(result->stage));
+	else
+		printf("ok        %s -> %s (%s, %u ms)\n", job->input_path,
+				job->output_path, result->backend,
+				(unsigned int) (result->run_us / 1000));
+}
+
+/**
+ * @brief Checks whether the command line asks for a headless batch.
+ */
+bool cli_requested(int argc, char *argv[]) {
+	return argc > 1 && (strcmp(argv[1], CLI_BATCH_OPTION) == 0
+			|| strcmp(argv[1], CLI_SERVE_OPTION) == 0
+			|| strcmp(argv[1], CLI_CLIENT_OPTION) == 0
+			|| strcmp(argv[1], CLI_LIST_PACK_OPTION) == 0
+			|| strcmp(argv[1], CLI_LIST_ARCHIVE_OPTION) == 0
+			|| strcmp(argv[1], CLI_EXTRACT_OPTION) == 0);
+}
+
+/**
+ * @brief Parses "--key value" pairs into a request.
+ * @details Dashes in keys stand for underscores, so "--output-dir" sets
+ *          output_dir.
+ *
+ * @param first The index of the first pair in argv
+ */
+static int _parse_args(int argc, char *argv[], int first, batch_request *req) {
+	char key[32];
+
+	batch_request_init(req);
+	for (int i = first; i < argc; i += 2) {
+		if (strncmp(argv[i], "--", 2) != 0 || i + 1 == argc
+				|| strlen(argv[i] + 2) >= sizeof(key))
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+		snprintf(key, sizeof(key), "%s", argv[i] + 2);
+		for (char *dash = strchr(key, '-'); dash != NULL;
+				dash = strchr(dash, '-'))
+			*dash = '_';
+
+		int error_code = batch_request_set(req, key, argv[i + 1]);
+		if (error_code != IMAGE_UTIL_ERROR_NONE) {
+			fprintf(stderr, "Invalid %s %s\n", argv[i], argv[i + 1]);
+			return error_code;
+		}
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Runs the transform service until SIGINT or SIGTERM.
+ * @details The workers and caches are started once and stay warm across
+ *          all the requests of all the clients.
+ *
+ * @param socket_path The path of the socket
+ * @param root The directory clients may read from, or NULL for the
+ *             directories of the application
+ */
+static int _serve(const char *socket_path, const char *root) {
+	sigset_t signals;
+	int signum;
+
+	/* Blocked before any thread starts, so only sigwait() sees them. */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	int error_code = batch_init();
+	if (error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = service_start(socket_path, root);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		fprintf(stderr, "Cannot serve on %s: %s\n", socket_path,
+				get_error_message(error_code));
+		batch_shutdown();
+		return 1;
+	}
+
+	printf("Serving on %s\n", socket_path);
+	fflush(stdout);
+	sigwait(&signals, &signum);
+
+	service_stop();
+	service_log_stats();
+	lazy_log_stats();
+	frame_cache_log_stats();
+	scheduler_log_stats();
+	concurrency_log_stats();
+	memgov_log_stats();
+	arena_log_stats();
+	lazy_shutdown();
+	batch_shutdown();
+	pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+	return 0;
+}
+
+/**
+ * @brief Maps a result, and saves it if it is a JPEG for the output directory.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+static int _take_result(const batch_request *req, const char *input,
+		const batch_size *size, const service_reply *reply, int image_fd) {
+	char path[BUFLEN];
+
+	void *data = mmap(NULL, reply->size, PROT_READ, MAP_SHARED, image_fd, 0);
+	if (data == MAP_FAILED)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	int error_code = IMAGE_UTIL_ERROR_NONE;
+	if (req->output_dir[0] != '\0') {
+		FILE *file = NULL;
+
+		if (batch_output_path(req, input, size, path))
+			file = fopen(path, "wb");
+		if (file == NULL || fwrite(data, 1, reply->size, file) != reply->size)
+			error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+		if (file != NULL)
+			fclose(file);
+	}
+
+	munmap(data, reply->size);
+	return error_code;
+}
+
+/**
+ * @brief Sends every input at every size to a running service.
+ * @details With an output directory, JPEGs are requested and saved there;
+ *          otherwise raw pixels are requested and only mapped.
+ */
+static int _client(const char *socket_path, const batch_request *req) {
+	static const batch_size source_size = { 0, 0 };
+	const batch_size *sizes = (req->size_count > 0) ? req->sizes : &source_size;
+	unsigned int size_count = (req->size_count > 0) ? req->size_count : 1;
+	unsigned int requests = 0, failures = 0;
+	bool connected = true;
+	scan_list files;
+	int fd;
+
+	int error_code = scan_inputs((const char (*)[BUFLEN]) req->inputs,
+			req->input_count, &files);
+	if (error_code == IMAGE_UTIL_ERROR_NONE && req->output_dir[0] != '\0') {
+		error_code = batch_make_output_dir(req);
+		if (error_code == IMAGE_UTIL_ERROR_NONE)
+			error_code = batch_prepare_outputs(req, &files);
+		if (error_code != IMAGE_UTIL_ERROR_NONE) {
+			scan_list_clear(&files);
+			fprintf(stderr, "Cannot write to %s: %s\n", req->output_dir,
+					get_error_message(error_code));
+			return 1;
+		}
+	}
+	if (error_code == IMAGE_UTIL_ERROR_NONE) {
+		error_code = service_connect(socket_path, &fd);
+		if (error_code != IMAGE_UTIL_ERROR_NONE)
+			scan_list_clear(&files);
+	}
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		fprintf(stderr, "Cannot reach %s: %s\n", socket_path,
+				get_error_message(error_code));
+		return 1;
+	}
+
+	uint64_t start_us = monotonic_us();
+	for (unsigned int i = 0; i < files.count && connected; ++i) {
+		for (unsigned int s = 0; s < size_count && connected; ++s) {
+			service_request request = { .version = SERVICE_PROTOCOL_VERSION,
+					.width = sizes[s].width, .height = sizes[s].height,
+					.colorspace = req->colorspace, .encoded =
+							req->output_dir[0] != '\0' };
+			service_reply reply;
+			int image_fd;
+			char absolute[PATH_MAX];
+
+			if (realpath(files.entries[i].path, absolute) == NULL
+					|| strlen(absolute) >= BUFLEN)
+				error_code = IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+			else {
+				memcpy(request.path, absolute, strlen(absolute) + 1);
+				uint64_t call_us = monotonic_us();
+				error_code = service_call(fd, &request, &reply, &image_fd);
+				call_us = monotonic_us() - call_us;
+
+				if (error_code == IMAGE_UTIL_ERROR_NONE) {
+					error_code = _take_result(req, files.entries[i].path,
+							&sizes[s], &reply, image_fd);
+					close(image_fd);
+				}
+				if (error_code == IMAGE_UTIL_ERROR_NONE)
+					printf("ok        %s %ux%u, %llu bytes in %u us "
+							"(%u us in the service)\n",
+							files.entries[i].path, reply.width, reply.height,
+							(unsigned long long) reply.size,
+							(unsigned int) call_us,
+							(unsigned int) reply.service_us);
+			}
+
+			requests++;
+			if (error_code != IMAGE_UTIL_ERROR_NONE) {
+				failures++;
+				printf("failed    %s: %s\n", files.entries[i].path,
+						get_error_message(error_code));
+				/* The service is gone. */
+				connected = (error_code != IMAGE_UTIL_ERROR_INVALID_OPERATION);
+			}
+		}
+	}
+
+	close(fd);
+	scan_list_clear(&files);
+	printf("%u requests: %u failed in %u ms\n", requests, failures,
+			(unsigned int) ((monotonic_us() - start_us) / 1000));
+	return (failures == 0) ? 0 : 1;
+}
+
+static void _print_asset(const asset_view *view) {
+	printf("%-24.*s %5ux%-5u %-4s %8zu bytes\n", (int) view->name_length,
+			view->name, view->width, view->height,
+			(view->format == ASSET_FORMAT_JPEG) ? "jpeg" : "raw", view->length);
+}
+
+/**
+ * @brief Lists the images of an asset pack, or looks one up.
+ *
+ * @param name The image to look up, NULL to list them all
+ * @param size The wanted size of the image, may be NULL
+ */
+static int _list_pack(const char *path, const char *name, const char *size) {
+	unsigned int width = 0, height = 0;
+	asset_pack *pack;
+	asset_view view;
+
+	if (size != NULL && sscanf(size, "%ux%u", &width, &height) != 2)
+		return 2;
+
+	uint64_t start_us = monotonic_us();
+	int error_code = asset_pack_open(path, &pack);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		fprintf(stderr, "Cannot open %s: %s\n", path,
+				get_error_message(error_code));
+		return 1;
+	}
+
+	if (name != NULL) {
+		error_code = asset_pack_find(pack, name, width, height, &view);
+		if (error_code == IMAGE_UTIL_ERROR_NONE)
+			_print_asset(&view);
+		else
+			fprintf(stderr, "%s: %s\n", name, get_error_message(error_code));
+	} else {
+		for (unsigned int i = 0; i < asset_pack_count(pack); ++i) {
+			if (asset_pack_get(pack, i, &view) != IMAGE_UTIL_ERROR_NONE) {
+				fprintf(stderr, "Entry %u is corrupt\n", i);
+				error_code = IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+				continue;
+			}
+			_print_asset(&view);
+		}
+	}
+	printf("%u images, opened and read in %llu us\n", asset_pack_count(pack),
+			(unsigned long long) (monotonic_us() - start_us));
+
+	asset_pack_close(pack);
+	return (error_code == IMAGE_UTIL_ERROR_NONE) ? 0 : 1;
+}
+
+/**
+ * @brief Lists the files of an archive, looks one up, or extracts them all.
+ *
+ * @param name The file to look up, NULL to list them all
+ * @param directory The directory to extract to, NULL to only list
+ */
+static int _read_archive(const char *path, const char *name,
+		const char *directory) {
+	archive *reader;
+	archive_view view;
+
+	uint64_t start_us = monotonic_us();
+	int error_code = archive_open(path, &reader);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		fprintf(stderr, "Cannot open %s: %s\n", path,
+				get_error_message(error_code));
+		return 1;
+	}
+
+	if (directory != NULL) {
+		error_code = archive_extract(reader, directory);
+		if (error_code != IMAGE_UTIL_ERROR_NONE)
+			fprintf(stderr, "Cannot extract every file to %s: %s\n",
+					directory, get_error_message(error_code));
+	} else if (name != NULL) {
+		error_code = archive_find(reader, name, &view);
+		if (error_code == IMAGE_UTIL_ERROR_NONE)
+			printf("%-32s %8zu bytes\n", view.name, view.length);
+		else
+			fprintf(stderr, "%s: %s\n", name, get_error_message(error_code));
+	} else {
+		for (unsigned int i = 0; i < archive_count(reader); ++i)
+			if (archive_get(reader, i, &view) == IMAGE_UTIL_ERROR_NONE)
+				printf("%-32s %8zu bytes\n", view.name, view.length);
+	}
+	printf("%u files, read in %llu us\n", archive_count(reader),
+			(unsigned long long) (monotonic_us() - start_us));
+
+	archive_close(reader);
+	return (error_code == IMAGE_UTIL_ERROR_NONE) ? 0 : 1;
+}
+
+/**
+ * @brief Runs the command-line mode chosen by argv[1].
+ * @details --batch starts the workers without the window, conformant and
+ *          naviframe, prints one line per job and a summary to stdout.
+ *          --serve and --client run the transform service and a client
+ *          of it; --list-pack reads an asset pack, --list-archive and
+ *          --extract an archive.
+ *
+ * @return 0 if every job succeeded, 1 if any failed or was cancelled,
+ *         2 for a usage error
+ */
+int cli_main(int argc, char *argv[]) {
+	batch_request req;
+	batch_summary summary;
+
+	if (strcmp(argv[1], CLI_SERVE_OPTION) == 0) {
+		if (argc < 3 || argc > 4) {
+			_usage(argv[0]);
+			return 2;
+		}
+		return _serve(argv[2], (argc > 3) ? argv[3] : NULL);
+	}
+
+	if (strcmp(argv[1], CLI_LIST_PACK_OPTION) == 0) {
+		if (argc < 3 || argc > 5) {
+			_usage(argv[0]);
+			return 2;
+		}
+		int status = _list_pack(argv[2], (argc > 3) ? argv[3] : NULL,
+				(argc > 4) ? argv[4] : NULL);
+		if (status == 2)
+			_usage(argv[0]);
+		return status;
+	}
+
+	if (strcmp(argv[1], CLI_LIST_ARCHIVE_OPTION) == 0
+			|| strcmp(argv[1], CLI_EXTRACT_OPTION) == 0) {
+		bool extract = strcmp(argv[1], CLI_EXTRACT_OPTION) == 0;
+
+		if (extract ? argc != 4 : (argc < 3 || argc > 4)) {
+			_usage(argv[0]);
+			return 2;
+		}
+		return _read_archive(argv[2], (!extract && argc > 3) ? argv[3] : NULL,
+				extract ? argv[3] : NULL);
+	}
+
+	if (strcmp(argv[1], CLI_CLIENT_OPTION) == 0) {
+		if (argc < 3 || _parse_args(argc, argv, 3, &req)
+				!= IMAGE_UTIL_ERROR_NONE || req.input_count == 0) {
+			_usage(argv[0]);
+			return 2;
+		}
+		return _client(argv[2], &req);
+	}
+
+	if (_parse_args(argc, argv, 2, &req) != IMAGE_UTIL_ERROR_NONE
+			|| batch_request_validate(&req) != IMAGE_UTIL_ERROR_NONE) {
+		_usage(argv[0]);
+		return 2;
+	}
+
+	/* Worker processes are forked before any thread exists. */
+	int error_code = (req.processes > 0) ?
+			IMAGE_UTIL_ERROR_NONE : batch_init();
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		fprintf(stderr, "Cannot start the workers: %s\n",
+				get_error_message(error_code));
+		return 1;
+	}
+
+	cli_token = cancel_token_create(NULL);
+	signal(SIGINT, _signal_cb);
+	signal(SIGTERM, _signal_cb);
+
+	trace_thread_name("cli");
+	uint64_t start_us = monotonic_us();
+	if (req.processes > 0)
+		error_code = supervisor_run(&req, cli_token, _job_done_cb, NULL,
+				&summary);
+	else
+		error_code = batch_run(&req, cli_token, _job_done_cb, NULL, &summary);
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	if (req.overlays.count > 0)
+		composite_log_stats();
+	if (req.processes == 0) {
+		concurrency_log_stats();
+		memgov_log_stats();
+		arena_log_stats();
+		trace_log_stats();
+		batch_shutdown();
+	}
+	cancel_token_unref(cli_token);
+	cli_token = NULL;
+
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		fprintf(stderr, "Batch failed: %s\n", get_error_message(error_code));
+		return 1;
+	}
+
+	printf("%u jobs: %u succeeded, %u failed, %u cancelled in %u ms\n",
+			summary.submitted, summary.succeeded, summary.failed,
+			summary.cancelled,
+			(unsigned int) ((monotonic_us() - start_us) / 1000));
+	if (summary.retried > 0)
+		printf("%u runs repeated after a transient error\n", summary.retried);
+	if (summary.deduplicated > 0)
+		printf("%u jobs copied from a duplicate input\n", summary.deduplicated);
+	if (summary.quarantined > 0)
+		printf("%u inputs quarantined, see %s/" SUPERVISOR_QUARANTINE_FILE "\n",
+				summary.quarantined, req.output_dir);
+	return (summary.succeeded == summary.submitted && summary.failed == 0) ?
+			0 : 1;
+}
@@ -0,0 +1,826 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "main.h"
+#include "composite.h"
+#include "frame_cache.h"
+#include "arena.h"
+#include "ops.h"
+#include <tizen.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define COMPOSITE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define COMPOSITE_NEON 1
+#endif
+
+#define COMPOSITE_MAX_PLANES 3
+
+/* The planes of a base image, and how much each is subsampled. */
+typedef struct {
+	image_plane planes[COMPOSITE_MAX_PLANES];
+	/* log2 of the subsampling of each plane, on both axes. */
+	int shift[COMPOSITE_MAX_PLANES];
+	int count;
+	bool yuv;
+	/* BGRA8888: red and blue are swapped. */
+	bool bgr;
+	/* NV21 and YV12: V comes before U. */
+	bool vu;
+} composite_base;
+
+/* A plane of an overlay, ready to be blended onto the same plane of a base. */
+typedef struct {
+	/* Premultiplied samples. */
+	unsigned char *samples;
+	/* The alpha of each sample byte; NULL if it is the fourth byte of RGBA. */
+	unsigned char *alpha;
+	ptrdiff_t stride;
+	int width;
+	int height;
+} overlay_plane;
+
+/* An overlay converted for one base image. */
+typedef struct {
+	/* Top left corner on the base; may be outside of it. */
+	int x;
+	int y;
+	overlay_plane planes[COMPOSITE_MAX_PLANES];
+	/* Holds the planes; from scratch_get(). */
+	unsigned char *buffer;
+} composite_overlay;
+
+static struct {
+	unsigned int images;
+	unsigned int layers;
+	unsigned int yuv_layers;
+	unsigned int failures;
+	uint64_t pixels;
+	uint64_t prepare_us;
+	uint64_t blend_us;
+} composite_stats;
+
+/**
+ * @brief Divides a product of two bytes by 255, rounded.
+ */
+static inline unsigned int _div255(unsigned int value) {
+	value += 128;
+	return (value + (value >> 8)) >> 8;
+}
+
+/*
+ * The kernels below blend premultiplied samples over the base in place:
+ * dst = src + dst * (255 - alpha) / 255.
+ */
+
+/**
+ * @brief Blends bytes that each come with their own alpha byte.
+ * @details Used for the planes of YUV bases; NV12 chroma passes its
+ *          interleaved U and V as twice as many bytes.
+ */
+static void _over_bytes(unsigned char *dst, const unsigned char *src,
+		const unsigned char *alpha, int count) {
+	int i = 0;
+
+#if defined(COMPOSITE_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i half = _mm_set1_epi16(128);
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+		__m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i a = _mm_loadu_si128((const __m128i *) (alpha + i));
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+				_mm_sub_epi16(full, _mm_unpacklo_epi8(a, zero))), half);
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+				_mm_sub_epi16(full, _mm_unpackhi_epi8(a, zero))), half);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		_mm_storeu_si128((__m128i *) (dst + i),
+				_mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+	}
+#elif defined(COMPOSITE_NEON)
+	for (; i + 8 <= count; i += 8) {
+		uint16x8_t t = vmull_u8(vld1_u8(dst + i), vmvn_u8(vld1_u8(alpha + i)));
+
+		vst1_u8(dst + i, vqadd_u8(vld1_u8(src + i),
+				vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8)));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = src[i] + _div255(dst[i] * (255 - alpha[i]));
+}
+
+/**
+ * @brief Blends premultiplied RGBA over four-byte pixels.
+ * @details The order of the color channels does not matter as long as
+ *          both sides use the same one; the base alpha is blended too.
+ */
+static void _over_rgba(unsigned char *dst, const unsigned char *src,
+		int count) {
+	int i = 0;
+
+#if defined(COMPOSITE_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i half = _mm_set1_epi16(128);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i d = _mm_loadu_si128((const __m128i *) (dst + 4 * i));
+		__m128i s = _mm_loadu_si128((const __m128i *) (src + 4 * i));
+		__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+		__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+
+		/* Spread the alpha of each of the two pixels over its lanes. */
+		__m128i a_lo = _mm_shufflehi_epi16(
+				_mm_shufflelo_epi16(s_lo, _MM_SHUFFLE(3, 3, 3, 3)),
+				_MM_SHUFFLE(3, 3, 3, 3));
+		__m128i a_hi = _mm_shufflehi_epi16(
+				_mm_shufflelo_epi16(s_hi, _MM_SHUFFLE(3, 3, 3, 3)),
+				_MM_SHUFFLE(3, 3, 3, 3));
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+				_mm_sub_epi16(full, a_lo)), half);
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+				_mm_sub_epi16(full, a_hi)), half);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		_mm_storeu_si128((__m128i *) (dst + 4 * i),
+				_mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+	}
+#elif defined(COMPOSITE_NEON)
+	for (; i + 8 <= count; i += 8) {
+		uint8x8x4_t d = vld4_u8(dst + 4 * i);
+		uint8x8x4_t s = vld4_u8(src + 4 * i);
+		uint8x8_t inverse = vmvn_u8(s.val[3]);
+
+		for (int c = 0; c < 4; ++c) {
+			uint16x8_t t = vmull_u8(d.val[c], inverse);
+
+			d.val[c] = vqadd_u8(s.val[c], vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8));
+		}
+		vst4_u8(dst + 4 * i, d);
+	}
+#endif
+	for (; i < count; ++i) {
+		unsigned int inverse = 255 - src[4 * i + 3];
+
+		for (int c = 0; c < 4; ++c)
+			dst[4 * i + c] = src[4 * i + c]
+					+ _div255(dst[4 * i + c] * inverse);
+	}
+}
+
+/**
+ * @brief Blends premultiplied RGBA over RGB888 pixels.
+ * @details With SSE2, four pixels at a time are widened to the layout of
+ *          _over_rgba(), the byte after each taking the place of alpha,
+ *          and narrowed back without touching that byte.
+ */
+static void _over_rgb(unsigned char *dst, const unsigned char *src,
+		int count) {
+	int i = 0;
+
+#if defined(COMPOSITE_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i half = _mm_set1_epi16(128);
+
+	/* The last pixel is read with the byte after it, so stop one short. */
+	for (; i + 5 <= count; i += 4) {
+		unsigned char *row = dst + 3 * i;
+		int pixels[4];
+
+		for (int p = 0; p < 4; ++p)
+			memcpy(&pixels[p], row + 3 * p, 4);
+		__m128i d = _mm_loadu_si128((const __m128i *) pixels);
+		__m128i s = _mm_loadu_si128((const __m128i *) (src + 4 * i));
+		__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+		__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+
+		__m128i a_lo = _mm_shufflehi_epi16(
+				_mm_shufflelo_epi16(s_lo, _MM_SHUFFLE(3, 3, 3, 3)),
+				_MM_SHUFFLE(3, 3, 3, 3));
+		__m128i a_hi = _mm_shufflehi_epi16(
+				_mm_shufflelo_epi16(s_hi, _MM_SHUFFLE(3, 3, 3, 3)),
+				_MM_SHUFFLE(3, 3, 3, 3));
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+				_mm_sub_epi16(full, a_lo)), half);
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+				_mm_sub_epi16(full, a_hi)), half);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		_mm_storeu_si128((__m128i *) pixels,
+				_mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+		for (int p = 0; p < 4; ++p)
+			memcpy(row + 3 * p, &pixels[p], 3);
+	}
+#elif defined(COMPOSITE_NEON)
+	for (; i + 8 <= count; i += 8) {
+		uint8x8x3_t d = vld3_u8(dst + 3 * i);
+		uint8x8x4_t s = vld4_u8(src + 4 * i);
+		uint8x8_t inverse = vmvn_u8(s.val[3]);
+
+		for (int c = 0; c < 3; ++c) {
+			uint16x8_t t = vmull_u8(d.val[c], inverse);
+
+			d.val[c] = vqadd_u8(s.val[c], vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8));
+		}
+		vst3_u8(dst + 3 * i, d);
+	}
+#endif
+	for (; i < count; ++i) {
+		unsigned int inverse = 255 - src[4 * i + 3];
+
+		for (int c = 0; c < 3; ++c)
+			dst[3 * i + c] = src[4 * i + c]
+					+ _div255(dst[3 * i + c] * inverse);
+	}
+}
+
+/**
+ * @brief Checks whether composite_apply() takes images in a color space.
+ */
+bool composite_supports(image_util_colorspace_e colorspace) {
+	switch (colorspace) {
+	case IMAGE_UTIL_COLORSPACE_RGB888:
+	case IMAGE_UTIL_COLORSPACE_RGBA8888:
+	case IMAGE_UTIL_COLORSPACE_BGRA8888:
+		return true;
+	default:
+		return composite_is_yuv(colorspace);
+	}
+}
+
+/**
+ * @brief Checks whether composite_apply() blends in YUV for a color space.
+ * @details 4:2:0 images are blended as they are, without going through
+ *          RGB.
+ */
+bool composite_is_yuv(image_util_colorspace_e colorspace) {
+	switch (colorspace) {
+	case IMAGE_UTIL_COLORSPACE_NV12:
+	case IMAGE_UTIL_COLORSPACE_NV21:
+	case IMAGE_UTIL_COLORSPACE_I420:
+	case IMAGE_UTIL_COLORSPACE_YV12:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Describes the planes of a base image.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT for a color space that
+ *         cannot be blended, otherwise IMAGE_UTIL_ERROR_INVALID_PARAMETER
+ */
+static int _describe_base(const image_buffer *image, composite_base *base) {
+	int width = image->width, height = image->height;
+	int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+	size_t size;
+
+	memset(base, 0, sizeof(composite_base));
+	if (width <= 0 || height <= 0 || image->data == NULL)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	switch (image->colorspace) {
+	case IMAGE_UTIL_COLORSPACE_RGB888:
+	case IMAGE_UTIL_COLORSPACE_RGBA8888:
+	case IMAGE_UTIL_COLORSPACE_BGRA8888: {
+		int bpp = (image->colorspace == IMAGE_UTIL_COLORSPACE_RGB888) ? 3 : 4;
+
+		base->planes[0] = (image_plane) { image->data, (ptrdiff_t) width * bpp,
+				width, height, bpp };
+		base->count = 1;
+		base->bgr = (image->colorspace == IMAGE_UTIL_COLORSPACE_BGRA8888);
+		size = (size_t) width * height * bpp;
+		break;
+	}
+	case IMAGE_UTIL_COLORSPACE_NV12:
+	case IMAGE_UTIL_COLORSPACE_NV21:
+		base->planes[0] = (image_plane) { image->data, width, width, height, 1 };
+		base->planes[1] = (image_plane) { image->data + (size_t) width * height,
+				(ptrdiff_t) chroma_width * 2, chroma_width, chroma_height, 2 };
+		base->shift[1] = 1;
+		base->count = 2;
+		base->vu = (image->colorspace == IMAGE_UTIL_COLORSPACE_NV21);
+		size = (size_t) width * height
+				+ (size_t) chroma_width * chroma_height * 2;
+		break;
+	case IMAGE_UTIL_COLORSPACE_I420:
+	case IMAGE_UTIL_COLORSPACE_YV12:
+		base->planes[0] = (image_plane) { image->data, width, width, height, 1 };
+		for (int p = 1; p < 3; ++p) {
+			base->planes[p] = (image_plane) { image->data
+					+ (size_t) width * height
+					+ (size_t) (p - 1) * chroma_width * chroma_height,
+					chroma_width, chroma_width, chroma_height, 1 };
+			base->shift[p] = 1;
+		}
+		base->count = 3;
+		base->vu = (image->colorspace == IMAGE_UTIL_COLORSPACE_YV12);
+		size = (size_t) width * height
+				+ (size_t) chroma_width * chroma_height * 2;
+		break;
+	default:
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+	}
+
+	base->yuv = (base->count > 1);
+	return (image->size >= size) ?
+			IMAGE_UTIL_ERROR_NONE : IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+}
+
+/**
+ * @brief Gets the alpha of an overlay pixel from its distance to the key.
+ */
+static unsigned int _key_alpha(const unsigned char *pixel,
+		const unsigned char *key) {
+	int distance = 0;
+
+	for (int c = 0; c < 3; ++c) {
+		int d = abs(pixel[c] - key[c]);
+
+		if (d > distance)
+			distance = d;
+	}
+	if (distance <= COMPOSITE_KEY_TOLERANCE)
+		return 0;
+	if (distance >= 2 * COMPOSITE_KEY_TOLERANCE)
+		return 255;
+	return (distance - COMPOSITE_KEY_TOLERANCE) * 255 / COMPOSITE_KEY_TOLERANCE;
+}
+
+/**
+ * @brief Scales an RGB888 overlay to premultiplied RGBA.
+ * @details Bilinear: each of the four source pixels is premultiplied by
+ *          its keyed alpha before being weighed, so the transparent
+ *          background does not bleed into the edges of the overlay.
+ *
+ * @param src The decoded overlay
+ * @param layer The layer, for its color key and opacity
+ * @param scaled_width The width of the whole scaled overlay
+ * @param scaled_height The height of the whole scaled overlay
+ * @param left The left edge of the part to compute, in the scaled overlay
+ * @param top The top edge of the part to compute, in the scaled overlay
+ * @param dst The width x height x 4 bytes receiving that part
+ */
+static void _resample(const image_buffer *src, const composite_layer *layer,
+		int scaled_width, int scaled_height, int left, int top,
+		unsigned char *dst, int width, int height) {
+	const unsigned char *key = src->data;
+	unsigned int opacity = (unsigned int) (layer->opacity * 255 + 0.5f);
+	ptrdiff_t stride = (ptrdiff_t) src->width * 3;
+
+	for (int y = top; y < top + height; ++y) {
+		/* Source coordinates of the pixel center, in 1/256 pixels. */
+		int sy = (int) (((int64_t) (2 * y + 1) * src->height * 128)
+				/ scaled_height) - 128;
+		if (sy < 0)
+			sy = 0;
+		int y0 = sy >> 8, fy = sy & 255;
+		int y1 = (y0 + 1 < src->height) ? y0 + 1 : y0;
+
+		for (int x = left; x < left + width; ++x, dst += 4) {
+			int sx = (int) (((int64_t) (2 * x + 1) * src->width * 128)
+					/ scaled_width) - 128;
+			if (sx < 0)
+				sx = 0;
+			int x0 = sx >> 8, fx = sx & 255;
+			int x1 = (x0 + 1 < src->width) ? x0 + 1 : x0;
+
+			const unsigned char *taps[4] = { src->data + y0 * stride + x0 * 3,
+					src->data + y0 * stride + x1 * 3, src->data + y1 * stride
+							+ x0 * 3, src->data + y1 * stride + x1 * 3 };
+			unsigned int weights[4] = { (256 - fx) * (256 - fy), fx * (256 - fy),
+					(256 - fx) * fy, fx * fy };
+			unsigned int sum[4] = { 0, 0, 0, 0 };
+
+			for (int t = 0; t < 4; ++t) {
+				unsigned int alpha = layer->color_key ?
+						_key_alpha(taps[t], key) : 255;
+
+				for (int c = 0; c < 3; ++c)
+					sum[c] += weights[t] * _div255(taps[t][c] * alpha);
+				sum[3] += weights[t] * alpha;
+			}
+			for (int c = 0; c < 4; ++c)
+				dst[c] = _div255(((sum[c] + 32768) >> 16) * opacity);
+		}
+	}
+}
+
+/**
+ * @brief Converts a premultiplied RGB pixel to premultiplied YUV.
+ * @details Full range BT.601, as in JPEG. U and V are premultiplied around
+ *          their 128 bias, so that they blend like Y.
+ */
+static void _to_yuv(const unsigned char *rgba, int *y, int *u, int *v) {
+	int r = rgba[0], g = rgba[1], b = rgba[2], a = rgba[3];
+	int bias = (128 * a + 127) / 255;
+
+	*y = (77 * r + 150 * g + 29 * b + 128) >> 8;
+	*u = bias + (-43 * r - 85 * g + 128 * b) / 256;
+	*v = bias + (128 * r - 107 * g - 21 * b) / 256;
+	if (*y > a)
+		*y = a;
+	*u = (*u < 0) ? 0 : (*u > a) ? a : *u;
+	*v = (*v < 0) ? 0 : (*v > a) ? a : *v;
+}
+
+/**
+ * @brief Splits a premultiplied RGBA overlay into the planes of a YUV base.
+ * @details Luma keeps the overlay's alpha; every chroma sample averages
+ *          its 2x2 block, alpha included.
+ */
+static void _split_yuv(const composite_base *base, const unsigned char *rgba,
+		int width, int height, composite_overlay *overlay,
+		unsigned char *free_space) {
+	int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+	overlay_plane *luma = &overlay->planes[0];
+
+	*luma = (overlay_plane) { free_space, free_space + (size_t) width * height,
+			width, width, height };
+	free_space += 2 * (size_t) width * height;
+
+	if (base->count == 2) {
+		/* Interleaved chroma; each alpha byte is doubled to match. */
+		overlay->planes[1] = (overlay_plane) { free_space, free_space
+				+ (size_t) chroma_width * chroma_height * 2,
+				(ptrdiff_t) chroma_width * 2, chroma_width, chroma_height };
+	} else {
+		size_t plane_size = (size_t) chroma_width * chroma_height;
+		unsigned char *alpha = free_space + 2 * plane_size;
+
+		overlay->planes[1] = (overlay_plane) { free_space, alpha, chroma_width,
+				chroma_width, chroma_height };
+		overlay->planes[2] = (overlay_plane) { free_space + plane_size, alpha,
+				chroma_width, chroma_width, chroma_height };
+	}
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			const unsigned char *pixel = rgba + ((size_t) y * width + x) * 4;
+			int Y, U, V;
+
+			_to_yuv(pixel, &Y, &U, &V);
+			luma->samples[y * width + x] = Y;
+			luma->alpha[y * width + x] = pixel[3];
+		}
+	}
+
+	for (int cy = 0; cy < chroma_height; ++cy) {
+		for (int cx = 0; cx < chroma_width; ++cx) {
+			int sum_u = 0, sum_v = 0, sum_a = 0, n = 0;
+
+			for (int y = 2 * cy; y < 2 * cy + 2 && y < height; ++y) {
+				for (int x = 2 * cx; x < 2 * cx + 2 && x < width; ++x) {
+					const unsigned char *pixel = rgba
+							+ ((size_t) y * width + x) * 4;
+					int Y, U, V;
+
+					_to_yuv(pixel, &Y, &U, &V);
+					sum_u += U;
+					sum_v += V;
+					sum_a += pixel[3];
+					n++;
+				}
+			}
+
+			int first = (sum_u + n / 2) / n, second = (sum_v + n / 2) / n;
+			int alpha = (sum_a + n / 2) / n;
+			if (base->vu) {
+				int swap = first;
+
+				first = second;
+				second = swap;
+			}
+
+			if (base->count == 2) {
+				overlay_plane *uv = &overlay->planes[1];
+				unsigned char *samples = uv->samples + cy * uv->stride + 2 * cx;
+				unsigned char *alphas = uv->alpha + cy * uv->stride + 2 * cx;
+
+				samples[0] = first;
+				samples[1] = second;
+				alphas[0] = alphas[1] = alpha;
+			} else {
+				size_t offset = (size_t) cy * chroma_width + cx;
+
+				overlay->planes[1].samples[offset] = first;
+				overlay->planes[2].samples[offset] = second;
+				overlay->planes[1].alpha[offset] = alpha;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Decodes an overlay and converts it for a base image.
+ * @details The decoded overlay comes from the frame cache, so the
+ *          stickers shared by the images of a batch are decoded once. Only
+ *          the part of the scaled overlay that is on the base is computed;
+ *          an overlay entirely off the base gets empty planes.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+static int _prepare(const composite_base *base, const composite_layer *layer,
+		composite_overlay *overlay) {
+	frame_handle *frame = NULL;
+
+	memset(overlay, 0, sizeof(composite_overlay));
+	int error_code = frame_cache_decode(layer->path, IMAGE_UTIL_DOWNSCALE_1_1,
+			&frame);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+
+	const image_buffer *src = frame_cache_image(frame);
+	float scale = (layer->scale > 0) ? layer->scale : 1;
+	int scaled_width = (int) (src->width * scale + 0.5f);
+	int scaled_height = (int) (src->height * scale + 0.5f);
+	if (scaled_width < 1)
+		scaled_width = 1;
+	if (scaled_height < 1)
+		scaled_height = 1;
+
+	const image_plane *whole = &base->planes[0];
+	int x = (layer->x < 0) ? (whole->width - scaled_width) / 2 : layer->x;
+	int y = (layer->y < 0) ? (whole->height - scaled_height) / 2 : layer->y;
+	if (base->yuv) {
+		/* Chroma is sampled on even pixels of the base. */
+		x &= ~1;
+		y &= ~1;
+	}
+
+	/* Clip to the base; the corner stays even as the base's is. */
+	overlay->x = (x > 0) ? x : 0;
+	overlay->y = (y > 0) ? y : 0;
+	int64_t right = (int64_t) x + scaled_width;
+	int64_t bottom = (int64_t) y + scaled_height;
+	int width = (int) (((right < whole->width) ? right : whole->width)
+			- overlay->x);
+	int height = (int) (((bottom < whole->height) ? bottom : whole->height)
+			- overlay->y);
+	if (width <= 0 || height <= 0) {
+		frame_cache_release(frame);
+		return IMAGE_UTIL_ERROR_NONE;
+	}
+
+	/* At most 4 bytes of RGBA, 2 of luma and 6 of chroma per pixel. */
+	if ((size_t) width > SIZE_MAX / 12 / (size_t) height) {
+		frame_cache_release(frame);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+	size_t pixels = (size_t) width * height;
+	size_t size = pixels * 4;
+	if (base->yuv)
+		size += 2 * pixels + 3 * (size_t) ((width + 1) / 2)
+				* ((height + 1) / 2) * 2;
+
+	overlay->buffer = scratch_get(size);
+	if (overlay->buffer == NULL) {
+		frame_cache_release(frame);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+
+	_resample(src, layer, scaled_width, scaled_height, overlay->x - x,
+			overlay->y - y, overlay->buffer, width, height);
+	frame_cache_release(frame);
+
+	if (base->yuv) {
+		_split_yuv(base, overlay->buffer, width, height, overlay,
+				overlay->buffer + pixels * 4);
+	} else {
+		overlay->planes[0] = (overlay_plane) { overlay->buffer, NULL,
+				(ptrdiff_t) width * 4, width, height };
+		if (base->bgr) {
+			for (size_t i = 0; i < pixels; ++i) {
+				unsigned char red = overlay->buffer[4 * i];
+
+				overlay->buffer[4 * i] = overlay->buffer[4 * i + 2];
+				overlay->buffer[4 * i + 2] = red;
+			}
+		}
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Blends the rows [first, last) of one plane of an overlay.
+ *
+ * @param shift The subsampling of the plane
+ */
+static void _blend_rows(const image_plane *dst, int shift,
+		const composite_overlay *overlay, const overlay_plane *src, int first,
+		int last) {
+	int x = overlay->x >> shift, y = overlay->y >> shift;
+	int x0 = (x > 0) ? x : 0;
+	int x1 = (x + src->width < dst->width) ? x + src->width : dst->width;
+	int y0 = (y > first) ? y : first;
+	int y1 = (y + src->height < last) ? y + src->height : last;
+
+	if (y1 > dst->height)
+		y1 = dst->height;
+	if (x0 >= x1)
+		return;
+
+	int count = x1 - x0;
+	for (int row = y0; row < y1; ++row) {
+		unsigned char *d = dst->data + row * dst->stride + x0 * dst->bpp;
+		ptrdiff_t offset = (row - y) * src->stride;
+
+		switch (dst->bpp) {
+		case 4:
+			_over_rgba(d, src->samples + offset + (x0 - x) * 4, count);
+			break;
+		case 3:
+			_over_rgb(d, src->samples + offset + (x0 - x) * 4, count);
+			break;
+		default:
+			_over_bytes(d, src->samples + offset + (x0 - x) * dst->bpp,
+					src->alpha + offset + (x0 - x) * dst->bpp,
+					count * dst->bpp);
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Blends overlays onto an image, in place.
+ * @details The overlays are scaled, keyed and premultiplied once, in the
+ *          layout of the image. Blending then goes over the image in bands
+ *          of COMPOSITE_TILE_ROWS rows, each blended by every overlay in
+ *          turn while it is in cache, with SIMD kernels. RGB images are
+ *          blended in RGB and 4:2:0 images in YUV, without converting the
+ *          image; the position of an overlay on those is rounded down to
+ *          even pixels.
+ *
+ * @param image The image, in a color space composite_supports()
+ * @param spec The overlays; may be NULL for none
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int composite_apply(image_buffer *image, const composite_spec *spec) {
+	composite_overlay overlays[COMPOSITE_MAX_LAYERS];
+	composite_base base;
+	unsigned int prepared = 0;
+
+	if (spec == NULL || spec->count == 0)
+		return IMAGE_UTIL_ERROR_NONE;
+	if (spec->count > COMPOSITE_MAX_LAYERS)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	uint64_t start = monotonic_us();
+	int error_code = _describe_base(image, &base);
+	while (error_code == IMAGE_UTIL_ERROR_NONE && prepared < spec->count) {
+		error_code = _prepare(&base, &spec->layers[prepared],
+				&overlays[prepared]);
+		if (error_code == IMAGE_UTIL_ERROR_NONE)
+			prepared++;
+	}
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot blend %u overlays: %s",
+				spec->count, get_error_message(error_code));
+		__atomic_add_fetch(&composite_stats.failures, 1, __ATOMIC_RELAXED);
+		goto out;
+	}
+
+	uint64_t blend_start = monotonic_us();
+	for (int first = 0; first < image->height; first += COMPOSITE_TILE_ROWS) {
+		int last = first + COMPOSITE_TILE_ROWS;
+
+		for (unsigned int i = 0; i < prepared; ++i) {
+			for (int p = 0; p < base.count; ++p) {
+				int shift = base.shift[p];
+
+				_blend_rows(&base.planes[p], shift, &overlays[i],
+						&overlays[i].planes[p], first >> shift,
+						(last + (1 << shift) - 1) >> shift);
+			}
+		}
+	}
+
+	uint64_t pixels = 0;
+	for (unsigned int i = 0; i < prepared; ++i)
+		pixels += (uint64_t) overlays[i].planes[0].width
+				* overlays[i].planes[0].height;
+	__atomic_add_fetch(&composite_stats.images, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&composite_stats.layers, prepared, __ATOMIC_RELAXED);
+	if (base.yuv)
+		__atomic_add_fetch(&composite_stats.yuv_layers, prepared,
+				__ATOMIC_RELAXED);
+	__atomic_add_fetch(&composite_stats.pixels, pixels, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&composite_stats.prepare_us, blend_start - start,
+			__ATOMIC_RELAXED);
+	__atomic_add_fetch(&composite_stats.blend_us,
+			monotonic_us() - blend_start, __ATOMIC_RELAXED);
+
+out:
+	for (unsigned int i = 0; i < prepared; ++i)
+		scratch_put(overlays[i].buffer);
+	return error_code;
+}
+
+static bool _parse_number(const char **value, float *number) {
+	char *end;
+
+	errno = 0;
+	*number = strtof(*value, &end);
+	if (errno != 0 || end == *value)
+		return false;
+	*value = end;
+	return true;
+}
+
+/**
+ * @brief Parses an overlay: "PATH@X,Y[,SCALE[,OPACITY[,KEY]]]".
+ * @details SCALE and OPACITY default to 1; KEY is "key", the default, or
+ *          "nokey" for an overlay drawn with its background.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise
+ *         IMAGE_UTIL_ERROR_INVALID_PARAMETER
+ */
+int composite_parse_layer(const char *value, composite_layer *layer) {
+	const char *at = strrchr(value, '@');
+	float x, y;
+
+	if (at == NULL || at == value || at - value >= BUFLEN)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	memset(layer, 0, sizeof(composite_layer));
+	memcpy(layer->path, value, at - value);
+	layer->scale = 1;
+	layer->opacity = 1;
+	layer->color_key = true;
+
+	value = at + 1;
+	if (!_parse_number(&value, &x) || *value++ != ','
+			|| !_parse_number(&value, &y))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (*value == ',') {
+		value++;
+		if (!_parse_number(&value, &layer->scale))
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	}
+	if (*value == ',') {
+		value++;
+		if (!_parse_number(&value, &layer->opacity))
+			return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	}
+	if (strcmp(value, ",nokey") == 0)
+		layer->color_key = false;
+	else if (*value != '\0' && strcmp(value, ",key") != 0)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	if (x != (int) x || y != (int) y || x > 65535 || y > 65535
+			|| !(layer->scale > 0 && layer->scale <= COMPOSITE_MAX_SCALE)
+			|| !(layer->opacity >= 0 && layer->opacity <= 1))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	layer->x = (x < 0) ? -1 : (int) x;
+	layer->y = (y < 0) ? -1 : (int) y;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Prints the compositing statistics to the log.
+ */
+void composite_log_stats(void) {
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Composite: %u images, %u layers (%u in YUV), %u failures, %llu overlay pixels, prepare %llu us, blend %llu us",
+			__atomic_load_n(&composite_stats.images, __ATOMIC_RELAXED),
+			__atomic_load_n(&composite_stats.layers, __ATOMIC_RELAXED),
+			__atomic_load_n(&composite_stats.yuv_layers, __ATOMIC_RELAXED),
+			__atomic_load_n(&composite_stats.failures, __ATOMIC_RELAXED),
+			(unsigned long long) __atomic_load_n(&composite_stats.pixels,
+					__ATOMIC_RELAXED),
+			(unsigned long long) __atomic_load_n(&composite_stats.prepare_us,
+					__ATOMIC_RELAXED),
+			(unsigned long long) __atomic_load_n(&composite_stats.blend_us,
+					__ATOMIC_RELAXED));
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "main.h"
+#include "concurrency.h"
+#include "scheduler.h"
+#include <tizen.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * An AIMD controller of the batch limit of the scheduler. Every
+ * measurement compares the throughput of the batch jobs, in decoded pixels
+ * per second (or jobs per second when their sizes are unknown), with the
+ * one before:
+ *   - while there is queued work, one more job is allowed (additive
+ *     increase);
+ *   - if the throughput fell, or jobs run much slower than they did alone,
+ *     the device is oversubscribed and the limit drops by a quarter
+ *     (multiplicative decrease);
+ *   - if the job added last brought no throughput, it is taken back.
+ * After a decrease or a take back the limit is held for a while before
+ * probing again.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+	bool paused;
+	unsigned int resume_limit;
+	/* Where the current measurement started. */
+	scheduler_load start;
+	uint64_t start_us;
+	/* The previous measurement. */
+	unsigned int last_limit;
+	double last_rate;
+	bool last_by_pixels;
+	/* The lowest run time per unit of work seen. */
+	double best_latency;
+	unsigned int hold;
+	/* Statistics. */
+	unsigned int measurements;
+	unsigned int increases;
+	unsigned int decreases;
+	unsigned int take_backs;
+	unsigned int pauses;
+} ctl = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Starts a new measurement.
+ * @remarks Must be called with ctl.lock held.
+ *
+ * @param forget Whether the previous measurement no longer compares
+ */
+static void _restart(bool forget) {
+	scheduler_sample(&ctl.start);
+	ctl.start_us = monotonic_us();
+	if (forget)
+		ctl.last_rate = 0;
+}
+
+/**
+ * @brief Ends the current measurement, if it is long enough, and adjusts
+ *        the batch limit.
+ * @remarks Must be called with ctl.lock held.
+ */
+static void _step(void) {
+	scheduler_load load;
+	uint64_t now = monotonic_us();
+
+	scheduler_sample(&load);
+	uint64_t finished = load.finished - ctl.start.finished;
+	uint64_t pixels = load.pixels - ctl.start.pixels;
+	uint64_t elapsed_us = now - ctl.start_us;
+	bool demand = load.batch_queued > 0;
+
+	if (finished == 0 && !demand) {
+		/* Idle: whatever comes next is a new workload. */
+		_restart(true);
+		return;
+	}
+	if (finished < load.batch_limit
+			&& elapsed_us < CONCURRENCY_MAX_PERIODS * CONCURRENCY_PERIOD_MS
+					* 1000ULL)
+		return;
+	if (finished == 0) {
+		/* Jobs longer than a measurement; nothing to learn from. */
+		_restart(false);
+		return;
+	}
+
+	bool by_pixels = (pixels > 0);
+	double work = by_pixels ? (double) pixels : (double) finished;
+	double rate = work * 1e6 / elapsed_us;
+	double latency = (double) (load.run_us - ctl.start.run_us) / work;
+	bool comparable = (ctl.last_rate > 0 && ctl.last_by_pixels == by_pixels);
+	unsigned int limit = load.batch_limit;
+
+	ctl.measurements++;
+	if (ctl.best_latency == 0 || latency < ctl.best_latency
+			|| ctl.last_by_pixels != by_pixels)
+		ctl.best_latency = latency;
+
+	if (comparable && (rate < ctl.last_rate * (1 - CONCURRENCY_TOLERANCE)
+			|| latency > ctl.best_latency * CONCURRENCY_MAX_SLOWDOWN)
+			&& limit > 1) {
+		unsigned int decreased = limit * 3 / 4;
+
+		limit = (decreased < limit - 1) ? decreased : limit - 1;
+		ctl.hold = CONCURRENCY_HOLD;
+		ctl.decreases++;
+	} else if (comparable && limit > ctl.last_limit
+			&& rate < ctl.last_rate * (1 + CONCURRENCY_TOLERANCE)) {
+		limit = ctl.last_limit;
+		ctl.hold = CONCURRENCY_HOLD;
+		ctl.take_backs++;
+	} else if (ctl.hold > 0) {
+		ctl.hold--;
+	} else if (demand && limit < load.workers) {
+		limit++;
+		ctl.increases++;
+	}
+
+	if (limit != load.batch_limit)
+		dlog_print(DLOG_DEBUG, LOG_TAG,
+				"Concurrency: %u -> %u batch jobs at %.1f %s/s, %.1f us per %s",
+				load.batch_limit, limit, by_pixels ? rate / 1e6 : rate,
+				by_pixels ? "Mpixels" : "images",
+				by_pixels ? latency * 1e6 : latency,
+				by_pixels ? "Mpixel" : "image");
+
+	ctl.last_limit = load.batch_limit;
+	ctl.last_rate = rate;
+	ctl.last_by_pixels = by_pixels;
+	scheduler_set_batch_limit(limit);
+	_restart(false);
+}
+
+static void *_controller(void *data) {
+	pthread_mutex_lock(&ctl.lock);
+	while (ctl.running) {
+		struct timespec deadline;
+
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += CONCURRENCY_PERIOD_MS * 1000000L;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+
+		int error = 0;
+		while (ctl.running && error != ETIMEDOUT)
+			error = pthread_cond_timedwait(&ctl.cond, &ctl.lock, &deadline);
+
+		if (ctl.running && !ctl.paused)
+			_step();
+	}
+	pthread_mutex_unlock(&ctl.lock);
+	return NULL;
+}
+
+/**
+ * @brief Starts adjusting the batch limit of the scheduler. Safe to call
+ *        more than once.
+ * @details The limit starts at CONCURRENCY_INITIAL_LIMIT jobs and grows
+ *          while that raises the throughput. Call after scheduler_init().
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int concurrency_start(void) {
+	pthread_condattr_t attr;
+
+	pthread_mutex_lock(&ctl.lock);
+	if (ctl.running) {
+		pthread_mutex_unlock(&ctl.lock);
+		return IMAGE_UTIL_ERROR_NONE;
+	}
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ctl.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	ctl.running = true;
+	ctl.hold = 0;
+	ctl.best_latency = 0;
+	ctl.last_limit = 0;
+	if (!ctl.paused)
+		scheduler_set_batch_limit(CONCURRENCY_INITIAL_LIMIT);
+	_restart(true);
+
+	if (pthread_create(&ctl.thread, NULL, _controller, NULL) != 0) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "pthread_create() failed");
+		ctl.running = false;
+		pthread_cond_destroy(&ctl.cond);
+		pthread_mutex_unlock(&ctl.lock);
+		scheduler_set_batch_limit(UINT_MAX);
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	}
+	pthread_mutex_unlock(&ctl.lock);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Stops adjusting the batch limit, which stays where it is.
+ * @details Call before scheduler_shutdown().
+ */
+void concurrency_stop(void) {
+	pthread_mutex_lock(&ctl.lock);
+	if (!ctl.running) {
+		pthread_mutex_unlock(&ctl.lock);
+		return;
+	}
+	ctl.running = false;
+	pthread_cond_signal(&ctl.cond);
+	pthread_mutex_unlock(&ctl.lock);
+
+	pthread_join(ctl.thread, NULL);
+	pthread_cond_destroy(&ctl.cond);
+}
+
+/**
+ * @brief Drops to CONCURRENCY_PAUSED_LIMIT batch jobs while the
+ *        application is in the background.
+ * @details Interactive jobs are not limited.
+ */
+void concurrency_pause(void) {
+	scheduler_load load;
+
+	pthread_mutex_lock(&ctl.lock);
+	if (!ctl.paused) {
+		scheduler_sample(&load);
+		ctl.resume_limit = load.batch_limit;
+		ctl.paused = true;
+		ctl.pauses++;
+		scheduler_set_batch_limit(CONCURRENCY_PAUSED_LIMIT);
+		dlog_print(DLOG_INFO, LOG_TAG, "Concurrency: paused at %u batch jobs",
+				CONCURRENCY_PAUSED_LIMIT);
+	}
+	pthread_mutex_unlock(&ctl.lock);
+}
+
+/**
+ * @brief Goes back to the batch limit the application had before
+ *        concurrency_pause().
+ * @details The controller then measures afresh: the device may be busier
+ *          or cooler than when the application left.
+ */
+void concurrency_resume(void) {
+	pthread_mutex_lock(&ctl.lock);
+	if (ctl.paused) {
+		ctl.paused = false;
+		ctl.hold = 0;
+		scheduler_set_batch_limit(ctl.resume_limit);
+		_restart(true);
+		dlog_print(DLOG_INFO, LOG_TAG, "Concurrency: resumed at %u batch jobs",
+				ctl.resume_limit);
+	}
+	pthread_mutex_unlock(&ctl.lock);
+}
+
+/**
+ * @brief Prints the controller statistics to the log.
+ */
+void concurrency_log_stats(void) {
+	scheduler_load load;
+
+	scheduler_sample(&load);
+	pthread_mutex_lock(&ctl.lock);
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Concurrency: %u of %u workers for batch jobs, %u measurements, %u increases, %u decreases, %u taken back, %u pauses",
+			load.batch_limit, load.workers, ctl.measurements, ctl.increases,
+			ctl.decreases, ctl.take_backs, ctl.pauses);
+	pthread_mutex_unlock(&ctl.lock);
+}
@@ -16,28 +16,57 @@
 
 #include "main.h"
 #include "data.h"
+#include "job.h"
+#include "backend.h"
+#include "scheduler.h"
+#include "concurrency.h"
+#include "memgov.h"
+#include "lazy.h"
+#include "frame_cache.h"
+#include "arena.h"
+#include "lossless.h"
+#include "report.h"
+#include "probe.h"
+#include "trace.h"
 #include <image_util.h>
 #include <storage.h>
 #include <dirent.h>
 #include <sys/stat.h>
 
-#define BUFLEN 256
+/* A finished job, handed from a worker thread to the main loop. */
+typedef struct {
+	char input_path[BUFLEN];
+	job_priority priority;
+	pipeline_result result;
+	/* Span of the handoff to the main loop. */
+	uint64_t handoff_span;
+} job_report;
+
+/* A phase of a preview, sent to the main loop. */
+typedef struct {
+	image_buffer jpeg;
+	lazy_phase phase;
+} preview_image;
 
 static Evas_Object *image;
-static transformation_h handle = NULL;
-static media_packet_h media_packet = NULL;
+static Evas_Object *preview_button;
+static Evas_Object *cancel_button;
 static char *images_directory = NULL;
-static char image_util_filename_encoded[BUFLEN];
 static const char *resource_path;
 static const char img_res_path[BUFLEN];
 static bool transform_finished = false;
-static media_packet_h packet_h;
+static cancel_token *batch_token = NULL;
+static unsigned int batch_pending = 0;
+static batch_report *batch_results = NULL;
+static batch_summary batch_totals;
+static cancel_token *preview_token = NULL;
+static unsigned int preview_index = 0;
+static bool tracing = false;
 
 extern struct view_info s_info;
 
 /**
- * @brief Destroys the transformation handle and enables the buttons.
- * @details Called once for each supported JPEG encode/decode color space.
+ * @brief Enables the buttons once the transformation is finished.
  * @remarks This function matches the Ecore_Task_Cb()
  *          type signature defined in the EFL API.
  *
@@ -47,12 +76,16 @@ extern struct view_info s_info;
  */
 Eina_Bool _btn_enable(void *data) {
 	if (transform_finished) {
-
-		image_util_transform_destroy(handle);
-		handle = NULL;
-
-		media_packet_destroy(packet_h);
-		packet_h = NULL;
+		backend_log_stats();
+		scheduler_log_stats();
+		concurrency_log_stats();
+		memgov_log_stats();
+		lazy_log_stats();
+		frame_cache_log_stats();
+		arena_log_stats();
+		lossless_log_stats();
+		probe_log_stats();
+		trace_log_stats();
 
 		for (app_button i = 0; i < BUTTON_COUNT; ++i)
 			_disable_button(i, EINA_FALSE);
@@ -62,82 +95,6 @@ Eina_Bool _btn_enable(void *data) {
 	return EINA_TRUE;
 }
 
-/**
- * @brief Stores the image after the transformation.
- * @details Called when the transformation of the image is finished.
- *
- * @param dst The result buffer of image util transform
- * @param error_code The error code of image util transform
- * @param user_data The user data passed from the callback registration function
- */
-static void _image_util_completed_cb(media_packet_h *dst, int error_code,
-		void *user_data) {
-	packet_h = *dst;
-	PRINT_MSG("Transformation finished!");
-	//dlog_print(DLOG_DEBUG, LOG_TAG, "Transformation finished.");
-	if (error_code != IMAGE_UTIL_ERROR_NONE || dst == NULL) {
-		dlog_print(DLOG_ERROR, LOG_TAG,
-				"An error occurred during transformation.<br>Error code: %d.",
-				error_code);
-		PRINT_MSG("An error occurred during transformation.");
-	} else {
-		/* Get the transformed image format. */
-		media_format_h fmt = NULL;
-
-		int error_code = media_packet_get_format(*dst, &fmt);
-		if (error_code != MEDIA_PACKET_ERROR_NONE) {
-			DLOG_PRINT_ERROR("media_packet_get_format", error_code);
-			PRINT_MSG("error media_packet_get_format");
-			image_util_transform_destroy(handle);
-			return;
-		}
-
-		/* Get the transformed image dimensions and MIME type. */
-		media_format_mimetype_e mimetype;
-		int width, height;
-
-		error_code = media_format_get_video_info(fmt, &mimetype, &width,
-				&height, NULL, NULL);
-		if (error_code != MEDIA_FORMAT_ERROR_NONE) {
-			DLOG_PRINT_ERROR("media_format_get_video_info", error_code);
-			media_format_unref(fmt);
-			image_util_transform_destroy(handle);
-			return;
-		}
-		/* Release the memory allocated for the media format. */
-		media_format_unref(fmt);
-
-		/* Get the buffer where the transformed image is stored. */
-		void *packet_buffer = NULL;
-
-		error_code = media_packet_get_buffer_data_ptr(*dst, &packet_buffer);
-		if (error_code != MEDIA_PACKET_ERROR_NONE) {
-			DLOG_PRINT_ERROR("media_packet_get_buffer_data_ptr", error_code);
-			PRINT_MSG("error media_packet_get_buffer_data_ptr");
-			image_util_transform_destroy(handle);
-			return;
-		}
-
-		if (mimetype == MEDIA_FORMAT_NV12) {
-			/* Store the image from the buffer in a file. */
-			error_code = image_util_encode_jpeg(packet_buffer, width, height,
-					IMAGE_UTIL_COLORSPACE_NV12, 100,
-					image_util_filename_encoded);
-			if (error_code != IMAGE_UTIL_ERROR_NONE) {
-				DLOG_PRINT_ERROR("image_util_encode_jpeg", error_code);
-				PRINT_MSG("error image_util_encode_jpeg");
-				image_util_transform_destroy(handle);
-				return;
-			}
-
-			DLOG_PRINT_DEBUG_MSG("Transformed image file saved at %s",
-					image_util_filename_encoded);
-
-		}
-	}
-	transform_finished = true;
-}
-
 /**
  * @brief Maps the image util color space to its string representation.
  *
@@ -214,10 +171,338 @@ static bool _image_util_supported_jpeg_colorspace_cb(
 	return true;
 }
 
+/**
+ * @brief Adds the outcome of a batch job to the totals of the batch.
+ */
+static void _count_result(const pipeline_result *result) {
+	if (result->cancelled)
+		batch_totals.cancelled++;
+	else if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+		batch_totals.failed++;
+	else
+		batch_totals.succeeded++;
+}
+
+/**
+ * @brief Ends the running batch and writes its report.
+ * @details The JSON report lists every file with its status, error, stage
+ *          and timings, and goes to the data directory of the application.
+ *          So does the trace, when TRACE_ENV is set.
+ */
+static void _finish_batch(void) {
+	char path[BUFLEN];
+	char *data_path = app_get_data_path();
+
+	PRINT_MSG("Transformation finished!");
+	PRINT_MSG("%u succeeded, %u failed, %u cancelled", batch_totals.succeeded,
+			batch_totals.failed, batch_totals.cancelled);
+
+	if (batch_results != NULL && data_path != NULL) {
+		snprintf(path, BUFLEN, "%s" BATCH_REPORT_FILE, data_path);
+		int error_code = report_write_json(batch_results, &batch_totals, path);
+		if (error_code == IMAGE_UTIL_ERROR_NONE)
+			PRINT_MSG("Report: %s", path);
+		else
+			DLOG_PRINT_ERROR("report_write_json", error_code);
+	}
+	if (tracing && data_path != NULL) {
+		snprintf(path, BUFLEN, "%s" TRACE_FILE, data_path);
+		int error_code = trace_write_json(path, 0);
+		if (error_code == IMAGE_UTIL_ERROR_NONE)
+			PRINT_MSG("Trace: %s", path);
+		else
+			DLOG_PRINT_ERROR("trace_write_json", error_code);
+	}
+	free(data_path);
+
+	report_destroy(batch_results);
+	batch_results = NULL;
+	cancel_token_unref(batch_token);
+	batch_token = NULL;
+	transform_finished = true;
+}
+
+/**
+ * @brief Prints the outcome of a job.
+ * @details Called in the main loop for every finished job.
+ * @remarks This function matches the Ecore_Cb() type signature
+ *          defined in the EFL API.
+ *
+ * @param data The job_report sent by _job_done_cb()
+ */
+static void _job_done_main_cb(void *data) {
+	job_report *report = data;
+	const pipeline_result *result = &report->result;
+	const char *name = strrchr(report->input_path, '/');
+
+	name = (name != NULL) ? name + 1 : report->input_path;
+	trace_end("handoff", report->handoff_span, name);
+
+	if (report->priority == JOB_PRIORITY_BATCH)
+		_count_result(result);
+
+	if (result->cancelled) {
+		PRINT_MSG("img: %s cancelled before %s", name,
+				pipeline_stage_name(result->stage));
+	} else if (result->error_code != IMAGE_UTIL_ERROR_NONE) {
+		PRINT_MSG("img: %s failed in %s (error %d)", name,
+				pipeline_stage_name(result->stage), result->error_code);
+	} else {
+		PRINT_MSG("img: %s done on the %s backend in %u ms (queued %u ms)",
+				name, result->backend,
+				(unsigned int) (result->run_us / 1000),
+				(unsigned int) (result->queued_us / 1000));
+	}
+
+	if (report->priority == JOB_PRIORITY_BATCH && batch_pending > 0
+			&& --batch_pending == 0)
+		_finish_batch();
+
+	free(report);
+}
+
+/**
+ * @brief Forwards the outcome of a job to the main loop.
+ * @remarks This function matches the scheduler_done_cb() type signature;
+ *          it is called on a worker thread.
+ *
+ * @param job The finished job
+ * @param result The outcome of the job
+ * @param user_data The job_report allocated when the job was submitted, so
+ *                  that every outcome reaches the main loop
+ */
+static void _job_done_cb(transform_job *job, pipeline_result *result,
+		void *user_data) {
+	job_report *report = user_data;
+
+	snprintf(report->input_path, BUFLEN, "%s", job->input_path);
+	report->priority = job->priority;
+	report->result = *result;
+	report->handoff_span = trace_begin();
+
+	if (job->priority == JOB_PRIORITY_BATCH)
+		report_add_result(batch_results, job, result);
+
+	ecore_main_loop_thread_safe_call_async(_job_done_main_cb, report);
+}
+
+/**
+ * @brief Fills in a job with the settings entered in the UI.
+ *
+ * @param job The job to initialize
+ * @param priority The priority of the job
+ */
+static void _init_job(transform_job *job, job_priority priority) {
+	memset(job, 0, sizeof(transform_job));
+
+	/* Set the color space the image color space will be converted to. */
+	job->colorspace = IMAGE_UTIL_COLORSPACE_NV12;
+	job->quality = 100;
+	job->priority = priority;
+
+	/* Set new values for the width and height the image will be resized to. */
+	job->width = atoi(elm_entry_entry_get(s_info.width));
+	job->height = atoi(elm_entry_entry_get(s_info.height));
+}
+
+/**
+ * @brief Adds the geometry of a button's mode to a job.
+ *
+ * @param job The job, initialized with _init_job()
+ * @param button The button that was clicked
+ * @return The prefix of the output file names of the mode
+ */
+static const char *_init_job_geometry(transform_job *job, app_button button) {
+	switch (button) {
+	case ROTATE_BTN:
+		job->rotation = 90;
+		PRINT_MSG("Rotation set to 90 degrees clockwise");
+		return "rotated_";
+
+	case CROP_BTN:
+		/* Cut the entered size out of the center, without resizing. */
+		job->crop_x = -1;
+		job->crop_y = -1;
+		job->crop_width = job->width;
+		job->crop_height = job->height;
+		job->width = 0;
+		job->height = 0;
+		PRINT_MSG("Crop set to the central %ux%u pixels", job->crop_width,
+				job->crop_height);
+		return "cropped_";
+
+	default:
+		return "";
+	}
+}
+
+/**
+ * @brief Gets the path of the n-th regular file in the resource directory.
+ *
+ * @param n The index of the file; wraps around
+ * @param path The buffer of BUFLEN bytes receiving the path
+ * @return @c true if a file was found
+ */
+static bool _nth_resource_file(unsigned int n, char *path) {
+	unsigned int count = 0;
+	bool found = false;
+
+	/* Count the files first, so that n can wrap around. */
+	for (int pass = 0; pass < 2 && !found; ++pass) {
+		DIR *res = opendir(resource_path);
+		struct dirent *entry;
+		struct stat buf;
+		unsigned int i = 0;
+
+		if (res == NULL)
+			return false;
+
+		while ((entry = readdir(res)) != NULL) {
+			snprintf(path, BUFLEN, "%s/%s", resource_path, entry->d_name);
+			if (stat(path, &buf) != 0 || !S_ISREG(buf.st_mode))
+				continue;
+
+			if (pass == 1 && i == n % count) {
+				found = true;
+				break;
+			}
+			++i;
+		}
+		closedir(res);
+
+		count = i;
+		if (count == 0)
+			return false;
+	}
+	return found;
+}
+
+/**
+ * @brief Shows a preview image.
+ * @details The low resolution draft is scaled up to the size of the image
+ *          it stands for, until the final image replaces it.
+ * @remarks This function matches the Ecore_Cb() type signature
+ *          defined in the EFL API.
+ *
+ * @param data The preview_image sent by _preview_result_cb()
+ */
+static void _preview_show_main_cb(void *data) {
+	preview_image *preview = data;
+	image_buffer *jpeg = &preview->jpeg;
+
+	elm_image_memfile_set(image, jpeg->data, jpeg->size, "jpg", NULL);
+	if (preview->phase == LAZY_PHASE_PREVIEW)
+		PRINT_MSG("Preview draft: %dx%d", jpeg->width, jpeg->height);
+	else
+		PRINT_MSG("Preview ready: %dx%d", jpeg->width, jpeg->height);
+
+	free(jpeg->data);
+	free(preview);
+}
+
+/**
+ * @brief Forwards a phase of a preview to the main loop.
+ * @remarks This function matches the lazy_progress_cb() type signature.
+ *
+ * @param error_code The outcome of the request
+ * @param image The JPEG image, valid for the duration of the call
+ * @param phase Whether the image is the draft or the final image
+ * @param user_data The user data passed to lazy_request_progressive()
+ *                  (not used here)
+ */
+static void _preview_result_cb(int error_code, const image_buffer *image,
+		lazy_phase phase, void *user_data) {
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		if (error_code != TIZEN_ERROR_CANCELED)
+			DLOG_PRINT_ERROR("lazy_request_progressive", error_code);
+		return;
+	}
+
+	preview_image *preview = malloc(sizeof(preview_image));
+	if (preview == NULL)
+		return;
+
+	preview->jpeg = *image;
+	preview->phase = phase;
+	preview->jpeg.data = malloc(image->size);
+	if (preview->jpeg.data == NULL) {
+		free(preview);
+		return;
+	}
+	memcpy(preview->jpeg.data, image->data, image->size);
+
+	ecore_main_loop_thread_safe_call_async(_preview_show_main_cb, preview);
+}
+
+/**
+ * @brief Transforms a single image ahead of any running batch.
+ * @details Called when clicking the "Preview" button. A low resolution
+ *          draft is shown within milliseconds and replaced by the image once
+ *          it is ready. A preview still in progress is cancelled. Previews
+ *          already computed are served from the cache.
+ * @remarks This function matches the Evas_Smart_Cb() type signature
+ *          defined in the EFL API.
+ *
+ * @param data The user data passed via void pointer (not used here)
+ * @param object The object for which the 'clicked' event was triggered (not used here)
+ * @param event_info Additional event information (not used here)
+ */
+static void _image_util_preview_cb(void *data, Evas_Object *obj,
+		void *event_info) {
+	char path[BUFLEN];
+	transform_job settings;
+
+	_init_job(&settings, JOB_PRIORITY_INTERACTIVE);
+
+	if (!_nth_resource_file(preview_index++, path)) {
+		PRINT_MSG("No image to preview");
+		return;
+	}
+
+	cancel_token_cancel(preview_token);
+	cancel_token_unref(preview_token);
+	preview_token = cancel_token_create(NULL);
+
+	/* A preview is only useful while it is fresh. */
+	lazy_spec spec = { .path = path, .width = settings.width, .height =
+			settings.height, .colorspace = settings.colorspace, .encoded =
+			true, .priority = JOB_PRIORITY_INTERACTIVE, .deadline_us =
+			monotonic_us() + 100 * 1000, .cancel = preview_token };
+
+	PRINT_MSG("Preview: %s", strrchr(path, '/') + 1);
+	int error_code = lazy_request_progressive(&spec, _preview_result_cb, NULL);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		PRINT_MSG("lazy_request_progressive() failed.");
+		DLOG_PRINT_ERROR("lazy_request_progressive", error_code);
+	}
+}
+
+/**
+ * @brief Cancels the running batch and preview.
+ * @details Called when clicking the "Cancel" button. Queued jobs are dropped
+ *          and running jobs stop after their current stage.
+ * @remarks This function matches the Evas_Smart_Cb() type signature
+ *          defined in the EFL API.
+ *
+ * @param data The user data passed via void pointer (not used here)
+ * @param object The object for which the 'clicked' event was triggered (not used here)
+ * @param event_info Additional event information (not used here)
+ */
+static void _image_util_cancel_cb(void *data, Evas_Object *obj,
+		void *event_info) {
+	if (batch_token != NULL) {
+		PRINT_MSG("Cancelling...");
+		cancel_token_cancel(batch_token);
+	}
+	cancel_token_cancel(preview_token);
+}
+
 /**
  * @brief Executes the image transformations.
  * @details Called when clicking any button from the Image Util (except
- *          the "Clear" button).
+ *          the "Clear" button). Queues one batch job per image, converted,
+ *          rotated or cropped depending on the button; the buttons are
+ *          enabled again once all of them are over.
  * @remarks This function matches the Evas_Smart_Cb() type signature
  *          defined in the EFL API.
  *
@@ -234,160 +519,65 @@ static void _image_util_start_cb(void *data, Evas_Object *obj, void *event_info)
 	DIR* res;
 	struct dirent* entry;
 	struct stat buf;
+	transform_job job;
 
 	PRINT_MSG("Running transforming!");
 	if ((res = opendir(resource_path)) == NULL) {
 		DLOG_PRINT_ERROR("Cannot open resource_path", 0);
 		PRINT_MSG("Cannot open resource_path");
+		transform_finished = true;
 		return;
 	}
-	while ((entry = readdir(res)) != NULL) {
-		lstat(entry->d_name, &buf);
-		if (S_ISDIR(buf.st_mode))
-			continue;
 
-		PRINT_MSG("img: %s", entry->d_name);
-		/* Decode the given JPEG file to the img_source buffer. */
-		unsigned char *img_source = NULL;
-		int width, height;
-		unsigned int size_decode;
-		const char input_file_path[BUFLEN];
-		snprintf(input_file_path, BUFLEN, "%s/%s", resource_path,
-				entry->d_name);
+	_init_job(&job, JOB_PRIORITY_BATCH);
+	PRINT_MSG("Color space set to %s", _map_colorspace(job.colorspace));
+	PRINT_MSG("New resolution is:%dx%d", job.width, job.height);
+	const char *prefix = _init_job_geometry(&job, (app_button) data);
 
-		int error_code = image_util_decode_jpeg(input_file_path,
-				IMAGE_UTIL_COLORSPACE_RGB888, &img_source, &width, &height,
-				&size_decode);
-		if (error_code != IMAGE_UTIL_ERROR_NONE) {
-			PRINT_MSG("image_util_decode_jpeg() failed.");
-			DLOG_PRINT_ERROR("image_util_decode_jpeg", error_code);
-			return;
-		}
+	if (batch_token == NULL)
+		batch_token = cancel_token_create(NULL);
+	job.cancel = batch_token;
 
-		DLOG_PRINT_DEBUG_MSG("Decoded image width: %d height: %d size %d",
-				width, height, size_decode);
-
-		/* Create a media format structure. */
-		media_format_h fmt;
-		error_code = media_format_create(&fmt);
-		if (error_code != MEDIA_FORMAT_ERROR_NONE) {
-			PRINT_MSG("media_format_create() failed.");
-			DLOG_PRINT_ERROR("media_format_create", error_code);
-			free(img_source);
-			return;
-		}
-
-		/* Set the MIME type of the created format. */
-		error_code = media_format_set_video_mime(fmt, MEDIA_FORMAT_RGB888);
-		if (error_code != MEDIA_FORMAT_ERROR_NONE) {
-			PRINT_MSG("media_format_set_video_mime() failed.");
-			DLOG_PRINT_ERROR("media_format_set_video_mime", error_code);
-			media_format_unref(fmt);
-			free(img_source);
-			return;
-		}
-
-		/* Set the width of the created format. */
-		error_code = media_format_set_video_width(fmt, width);
-		if (error_code != MEDIA_FORMAT_ERROR_NONE) {
-			PRINT_MSG("media_format_set_video_width() failed.");
-			DLOG_PRINT_ERROR("media_format_set_video_width", error_code);
-			media_format_unref(fmt);
-			free(img_source);
-			return;
-		}
-
-		/* Set the height of the created format. */
-		error_code = media_format_set_video_height(fmt, height);
-		if (error_code != MEDIA_FORMAT_ERROR_NONE) {
-			PRINT_MSG("media_format_set_video_height() failed.");
-			DLOG_PRINT_ERROR("media_format_set_video_height", error_code);
-			media_format_unref(fmt);
-			free(img_source);
-			return;
-		}
-
-		/* Create a media packet with the image. */
-		error_code = media_packet_create_alloc(fmt, NULL, NULL, &media_packet);
-		if (error_code != MEDIA_PACKET_ERROR_NONE) {
-			PRINT_MSG("media_packet_create_alloc() failed.");
-			DLOG_PRINT_ERROR("media_packet_create_alloc", error_code);
-			media_format_unref(fmt);
-			free(img_source);
-			return;
-		}
-
-		media_format_unref(fmt);
-
-		/* Get the pointer to the internal media packet buffer, where the image will be stored. */
-		void *packet_buffer = NULL;
-
-		error_code = media_packet_get_buffer_data_ptr(media_packet,
-				&packet_buffer);
-		if (error_code != MEDIA_PACKET_ERROR_NONE || NULL == packet_buffer) {
-			PRINT_MSG("media_packet_get_buffer_data_ptr() failed.");
-			DLOG_PRINT_ERROR("media_packet_get_buffer_data_ptr", error_code);
-			free(img_source);
-			return;
-		}
-
-		/* Copy the image content to the media_packet internal buffer. */
-		memcpy(packet_buffer, (void *) img_source, size_decode);
-		free(img_source);
-
-		/* Create a handle to the transformation. */
-		error_code = image_util_transform_create(&handle);
-		if (error_code != IMAGE_UTIL_ERROR_NONE) {
-			PRINT_MSG("image_util_transform_create() failed.");
-			DLOG_PRINT_ERROR("image_util_transform_create", error_code);
-			return;
-		}
-
-		/* Disable the hardware acceleration for the created transformation. */
-		error_code = image_util_transform_set_hardware_acceleration(handle,
-		false);
-		CHECK_ERROR("image_util_transform_set_hardware_acceleration",
-				error_code);
-
-		PRINT_MSG("<b>Converting the image color space.</b>");
-		DLOG_PRINT_DEBUG_MSG("Converting the image color space.");
-
-		image_util_colorspace_e colorspace = IMAGE_UTIL_COLORSPACE_NV12;
-
-		/* Set the color space the image color space will be converted to. */
-		error_code = image_util_transform_set_colorspace(handle, colorspace);
-		if (error_code != IMAGE_UTIL_ERROR_NONE) {
-			PRINT_MSG("image_util_transform_set_colorspace() failed.");
-			DLOG_PRINT_ERROR("image_util_transform_set_colorspace", error_code);
-			return;
-		}
-		PRINT_MSG("Color space set to %s", _map_colorspace(colorspace));
-
-		/* Set new values for the width and height the image will be resized to. */
-		unsigned int new_width = atoi(elm_entry_entry_get(s_info.width));
-		unsigned int new_height = atoi(elm_entry_entry_get(s_info.height));
-
-		error_code = image_util_transform_set_resolution(handle, new_width,
-				new_height);
-		if (error_code != IMAGE_UTIL_ERROR_NONE) {
-			PRINT_MSG("image_util_transform_set_resolution() failed.");
-			DLOG_PRINT_ERROR("image_util_transform_set_resolution", error_code);
-			return;
-		}
-
-		PRINT_MSG("New resolution is:%dx%d", new_width, new_height);
+	/* Outcomes are collected until the last job of the batch is over. */
+	if (batch_results == NULL) {
+		batch_results = report_create();
+		memset(&batch_totals, 0, sizeof(batch_summary));
+	}
 
-		snprintf(image_util_filename_encoded, BUFLEN, "%s/%s", images_directory,
+	while ((entry = readdir(res)) != NULL) {
+		snprintf(job.input_path, BUFLEN, "%s/%s", resource_path,
 				entry->d_name);
+		if (stat(job.input_path, &buf) != 0 || S_ISDIR(buf.st_mode))
+			continue;
+
+		snprintf(job.output_path, BUFLEN, "%s/%s%s", images_directory,
+				prefix, entry->d_name);
 
-		/* Execute the transformation. */
-		error_code = image_util_transform_run(handle, media_packet,
-				_image_util_completed_cb, NULL);
+		batch_totals.submitted++;
+		job.decode_scale = IMAGE_UTIL_DOWNSCALE_1_1;
+		job_report *report = malloc(sizeof(job_report));
+		int error_code = (report != NULL) ?
+				probe_job(&job) : IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+		if (error_code == IMAGE_UTIL_ERROR_NONE)
+			error_code = scheduler_submit(&job, _job_done_cb, report);
 		if (error_code != IMAGE_UTIL_ERROR_NONE) {
-			PRINT_MSG("image_util_transform_run() failed.");
-			DLOG_PRINT_ERROR("image_util_transform_run", error_code);
+			pipeline_result result = { .error_code = error_code, .stage =
+					PIPELINE_STAGE_QUEUE };
+
+			/* Keep going with the other files. */
+			PRINT_MSG("Cannot queue %s (error %d)", entry->d_name, error_code);
+			DLOG_PRINT_ERROR("scheduler_submit", error_code);
+			_count_result(&result);
+			report_add_result(batch_results, &job, &result);
+			free(report);
+			continue;
 		}
+		batch_pending++;
 	}
+	closedir(res);
+
+	if (batch_pending == 0)
+		_finish_batch();
 }
 
 /**
@@ -432,10 +622,45 @@ void create_buttons_in_main_window() {
 	/* Create buttons for the Image Util. */
 	_create_button(CONVERT_BTN, display, "Convert the Color Space",
 			_image_util_start_cb);
+	_create_button(ROTATE_BTN, display, "Rotate", _image_util_start_cb);
+	_create_button(CROP_BTN, display, "Crop", _image_util_start_cb);
+
+	/* These stay enabled while a batch is running. */
+	preview_button = _new_button(NULL, display, "Preview next image",
+			_image_util_preview_cb);
+	cancel_button = _new_button(NULL, display, "Cancel",
+			_image_util_cancel_cb);
+
+	/* Create the view for the preview images. */
+	image = elm_image_add(display);
+	evas_object_size_hint_min_set(image, 0, 200);
+	evas_object_size_hint_weight_set(image, EVAS_HINT_EXPAND, 0.0);
+	evas_object_size_hint_align_set(image, EVAS_HINT_FILL, EVAS_HINT_FILL);
+	elm_box_pack_end(display, image);
+	evas_object_show(image);
 
 	/* Get the path to the resources. */
 	resource_path = app_get_resource_path();
 
+	/* Trace every job and the handoffs to this thread, see trace.h. */
+	trace_thread_name("main loop");
+	if (getenv(TRACE_ENV) != NULL) {
+		tracing = true;
+		trace_start();
+	}
+
+	/*
+	 * Probe the available transformation backends and start the workers,
+	 * with as many batch jobs at once as the device handles best.
+	 */
+	backend_init();
+	scheduler_init(0);
+	concurrency_start();
+	lazy_init(LAZY_CACHE_BUDGET);
+	frame_cache_init(FRAME_CACHE_BUDGET);
+	/* From now on the budgets above are set by the memory governor. */
+	memgov_start(0);
+
 	/* Get the path to the Images directory: */
 
 	/* 1. Get internal storage id. */
@@ -457,6 +682,31 @@ void create_buttons_in_main_window() {
 	ecore_idler_add(_btn_enable, NULL);
 }
 
+/**
+ * @brief Cancels outstanding work and stops the worker threads.
+ */
+void release_data(void) {
+	cancel_token_cancel(batch_token);
+	cancel_token_cancel(preview_token);
+	memgov_stop();
+	concurrency_stop();
+	scheduler_shutdown();
+	lazy_shutdown();
+	frame_cache_shutdown();
+	buffer_pool_set_budget(0);
+
+	cancel_token_unref(batch_token);
+	batch_token = NULL;
+	cancel_token_unref(preview_token);
+	preview_token = NULL;
+	report_destroy(batch_results);
+	batch_results = NULL;
+	if (tracing) {
+		trace_stop();
+		tracing = false;
+	}
+}
+
 /**
  * @brief Loads the image which will be used as a source to the display.
  * @details Called when the 'Clear' button is clicked.
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "frame_cache.h"
+#include "arena.h"
+#include "trace.h"
+#include <tizen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define FRAME_KEYLEN (BUFLEN + 48)
+
+/* A key being decoded; other threads wanting it wait instead of decoding. */
+typedef struct frame_pending {
+	char key[FRAME_KEYLEN];
+	struct frame_pending *next;
+} frame_pending;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t decoded;
+	lru_cache *cache;
+	frame_pending *pending;
+	unsigned int requests;
+	unsigned int decodes;
+	unsigned int waits;
+} frames = { .lock = PTHREAD_MUTEX_INITIALIZER, .decoded =
+		PTHREAD_COND_INITIALIZER };
+
+static void _free_frame(void *value) {
+	image_buffer *frame = value;
+
+	image_buffer_free(frame);
+	free(frame);
+}
+
+/**
+ * @brief Creates the cache. Safe to call more than once.
+ *
+ * @param budget The byte budget of the cache, 0 for the default
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int frame_cache_init(size_t budget) {
+	pthread_mutex_lock(&frames.lock);
+	if (frames.cache == NULL)
+		frames.cache = lru_create(budget ? budget : FRAME_CACHE_BUDGET,
+				_free_frame);
+	pthread_mutex_unlock(&frames.lock);
+
+	return (frames.cache != NULL) ?
+			IMAGE_UTIL_ERROR_NONE : IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+}
+
+/**
+ * @brief Drops the cache.
+ * @remarks Call once no job is running.
+ */
+void frame_cache_shutdown(void) {
+	pthread_mutex_lock(&frames.lock);
+	lru_destroy(frames.cache);
+	frames.cache = NULL;
+	pthread_mutex_unlock(&frames.lock);
+}
+
+static bool _is_pending(const char *key) {
+	for (frame_pending *pending = frames.pending; pending != NULL; pending =
+			pending->next)
+		if (strcmp(pending->key, key) == 0)
+			return true;
+	return false;
+}
+
+static void _remove_pending(frame_pending *done) {
+	for (frame_pending **link = &frames.pending; *link != NULL; link =
+			&(*link)->next) {
+		if (*link == done) {
+			*link = done->next;
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Decodes a JPEG file to RGB888, or reuses an earlier decode.
+ * @details Frames are keyed by path, modification time and scale. If another
+ *          thread is decoding the same frame, the call waits for it instead
+ *          of decoding again.
+ *
+ * @param path The JPEG file
+ * @param scale The decode downscale factor
+ * @param handle The frame, to be released with frame_cache_release()
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int frame_cache_decode(const char *path, image_util_scale_e scale,
+		frame_handle **handle) {
+	char key[FRAME_KEYLEN];
+	struct stat buf;
+
+	if (frame_cache_init(0) != IMAGE_UTIL_ERROR_NONE)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	if (stat(path, &buf) != 0)
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+
+	snprintf(key, FRAME_KEYLEN, "%s|%ld.%09ld|%d", path,
+			(long) buf.st_mtim.tv_sec, (long) buf.st_mtim.tv_nsec, scale);
+
+	frame_pending pending;
+
+	pthread_mutex_lock(&frames.lock);
+	frames.requests++;
+	for (;;) {
+		*handle = lru_get(frames.cache, key);
+		if (*handle != NULL) {
+			pthread_mutex_unlock(&frames.lock);
+			return IMAGE_UTIL_ERROR_NONE;
+		}
+		if (!_is_pending(key))
+			break;
+		frames.waits++;
+
+		/* Another thread is decoding the frame. */
+		uint64_t span = trace_begin();
+		pthread_cond_wait(&frames.decoded, &frames.lock);
+		trace_end("frame wait", span, path);
+	}
+
+	snprintf(pending.key, FRAME_KEYLEN, "%s", key);
+	pending.next = frames.pending;
+	frames.pending = &pending;
+	frames.decodes++;
+	pthread_mutex_unlock(&frames.lock);
+
+	image_buffer *frame = calloc(1, sizeof(image_buffer));
+	unsigned int size = 0;
+	int error_code = IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	if (frame != NULL) {
+		error_code = image_util_decode_jpeg_with_downscale(path,
+				IMAGE_UTIL_COLORSPACE_RGB888, scale, &frame->data,
+				&frame->width, &frame->height, &size);
+		if (error_code != IMAGE_UTIL_ERROR_NONE) {
+			DLOG_PRINT_ERROR("image_util_decode_jpeg_with_downscale",
+					error_code);
+			free(frame);
+		} else {
+			frame->size = size;
+			frame->colorspace = IMAGE_UTIL_COLORSPACE_RGB888;
+			*handle = lru_put(frames.cache, key, frame, frame->size);
+			if (*handle == NULL)
+				error_code = IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+		}
+	}
+
+	pthread_mutex_lock(&frames.lock);
+	_remove_pending(&pending);
+	pthread_cond_broadcast(&frames.decoded);
+	pthread_mutex_unlock(&frames.lock);
+
+	return error_code;
+}
+
+/**
+ * @brief Returns the decoded image of a frame.
+ */
+const image_buffer *frame_cache_image(const frame_handle *handle) {
+	return lru_entry_value(handle);
+}
+
+/**
+ * @brief Releases a frame returned by frame_cache_decode().
+ *
+ * @param handle The frame, may be NULL
+ */
+void frame_cache_release(frame_handle *handle) {
+	if (handle != NULL && frames.cache != NULL)
+		lru_release(frames.cache, handle);
+}
+
+/**
+ * @brief Changes the byte budget, evicting frames if it shrinks.
+ *
+ * @param budget The new budget in bytes
+ */
+void frame_cache_set_budget(size_t budget) {
+	if (frame_cache_init(budget) == IMAGE_UTIL_ERROR_NONE)
+		lru_set_budget(frames.cache, budget);
+}
+
+/**
+ * @brief Prints the cache statistics to the log.
+ */
+void frame_cache_log_stats(void) {
+	lru_stats stats;
+
+	if (frames.cache == NULL)
+		return;
+
+	lru_get_stats(frames.cache, &stats);
+
+	/* A request that waited for another thread's decode counts as a hit. */
+	pthread_mutex_lock(&frames.lock);
+	unsigned int requests = frames.requests;
+	unsigned int hits = requests - frames.decodes;
+	unsigned int waits = frames.waits;
+	pthread_mutex_unlock(&frames.lock);
+
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Frame cache: hit rate %u%% (%u of %u), %u waits, %u evictions, %u frames, %zu of %zu bytes",
+			requests ? hits * 100 / requests : 0, hits, requests, waits,
+			stats.evictions, stats.entries, stats.bytes, stats.budget);
+}
@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "hash.h"
+#include <image_util.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* xxHash64 primes. */
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+/* The perceptual hash compares neighbours on a 9x8 grid of luma. */
+#define DHASH_COLUMNS 9
+#define DHASH_ROWS 8
+
+static struct {
+	unsigned int files;
+	uint64_t bytes;
+	uint64_t hash_us;
+	unsigned int perceptual;
+	uint64_t perceptual_us;
+} stats;
+
+static uint64_t _rotl(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+/* Host byte order: digests are only compared with each other. */
+static uint64_t _read64(const unsigned char *p) {
+	uint64_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32_t _read32(const unsigned char *p) {
+	uint32_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t _round(uint64_t acc, uint64_t input) {
+	acc += input * PRIME2;
+	return _rotl(acc, 31) * PRIME1;
+}
+
+static uint64_t _merge(uint64_t acc, uint64_t value) {
+	acc ^= _round(0, value);
+	return acc * PRIME1 + PRIME4;
+}
+
+/**
+ * @brief Hashes a buffer with xxHash64.
+ * @details Four independent lanes consume 32 bytes per step, which keeps
+ *          the hash close to memory speed.
+ */
+uint64_t hash_bytes(const void *data, size_t length, uint64_t seed) {
+	const unsigned char *p = data;
+	const unsigned char *end = p + length;
+	uint64_t hash;
+
+	if (length >= 32) {
+		uint64_t v1 = seed + PRIME1 + PRIME2;
+		uint64_t v2 = seed + PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME1;
+
+		do {
+			v1 = _round(v1, _read64(p));
+			v2 = _round(v2, _read64(p + 8));
+			v3 = _round(v3, _read64(p + 16));
+			v4 = _round(v4, _read64(p + 24));
+			p += 32;
+		} while (end - p >= 32);
+
+		hash = _rotl(v1, 1) + _rotl(v2, 7) + _rotl(v3, 12) + _rotl(v4, 18);
+		hash = _merge(hash, v1);
+		hash = _merge(hash, v2);
+		hash = _merge(hash, v3);
+		hash = _merge(hash, v4);
+	} else {
+		hash = seed + PRIME5;
+	}
+	hash += length;
+
+	for (; end - p >= 8; p += 8) {
+		hash ^= _round(0, _read64(p));
+		hash = _rotl(hash, 27) * PRIME1 + PRIME4;
+	}
+	if (end - p >= 4) {
+		hash ^= _read32(p) * PRIME1;
+		hash = _rotl(hash, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		hash ^= *p * PRIME5;
+		hash = _rotl(hash, 11) * PRIME1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+/**
+ * @brief Maps a whole file read-only.
+ *
+ * @return The mapping, MAP_FAILED on error; NULL for an empty file
+ */
+static void *_map_file(const char *path, size_t *size) {
+	struct stat st;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return MAP_FAILED;
+
+	void *data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		*size = st.st_size;
+		data = (*size > 0) ?
+				mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	}
+	close(fd);
+	return data;
+}
+
+/**
+ * @brief Hashes the content of a file.
+ *
+ * @param path The file
+ * @param digest Receives the 64-bit digest
+ * @return IMAGE_UTIL_ERROR_NONE on success, IMAGE_UTIL_ERROR_NO_SUCH_FILE
+ *         if the file cannot be read
+ */
+int hash_file(const char *path, uint64_t *digest) {
+	uint64_t start_us = monotonic_us();
+	size_t size = 0;
+
+	void *data = _map_file(path, &size);
+	if (data == MAP_FAILED)
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+
+	madvise(data, size, MADV_SEQUENTIAL);
+	*digest = hash_bytes(data, size, 0);
+	if (data != NULL)
+		munmap(data, size);
+
+	__atomic_add_fetch(&stats.files, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.bytes, size, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.hash_us, monotonic_us() - start_us,
+			__ATOMIC_RELAXED);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Compares two files byte for byte.
+ * @details Rules out a collision once the digests of two files match.
+ *
+ * @return @c true if both files can be read and are identical
+ */
+bool hash_same_content(const char *first, const char *second) {
+	size_t first_size = 0, second_size = 0;
+	bool same = false;
+
+	void *first_data = _map_file(first, &first_size);
+	if (first_data == MAP_FAILED)
+		return false;
+
+	void *second_data = _map_file(second, &second_size);
+	if (second_data != MAP_FAILED) {
+		same = (first_size == second_size)
+				&& (first_size == 0
+						|| memcmp(first_data, second_data, first_size) == 0);
+		if (second_data != NULL)
+			munmap(second_data, second_size);
+	}
+	if (first_data != NULL)
+		munmap(first_data, first_size);
+	return same;
+}
+
+/**
+ * @brief Computes the difference hash of an image.
+ * @details The image is decoded at 1/8 scale and averaged down to a 9x8 grid
+ *          of luma; each bit tells whether a cell is darker than its right
+ *          neighbour. Re-encoded or resized copies of an image get hashes a
+ *          few bits apart, see hash_distance().
+ *
+ * @param path The JPEG file
+ * @param dhash Receives the 64-bit hash
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int hash_perceptual(const char *path, uint64_t *dhash) {
+	uint64_t start_us = monotonic_us();
+	unsigned int luma[DHASH_ROWS][DHASH_COLUMNS];
+	unsigned char *image = NULL;
+	unsigned int size;
+	int width, height;
+
+	int error_code = image_util_decode_jpeg_with_downscale(path,
+			IMAGE_UTIL_COLORSPACE_RGB888, IMAGE_UTIL_DOWNSCALE_1_8, &image,
+			&width, &height, &size);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+	if (image == NULL || width <= 0 || height <= 0
+			|| size < (unsigned int) width * height * 3) {
+		free(image);
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	}
+
+	for (int row = 0; row < DHASH_ROWS; ++row) {
+		int y0 = row * height / DHASH_ROWS;
+		int y1 = (row + 1) * height / DHASH_ROWS;
+		if (y1 <= y0)
+			y1 = y0 + 1;
+
+		for (int column = 0; column < DHASH_COLUMNS; ++column) {
+			int x0 = column * width / DHASH_COLUMNS;
+			int x1 = (column + 1) * width / DHASH_COLUMNS;
+			if (x1 <= x0)
+				x1 = x0 + 1;
+
+			unsigned int sum = 0;
+			for (int y = y0; y < y1; ++y) {
+				const unsigned char *pixel = image + ((size_t) y * width + x0) * 3;
+
+				for (int x = x0; x < x1; ++x, pixel += 3)
+					sum += (77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> 8;
+			}
+			luma[row][column] = sum / ((y1 - y0) * (x1 - x0));
+		}
+	}
+	free(image);
+
+	*dhash = 0;
+	for (int row = 0; row < DHASH_ROWS; ++row)
+		for (int column = 0; column < DHASH_COLUMNS - 1; ++column)
+			*dhash = (*dhash << 1)
+					| (luma[row][column] < luma[row][column + 1]);
+
+	__atomic_add_fetch(&stats.perceptual, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.perceptual_us, monotonic_us() - start_us,
+			__ATOMIC_RELAXED);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Counts the bits two perceptual hashes differ in.
+ */
+unsigned int hash_distance(uint64_t first, uint64_t second) {
+	return __builtin_popcountll(first ^ second);
+}
+
+void hash_log_stats(void) {
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Hash: %u files, %llu bytes in %llu us; %u perceptual in %llu us",
+			stats.files, (unsigned long long) stats.bytes,
+			(unsigned long long) stats.hash_us, stats.perceptual,
+			(unsigned long long) stats.perceptual_us);
+}
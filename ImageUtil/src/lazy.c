@@ -0,0 +1,607 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "lazy.h"
+#include "lru.h"
+#include "scheduler.h"
+#include "arena.h"
+#include "probe.h"
+#include <tizen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define LAZY_KEYLEN (BUFLEN + 64)
+#define LAZY_JPEG_QUALITY 90
+
+typedef struct lazy_waiter lazy_waiter;
+typedef struct lazy_inflight lazy_inflight;
+
+/* A caller waiting for a computation. */
+struct lazy_waiter {
+	bool encoded;
+	cancel_token *cancel;
+	lazy_result_cb result_cb;
+	void *user_data;
+	lazy_waiter *next;
+};
+
+/* A computation in progress, shared by all callers asking for the same key. */
+struct lazy_inflight {
+	char key[LAZY_KEYLEN];
+	unsigned int quality;
+	/* The token of the job, cancelled once every waiter is. */
+	cancel_token *cancel;
+	/* Set once the job was found cancelled; nobody may join it then. */
+	bool abandoned;
+	lazy_waiter *waiters;
+	lazy_inflight *next;
+};
+
+/* The two phases of a progressive request. */
+typedef struct {
+	pthread_mutex_t lock;
+	unsigned int refs;
+	/* Once set, a preview still to come is dropped. */
+	bool final_done;
+	cancel_token *preview_cancel;
+	lazy_progress_cb progress_cb;
+	void *user_data;
+} lazy_progressive;
+
+static struct {
+	pthread_mutex_t lock;
+	lru_cache *cache;
+	lazy_inflight *inflight;
+	unsigned int requests;
+	unsigned int joined;
+	unsigned int computed;
+	unsigned int previews;
+	unsigned int previews_dropped;
+} lazy = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void _free_image(void *value) {
+	image_buffer *image = value;
+
+	image_buffer_free(image);
+	free(image);
+}
+
+/**
+ * @brief Builds the cache key of a variant of a request.
+ */
+static void _variant_key(char *buffer, const char *key, bool encoded) {
+	snprintf(buffer, LAZY_KEYLEN, "%s|%s", encoded ? "jpeg" : "raw", key);
+}
+
+/**
+ * @brief Moves an image into the cache.
+ *
+ * @param key The request key
+ * @param encoded Whether the image is the JPEG variant
+ * @param image The image; its data is taken over and set to NULL
+ * @return A referenced cache entry, or NULL
+ */
+static lru_entry *_cache_put(const char *key, bool encoded,
+		image_buffer *image) {
+	char variant[LAZY_KEYLEN];
+	image_buffer *copy = malloc(sizeof(image_buffer));
+
+	if (copy == NULL)
+		return NULL;
+
+	*copy = *image;
+	image->data = NULL;
+
+	_variant_key(variant, key, encoded);
+	return lru_put(lazy.cache, variant, copy, copy->size);
+}
+
+static lru_entry *_cache_get(const char *key, bool encoded) {
+	char variant[LAZY_KEYLEN];
+
+	_variant_key(variant, key, encoded);
+	return lru_get(lazy.cache, variant);
+}
+
+/**
+ * @brief Encodes cached raw pixels and caches the JPEG.
+ *
+ * @param key The request key
+ * @param raw The cache entry holding the raw image
+ * @param quality The JPEG quality
+ * @param error_code Receives the encoder error code
+ * @return A referenced cache entry holding the JPEG, or NULL
+ */
+static lru_entry *_encode_cached(const char *key, lru_entry *raw,
+		unsigned int quality, int *error_code) {
+	const image_buffer *image = lru_entry_value(raw);
+	image_buffer jpeg = { .width = image->width, .height = image->height,
+			.colorspace = image->colorspace };
+	unsigned int size = 0;
+
+	*error_code = image_util_encode_jpeg_to_memory(image->data, image->width,
+			image->height, image->colorspace, quality, &jpeg.data,
+			&size);
+	if (*error_code != IMAGE_UTIL_ERROR_NONE) {
+		DLOG_PRINT_ERROR("image_util_encode_jpeg_to_memory", *error_code);
+		return NULL;
+	}
+
+	jpeg.size = size;
+	return _cache_put(key, true, &jpeg);
+}
+
+/**
+ * @brief Delivers a result to one waiter and frees it.
+ */
+static void _deliver(lazy_waiter *waiter, int error_code, lru_entry *entry) {
+	const image_buffer *image = NULL;
+
+	if (cancel_token_is_cancelled(waiter->cancel))
+		error_code = TIZEN_ERROR_CANCELED;
+	else if (error_code == IMAGE_UTIL_ERROR_NONE && entry == NULL)
+		error_code = IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	else if (error_code == IMAGE_UTIL_ERROR_NONE)
+		image = lru_entry_value(entry);
+
+	waiter->result_cb(error_code, image, waiter->user_data);
+
+	cancel_token_unref(waiter->cancel);
+	free(waiter);
+}
+
+/**
+ * @brief Caches the result of a computation and hands it to every waiter.
+ * @remarks This function matches the scheduler_done_cb() type signature.
+ *
+ * @param job The finished job
+ * @param result The outcome of the job
+ * @param user_data The lazy_inflight of the computation
+ */
+static void _lazy_done_cb(transform_job *job, pipeline_result *result,
+		void *user_data) {
+	lazy_inflight *inflight = user_data;
+	lru_entry *raw = NULL;
+	lru_entry *jpeg = NULL;
+	int error_code = result->error_code;
+
+	/* Unlink first, so that new requests look at the cache from now on. */
+	pthread_mutex_lock(&lazy.lock);
+	for (lazy_inflight **link = &lazy.inflight; *link != NULL; link =
+			&(*link)->next) {
+		if (*link == inflight) {
+			*link = inflight->next;
+			break;
+		}
+	}
+	lazy.computed++;
+	pthread_mutex_unlock(&lazy.lock);
+
+	if (error_code == IMAGE_UTIL_ERROR_NONE) {
+		raw = _cache_put(inflight->key, false, &result->raw);
+		if (result->encoded.data != NULL)
+			jpeg = _cache_put(inflight->key, true, &result->encoded);
+	}
+
+	while (inflight->waiters != NULL) {
+		lazy_waiter *waiter = inflight->waiters;
+		int waiter_error = error_code;
+
+		inflight->waiters = waiter->next;
+
+		/* Someone joined after the job was queued without encoding. */
+		if (waiter->encoded && jpeg == NULL && raw != NULL)
+			jpeg = _encode_cached(inflight->key, raw, inflight->quality,
+					&waiter_error);
+
+		_deliver(waiter, waiter_error, waiter->encoded ? jpeg : raw);
+	}
+
+	lru_release(lazy.cache, raw);
+	lru_release(lazy.cache, jpeg);
+	cancel_token_unref(inflight->cancel);
+	free(inflight);
+}
+
+/**
+ * @brief Tells the job of a computation whether anyone still waits for it.
+ * @details The computation is cancelled once every waiter cancelled its
+ *          request; a waiter without a token keeps it going.
+ * @remarks This function matches the cancel_poll_cb() type signature.
+ *
+ * @param user_data The lazy_inflight of the computation
+ * @return @c true if the job should stop
+ */
+static bool _inflight_abandoned(void *user_data) {
+	lazy_inflight *inflight = user_data;
+
+	pthread_mutex_lock(&lazy.lock);
+	if (!inflight->abandoned) {
+		lazy_waiter *waiter = inflight->waiters;
+
+		while (waiter != NULL && cancel_token_is_cancelled(waiter->cancel))
+			waiter = waiter->next;
+		inflight->abandoned = (inflight->waiters != NULL && waiter == NULL);
+	}
+	bool abandoned = inflight->abandoned;
+	pthread_mutex_unlock(&lazy.lock);
+
+	return abandoned;
+}
+
+/**
+ * @brief Builds the key of a request.
+ * @details The modification time invalidates results of an edited source.
+ *
+ * @param spec The request
+ * @param key The buffer of LAZY_KEYLEN bytes receiving the key
+ * @return @c false if the source cannot be found
+ */
+static bool _request_key(const lazy_spec *spec, char *key) {
+	struct stat buf;
+
+	if (stat(spec->path, &buf) != 0)
+		return false;
+
+	snprintf(key, LAZY_KEYLEN, "%s|%ld.%09ld|%ux%u|%d|%u", spec->path,
+			(long) buf.st_mtim.tv_sec, (long) buf.st_mtim.tv_nsec,
+			spec->width, spec->height, spec->colorspace,
+			spec->quality ? spec->quality : LAZY_JPEG_QUALITY);
+	return true;
+}
+
+/**
+ * @brief Creates the result cache. Safe to call more than once.
+ *
+ * @param cache_budget The byte budget of the cache, 0 for the default
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int lazy_init(size_t cache_budget) {
+	pthread_mutex_lock(&lazy.lock);
+	if (lazy.cache == NULL)
+		lazy.cache = lru_create(cache_budget ? cache_budget : LAZY_CACHE_BUDGET,
+				_free_image);
+	pthread_mutex_unlock(&lazy.lock);
+
+	return (lazy.cache != NULL) ?
+			IMAGE_UTIL_ERROR_NONE : IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+}
+
+/**
+ * @brief Drops the result cache.
+ * @remarks Call after scheduler_shutdown(), once no request is in flight.
+ */
+void lazy_shutdown(void) {
+	pthread_mutex_lock(&lazy.lock);
+	lru_destroy(lazy.cache);
+	lazy.cache = NULL;
+	pthread_mutex_unlock(&lazy.lock);
+}
+
+/**
+ * @brief Changes the byte budget of the result cache, evicting results if
+ *        it shrinks. Does nothing if there is no cache.
+ *
+ * @param budget The new budget in bytes
+ */
+void lazy_set_budget(size_t budget) {
+	pthread_mutex_lock(&lazy.lock);
+	if (lazy.cache != NULL)
+		lru_set_budget(lazy.cache, budget);
+	pthread_mutex_unlock(&lazy.lock);
+}
+
+/**
+ * @brief Requests one image at one size in one color space.
+ * @details Results come from the cache when possible. Otherwise the image is
+ *          computed at the requested priority, and concurrent requests for
+ *          the same image share a single computation, which stops once
+ *          all of them are cancelled. A source file that changes on disk is
+ *          recomputed.
+ *
+ * @param spec What to compute
+ * @param result_cb The function receiving the result
+ * @param user_data The user data passed to result_cb
+ * @return IMAGE_UTIL_ERROR_NONE if result_cb will be (or has been) called,
+ *         otherwise an error code
+ */
+int lazy_request(const lazy_spec *spec, lazy_result_cb result_cb,
+		void *user_data) {
+	char key[LAZY_KEYLEN];
+	lru_entry *entry;
+	int error_code = IMAGE_UTIL_ERROR_NONE;
+
+	if (spec == NULL || spec->path == NULL || result_cb == NULL)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (lazy_init(0) != IMAGE_UTIL_ERROR_NONE)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	if (!_request_key(spec, key))
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+
+	unsigned int quality = spec->quality ? spec->quality : LAZY_JPEG_QUALITY;
+
+	lazy_waiter *waiter = calloc(1, sizeof(lazy_waiter));
+	if (waiter == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	waiter->encoded = spec->encoded;
+	waiter->cancel = cancel_token_ref(spec->cancel);
+	waiter->result_cb = result_cb;
+	waiter->user_data = user_data;
+
+	__atomic_add_fetch(&lazy.requests, 1, __ATOMIC_RELAXED);
+
+	/* Served from the cache, possibly encoding cached pixels on the way. */
+	entry = _cache_get(key, spec->encoded);
+	if (entry == NULL && spec->encoded) {
+		lru_entry *raw = _cache_get(key, false);
+
+		if (raw != NULL) {
+			entry = _encode_cached(key, raw, quality, &error_code);
+			lru_release(lazy.cache, raw);
+		}
+	}
+	if (entry != NULL || error_code != IMAGE_UTIL_ERROR_NONE) {
+		_deliver(waiter, error_code, entry);
+		lru_release(lazy.cache, entry);
+		return IMAGE_UTIL_ERROR_NONE;
+	}
+
+	transform_job job = { .width = spec->width, .height = spec->height,
+			.colorspace = spec->colorspace, .quality = quality,
+			.output = JOB_OUTPUT_MEMORY, .encode = spec->encoded, .priority =
+					spec->priority, .deadline_us = spec->deadline_us };
+	snprintf(job.input_path, BUFLEN, "%s", spec->path);
+
+	/* A small request only needs a downscaled decode of a large source. */
+	error_code = probe_job(&job);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		cancel_token_unref(waiter->cancel);
+		free(waiter);
+		return error_code;
+	}
+
+	pthread_mutex_lock(&lazy.lock);
+
+	/* Join an identical computation in progress, unless it is stopping. */
+	for (lazy_inflight *inflight = lazy.inflight; inflight != NULL;
+			inflight = inflight->next) {
+		if (!inflight->abandoned && strcmp(inflight->key, key) == 0) {
+			waiter->next = inflight->waiters;
+			inflight->waiters = waiter;
+			lazy.joined++;
+			pthread_mutex_unlock(&lazy.lock);
+			return IMAGE_UTIL_ERROR_NONE;
+		}
+	}
+
+	lazy_inflight *inflight = calloc(1, sizeof(lazy_inflight));
+	if (inflight != NULL)
+		inflight->cancel = cancel_token_create_polled(_inflight_abandoned,
+				inflight);
+	if (inflight == NULL || inflight->cancel == NULL) {
+		pthread_mutex_unlock(&lazy.lock);
+		cancel_token_unref(waiter->cancel);
+		free(waiter);
+		free(inflight);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+	snprintf(inflight->key, LAZY_KEYLEN, "%s", key);
+	inflight->quality = quality;
+	inflight->waiters = waiter;
+	job.cancel = inflight->cancel;
+
+	error_code = scheduler_submit(&job, _lazy_done_cb, inflight);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		pthread_mutex_unlock(&lazy.lock);
+		DLOG_PRINT_ERROR("scheduler_submit", error_code);
+		cancel_token_unref(waiter->cancel);
+		free(waiter);
+		cancel_token_unref(inflight->cancel);
+		free(inflight);
+		return error_code;
+	}
+
+	inflight->next = lazy.inflight;
+	lazy.inflight = inflight;
+	pthread_mutex_unlock(&lazy.lock);
+
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+static void _progressive_unref(lazy_progressive *progressive) {
+	if (__atomic_sub_fetch(&progressive->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	cancel_token_unref(progressive->preview_cancel);
+	pthread_mutex_destroy(&progressive->lock);
+	free(progressive);
+}
+
+/**
+ * @brief Hands the preview to the caller, unless the final image came first.
+ * @remarks This function matches the lazy_result_cb() type signature.
+ *
+ * @param error_code The outcome of the preview
+ * @param image The preview
+ * @param user_data The lazy_progressive of the request
+ */
+static void _preview_cb(int error_code, const image_buffer *image,
+		void *user_data) {
+	lazy_progressive *progressive = user_data;
+
+	/* Holding the lock keeps the final image from overtaking the preview. */
+	pthread_mutex_lock(&progressive->lock);
+	if (error_code == IMAGE_UTIL_ERROR_NONE && !progressive->final_done)
+		progressive->progress_cb(error_code, image, LAZY_PHASE_PREVIEW,
+				progressive->user_data);
+	else
+		__atomic_add_fetch(&lazy.previews_dropped, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&progressive->lock);
+
+	_progressive_unref(progressive);
+}
+
+/**
+ * @brief Hands the final image to the caller and stops the preview.
+ * @details Cancelling the preview's token also stops the preview job, at its
+ *          next stage or while still queued, unless another request waits
+ *          for the same preview.
+ * @remarks This function matches the lazy_result_cb() type signature.
+ *
+ * @param error_code The outcome of the request
+ * @param image The final image
+ * @param user_data The lazy_progressive of the request
+ */
+static void _final_cb(int error_code, const image_buffer *image,
+		void *user_data) {
+	lazy_progressive *progressive = user_data;
+
+	pthread_mutex_lock(&progressive->lock);
+	progressive->final_done = true;
+	pthread_mutex_unlock(&progressive->lock);
+	/* Before delivering, so that the preview frees its worker early. */
+	cancel_token_cancel(progressive->preview_cancel);
+
+	progressive->progress_cb(error_code, image, LAZY_PHASE_FINAL,
+			progressive->user_data);
+	_progressive_unref(progressive);
+}
+
+/**
+ * @brief Plans the preview of a progressive request.
+ * @details There is no preview when the final image is cached, or when its
+ *          decode is already as cheap as the preview's would be.
+ *
+ * @param spec The request
+ * @param preview Receives the request of the preview
+ * @return @c true if the request is worth a preview
+ */
+static bool _plan_preview(const lazy_spec *spec, lazy_spec *preview) {
+	char key[LAZY_KEYLEN];
+	probe_info info;
+
+	if (!_request_key(spec, key))
+		return false;
+
+	lru_entry *entry = _cache_get(key, spec->encoded);
+	if (entry != NULL || (spec->encoded && (entry = _cache_get(key, false))
+			!= NULL)) {
+		lru_release(lazy.cache, entry);
+		return false;
+	}
+
+	if (probe_file(spec->path, &info) != IMAGE_UTIL_ERROR_NONE)
+		return false;
+
+	transform_job job = { .width = spec->width, .height = spec->height };
+	if (probe_decode_scale(&info, &job) == IMAGE_UTIL_DOWNSCALE_1_8)
+		return false;
+
+	unsigned int width = spec->width ? spec->width : info.width;
+	unsigned int height = spec->height ? spec->height : info.height;
+
+	*preview = *spec;
+	preview->width = (width + LAZY_PREVIEW_DIVISOR - 1) / LAZY_PREVIEW_DIVISOR;
+	preview->height = (height + LAZY_PREVIEW_DIVISOR - 1)
+			/ LAZY_PREVIEW_DIVISOR;
+	preview->quality = LAZY_PREVIEW_QUALITY;
+	preview->deadline_us = monotonic_us() + LAZY_PREVIEW_DEADLINE_US;
+	return true;
+}
+
+/**
+ * @brief Requests an image in two phases: a quick preview, then the image.
+ * @details The preview is a request at 1/LAZY_PREVIEW_DIVISOR of the size
+ *          and low quality, which the decoder serves from a downscaled
+ *          decode; its earlier deadline runs it ahead of the final image.
+ *          Both go through the result cache, so a cached final image skips
+ *          the preview and repeated previews are not computed again. A
+ *          preview not done when the final image arrives is cancelled, so
+ *          its job stops unless another request shares it.
+ *
+ * @param spec What to compute; its cancel token also cancels the preview
+ * @param progress_cb The function receiving the preview and the image
+ * @param user_data The user data passed to progress_cb
+ * @return IMAGE_UTIL_ERROR_NONE if progress_cb will be (or has been) called
+ *         with the final image, otherwise an error code
+ */
+int lazy_request_progressive(const lazy_spec *spec,
+		lazy_progress_cb progress_cb, void *user_data) {
+	lazy_spec preview;
+
+	if (spec == NULL || spec->path == NULL || progress_cb == NULL)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (lazy_init(0) != IMAGE_UTIL_ERROR_NONE)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	lazy_progressive *progressive = calloc(1, sizeof(lazy_progressive));
+	if (progressive == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	pthread_mutex_init(&progressive->lock, NULL);
+	progressive->refs = 1;
+	progressive->progress_cb = progress_cb;
+	progressive->user_data = user_data;
+
+	/* Queue the preview first, so that it gets a free worker first. */
+	if (_plan_preview(spec, &preview)) {
+		progressive->preview_cancel = cancel_token_create(spec->cancel);
+		preview.cancel = progressive->preview_cancel;
+		__atomic_add_fetch(&progressive->refs, 1, __ATOMIC_RELAXED);
+		if (lazy_request(&preview, _preview_cb, progressive)
+				== IMAGE_UTIL_ERROR_NONE)
+			__atomic_add_fetch(&lazy.previews, 1, __ATOMIC_RELAXED);
+		else
+			__atomic_sub_fetch(&progressive->refs, 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_add_fetch(&progressive->refs, 1, __ATOMIC_RELAXED);
+	int error_code = lazy_request(spec, _final_cb, progressive);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		/* Nothing to follow the preview. */
+		pthread_mutex_lock(&progressive->lock);
+		progressive->final_done = true;
+		pthread_mutex_unlock(&progressive->lock);
+		cancel_token_cancel(progressive->preview_cancel);
+		__atomic_sub_fetch(&progressive->refs, 1, __ATOMIC_RELAXED);
+	}
+
+	_progressive_unref(progressive);
+	return error_code;
+}
+
+/**
+ * @brief Prints the request and cache statistics to the log.
+ */
+void lazy_log_stats(void) {
+	lru_stats stats;
+
+	if (lazy.cache == NULL)
+		return;
+
+	lru_get_stats(lazy.cache, &stats);
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Lazy: requests %u joined %u computed %u, previews %u dropped %u; cache hits %u misses %u evictions %u, %u entries, %zu of %zu bytes",
+			lazy.requests, lazy.joined, lazy.computed, lazy.previews,
+			lazy.previews_dropped, stats.hits,
+			stats.misses, stats.evictions, stats.entries, stats.bytes,
+			stats.budget);
+}
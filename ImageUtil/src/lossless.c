@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "lossless.h"
+#include "ops.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+
+typedef struct {
+	struct jpeg_error_mgr base;
+	jmp_buf escape;
+} lossless_error;
+
+/* What to copy from the source, in source pixels, and what comes out. */
+typedef struct {
+	orientation o;
+	int x;
+	int y;
+	int width;
+	int height;
+	int mcu_width;
+	int mcu_height;
+	int out_width;
+	int out_height;
+} lossless_plan;
+
+/* Where each output coefficient of a block comes from, and its sign. */
+typedef struct {
+	unsigned char index[DCTSIZE2];
+	JCOEF sign[DCTSIZE2];
+} block_map;
+
+static struct {
+	unsigned int transformed;
+	unsigned int unsupported;
+} stats;
+
+/**
+ * @brief Leaves libjpeg through the longjmp() set up by lossless_transform().
+ * @remarks This function matches the error_exit() type signature of the
+ *          libjpeg error manager.
+ */
+static void _error_exit(j_common_ptr cinfo) {
+	lossless_error *error = (lossless_error *) cinfo->err;
+	char message[JMSG_LENGTH_MAX];
+
+	cinfo->err->format_message(cinfo, message);
+	dlog_print(DLOG_ERROR, LOG_TAG, "libjpeg: %s", message);
+	longjmp(error->escape, 1);
+}
+
+static void _output_message(j_common_ptr cinfo) {
+	char message[JMSG_LENGTH_MAX];
+
+	cinfo->err->format_message(cinfo, message);
+	dlog_print(DLOG_WARN, LOG_TAG, "libjpeg: %s", message);
+}
+
+/**
+ * @brief Works out the region of whole blocks the job keeps.
+ * @details The crop rectangle grows up and left to the MCU grid. A partial
+ *          MCU at the right or bottom edge cannot be moved to the left or
+ *          top losslessly, so it is trimmed off when that edge is mirrored.
+ *
+ * @param job The job
+ * @param src The decompressor, after jpeg_read_header()
+ * @param plan Receives the plan
+ * @return IMAGE_UTIL_ERROR_NONE, or IMAGE_UTIL_ERROR_NOT_SUPPORTED if the job
+ *         needs the pixel path
+ */
+static int _plan(const transform_job *job, j_decompress_ptr src,
+		lossless_plan *plan) {
+	plan->o = ops_orientation(job->rotation, job->flip);
+	plan->mcu_width = src->max_h_samp_factor * DCTSIZE;
+	plan->mcu_height = src->max_v_samp_factor * DCTSIZE;
+
+	ops_crop_rect(job, src->image_width, src->image_height, &plan->x,
+			&plan->y, &plan->width, &plan->height);
+
+	plan->width += plan->x % plan->mcu_width;
+	plan->x -= plan->x % plan->mcu_width;
+	plan->height += plan->y % plan->mcu_height;
+	plan->y -= plan->y % plan->mcu_height;
+
+	if (plan->o.rev_x)
+		plan->width -= plan->width % plan->mcu_width;
+	if (plan->o.rev_y)
+		plan->height -= plan->height % plan->mcu_height;
+	if (plan->width == 0 || plan->height == 0)
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED;
+
+	plan->out_width = plan->o.swap ? plan->height : plan->width;
+	plan->out_height = plan->o.swap ? plan->width : plan->height;
+
+	/* Anything but the size the geometry gives needs resampling. */
+	if (job->width > 0 && job->height > 0
+			&& (job->width != (unsigned int) plan->out_width
+					|| job->height != (unsigned int) plan->out_height))
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED;
+
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Works out how an orientation moves the coefficients of a block.
+ * @details Transposing the pixels transposes the coefficients, and
+ *          mirroring an axis negates the odd frequencies along it.
+ */
+static void _block_map(orientation o, block_map *map) {
+	for (int v = 0; v < DCTSIZE; ++v) {
+		for (int u = 0; u < DCTSIZE; ++u) {
+			int su = o.swap ? v : u;
+			int sv = o.swap ? u : v;
+			bool negate = (o.rev_x && (su & 1)) != (o.rev_y && (sv & 1));
+
+			map->index[v * DCTSIZE + u] = sv * DCTSIZE + su;
+			map->sign[v * DCTSIZE + u] = negate ? -1 : 1;
+		}
+	}
+}
+
+static inline void _transform_block(const JCOEF *src, JCOEF *dst,
+		const block_map *map) {
+	for (int k = 0; k < DCTSIZE2; ++k)
+		dst[k] = src[map->index[k]] * map->sign[k];
+}
+
+/**
+ * @brief Returns the size of a component's coefficient array in the output.
+ */
+static void _output_blocks(const lossless_plan *plan,
+		const jpeg_component_info *comp, int max_h, int max_v,
+		JDIMENSION *width, JDIMENSION *height) {
+	int h = plan->o.swap ? comp->v_samp_factor : comp->h_samp_factor;
+	int v = plan->o.swap ? comp->h_samp_factor : comp->v_samp_factor;
+	int mcu_width = (plan->o.swap ? max_v : max_h) * DCTSIZE;
+	int mcu_height = (plan->o.swap ? max_h : max_v) * DCTSIZE;
+
+	*width = (plan->out_width + mcu_width - 1) / mcu_width * h;
+	*height = (plan->out_height + mcu_height - 1) / mcu_height * v;
+}
+
+/**
+ * @brief Copies the planned blocks of every component into the output.
+ */
+static void _copy_blocks(j_decompress_ptr src, jvirt_barray_ptr *src_arrays,
+		jvirt_barray_ptr *dst_arrays, const lossless_plan *plan) {
+	block_map map;
+	bool identity = !plan->o.swap && !plan->o.rev_x && !plan->o.rev_y;
+
+	_block_map(plan->o, &map);
+
+	for (int c = 0; c < src->num_components; ++c) {
+		jpeg_component_info *comp = &src->comp_info[c];
+		JDIMENSION out_width, out_height;
+
+		/* The region, in blocks of this component. */
+		JDIMENSION x0 = plan->x / plan->mcu_width * comp->h_samp_factor;
+		JDIMENSION y0 = plan->y / plan->mcu_height * comp->v_samp_factor;
+		JDIMENSION width = ((JDIMENSION) plan->width * comp->h_samp_factor
+				+ plan->mcu_width - 1) / plan->mcu_width;
+		JDIMENSION height = ((JDIMENSION) plan->height * comp->v_samp_factor
+				+ plan->mcu_height - 1) / plan->mcu_height;
+
+		_output_blocks(plan, comp, src->max_h_samp_factor,
+				src->max_v_samp_factor, &out_width, &out_height);
+
+		for (JDIMENSION oy = 0; oy < out_height; ++oy) {
+			JBLOCKARRAY out = src->mem->access_virt_barray((j_common_ptr) src,
+					dst_arrays[c], oy, 1, TRUE);
+
+			/* A plain crop copies whole rows of blocks. */
+			if (identity) {
+				if (oy < height) {
+					JBLOCKARRAY in = src->mem->access_virt_barray(
+							(j_common_ptr) src, src_arrays[c], y0 + oy, 1,
+							FALSE);
+					memcpy(out[0], in[0] + x0, width * sizeof(JBLOCK));
+				}
+				continue;
+			}
+
+			for (JDIMENSION ox = 0; ox < out_width; ++ox) {
+				JDIMENSION sx = plan->o.swap ? oy : ox;
+				JDIMENSION sy = plan->o.swap ? ox : oy;
+
+				/* Padding of the last MCU; the array starts out zeroed. */
+				if (sx >= width || sy >= height)
+					continue;
+				if (plan->o.rev_x)
+					sx = width - 1 - sx;
+				if (plan->o.rev_y)
+					sy = height - 1 - sy;
+
+				JBLOCKARRAY in = src->mem->access_virt_barray(
+						(j_common_ptr) src, src_arrays[c], y0 + sy, 1, FALSE);
+				_transform_block(in[0][x0 + sx], out[0][ox], &map);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Adapts the output parameters to exchanged axes.
+ */
+static void _transpose_parameters(j_compress_ptr dst) {
+	for (int c = 0; c < dst->num_components; ++c) {
+		jpeg_component_info *comp = &dst->comp_info[c];
+		int h = comp->h_samp_factor;
+
+		comp->h_samp_factor = comp->v_samp_factor;
+		comp->v_samp_factor = h;
+	}
+
+	/* Coefficients are transposed, so their quantizers must be too. */
+	for (int t = 0; t < NUM_QUANT_TBLS; ++t) {
+		JQUANT_TBL *table = dst->quant_tbl_ptrs[t];
+
+		if (table == NULL)
+			continue;
+		for (int v = 0; v < DCTSIZE; ++v) {
+			for (int u = v + 1; u < DCTSIZE; ++u) {
+				UINT16 q = table->quantval[v * DCTSIZE + u];
+
+				table->quantval[v * DCTSIZE + u] = table->quantval[u * DCTSIZE
+						+ v];
+				table->quantval[u * DCTSIZE + v] = q;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Crops, rotates and flips a JPEG file without decoding its pixels.
+ * @details Works on the DCT coefficients, like jpegtran, so the result has
+ *          exactly the quality of the source and no time is spent in the
+ *          codec. Crops are aligned to the MCU grid, and partial MCUs on
+ *          mirrored edges are trimmed. Markers other than JFIF are copied.
+ *
+ * @param job The job; reads input_path, writes output_path. Its source
+ *            dimensions are filled in
+ * @return IMAGE_UTIL_ERROR_NONE on success, IMAGE_UTIL_ERROR_NOT_SUPPORTED
+ *         if the job needs the pixel path, otherwise an error code
+ */
+int lossless_transform(transform_job *job) {
+	struct jpeg_decompress_struct src;
+	struct jpeg_compress_struct dst;
+	lossless_error error;
+	jvirt_barray_ptr dst_arrays[MAX_COMPONENTS];
+	lossless_plan plan;
+	FILE *volatile output = NULL;
+	volatile int error_code = IMAGE_UTIL_ERROR_INVALID_OPERATION;
+
+	FILE *input = fopen(job->input_path, "rb");
+	if (input == NULL)
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+
+	src.err = jpeg_std_error(&error.base);
+	error.base.error_exit = _error_exit;
+	error.base.output_message = _output_message;
+	dst.err = &error.base;
+	jpeg_create_decompress(&src);
+	jpeg_create_compress(&dst);
+
+	if (setjmp(error.escape))
+		goto out;
+
+	jpeg_stdio_src(&src, input);
+	jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+	for (int m = 1; m < 16; ++m)
+		jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+	jpeg_read_header(&src, TRUE);
+
+	error_code = _plan(job, &src, &plan);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		goto out;
+	job->src_width = src.image_width;
+	job->src_height = src.image_height;
+
+	/* Output arrays must be requested before the source is read. */
+	for (int c = 0; c < src.num_components; ++c) {
+		JDIMENSION width, height;
+		jpeg_component_info *comp = &src.comp_info[c];
+
+		_output_blocks(&plan, comp, src.max_h_samp_factor,
+				src.max_v_samp_factor, &width, &height);
+		dst_arrays[c] = src.mem->request_virt_barray((j_common_ptr) &src,
+				JPOOL_IMAGE, TRUE, width, height,
+				plan.o.swap ? comp->h_samp_factor : comp->v_samp_factor);
+	}
+	error_code = IMAGE_UTIL_ERROR_INVALID_OPERATION;
+
+	jvirt_barray_ptr *src_arrays = jpeg_read_coefficients(&src);
+
+	jpeg_copy_critical_parameters(&src, &dst);
+	dst.image_width = plan.out_width;
+	dst.image_height = plan.out_height;
+	if (plan.o.swap)
+		_transpose_parameters(&dst);
+
+	output = fopen(job->output_path, "wb");
+	if (output == NULL) {
+		error_code = IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+		goto out;
+	}
+	jpeg_stdio_dest(&dst, output);
+	jpeg_write_coefficients(&dst, dst_arrays);
+	for (jpeg_saved_marker_ptr marker = src.marker_list; marker != NULL;
+			marker = marker->next)
+		jpeg_write_marker(&dst, marker->marker, marker->data,
+				marker->data_length);
+
+	_copy_blocks(&src, src_arrays, dst_arrays, &plan);
+
+	jpeg_finish_compress(&dst);
+	jpeg_finish_decompress(&src);
+	error_code = IMAGE_UTIL_ERROR_NONE;
+
+out:
+	jpeg_destroy_compress(&dst);
+	jpeg_destroy_decompress(&src);
+	fclose(input);
+	if (output != NULL) {
+		fclose(output);
+		if (error_code != IMAGE_UTIL_ERROR_NONE)
+			remove(job->output_path);
+	}
+
+	if (error_code == IMAGE_UTIL_ERROR_NONE)
+		__atomic_add_fetch(&stats.transformed, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_add_fetch(&stats.unsupported, 1, __ATOMIC_RELAXED);
+	return error_code;
+}
+
+/**
+ * @brief Prints how many jobs took the lossless path to the log.
+ */
+void lossless_log_stats(void) {
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Lossless JPEG: %u transformed, %u left to the pixel path",
+			__atomic_load_n(&stats.transformed, __ATOMIC_RELAXED),
+			__atomic_load_n(&stats.unsupported, __ATOMIC_RELAXED));
+}
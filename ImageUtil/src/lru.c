@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lru.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LRU_MIN_BUCKETS 64
+
+struct lru_entry {
+	char *key;
+	unsigned int hash;
+	void *value;
+	size_t bytes;
+	/* One reference for the cache while cached, one per lru_get() user. */
+	int refcount;
+	bool cached;
+	lru_entry *hash_next;
+	/* Recency list, most recently used first. */
+	lru_entry *prev;
+	lru_entry *next;
+};
+
+struct lru_cache {
+	pthread_mutex_t lock;
+	lru_entry **buckets;
+	unsigned int bucket_count;
+	lru_entry *head;
+	lru_entry *tail;
+	lru_free_cb free_value;
+	lru_stats stats;
+};
+
+/* FNV-1a. */
+static unsigned int _hash(const char *key) {
+	unsigned int hash = 2166136261u;
+
+	for (; *key != '\0'; ++key) {
+		hash ^= (unsigned char) *key;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void _unref_locked(lru_cache *cache, lru_entry *entry) {
+	if (--entry->refcount > 0)
+		return;
+
+	if (cache->free_value != NULL)
+		cache->free_value(entry->value);
+	free(entry->key);
+	free(entry);
+}
+
+static void _list_unlink(lru_cache *cache, lru_entry *entry) {
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void _list_push_front(lru_cache *cache, lru_entry *entry) {
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head != NULL)
+		cache->head->prev = entry;
+	cache->head = entry;
+	if (cache->tail == NULL)
+		cache->tail = entry;
+}
+
+static lru_entry **_bucket(lru_cache *cache, unsigned int hash) {
+	return &cache->buckets[hash & (cache->bucket_count - 1)];
+}
+
+/**
+ * @brief Removes a cached entry and drops the cache's reference to it.
+ * @remarks Must be called with the cache lock held.
+ */
+static void _remove_locked(lru_cache *cache, lru_entry *entry) {
+	lru_entry **link = _bucket(cache, entry->hash);
+
+	while (*link != entry)
+		link = &(*link)->hash_next;
+	*link = entry->hash_next;
+	entry->hash_next = NULL;
+
+	_list_unlink(cache, entry);
+	entry->cached = false;
+	cache->stats.entries--;
+	cache->stats.bytes -= entry->bytes;
+	_unref_locked(cache, entry);
+}
+
+static void _evict_locked(lru_cache *cache) {
+	while (cache->stats.bytes > cache->stats.budget && cache->tail != NULL) {
+		_remove_locked(cache, cache->tail);
+		cache->stats.evictions++;
+	}
+}
+
+static void _grow_locked(lru_cache *cache) {
+	unsigned int count = cache->bucket_count * 2;
+	lru_entry **buckets = calloc(count, sizeof(lru_entry *));
+
+	/* A crowded table is still correct, just slower. */
+	if (buckets == NULL)
+		return;
+
+	for (unsigned int i = 0; i < cache->bucket_count; ++i) {
+		lru_entry *entry = cache->buckets[i];
+
+		while (entry != NULL) {
+			lru_entry *next = entry->hash_next;
+			lru_entry **link = &buckets[entry->hash & (count - 1)];
+
+			entry->hash_next = *link;
+			*link = entry;
+			entry = next;
+		}
+	}
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->bucket_count = count;
+}
+
+/**
+ * @brief Creates a cache.
+ *
+ * @param budget The maximum number of bytes of cached values
+ * @param free_value The function releasing a value, may be NULL
+ * @return The new cache, or NULL
+ */
+lru_cache *lru_create(size_t budget, lru_free_cb free_value) {
+	lru_cache *cache = calloc(1, sizeof(lru_cache));
+
+	if (cache == NULL)
+		return NULL;
+
+	cache->buckets = calloc(LRU_MIN_BUCKETS, sizeof(lru_entry *));
+	if (cache->buckets == NULL) {
+		free(cache);
+		return NULL;
+	}
+
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->bucket_count = LRU_MIN_BUCKETS;
+	cache->free_value = free_value;
+	cache->stats.budget = budget;
+	return cache;
+}
+
+/**
+ * @brief Destroys the cache. All entries must have been released.
+ *
+ * @param cache The cache, may be NULL
+ */
+void lru_destroy(lru_cache *cache) {
+	if (cache == NULL)
+		return;
+
+	lru_clear(cache);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->buckets);
+	free(cache);
+}
+
+/**
+ * @brief Looks up a key and marks it as most recently used.
+ *
+ * @param cache The cache
+ * @param key The key
+ * @return The entry with a reference the caller must release with
+ *         lru_release(), or NULL on a miss
+ */
+lru_entry *lru_get(lru_cache *cache, const char *key) {
+	unsigned int hash = _hash(key);
+	lru_entry *entry;
+
+	pthread_mutex_lock(&cache->lock);
+	for (entry = *_bucket(cache, hash); entry != NULL; entry =
+			entry->hash_next)
+		if (entry->hash == hash && strcmp(entry->key, key) == 0)
+			break;
+
+	if (entry != NULL) {
+		_list_unlink(cache, entry);
+		_list_push_front(cache, entry);
+		entry->refcount++;
+		cache->stats.hits++;
+	} else {
+		cache->stats.misses++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return entry;
+}
+
+/**
+ * @brief Inserts a value, replacing any value with the same key.
+ * @details The cache takes ownership of the value. Least recently used
+ *          entries are evicted to stay within the budget. A value larger
+ *          than the whole budget is not cached, but the returned entry is
+ *          still usable until released.
+ *
+ * @param cache The cache
+ * @param key The key; copied
+ * @param value The value
+ * @param bytes The size accounted for the value
+ * @return The entry with a reference the caller must release with
+ *         lru_release(), or NULL if out of memory (the value is freed)
+ */
+lru_entry *lru_put(lru_cache *cache, const char *key, void *value,
+		size_t bytes) {
+	lru_entry *entry = calloc(1, sizeof(lru_entry));
+
+	if (entry != NULL)
+		entry->key = strdup(key);
+	if (entry == NULL || entry->key == NULL) {
+		free(entry);
+		if (cache->free_value != NULL)
+			cache->free_value(value);
+		return NULL;
+	}
+
+	entry->hash = _hash(key);
+	entry->value = value;
+	entry->bytes = bytes;
+	entry->refcount = 1;
+
+	pthread_mutex_lock(&cache->lock);
+	for (lru_entry *old = *_bucket(cache, entry->hash); old != NULL; old =
+			old->hash_next) {
+		if (old->hash == entry->hash && strcmp(old->key, key) == 0) {
+			_remove_locked(cache, old);
+			break;
+		}
+	}
+
+	if (bytes <= cache->stats.budget) {
+		lru_entry **link = _bucket(cache, entry->hash);
+
+		entry->hash_next = *link;
+		*link = entry;
+		_list_push_front(cache, entry);
+		entry->cached = true;
+		entry->refcount++;
+		cache->stats.entries++;
+		cache->stats.bytes += bytes;
+		cache->stats.insertions++;
+
+		_evict_locked(cache);
+		if (cache->stats.entries > cache->bucket_count)
+			_grow_locked(cache);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return entry;
+}
+
+/**
+ * @brief Returns the value stored in an entry.
+ */
+void *lru_entry_value(const lru_entry *entry) {
+	return entry->value;
+}
+
+/**
+ * @brief Releases a reference returned by lru_get() or lru_put().
+ *
+ * @param cache The cache the entry belongs to
+ * @param entry The entry, may be NULL
+ */
+void lru_release(lru_cache *cache, lru_entry *entry) {
+	if (entry == NULL)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	_unref_locked(cache, entry);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Changes the budget, evicting entries if it shrinks.
+ *
+ * @param cache The cache
+ * @param budget The new budget in bytes
+ */
+void lru_set_budget(lru_cache *cache, size_t budget) {
+	pthread_mutex_lock(&cache->lock);
+	cache->stats.budget = budget;
+	_evict_locked(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Evicts every entry. Entries still referenced stay valid.
+ *
+ * @param cache The cache
+ */
+void lru_clear(lru_cache *cache) {
+	pthread_mutex_lock(&cache->lock);
+	while (cache->tail != NULL) {
+		_remove_locked(cache, cache->tail);
+		cache->stats.evictions++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Copies the cache statistics.
+ *
+ * @param cache The cache
+ * @param stats The structure receiving the statistics
+ */
+void lru_get_stats(lru_cache *cache, lru_stats *stats) {
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+}
@@ -23,6 +23,21 @@
 #include "main.h"
 #include "view.h"
 #include "data.h"
+#include "batch.h"
+#include "concurrency.h"
+#include "memgov.h"
+#include "cli.h"
+
+/* A batch requested through app_control, waiting for its reply. */
+typedef struct
+{
+    app_control_h request;
+    batch_summary summary;
+} batch_launch;
+
+static bool view_created = false;
+static unsigned int batches_running = 0;
+static cancel_token *batches_token = NULL;
 
 /**
  * @brief Hook to take necessary actions before main event loop starts.
@@ -35,20 +50,135 @@
  */
 static bool app_create(void *user_data)
 {
-    view_create(user_data);
+    /* The view is created in app_control(), unless a batch is requested. */
     return true;
 }
 
+/**
+ * @brief Replies to a batch launch request with its summary.
+ * @details Exits the application after the last batch if it has no view.
+ * @remarks This function matches the Ecore_Cb() type signature
+ *          defined in the EFL API.
+ *
+ * @param data The batch_launch sent by _batch_done_cb()
+ */
+static void _batch_reply_main_cb(void *data)
+{
+    batch_launch *launch = data;
+    const batch_summary *summary = &launch->summary;
+    app_control_h reply = NULL;
+    char value[16];
+
+    if (app_control_create(&reply) == APP_CONTROL_ERROR_NONE) {
+        snprintf(value, sizeof(value), "%u", summary->submitted);
+        app_control_add_extra_data(reply, "submitted", value);
+        snprintf(value, sizeof(value), "%u", summary->succeeded);
+        app_control_add_extra_data(reply, "succeeded", value);
+        snprintf(value, sizeof(value), "%u", summary->failed);
+        app_control_add_extra_data(reply, "failed", value);
+        snprintf(value, sizeof(value), "%u", summary->cancelled);
+        app_control_add_extra_data(reply, "cancelled", value);
+
+        app_control_reply_to_launch_request(reply, launch->request,
+                (summary->failed == 0 && summary->cancelled == 0) ?
+                        APP_CONTROL_RESULT_SUCCEEDED : APP_CONTROL_RESULT_FAILED);
+        app_control_destroy(reply);
+    }
+
+    dlog_print(DLOG_INFO, LOG_TAG, "Batch over: %u succeeded, %u failed, %u cancelled",
+            summary->succeeded, summary->failed, summary->cancelled);
+
+    app_control_destroy(launch->request);
+    free(launch);
+
+    if (--batches_running == 0 && !view_created)
+        ui_app_exit();
+}
+
+/**
+ * @brief Forwards the summary of a batch to the main loop.
+ * @remarks This function matches the batch_done_cb() type signature.
+ *
+ * @param summary The outcome of the batch
+ * @param user_data The batch_launch passed to batch_submit()
+ */
+static void _batch_done_cb(const batch_summary *summary, void *user_data)
+{
+    batch_launch *launch = user_data;
+
+    launch->summary = *summary;
+    ecore_main_loop_thread_safe_call_async(_batch_reply_main_cb, launch);
+}
+
+/**
+ * @brief Starts a batch described by the extras of a launch request.
+ * @details The batch runs on the workers without creating the view; the
+ *          caller gets the summary as the reply to its request.
+ *
+ * @param app_control The launch request
+ */
+static void _start_batch(app_control_h app_control)
+{
+    batch_request req;
+    batch_launch *launch = NULL;
+    int error_code = batch_request_from_app_control(app_control, &req);
+
+    if (error_code == IMAGE_UTIL_ERROR_NONE)
+        error_code = batch_init();
+
+    if (error_code == IMAGE_UTIL_ERROR_NONE) {
+        launch = calloc(1, sizeof(batch_launch));
+        if (launch == NULL || app_control_clone(&launch->request, app_control) != APP_CONTROL_ERROR_NONE)
+            error_code = IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (batches_token == NULL)
+        batches_token = cancel_token_create(NULL);
+
+    if (error_code == IMAGE_UTIL_ERROR_NONE) {
+        batches_running++;
+        error_code = batch_submit(&req, batches_token, NULL, _batch_done_cb, launch);
+        if (error_code != IMAGE_UTIL_ERROR_NONE) {
+            batches_running--;
+            app_control_destroy(launch->request);
+        }
+    }
+
+    if (error_code != IMAGE_UTIL_ERROR_NONE) {
+        DLOG_PRINT_ERROR("batch_submit", error_code);
+        free(launch);
+
+        app_control_h reply = NULL;
+        if (app_control_create(&reply) == APP_CONTROL_ERROR_NONE) {
+            app_control_reply_to_launch_request(reply, app_control, APP_CONTROL_RESULT_FAILED);
+            app_control_destroy(reply);
+        }
+        if (batches_running == 0 && !view_created)
+            ui_app_exit();
+    }
+}
+
 /**
  * @brief This callback function is called when another application
  * sends a launch request to the application.
+ * @details A request with the BATCH_APP_CONTROL_OPERATION operation runs a
+ * batch headless. Any other request shows the view.
  *
- * @param app_control The launch request (not used here)
- * @param user_data The data passed from the callback registration function (not used here)
+ * @param app_control The launch request
+ * @param user_data The data passed from the callback registration function
  */
 static void app_control(app_control_h app_control, void *user_data)
 {
-    /* Handle the launch request. */
+    char *operation = NULL;
+
+    app_control_get_operation(app_control, &operation);
+    if (operation != NULL && strcmp(operation, BATCH_APP_CONTROL_OPERATION) == 0) {
+        _start_batch(app_control);
+    } else if (!view_created) {
+        view_create(user_data);
+        view_created = true;
+    }
+    free(operation);
 }
 
 /**
@@ -61,6 +191,8 @@ static void app_control(app_control_h app_control, void *user_data)
 static void app_pause(void *user_data)
 {
     /* Take necessary actions when application becomes invisible. */
+    /* Let batches go on in the background, but gently. */
+    concurrency_pause();
 }
 
 /**
@@ -72,6 +204,7 @@ static void app_pause(void *user_data)
 static void app_resume(void *user_data)
 {
     /* Take necessary actions when application becomes visible. */
+    concurrency_resume();
 }
 
 /**
@@ -82,7 +215,12 @@ static void app_resume(void *user_data)
 static void app_terminate(void *user_data)
 {
     /* Release all resources. */
-    _pop_navi();
+    cancel_token_cancel(batches_token);
+    release_data();
+    cancel_token_unref(batches_token);
+    batches_token = NULL;
+    if (view_created)
+        _pop_navi();
 }
 
 /**
@@ -105,6 +243,30 @@ static void ui_app_lang_changed(app_event_info_h event_info, void *user_data)
     return;
 }
 
+/**
+ * @brief This function will be called when the device runs low on memory,
+ * and again when it no longer does.
+ *
+ * @param event_info The system event information, holding the memory status
+ * @param user_data The data passed from the callback registration function (not used here)
+ */
+static void ui_app_low_memory(app_event_info_h event_info, void *user_data)
+{
+    /* APP_EVENT_LOW_MEMORY */
+    app_event_low_memory_status_e status;
+
+    if (app_event_get_low_memory_status(event_info, &status) != APP_ERROR_NONE)
+        return;
+
+    /* Give memory back instead of being killed in the middle of a batch. */
+    if (status == APP_EVENT_LOW_MEMORY_HARD_WARNING)
+        memgov_set_pressure(MEMGOV_PRESSURE_HARD);
+    else if (status == APP_EVENT_LOW_MEMORY_SOFT_WARNING)
+        memgov_set_pressure(MEMGOV_PRESSURE_SOFT);
+    else
+        memgov_set_pressure(MEMGOV_PRESSURE_NORMAL);
+}
+
 /**
  * @brief Main function of the application.
  */
@@ -115,6 +277,10 @@ int main(int argc, char *argv[])
     ui_app_lifecycle_callback_s event_callback = {0, };
     app_event_handler_h handlers[5] = {NULL, };
 
+    /* A command-line batch does not need the UI at all. */
+    if (cli_requested(argc, argv))
+        return cli_main(argc, argv);
+
     event_callback.create = app_create;
     event_callback.terminate = app_terminate;
     event_callback.pause = app_pause;
@@ -126,6 +292,7 @@ int main(int argc, char *argv[])
      * please check the application life cycle guide.
      */
     ui_app_add_event_handler(&handlers[APP_EVENT_LANGUAGE_CHANGED], APP_EVENT_LANGUAGE_CHANGED, ui_app_lang_changed, NULL);
+    ui_app_add_event_handler(&handlers[APP_EVENT_LOW_MEMORY], APP_EVENT_LOW_MEMORY, ui_app_low_memory, NULL);
 
     ret = ui_app_main(argc, argv, &event_callback, NULL);
     if (ret != APP_ERROR_NONE)
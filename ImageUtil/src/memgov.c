@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "main.h"
+#include "memgov.h"
+#include "scheduler.h"
+#include "frame_cache.h"
+#include "lazy.h"
+#include "arena.h"
+#include <tizen.h>
+#include <pthread.h>
+
+/* Percentages of the budget given to each consumer of memory. */
+typedef struct {
+	unsigned int frames;
+	unsigned int results;
+	unsigned int pool;
+	unsigned int jobs;
+} memgov_shares;
+
+/*
+ * The caches only save work, so they shrink first: under soft pressure to
+ * about a third, under hard pressure to nothing, every entry evicted. The
+ * jobs keep most of their share until the pressure is hard; even then a
+ * job larger than it still runs, alone.
+ */
+static const memgov_shares shares[MEMGOV_PRESSURE_COUNT] = {
+	[MEMGOV_PRESSURE_NORMAL] = { 25, 12, 25, 38 },
+	[MEMGOV_PRESSURE_SOFT] = { 8, 4, 8, 30 },
+	[MEMGOV_PRESSURE_HARD] = { 0, 0, 0, 15 }
+};
+
+static const char *pressure_names[MEMGOV_PRESSURE_COUNT] = { "normal", "soft",
+		"hard" };
+
+static struct {
+	pthread_mutex_t lock;
+	bool running;
+	size_t budget;
+	memgov_pressure pressure;
+	unsigned int changes[MEMGOV_PRESSURE_COUNT];
+} gov = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Hands each consumer its share of the budget at the current
+ *        pressure.
+ * @details Shrinking a cache evicts its least recently used entries and
+ *          shrinking the pool frees its buffers right away; entries in use
+ *          are freed when released.
+ * @remarks Must be called with gov.lock held.
+ */
+static void _apply(void) {
+	const memgov_shares *share = &shares[gov.pressure];
+	size_t unit = gov.budget / 100;
+
+	frame_cache_set_budget(unit * share->frames);
+	lazy_set_budget(unit * share->results);
+	buffer_pool_set_budget(unit * share->pool);
+	scheduler_set_memory_budget(unit * share->jobs);
+}
+
+/**
+ * @brief Starts governing the memory of the caches, the buffer pool and
+ *        the batch jobs. Safe to call more than once.
+ * @details Call after frame_cache_init() and scheduler_init().
+ *
+ * @param budget The byte budget, 0 for MEMGOV_BUDGET
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int memgov_start(size_t budget) {
+	pthread_mutex_lock(&gov.lock);
+	if (!gov.running) {
+		gov.running = true;
+		gov.budget = budget ? budget : MEMGOV_BUDGET;
+		_apply();
+	}
+	pthread_mutex_unlock(&gov.lock);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Stops governing; later pressure changes are only recorded.
+ * @details Call before the caches are shut down, so that they are not
+ *          created again.
+ */
+void memgov_stop(void) {
+	pthread_mutex_lock(&gov.lock);
+	gov.running = false;
+	pthread_mutex_unlock(&gov.lock);
+}
+
+/**
+ * @brief Reacts to a change of memory pressure.
+ * @details Back to normal, the caches may grow again; they refill as
+ *          they are used.
+ */
+void memgov_set_pressure(memgov_pressure pressure) {
+	if (pressure >= MEMGOV_PRESSURE_COUNT)
+		return;
+
+	pthread_mutex_lock(&gov.lock);
+	if (pressure != gov.pressure) {
+		dlog_print(DLOG_WARN, LOG_TAG, "Memory pressure %s -> %s",
+				pressure_names[gov.pressure], pressure_names[pressure]);
+		gov.pressure = pressure;
+		gov.changes[pressure]++;
+		if (gov.running)
+			_apply();
+	}
+	pthread_mutex_unlock(&gov.lock);
+}
+
+/**
+ * @brief Estimates the memory a job holds while it runs.
+ * @details The decoded source in RGB888, and the transformed image twice:
+ *          in its media packet and in the buffer it is encoded from.
+ * @remarks The source size is that of the decode, see probe_plan_job(), so
+ *          a job decoded at 1/8 scale is charged 1/64 of the full image.
+ */
+size_t memgov_job_bytes(const transform_job *job) {
+	if (job->src_width <= 0 || job->src_height <= 0)
+		return MEMGOV_UNKNOWN_JOB_BYTES;
+
+	size_t source = (size_t) job->src_width * job->src_height;
+	size_t output = (job->width > 0 && job->height > 0) ?
+			(size_t) job->width * job->height : source;
+
+	return source * 3 + output * 4 * 2;
+}
+
+/**
+ * @brief Prints the budget, the pressure and what it caused to the log.
+ */
+void memgov_log_stats(void) {
+	scheduler_load load;
+
+	scheduler_sample(&load);
+	pthread_mutex_lock(&gov.lock);
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Memory: budget %zu bytes, pressure %s (%u soft, %u hard, %u normal), jobs hold %zu of %zu bytes, %u waits for memory",
+			gov.budget, pressure_names[gov.pressure],
+			gov.changes[MEMGOV_PRESSURE_SOFT], gov.changes[MEMGOV_PRESSURE_HARD],
+			gov.changes[MEMGOV_PRESSURE_NORMAL], load.batch_bytes,
+			load.memory_budget, load.memory_holds);
+	pthread_mutex_unlock(&gov.lock);
+}
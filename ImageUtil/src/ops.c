@@ -0,0 +1,602 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "ops.h"
+#include "arena.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OPS_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OPS_NEON 1
+#endif
+
+/* Transposes run in square tiles of this many pixels, 8x8 blocks inside. */
+#define OPS_TILE 32
+
+/* Transposes an 8x8 block; dst receives src's columns as rows. */
+typedef void (*transpose8x8_fn)(const unsigned char *src, ptrdiff_t src_stride,
+		unsigned char *dst, ptrdiff_t dst_stride);
+
+#if defined(OPS_SSE2)
+static void _transpose8x8_u8(const unsigned char *src, ptrdiff_t src_stride,
+		unsigned char *dst, ptrdiff_t dst_stride) {
+	__m128i r[8];
+
+	for (int i = 0; i < 8; ++i)
+		r[i] = _mm_loadl_epi64((const __m128i *) (src + i * src_stride));
+
+	__m128i a0 = _mm_unpacklo_epi8(r[0], r[1]);
+	__m128i a1 = _mm_unpacklo_epi8(r[2], r[3]);
+	__m128i a2 = _mm_unpacklo_epi8(r[4], r[5]);
+	__m128i a3 = _mm_unpacklo_epi8(r[6], r[7]);
+
+	__m128i b0 = _mm_unpacklo_epi16(a0, a1);
+	__m128i b1 = _mm_unpackhi_epi16(a0, a1);
+	__m128i b2 = _mm_unpacklo_epi16(a2, a3);
+	__m128i b3 = _mm_unpackhi_epi16(a2, a3);
+
+	/* Each register now holds two output rows. */
+	__m128i c[4] = { _mm_unpacklo_epi32(b0, b2), _mm_unpackhi_epi32(b0, b2),
+			_mm_unpacklo_epi32(b1, b3), _mm_unpackhi_epi32(b1, b3) };
+
+	for (int i = 0; i < 4; ++i) {
+		_mm_storel_epi64((__m128i *) (dst + 2 * i * dst_stride), c[i]);
+		_mm_storel_epi64((__m128i *) (dst + (2 * i + 1) * dst_stride),
+				_mm_unpackhi_epi64(c[i], c[i]));
+	}
+}
+
+static void _transpose8x8_u16(const unsigned char *src, ptrdiff_t src_stride,
+		unsigned char *dst, ptrdiff_t dst_stride) {
+	__m128i r[8];
+	__m128i a[8];
+	__m128i b[8];
+
+	for (int i = 0; i < 8; ++i)
+		r[i] = _mm_loadu_si128((const __m128i *) (src + i * src_stride));
+
+	for (int i = 0; i < 8; i += 2) {
+		a[i] = _mm_unpacklo_epi16(r[i], r[i + 1]);
+		a[i + 1] = _mm_unpackhi_epi16(r[i], r[i + 1]);
+	}
+	for (int i = 0; i < 8; i += 4) {
+		b[i] = _mm_unpacklo_epi32(a[i], a[i + 2]);
+		b[i + 1] = _mm_unpackhi_epi32(a[i], a[i + 2]);
+		b[i + 2] = _mm_unpacklo_epi32(a[i + 1], a[i + 3]);
+		b[i + 3] = _mm_unpackhi_epi32(a[i + 1], a[i + 3]);
+	}
+	for (int i = 0; i < 4; ++i) {
+		_mm_storeu_si128((__m128i *) (dst + 2 * i * dst_stride),
+				_mm_unpacklo_epi64(b[i], b[i + 4]));
+		_mm_storeu_si128((__m128i *) (dst + (2 * i + 1) * dst_stride),
+				_mm_unpackhi_epi64(b[i], b[i + 4]));
+	}
+}
+
+/**
+ * @brief Spreads four packed RGB pixels to one per 32-bit lane.
+ * @details Lane i takes bytes 3i to 3i + 3; its top byte is ignored.
+ */
+static inline __m128i _rgb_spread4(__m128i v) {
+	__m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+	__m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6),
+			_mm_srli_si128(v, 9));
+
+	return _mm_unpacklo_epi64(p01, p23);
+}
+
+/**
+ * @brief Packs four pixels of one per 32-bit lane into the low 12 bytes.
+ */
+static inline __m128i _rgb_pack4(__m128i v) {
+	const __m128i low = _mm_set_epi32(0, 0xFFFFFF, 0, 0xFFFFFF);
+	const __m128i high = _mm_set_epi32(0xFFFF, 0xFF000000, 0xFFFF,
+			0xFF000000);
+	/* Two pixels in the low 6 bytes of each half. */
+	__m128i pairs = _mm_or_si128(_mm_and_si128(v, low),
+			_mm_and_si128(_mm_srli_epi64(v, 8), high));
+
+	return _mm_or_si128(_mm_move_epi64(pairs),
+			_mm_slli_si128(_mm_srli_si128(pairs, 8), 6));
+}
+
+static inline void _transpose4x4_u32(__m128i m[4]) {
+	__m128i t0 = _mm_unpacklo_epi32(m[0], m[1]);
+	__m128i t1 = _mm_unpacklo_epi32(m[2], m[3]);
+	__m128i t2 = _mm_unpackhi_epi32(m[0], m[1]);
+	__m128i t3 = _mm_unpackhi_epi32(m[2], m[3]);
+
+	m[0] = _mm_unpacklo_epi64(t0, t1);
+	m[1] = _mm_unpackhi_epi64(t0, t1);
+	m[2] = _mm_unpacklo_epi64(t2, t3);
+	m[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+static void _transpose8x8_rgb(const unsigned char *src, ptrdiff_t src_stride,
+		unsigned char *dst, ptrdiff_t dst_stride) {
+	/* Pixels 0 to 3 and 4 to 7 of every row, one per lane. */
+	__m128i left[8];
+	__m128i right[8];
+
+	/* Exactly 24 bytes per row are read and written. */
+	for (int i = 0; i < 8; ++i) {
+		const unsigned char *row = src + i * src_stride;
+		__m128i a = _mm_loadu_si128((const __m128i *) row);
+		__m128i b = _mm_loadl_epi64((const __m128i *) (row + 16));
+
+		left[i] = _rgb_spread4(a);
+		right[i] = _rgb_spread4(_mm_or_si128(_mm_srli_si128(a, 12),
+				_mm_slli_si128(b, 4)));
+	}
+
+	/*
+	 * Four 4x4 transposes: left[0..3] then holds rows 0 to 3 of output rows
+	 * 0 to 3, left[4..7] rows 4 to 7 of them, right[] those of output rows
+	 * 4 to 7.
+	 */
+	_transpose4x4_u32(left);
+	_transpose4x4_u32(left + 4);
+	_transpose4x4_u32(right);
+	_transpose4x4_u32(right + 4);
+
+	for (int i = 0; i < 8; ++i) {
+		unsigned char *row = dst + i * dst_stride;
+		__m128i *half = (i < 4) ? left : right;
+		__m128i a = _rgb_pack4(half[i % 4]);
+		__m128i b = _rgb_pack4(half[i % 4 + 4]);
+
+		_mm_storeu_si128((__m128i *) row, _mm_or_si128(a,
+				_mm_slli_si128(b, 12)));
+		_mm_storel_epi64((__m128i *) (row + 16), _mm_srli_si128(b, 4));
+	}
+}
+#elif defined(OPS_NEON)
+/**
+ * @brief Transposes eight rows of eight bytes held in registers.
+ */
+static inline void _transpose_regs_u8(uint8x8_t r[8]) {
+	uint8x8x2_t t01 = vtrn_u8(r[0], r[1]);
+	uint8x8x2_t t23 = vtrn_u8(r[2], r[3]);
+	uint8x8x2_t t45 = vtrn_u8(r[4], r[5]);
+	uint8x8x2_t t67 = vtrn_u8(r[6], r[7]);
+
+	uint16x4x2_t u02 = vtrn_u16(vreinterpret_u16_u8(t01.val[0]),
+			vreinterpret_u16_u8(t23.val[0]));
+	uint16x4x2_t u13 = vtrn_u16(vreinterpret_u16_u8(t01.val[1]),
+			vreinterpret_u16_u8(t23.val[1]));
+	uint16x4x2_t u46 = vtrn_u16(vreinterpret_u16_u8(t45.val[0]),
+			vreinterpret_u16_u8(t67.val[0]));
+	uint16x4x2_t u57 = vtrn_u16(vreinterpret_u16_u8(t45.val[1]),
+			vreinterpret_u16_u8(t67.val[1]));
+
+	uint32x2x2_t v04 = vtrn_u32(vreinterpret_u32_u16(u02.val[0]),
+			vreinterpret_u32_u16(u46.val[0]));
+	uint32x2x2_t v26 = vtrn_u32(vreinterpret_u32_u16(u02.val[1]),
+			vreinterpret_u32_u16(u46.val[1]));
+	uint32x2x2_t v15 = vtrn_u32(vreinterpret_u32_u16(u13.val[0]),
+			vreinterpret_u32_u16(u57.val[0]));
+	uint32x2x2_t v37 = vtrn_u32(vreinterpret_u32_u16(u13.val[1]),
+			vreinterpret_u32_u16(u57.val[1]));
+
+	r[0] = vreinterpret_u8_u32(v04.val[0]);
+	r[1] = vreinterpret_u8_u32(v15.val[0]);
+	r[2] = vreinterpret_u8_u32(v26.val[0]);
+	r[3] = vreinterpret_u8_u32(v37.val[0]);
+	r[4] = vreinterpret_u8_u32(v04.val[1]);
+	r[5] = vreinterpret_u8_u32(v15.val[1]);
+	r[6] = vreinterpret_u8_u32(v26.val[1]);
+	r[7] = vreinterpret_u8_u32(v37.val[1]);
+}
+
+static void _transpose8x8_u8(const unsigned char *src, ptrdiff_t src_stride,
+		unsigned char *dst, ptrdiff_t dst_stride) {
+	uint8x8_t r[8];
+
+	for (int i = 0; i < 8; ++i)
+		r[i] = vld1_u8(src + i * src_stride);
+	_transpose_regs_u8(r);
+	for (int i = 0; i < 8; ++i)
+		vst1_u8(dst + i * dst_stride, r[i]);
+}
+
+static void _transpose8x8_u16(const unsigned char *src, ptrdiff_t src_stride,
+		unsigned char *dst, ptrdiff_t dst_stride) {
+	uint16x8_t r[8];
+
+	for (int i = 0; i < 8; ++i)
+		r[i] = vld1q_u16((const uint16_t *) (src + i * src_stride));
+
+	uint16x8x2_t t01 = vtrnq_u16(r[0], r[1]);
+	uint16x8x2_t t23 = vtrnq_u16(r[2], r[3]);
+	uint16x8x2_t t45 = vtrnq_u16(r[4], r[5]);
+	uint16x8x2_t t67 = vtrnq_u16(r[6], r[7]);
+
+	uint32x4x2_t u02 = vtrnq_u32(vreinterpretq_u32_u16(t01.val[0]),
+			vreinterpretq_u32_u16(t23.val[0]));
+	uint32x4x2_t u13 = vtrnq_u32(vreinterpretq_u32_u16(t01.val[1]),
+			vreinterpretq_u32_u16(t23.val[1]));
+	uint32x4x2_t u46 = vtrnq_u32(vreinterpretq_u32_u16(t45.val[0]),
+			vreinterpretq_u32_u16(t67.val[0]));
+	uint32x4x2_t u57 = vtrnq_u32(vreinterpretq_u32_u16(t45.val[1]),
+			vreinterpretq_u32_u16(t67.val[1]));
+
+	/* Low halves hold columns 0 to 3 of the block, high halves 4 to 7. */
+	uint16x8_t lo[4] = { vreinterpretq_u16_u32(u02.val[0]),
+			vreinterpretq_u16_u32(u13.val[0]), vreinterpretq_u16_u32(
+					u02.val[1]), vreinterpretq_u16_u32(u13.val[1]) };
+	uint16x8_t hi[4] = { vreinterpretq_u16_u32(u46.val[0]),
+			vreinterpretq_u16_u32(u57.val[0]), vreinterpretq_u16_u32(
+					u46.val[1]), vreinterpretq_u16_u32(u57.val[1]) };
+
+	for (int i = 0; i < 4; ++i) {
+		vst1q_u16((uint16_t *) (dst + i * dst_stride),
+				vcombine_u16(vget_low_u16(lo[i]), vget_low_u16(hi[i])));
+		vst1q_u16((uint16_t *) (dst + (i + 4) * dst_stride),
+				vcombine_u16(vget_high_u16(lo[i]), vget_high_u16(hi[i])));
+	}
+}
+
+static void _transpose8x8_rgb(const unsigned char *src, ptrdiff_t src_stride,
+		unsigned char *dst, ptrdiff_t dst_stride) {
+	uint8x8_t channels[3][8];
+
+	/* Deinterleave, transpose every channel and interleave again. */
+	for (int i = 0; i < 8; ++i) {
+		uint8x8x3_t rgb = vld3_u8(src + i * src_stride);
+
+		for (int c = 0; c < 3; ++c)
+			channels[c][i] = rgb.val[c];
+	}
+	for (int c = 0; c < 3; ++c)
+		_transpose_regs_u8(channels[c]);
+	for (int i = 0; i < 8; ++i) {
+		uint8x8x3_t rgb = { { channels[0][i], channels[1][i], channels[2][i] } };
+
+		vst3_u8(dst + i * dst_stride, rgb);
+	}
+}
+#endif
+
+/**
+ * @brief Picks the SIMD block transpose for an element size.
+ *
+ * @return The function, or NULL if blocks go through the scalar path
+ */
+static transpose8x8_fn _block_kernel(int bpp) {
+#if defined(OPS_SSE2) || defined(OPS_NEON)
+	if (bpp == 1)
+		return _transpose8x8_u8;
+	if (bpp == 2)
+		return _transpose8x8_u16;
+	if (bpp == 3)
+		return _transpose8x8_rgb;
+#endif
+	return NULL;
+}
+
+static inline void _copy_pixel(unsigned char *dst, const unsigned char *src,
+		int bpp) {
+	switch (bpp) {
+	case 1:
+		dst[0] = src[0];
+		break;
+	case 2:
+		memcpy(dst, src, 2);
+		break;
+	case 3:
+		memcpy(dst, src, 3);
+		break;
+	default:
+		memcpy(dst, src, 4);
+		break;
+	}
+}
+
+static void _transpose_scalar(const unsigned char *src, ptrdiff_t src_stride,
+		unsigned char *dst, ptrdiff_t dst_stride, int width, int height,
+		int bpp) {
+	for (int y = 0; y < height; ++y) {
+		const unsigned char *s = src + y * src_stride;
+		unsigned char *d = dst + y * bpp;
+
+		for (int x = 0; x < width; ++x, s += bpp, d += dst_stride)
+			_copy_pixel(d, s, bpp);
+	}
+}
+
+/**
+ * @brief Writes the columns of src as the rows of dst.
+ * @details Works through OPS_TILE square tiles, so that the rows being read
+ *          and the rows being written both stay in cache, and through 8x8
+ *          SIMD blocks inside the tiles.
+ */
+static void _transpose(const image_plane *src, const image_plane *dst) {
+	transpose8x8_fn kernel = _block_kernel(src->bpp);
+	int bpp = src->bpp;
+
+	for (int ty = 0; ty < src->height; ty += OPS_TILE) {
+		int th = (src->height - ty < OPS_TILE) ? src->height - ty : OPS_TILE;
+
+		for (int tx = 0; tx < src->width; tx += OPS_TILE) {
+			int tw = (src->width - tx < OPS_TILE) ? src->width - tx : OPS_TILE;
+			const unsigned char *s = src->data + ty * src->stride + tx * bpp;
+			unsigned char *d = dst->data + tx * dst->stride + ty * bpp;
+			int y = 0;
+
+			for (; kernel != NULL && y + 8 <= th; y += 8) {
+				int x = 0;
+
+				for (; x + 8 <= tw; x += 8)
+					kernel(s + y * src->stride + x * bpp, src->stride,
+							d + x * dst->stride + y * bpp, dst->stride);
+				_transpose_scalar(s + y * src->stride + x * bpp, src->stride,
+						d + x * dst->stride + y * bpp, dst->stride, tw - x, 8,
+						bpp);
+			}
+			_transpose_scalar(s + y * src->stride, src->stride, d + y * bpp,
+					dst->stride, tw, th - y, bpp);
+		}
+	}
+}
+
+static void _reverse_row(const unsigned char *src, unsigned char *dst,
+		int width, int bpp) {
+	const unsigned char *s = src + (ptrdiff_t) (width - 1) * bpp;
+
+	for (int x = 0; x < width; ++x, s -= bpp, dst += bpp)
+		_copy_pixel(dst, s, bpp);
+}
+
+/**
+ * @brief Maps a rotation followed by a flip to an orientation.
+ *
+ * @param rotation The clockwise rotation in degrees: 0, 90, 180 or 270
+ * @param flip The flip applied after the rotation
+ * @return The orientation
+ */
+orientation ops_orientation(unsigned int rotation, job_flip flip) {
+	orientation o = { false, false, false };
+
+	switch (rotation % 360) {
+	case 90:
+		o = (orientation) { true, false, true };
+		break;
+	case 180:
+		o = (orientation) { false, true, true };
+		break;
+	case 270:
+		o = (orientation) { true, true, false };
+		break;
+	}
+
+	/* Mirroring an output axis mirrors the source axis it is read from. */
+	if (flip == JOB_FLIP_HORIZONTAL) {
+		if (o.swap)
+			o.rev_y = !o.rev_y;
+		else
+			o.rev_x = !o.rev_x;
+	} else if (flip == JOB_FLIP_VERTICAL) {
+		if (o.swap)
+			o.rev_x = !o.rev_x;
+		else
+			o.rev_y = !o.rev_y;
+	}
+	return o;
+}
+
+/**
+ * @brief Checks whether the job crops, rotates or flips its source.
+ */
+bool ops_job_has_geometry(const transform_job *job) {
+	return (job->crop_width > 0 && job->crop_height > 0)
+			|| (job->rotation % 360) != 0 || job->flip != JOB_FLIP_NONE;
+}
+
+/**
+ * @brief Checks whether the job's rotation exchanges width and height.
+ */
+bool ops_job_swaps_axes(const transform_job *job) {
+	return ops_orientation(job->rotation, job->flip).swap;
+}
+
+/**
+ * @brief Resolves the job's crop rectangle for an image.
+ *
+ * @param job The job; a job without a crop rectangle keeps the whole image
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param x Receives the left edge of the rectangle
+ * @param y Receives the top edge of the rectangle
+ * @param crop_width Receives the width of the rectangle
+ * @param crop_height Receives the height of the rectangle
+ */
+void ops_crop_rect(const transform_job *job, int width, int height, int *x,
+		int *y, int *crop_width, int *crop_height) {
+	*x = 0;
+	*y = 0;
+	*crop_width = width;
+	*crop_height = height;
+	if (job->crop_width == 0 || job->crop_height == 0)
+		return;
+
+	if (job->crop_width < (unsigned int) width)
+		*crop_width = job->crop_width;
+	if (job->crop_height < (unsigned int) height)
+		*crop_height = job->crop_height;
+	*x = (job->crop_x < 0) ? (width - *crop_width) / 2 : job->crop_x;
+	*y = (job->crop_y < 0) ? (height - *crop_height) / 2 : job->crop_y;
+
+	if (*x > width - *crop_width)
+		*x = width - *crop_width;
+	if (*y > height - *crop_height)
+		*y = height - *crop_height;
+}
+
+/**
+ * @brief Restricts a plane to the job's crop rectangle without copying.
+ *
+ * @param plane The plane
+ * @param job The job; a job without a crop rectangle keeps the whole plane
+ * @return A view sharing the plane's pixels
+ */
+image_plane ops_crop_view(const image_plane *plane, const transform_job *job) {
+	image_plane view = *plane;
+	int x, y;
+
+	ops_crop_rect(job, plane->width, plane->height, &x, &y, &view.width,
+			&view.height);
+	view.data += y * plane->stride + x * plane->bpp;
+	return view;
+}
+
+/**
+ * @brief Rotates and flips a plane into another.
+ * @details Quarter turns are done as tiled, cache-blocked transposes;
+ *          vertical mirroring costs nothing beyond walking rows backwards.
+ *
+ * @param src The source plane
+ * @param dst The destination plane, of the oriented size; must not overlap
+ *            src
+ * @param rotation The clockwise rotation in degrees: 0, 90, 180 or 270
+ * @param flip The flip applied after the rotation
+ */
+void ops_orient_plane(const image_plane *src, const image_plane *dst,
+		unsigned int rotation, job_flip flip) {
+	orientation o = ops_orientation(rotation, flip);
+	image_plane s = *src;
+	image_plane d = *dst;
+
+	if (o.rev_y) {
+		s.data += (s.height - 1) * s.stride;
+		s.stride = -s.stride;
+	}
+
+	if (o.swap) {
+		/* Source column x becomes output row x, or row width - 1 - x. */
+		if (o.rev_x) {
+			d.data += (d.height - 1) * d.stride;
+			d.stride = -d.stride;
+		}
+		_transpose(&s, &d);
+		return;
+	}
+
+	for (int y = 0; y < s.height; ++y) {
+		const unsigned char *row = s.data + y * s.stride;
+
+		if (o.rev_x)
+			_reverse_row(row, d.data + y * d.stride, s.width, s.bpp);
+		else
+			memcpy(d.data + y * d.stride, row, (size_t) s.width * s.bpp);
+	}
+}
+
+/**
+ * @brief Splits a tightly packed image into its planes.
+ *
+ * @return The number of planes, 0 if the color space is not supported
+ */
+static int _planes(unsigned char *data, image_util_colorspace_e colorspace,
+		int width, int height, image_plane planes[3]) {
+	switch (colorspace) {
+	case IMAGE_UTIL_COLORSPACE_RGB888:
+		planes[0] = (image_plane) { data, width * 3, width, height, 3 };
+		return 1;
+	case IMAGE_UTIL_COLORSPACE_RGBA8888:
+	case IMAGE_UTIL_COLORSPACE_BGRA8888:
+	case IMAGE_UTIL_COLORSPACE_ARGB8888:
+	case IMAGE_UTIL_COLORSPACE_BGRX8888:
+		planes[0] = (image_plane) { data, width * 4, width, height, 4 };
+		return 1;
+	case IMAGE_UTIL_COLORSPACE_NV12:
+	case IMAGE_UTIL_COLORSPACE_NV21:
+		planes[0] = (image_plane) { data, width, width, height, 1 };
+		planes[1] = (image_plane) { data + width * height, width, width / 2,
+						height / 2, 2 };
+		return 2;
+	case IMAGE_UTIL_COLORSPACE_I420:
+	case IMAGE_UTIL_COLORSPACE_YV12:
+		planes[0] = (image_plane) { data, width, width, height, 1 };
+		planes[1] = (image_plane) { data + width * height, width / 2, width
+						/ 2, height / 2, 1 };
+		planes[2] = (image_plane) { planes[1].data + (width / 2) * (height
+						/ 2), width / 2, width / 2, height / 2, 1 };
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief Checks whether ops_orient_image() can handle an image.
+ * @details Subsampled formats need even dimensions, so that the chroma
+ *          planes turn with the luma plane.
+ */
+bool ops_can_orient(image_util_colorspace_e colorspace, int width,
+		int height) {
+	image_plane planes[3];
+	int count = _planes(NULL, colorspace, width, height, planes);
+
+	return count == 1 || (count > 1 && width % 2 == 0 && height % 2 == 0);
+}
+
+/**
+ * @brief Rotates and flips every plane of an image.
+ *
+ * @param src The image, tightly packed
+ * @param dst Receives the oriented image in a pool buffer; free it with
+ *            image_buffer_free()
+ * @param rotation The clockwise rotation in degrees: 0, 90, 180 or 270
+ * @param flip The flip applied after the rotation
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int ops_orient_image(const image_buffer *src, image_buffer *dst,
+		unsigned int rotation, job_flip flip) {
+	image_plane src_planes[3];
+	image_plane dst_planes[3];
+	bool swap = ops_orientation(rotation, flip).swap;
+
+	if (!ops_can_orient(src->colorspace, src->width, src->height))
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+
+	*dst = *src;
+	if (swap) {
+		dst->width = src->height;
+		dst->height = src->width;
+	}
+
+	int count = _planes(src->data, src->colorspace, src->width, src->height,
+			src_planes);
+	const image_plane *last = &src_planes[count - 1];
+	if ((size_t) (last->data - src->data)
+			+ (size_t) last->stride * last->height > src->size)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	dst->data = buffer_pool_get(src->size);
+	if (dst->data == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	dst->pooled = true;
+
+	_planes(dst->data, dst->colorspace, dst->width, dst->height, dst_planes);
+	for (int i = 0; i < count; ++i)
+		ops_orient_plane(&src_planes[i], &dst_planes[i], rotation, flip);
+
+	return IMAGE_UTIL_ERROR_NONE;
+}
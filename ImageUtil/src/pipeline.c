@@ -0,0 +1,557 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "pipeline.h"
+#include "backend.h"
+#include "frame_cache.h"
+#include "arena.h"
+#include "ops.h"
+#include "lossless.h"
+#include "composite.h"
+#include "trace.h"
+#include <tizen.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Maps a pipeline stage to its name.
+ *
+ * @param stage The stage
+ * @return The name of the stage
+ */
+const char *pipeline_stage_name(pipeline_stage stage) {
+	switch (stage) {
+	case PIPELINE_STAGE_QUEUE:
+		return "queue";
+	case PIPELINE_STAGE_DECODE:
+		return "decode";
+	case PIPELINE_STAGE_TRANSFORM:
+		return "transform";
+	case PIPELINE_STAGE_ENCODE:
+		return "encode";
+	case PIPELINE_STAGE_DONE:
+		return "done";
+	}
+	return "unknown";
+}
+
+/**
+ * @brief Releases the frame a source packet was created from.
+ * @remarks This function matches the media_packet_finalize_cb() type
+ *          signature defined in the Media Tool API.
+ *
+ * @param packet The packet being destroyed (not used here)
+ * @param error_code The error code (not used here)
+ * @param user_data The frame_handle backing the packet
+ * @return MEDIA_PACKET_FINALIZE to let the packet be destroyed
+ */
+static int _frame_packet_finalize_cb(media_packet_h packet, int error_code,
+		void *user_data) {
+	frame_cache_release(user_data);
+	return MEDIA_PACKET_FINALIZE;
+}
+
+/**
+ * @brief Gives back the scratch buffer a source packet was created from.
+ * @remarks This function matches the media_packet_finalize_cb() type
+ *          signature defined in the Media Tool API.
+ *
+ * @param packet The packet being destroyed (not used here)
+ * @param error_code The error code (not used here)
+ * @param user_data The scratch buffer backing the packet
+ * @return MEDIA_PACKET_FINALIZE to let the packet be destroyed
+ */
+static int _scratch_packet_finalize_cb(media_packet_h packet, int error_code,
+		void *user_data) {
+	scratch_put(user_data);
+	return MEDIA_PACKET_FINALIZE;
+}
+
+/**
+ * @brief Wraps RGB888 pixels in a media packet without copying them.
+ * @details The pixels stay owned by their owner; finalize_cb is called with
+ *          owner once the packet is destroyed, or right away on failure.
+ *
+ * @param data The pixels, width * 3 bytes per row without padding
+ * @param width The width of the image
+ * @param height The height of the image
+ * @param finalize_cb The function releasing the pixels
+ * @param owner The user data passed to finalize_cb
+ * @param packet The new media packet, owned by the caller on success
+ * @return 0 on success, otherwise a media format or media packet error code
+ */
+static int _create_rgb_packet(unsigned char *data, int width, int height,
+		media_packet_finalize_cb finalize_cb, void *owner,
+		media_packet_h *packet) {
+	/* Create a media format structure. */
+	media_format_h fmt;
+	int error_code = media_format_create(&fmt);
+	if (error_code != MEDIA_FORMAT_ERROR_NONE) {
+		DLOG_PRINT_ERROR("media_format_create", error_code);
+		finalize_cb(NULL, error_code, owner);
+		return error_code;
+	}
+
+	/* Set the MIME type, width and height of the created format. */
+	error_code = media_format_set_video_mime(fmt, MEDIA_FORMAT_RGB888);
+	if (error_code == MEDIA_FORMAT_ERROR_NONE)
+		error_code = media_format_set_video_width(fmt, width);
+	if (error_code == MEDIA_FORMAT_ERROR_NONE)
+		error_code = media_format_set_video_height(fmt, height);
+	if (error_code != MEDIA_FORMAT_ERROR_NONE) {
+		DLOG_PRINT_ERROR("media_format_set_video", error_code);
+		media_format_unref(fmt);
+		finalize_cb(NULL, error_code, owner);
+		return error_code;
+	}
+
+	/* Create a media packet on top of the pixels. */
+	error_code = media_packet_create_from_external_memory(fmt, data,
+			(uint64_t) width * height * 3, finalize_cb, owner, packet);
+	media_format_unref(fmt);
+	if (error_code != MEDIA_PACKET_ERROR_NONE) {
+		DLOG_PRINT_ERROR("media_packet_create_from_external_memory",
+				error_code);
+		finalize_cb(NULL, error_code, owner);
+		return error_code;
+	}
+
+	return MEDIA_PACKET_ERROR_NONE;
+}
+
+/**
+ * @brief Decides whether to rotate and flip after the transform.
+ * @details Turning the smaller of the source and the output is cheaper, but
+ *          only the color spaces ops_orient_image() handles qualify.
+ *
+ * @param job The job
+ * @param width The width of the cropped source
+ * @param height The height of the cropped source
+ * @return @c true to orient the transformed image, @c false the source
+ */
+static bool _orient_late(const transform_job *job, int width, int height) {
+	if (job->rotation % 360 == 0 && job->flip == JOB_FLIP_NONE)
+		return false;
+	if (job->width == 0 || job->height == 0
+			|| (uint64_t) job->width * job->height
+					>= (uint64_t) width * height)
+		return false;
+
+	return ops_can_orient(job->colorspace, job->width, job->height);
+}
+
+/**
+ * @brief Decodes the job's source file into an RGB888 media packet.
+ * @details The decoded frame comes from the frame cache when another job
+ *          already decoded the same file at the same scale. The crop and,
+ *          unless it is cheaper afterwards, the rotation and flip are
+ *          applied in a single pass over the frame; a crop of whole rows
+ *          shares the cached frame instead.
+ *
+ * @param job The job; its source dimensions are filled in
+ * @param packet The new media packet, owned by the caller on success
+ * @param orient_late Set to @c true if the rotation and flip are left for
+ *                    after the transform
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+static int _decode(transform_job *job, media_packet_h *packet,
+		bool *orient_late) {
+	frame_handle *frame = NULL;
+
+	int error_code = frame_cache_decode(job->input_path, job->decode_scale,
+			&frame);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+
+	const image_buffer *image = frame_cache_image(frame);
+	image_plane whole = { image->data, image->width * 3, image->width,
+			image->height, 3 };
+	image_plane view = ops_crop_view(&whole, job);
+
+	*orient_late = _orient_late(job, view.width, view.height);
+	bool orient_now = !*orient_late
+			&& (job->rotation % 360 != 0 || job->flip != JOB_FLIP_NONE);
+	job->src_colorspace = IMAGE_UTIL_COLORSPACE_RGB888;
+
+	if (!orient_now && view.width == whole.width) {
+		job->src_width = view.width;
+		job->src_height = view.height;
+		return _create_rgb_packet(view.data, view.width, view.height,
+				_frame_packet_finalize_cb, frame, packet);
+	}
+
+	image_plane oriented = { NULL, 0, view.width, view.height, 3 };
+	if (orient_now && ops_job_swaps_axes(job)) {
+		oriented.width = view.height;
+		oriented.height = view.width;
+	}
+	oriented.stride = oriented.width * 3;
+	oriented.data = scratch_get((size_t) oriented.stride * oriented.height);
+	if (oriented.data == NULL) {
+		frame_cache_release(frame);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+
+	ops_orient_plane(&view, &oriented, orient_now ? job->rotation : 0,
+			orient_now ? job->flip : JOB_FLIP_NONE);
+	frame_cache_release(frame);
+
+	job->src_width = oriented.width;
+	job->src_height = oriented.height;
+	return _create_rgb_packet(oriented.data, oriented.width, oriented.height,
+			_scratch_packet_finalize_cb, oriented.data, packet);
+}
+
+/**
+ * @brief Gets the pixels, dimensions and size of a media packet.
+ *
+ * @param packet The media packet
+ * @param image The image_buffer receiving the description; its data points
+ *              into the packet
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+static int _describe_packet(media_packet_h packet, image_buffer *image) {
+	/* Get the transformed image format. */
+	media_format_h fmt = NULL;
+
+	int error_code = media_packet_get_format(packet, &fmt);
+	if (error_code != MEDIA_PACKET_ERROR_NONE) {
+		DLOG_PRINT_ERROR("media_packet_get_format", error_code);
+		return error_code;
+	}
+
+	/* Get the transformed image dimensions. */
+	media_format_mimetype_e mimetype;
+
+	error_code = media_format_get_video_info(fmt, &mimetype, &image->width,
+			&image->height, NULL, NULL);
+	/* Release the memory allocated for the media format. */
+	media_format_unref(fmt);
+	if (error_code != MEDIA_FORMAT_ERROR_NONE) {
+		DLOG_PRINT_ERROR("media_format_get_video_info", error_code);
+		return error_code;
+	}
+
+	/* Get the buffer where the transformed image is stored. */
+	void *packet_buffer = NULL;
+	uint64_t size = 0;
+
+	error_code = media_packet_get_buffer_data_ptr(packet, &packet_buffer);
+	if (error_code == MEDIA_PACKET_ERROR_NONE)
+		error_code = media_packet_get_buffer_size(packet, &size);
+	if (error_code != MEDIA_PACKET_ERROR_NONE) {
+		DLOG_PRINT_ERROR("media_packet_get_buffer_data_ptr", error_code);
+		return error_code;
+	}
+
+	image->data = packet_buffer;
+	image->size = size;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Stores the transformed image as the job asks for.
+ * @details Encodes it to the output file, or moves it (and optionally its
+ *          JPEG encoding) into the result. Pixels that still live in a
+ *          media packet are copied; pool buffers are handed over.
+ *
+ * @param job The job
+ * @param image The transformed image; pooled pixels may be taken over, in
+ *              which case its data is set to NULL
+ * @param result The result receiving in-memory output
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+static int _encode(const transform_job *job, image_buffer *image,
+		pipeline_result *result) {
+	int error_code;
+	uint64_t span = trace_begin();
+
+	if (job->output == JOB_OUTPUT_FILE) {
+		/* Store the image from the buffer in a file. */
+		error_code = image_util_encode_jpeg(image->data, image->width,
+				image->height, job->colorspace, job->quality, job->output_path);
+		trace_end("encode+write", span, job->input_path);
+		if (error_code != IMAGE_UTIL_ERROR_NONE) {
+			DLOG_PRINT_ERROR("image_util_encode_jpeg", error_code);
+			return error_code;
+		}
+
+		dlog_print(DLOG_DEBUG, LOG_TAG, "Transformed image file saved at %s",
+				job->output_path);
+		return IMAGE_UTIL_ERROR_NONE;
+	}
+
+	result->raw = *image;
+	if (image->pooled) {
+		image->data = NULL;
+	} else {
+		result->raw.data = buffer_pool_get(image->size);
+		if (result->raw.data == NULL) {
+			trace_end(job->encode ? "encode" : "copy", span, job->input_path);
+			return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+		}
+		result->raw.pooled = true;
+		memcpy(result->raw.data, image->data, image->size);
+	}
+
+	if (!job->encode) {
+		trace_end("copy", span, job->input_path);
+		return IMAGE_UTIL_ERROR_NONE;
+	}
+
+	unsigned int jpeg_size = 0;
+
+	error_code = image_util_encode_jpeg_to_memory(result->raw.data,
+			result->raw.width, result->raw.height, job->colorspace,
+			job->quality, &result->encoded.data, &jpeg_size);
+	trace_end("encode", span, job->input_path);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		DLOG_PRINT_ERROR("image_util_encode_jpeg_to_memory", error_code);
+		return error_code;
+	}
+	result->encoded.size = jpeg_size;
+	result->encoded.width = result->raw.width;
+	result->encoded.height = result->raw.height;
+	result->encoded.colorspace = job->colorspace;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Frees the in-memory output of a job.
+ *
+ * @param result The result; buffers taken over by the caller should be
+ *               set to NULL beforehand
+ */
+void pipeline_result_clear(pipeline_result *result) {
+	image_buffer_free(&result->raw);
+	image_buffer_free(&result->encoded);
+}
+
+/**
+ * @brief Checks the job's cancellation token before entering a stage.
+ *
+ * @param job The job
+ * @param result The result, updated if the job is cancelled
+ * @param stage The stage about to start
+ * @return @c true if the job should stop
+ */
+static bool _cancelled(const transform_job *job, pipeline_result *result,
+		pipeline_stage stage) {
+	result->stage = stage;
+	if (!cancel_token_is_cancelled(job->cancel))
+		return false;
+
+	result->cancelled = true;
+	result->error_code = TIZEN_ERROR_CANCELED;
+	return true;
+}
+
+/**
+ * @brief Checks whether the job may go through lossless_transform().
+ * @details That is the case for a file-to-file job that only crops, rotates
+ *          or flips; the color space only describes the decoded pixels,
+ *          which this path never produces.
+ */
+static bool _lossless_candidate(const transform_job *job) {
+	return job->output == JOB_OUTPUT_FILE
+			&& job->decode_scale == IMAGE_UTIL_DOWNSCALE_1_1
+			&& job->overlays == NULL && ops_job_has_geometry(job);
+}
+
+/**
+ * @brief Checks whether the job may skip the transform.
+ * @details That is the case for a job only placing overlays on the source,
+ *          at its own size, in a 4:2:0 color space: the JPEG is decoded
+ *          straight to it, blended and encoded again without going through
+ *          RGB.
+ */
+static bool _direct_candidate(const transform_job *job) {
+	return job->overlays != NULL && composite_is_yuv(job->colorspace)
+			&& job->decode_scale == IMAGE_UTIL_DOWNSCALE_1_1
+			&& (job->width == 0 || job->height == 0)
+			&& !ops_job_has_geometry(job);
+}
+
+/**
+ * @brief Decodes the job's source file straight to the output color space.
+ *
+ * @param job The job; its source dimensions are filled in
+ * @param image The image receiving the pixels, from malloc()
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+static int _decode_direct(transform_job *job, image_buffer *image) {
+	unsigned int size = 0;
+
+	int error_code = image_util_decode_jpeg(job->input_path, job->colorspace,
+			&image->data, &image->width, &image->height, &size);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		DLOG_PRINT_ERROR("image_util_decode_jpeg", error_code);
+		return error_code;
+	}
+
+	image->size = size;
+	image->colorspace = job->colorspace;
+	job->src_width = image->width;
+	job->src_height = image->height;
+	job->src_colorspace = job->colorspace;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Decodes the job's source and transforms it, geometry included.
+ *
+ * @param job The job; its source dimensions are filled in
+ * @param result The result, updated if the job fails or is cancelled
+ * @param src The decoded media packet, to destroy by the caller
+ * @param dst The transformed media packet, to destroy by the caller
+ * @param image The transformed image; points into dst unless pooled
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+static int _transform(transform_job *job, pipeline_result *result,
+		media_packet_h *src, media_packet_h *dst, image_buffer *image) {
+	bool orient_late = false;
+	uint64_t span = trace_begin();
+
+	result->error_code = _decode(job, src, &orient_late);
+	trace_end("decode", span, job->input_path);
+	if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+		return result->error_code;
+
+	if (_cancelled(job, result, PIPELINE_STAGE_TRANSFORM))
+		return result->error_code;
+
+	/* Resize to the size the image has before it is turned. */
+	transform_job stage = *job;
+	if (orient_late && ops_job_swaps_axes(job)) {
+		stage.width = job->height;
+		stage.height = job->width;
+	}
+	span = trace_begin();
+	result->error_code = backend_transform(*src, &stage, dst,
+			&result->backend);
+	if (result->error_code == IMAGE_UTIL_ERROR_NONE)
+		result->error_code = _describe_packet(*dst, image);
+	if (result->error_code != IMAGE_UTIL_ERROR_NONE) {
+		/* Failed transforms are traced too. */
+		trace_end("transform", span, job->input_path);
+		return result->error_code;
+	}
+	image->colorspace = job->colorspace;
+
+	if (orient_late) {
+		image_buffer transformed = *image;
+
+		result->error_code = ops_orient_image(&transformed, image,
+				job->rotation, job->flip);
+		if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+			image->pooled = false;
+	}
+	trace_end("transform", span, job->input_path);
+	return result->error_code;
+}
+
+/**
+ * @brief Runs the job: decode, transform and encode.
+ * @details Jobs that only crop, rotate or flip a JPEG skip the codec and
+ *          work on its DCT coefficients. Otherwise the geometry is applied
+ *          to the source while decoding or, when the output is smaller, to
+ *          the output of the transform. Overlays are blended onto the
+ *          transformed image; a job doing nothing else to a JPEG in a
+ *          4:2:0 color space skips the transform. The cancellation token
+ *          is checked between stages, so a cancelled job stops after the
+ *          stage it is in. Called from worker threads; must not touch the
+ *          UI. In-memory output is left in the result even on failure;
+ *          release it with pipeline_result_clear().
+ *
+ * @param job The job; its source dimensions are filled in
+ * @param result The outcome of the job
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise the error code of the
+ *         failed stage (also stored in result)
+ */
+int pipeline_run(transform_job *job, pipeline_result *result) {
+	media_packet_h src = NULL;
+	media_packet_h dst = NULL;
+	image_buffer image = { .data = NULL, .pooled = false };
+	unsigned char *decoded = NULL;
+	uint64_t start = monotonic_us();
+	uint64_t job_span = trace_begin();
+	uint64_t span;
+
+	result->error_code = IMAGE_UTIL_ERROR_NONE;
+	result->cancelled = false;
+	result->backend = NULL;
+	memset(&result->raw, 0, sizeof(image_buffer));
+	memset(&result->encoded, 0, sizeof(image_buffer));
+
+	if (_cancelled(job, result, PIPELINE_STAGE_DECODE))
+		goto out;
+
+	if (_lossless_candidate(job)) {
+		span = trace_begin();
+		int error_code = lossless_transform(job);
+		trace_end("lossless", span, job->input_path);
+		if (error_code == IMAGE_UTIL_ERROR_NONE) {
+			result->backend = "lossless";
+			result->stage = PIPELINE_STAGE_DONE;
+			goto out;
+		}
+	}
+
+	if (_direct_candidate(job)) {
+		span = trace_begin();
+		result->error_code = _decode_direct(job, &image);
+		trace_end("decode", span, job->input_path);
+		if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+			goto out;
+		decoded = image.data;
+		result->backend = "direct";
+		if (_cancelled(job, result, PIPELINE_STAGE_TRANSFORM))
+			goto out;
+	} else if (_transform(job, result, &src, &dst, &image)
+			!= IMAGE_UTIL_ERROR_NONE) {
+		goto out;
+	}
+
+	if (job->overlays != NULL) {
+		span = trace_begin();
+		result->error_code = composite_apply(&image, job->overlays);
+		trace_end("composite", span, job->input_path);
+		if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+			goto out;
+	}
+
+	if (_cancelled(job, result, PIPELINE_STAGE_ENCODE))
+		goto out;
+	result->error_code = _encode(job, &image, result);
+	if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+		goto out;
+
+	result->stage = PIPELINE_STAGE_DONE;
+
+out:
+	if (image.pooled)
+		image_buffer_free(&image);
+	if (dst != NULL)
+		media_packet_destroy(dst);
+	if (src != NULL)
+		media_packet_destroy(src);
+	free(decoded);
+
+	result->run_us = monotonic_us() - start;
+	trace_end("job", job_span, job->input_path);
+	return result->error_code;
+}
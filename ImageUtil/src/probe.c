@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "probe.h"
+#include "ops.h"
+#include <stdio.h>
+#include <string.h>
+
+/* JPEG markers. */
+#define JPEG_SOI 0xD8
+#define JPEG_EOI 0xD9
+#define JPEG_SOS 0xDA
+#define JPEG_DHT 0xC4
+#define JPEG_JPG 0xC8
+#define JPEG_DAC 0xCC
+#define JPEG_TEM 0x01
+#define JPEG_RST0 0xD0
+#define JPEG_RST7 0xD7
+
+static struct {
+	unsigned int probes;
+	unsigned int failures;
+	unsigned int rejected;
+	unsigned int downscaled;
+	uint64_t probe_us;
+} stats;
+
+static unsigned int _be16(const unsigned char *p) {
+	return (p[0] << 8) | p[1];
+}
+
+static unsigned int _be32(const unsigned char *p) {
+	return ((unsigned int) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static unsigned int _le16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int _le24(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+/**
+ * @brief Walks the marker segments of a JPEG up to its frame header.
+ * @details Only the segment headers are read; the other segments, EXIF
+ *          thumbnails included, are skipped with fseek().
+ */
+static bool _probe_jpeg(FILE *file, probe_info *info) {
+	unsigned char header[8];
+	int c;
+
+	for (;;) {
+		/* Find the next marker, skipping fill bytes. */
+		do
+			c = fgetc(file);
+		while (c != EOF && c != 0xFF);
+		do
+			c = fgetc(file);
+		while (c == 0xFF);
+		if (c == EOF || c == JPEG_EOI || c == JPEG_SOS)
+			return false;
+
+		if (c == 0 || c == JPEG_TEM || (c >= JPEG_RST0 && c <= JPEG_RST7))
+			continue;
+
+		if (fread(header, 1, 2, file) != 2)
+			return false;
+		unsigned int length = _be16(header);
+		if (length < 2)
+			return false;
+
+		/* SOF0 to SOF15, except the other markers in that range. */
+		if (c >= 0xC0 && c <= 0xCF && c != JPEG_DHT && c != JPEG_JPG
+				&& c != JPEG_DAC) {
+			if (length < 8 || fread(header, 1, 6, file) != 6)
+				return false;
+
+			info->format = PROBE_FORMAT_JPEG;
+			info->bits = header[0];
+			info->height = _be16(header + 1);
+			info->width = _be16(header + 3);
+			info->components = header[5];
+			info->progressive = (c == 0xC2 || c == 0xC6 || c == 0xCA
+					|| c == 0xCE);
+
+			for (unsigned int i = 0; i < info->components; ++i) {
+				if (fread(header, 1, 3, file) != 3)
+					return false;
+				if ((header[1] >> 4) > info->h_sampling)
+					info->h_sampling = header[1] >> 4;
+				if ((header[1] & 0x0F) > info->v_sampling)
+					info->v_sampling = header[1] & 0x0F;
+			}
+			/* A zero height is only known from a later DNL marker. */
+			return info->width > 0 && info->height > 0;
+		}
+
+		if (fseek(file, length - 2, SEEK_CUR) != 0)
+			return false;
+	}
+}
+
+/**
+ * @brief Reads the IHDR chunk, which a PNG must start with.
+ */
+static bool _probe_png(const unsigned char *header, probe_info *info) {
+	static const unsigned int channels[] = { 1, 0, 3, 1, 2, 0, 4 };
+
+	if (memcmp(header + 12, "IHDR", 4) != 0 || header[25] > 6)
+		return false;
+
+	info->format = PROBE_FORMAT_PNG;
+	info->width = _be32(header + 16);
+	info->height = _be32(header + 20);
+	info->bits = header[24];
+	info->components = channels[header[25]];
+	return info->components > 0;
+}
+
+/**
+ * @brief Reads the first chunk of a WebP: lossy, lossless or extended.
+ */
+static bool _probe_webp(const unsigned char *header, probe_info *info) {
+	const unsigned char *data = header + 20;
+
+	info->format = PROBE_FORMAT_WEBP;
+	info->bits = 8;
+	info->components = 3;
+
+	if (memcmp(header + 12, "VP8 ", 4) == 0) {
+		/* Frame tag, then the key frame start code. */
+		if (data[3] != 0x9D || data[4] != 0x01 || data[5] != 0x2A)
+			return false;
+		info->width = _le16(data + 6) & 0x3FFF;
+		info->height = _le16(data + 8) & 0x3FFF;
+	} else if (memcmp(header + 12, "VP8L", 4) == 0) {
+		if (data[0] != 0x2F)
+			return false;
+		unsigned int bits = data[1] | (data[2] << 8) | (data[3] << 16)
+				| ((unsigned int) data[4] << 24);
+		info->width = (bits & 0x3FFF) + 1;
+		info->height = ((bits >> 14) & 0x3FFF) + 1;
+		if (bits & (1U << 28))
+			info->components = 4;
+	} else if (memcmp(header + 12, "VP8X", 4) == 0) {
+		if (data[0] & 0x10)
+			info->components = 4;
+		info->width = _le24(data + 4) + 1;
+		info->height = _le24(data + 7) + 1;
+	} else {
+		return false;
+	}
+	return info->width > 0 && info->height > 0;
+}
+
+/**
+ * @brief Reads the dimensions and layout of an image from its header.
+ * @details Recognizes JPEG (by its frame header), PNG and WebP. Reads a
+ *          few hundred bytes at most, besides seeking over JPEG segments.
+ *
+ * @param path The image file
+ * @param info Receives what the header says
+ * @return IMAGE_UTIL_ERROR_NONE on success, IMAGE_UTIL_ERROR_NO_SUCH_FILE
+ *         if the file cannot be read, otherwise
+ *         IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT
+ */
+int probe_file(const char *path, probe_info *info) {
+	unsigned char header[32];
+	uint64_t start_us = monotonic_us();
+	bool probed = false;
+
+	memset(info, 0, sizeof(probe_info));
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return IMAGE_UTIL_ERROR_NO_SUCH_FILE;
+
+	size_t length = fread(header, 1, sizeof(header), file);
+	if (length >= 2 && header[0] == 0xFF && header[1] == JPEG_SOI) {
+		if (fseek(file, 2, SEEK_SET) == 0)
+			probed = _probe_jpeg(file, info);
+	} else if (length >= 26
+			&& memcmp(header, "\x89PNG\r\n\x1a\n", 8) == 0) {
+		probed = _probe_png(header, info);
+	} else if (length >= 30 && memcmp(header, "RIFF", 4) == 0
+			&& memcmp(header + 8, "WEBP", 4) == 0) {
+		probed = _probe_webp(header, info);
+	}
+	fclose(file);
+
+	__atomic_add_fetch(&stats.probes, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.probe_us, monotonic_us() - start_us,
+			__ATOMIC_RELAXED);
+
+	if (!probed) {
+		__atomic_add_fetch(&stats.failures, 1, __ATOMIC_RELAXED);
+		info->format = PROBE_FORMAT_UNKNOWN;
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Picks the smallest JPEG decode that still covers the job's output.
+ * @details The decoder can scale by 1/2, 1/4 and 1/8 almost for free, so
+ *          a large photo resized to a thumbnail need not be decoded at full
+ *          size. Jobs keeping the source size or cropping, whose rectangle
+ *          is in full-size pixels, are decoded at full size.
+ *
+ * @return The decode scale
+ */
+image_util_scale_e probe_decode_scale(const probe_info *info,
+		const transform_job *job) {
+	if (info->format != PROBE_FORMAT_JPEG || job->width == 0
+			|| job->height == 0 || (job->crop_width > 0 && job->crop_height > 0))
+		return IMAGE_UTIL_DOWNSCALE_1_1;
+
+	/* The output size is after the rotation. */
+	bool swap = ops_job_swaps_axes(job);
+	unsigned int width = swap ? job->height : job->width;
+	unsigned int height = swap ? job->width : job->height;
+	image_util_scale_e scale = IMAGE_UTIL_DOWNSCALE_1_1;
+
+	for (int shift = 1; shift <= 3; ++shift) {
+		unsigned int scaled_width = (info->width + (1 << shift) - 1) >> shift;
+		unsigned int scaled_height = (info->height + (1 << shift) - 1) >> shift;
+
+		if (scaled_width < width || scaled_height < height)
+			break;
+		scale = (image_util_scale_e) shift;
+	}
+	return scale;
+}
+
+/**
+ * @brief Prepares a job from the header of its source.
+ * @details Picks the decode scale unless one is set, fills in the source
+ *          size at that scale, and rejects sources that could not be
+ *          decoded anyway.
+ *
+ * @param job The job
+ * @param info What probe_file() says about the source
+ * @return IMAGE_UTIL_ERROR_NONE on success,
+ *         IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT for a source that is not a
+ *         JPEG, IMAGE_UTIL_ERROR_NOT_SUPPORTED for one above
+ *         PROBE_MAX_PIXELS
+ */
+int probe_plan_job(transform_job *job, const probe_info *info) {
+	if (info->format != PROBE_FORMAT_JPEG) {
+		__atomic_add_fetch(&stats.rejected, 1, __ATOMIC_RELAXED);
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT;
+	}
+	if ((uint64_t) info->width * info->height > PROBE_MAX_PIXELS) {
+		__atomic_add_fetch(&stats.rejected, 1, __ATOMIC_RELAXED);
+		dlog_print(DLOG_WARN, LOG_TAG, "%s is too large: %ux%u",
+				job->input_path, info->width, info->height);
+		return IMAGE_UTIL_ERROR_NOT_SUPPORTED;
+	}
+
+	if (job->decode_scale == IMAGE_UTIL_DOWNSCALE_1_1) {
+		job->decode_scale = probe_decode_scale(info, job);
+		if (job->decode_scale != IMAGE_UTIL_DOWNSCALE_1_1)
+			__atomic_add_fetch(&stats.downscaled, 1, __ATOMIC_RELAXED);
+	}
+
+	int shift = job->decode_scale;
+	job->src_width = (info->width + (1 << shift) - 1) >> shift;
+	job->src_height = (info->height + (1 << shift) - 1) >> shift;
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Probes the source of a job and prepares the job from its header.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int probe_job(transform_job *job) {
+	probe_info info;
+	int error_code = probe_file(job->input_path, &info);
+
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+	return probe_plan_job(job, &info);
+}
+
+/**
+ * @brief Prints the probe statistics to the log.
+ */
+void probe_log_stats(void) {
+	unsigned int probes = __atomic_load_n(&stats.probes, __ATOMIC_RELAXED);
+
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Probe: %u files in %llu us, %u unreadable, %u rejected, %u decoded downscaled",
+			probes, (unsigned long long) stats.probe_us, stats.failures,
+			stats.rejected, stats.downscaled);
+}
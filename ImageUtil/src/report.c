@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "report.h"
+#include <tizen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct batch_report {
+	pthread_mutex_t lock;
+	report_entry *entries;
+	unsigned int count;
+	unsigned int size;
+	uint64_t created_us;
+};
+
+/**
+ * @brief Creates an empty report.
+ *
+ * @return The report, to be destroyed with report_destroy(), or NULL
+ */
+batch_report *report_create(void) {
+	batch_report *report = calloc(1, sizeof(batch_report));
+	if (report == NULL)
+		return NULL;
+
+	pthread_mutex_init(&report->lock, NULL);
+	report->created_us = monotonic_us();
+	return report;
+}
+
+void report_destroy(batch_report *report) {
+	if (report == NULL)
+		return;
+
+	pthread_mutex_destroy(&report->lock);
+	free(report->entries);
+	free(report);
+}
+
+/**
+ * @brief Records the outcome of one job.
+ *
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int report_add(batch_report *report, const report_entry *entry) {
+	if (report == NULL)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&report->lock);
+	if (report->count == report->size) {
+		unsigned int size = report->size ? report->size * 2 : 64;
+		report_entry *entries = realloc(report->entries,
+				size * sizeof(report_entry));
+
+		if (entries == NULL) {
+			pthread_mutex_unlock(&report->lock);
+			return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+		}
+		report->entries = entries;
+		report->size = size;
+	}
+	report->entries[report->count++] = *entry;
+	pthread_mutex_unlock(&report->lock);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Records a finished job as reported by the scheduler.
+ */
+int report_add_result(batch_report *report, const transform_job *job,
+		const pipeline_result *result) {
+	report_entry entry = { .error_code = result->error_code, .stage =
+			result->stage, .backend = result->backend, .attempts =
+			job->attempt + 1, .queued_us = result->queued_us, .run_us =
+			result->run_us };
+
+	snprintf(entry.input_path, BUFLEN, "%s", job->input_path);
+	snprintf(entry.output_path, BUFLEN, "%s", job->output_path);
+	if (result->cancelled)
+		entry.status = REPORT_CANCELLED;
+	else if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+		entry.status = REPORT_FAILED;
+	else
+		entry.status = REPORT_OK;
+
+	return report_add(report, &entry);
+}
+
+/**
+ * @brief Tells whether an error may go away when the job is run again.
+ * @details Running out of memory or of a busy device is transient; a
+ *          missing or malformed file is not.
+ */
+bool report_is_transient(int error_code) {
+	switch (error_code) {
+	case IMAGE_UTIL_ERROR_OUT_OF_MEMORY:
+	case TIZEN_ERROR_RESOURCE_BUSY:
+	case TIZEN_ERROR_TRY_AGAIN:
+	case TIZEN_ERROR_TIMED_OUT:
+	case TIZEN_ERROR_IO_ERROR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static const char *_status_name(report_status status) {
+	switch (status) {
+	case REPORT_OK:
+		return "ok";
+	case REPORT_FAILED:
+		return "failed";
+	case REPORT_CANCELLED:
+		return "cancelled";
+	case REPORT_QUARANTINED:
+		return "quarantined";
+	}
+	return "unknown";
+}
+
+/**
+ * @brief Writes a JSON string, escaped.
+ */
+void report_write_string(FILE *file, const char *string) {
+	fputc('"', file);
+	for (const unsigned char *c = (const unsigned char *) string; *c != '\0';
+			++c) {
+		if (*c == '"' || *c == '\\')
+			fprintf(file, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(file, "\\u%04x", *c);
+		else
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+static int _compare_entries(const void *a, const void *b) {
+	const report_entry *first = a, *second = b;
+	int order = strcmp(first->input_path, second->input_path);
+
+	return order ? order : strcmp(first->output_path, second->output_path);
+}
+
+/**
+ * @brief Writes the summary and every outcome as JSON.
+ * @details Outcomes are sorted by input then output path. The file is
+ *          written next to its final path and renamed, so readers never
+ *          see a partial report.
+ *
+ * @param report The report
+ * @param summary The totals of the batch
+ * @param path The path of the JSON file
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int report_write_json(batch_report *report, const batch_summary *summary,
+		const char *path) {
+	char partial[BUFLEN];
+
+	if (report == NULL || path == NULL
+			|| snprintf(partial, BUFLEN, "%s.part", path) >= BUFLEN)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	FILE *file = fopen(partial, "w");
+	if (file == NULL)
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+
+	pthread_mutex_lock(&report->lock);
+	qsort(report->entries, report->count, sizeof(report_entry),
+			_compare_entries);
+
+	fprintf(file, "{\n  \"summary\": {\"submitted\": %u, \"succeeded\": %u, "
+			"\"failed\": %u, \"cancelled\": %u, \"quarantined\": %u, "
+			"\"retried\": %u, \"deduplicated\": %u, \"wall_ms\": %llu},\n"
+			"  \"files\": [", summary->submitted, summary->succeeded,
+			summary->failed, summary->cancelled, summary->quarantined,
+			summary->retried, summary->deduplicated,
+			(unsigned long long) ((monotonic_us() - report->created_us) / 1000));
+
+	for (unsigned int i = 0; i < report->count; ++i) {
+		const report_entry *entry = &report->entries[i];
+
+		fprintf(file, "%s\n    {\"input\": ", i ? "," : "");
+		report_write_string(file, entry->input_path);
+		fprintf(file, ", \"output\": ");
+		report_write_string(file, entry->output_path);
+		fprintf(file, ", \"status\": \"%s\", \"error\": %d, ",
+				_status_name(entry->status), entry->error_code);
+		fprintf(file, "\"message\": ");
+		report_write_string(file, (entry->error_code != IMAGE_UTIL_ERROR_NONE) ?
+				get_error_message(entry->error_code) : "");
+		fprintf(file, ", \"stage\": \"%s\", \"backend\": ",
+				pipeline_stage_name(entry->stage));
+		report_write_string(file, (entry->backend != NULL) ? entry->backend : "");
+		fprintf(file, ", \"attempts\": %u, \"queued_us\": %llu, "
+				"\"run_us\": %llu}", entry->attempts,
+				(unsigned long long) entry->queued_us,
+				(unsigned long long) entry->run_us);
+	}
+	pthread_mutex_unlock(&report->lock);
+
+	fprintf(file, "\n  ]\n}\n");
+
+	bool written = !ferror(file);
+	if (fclose(file) != 0 || !written || rename(partial, path) != 0) {
+		remove(partial);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
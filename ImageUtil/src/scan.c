@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "scan.h"
+#include "hash.h"
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Appends a file to the list.
+ *
+ * @return @c false if out of memory
+ */
+static bool _append(scan_list *list, const char *path, const struct stat *st) {
+	if (list->count == list->size) {
+		unsigned int size = list->size ? list->size * 2 : 64;
+		scan_entry *entries = realloc(list->entries,
+				size * sizeof(scan_entry));
+
+		if (entries == NULL)
+			return false;
+		list->entries = entries;
+		list->size = size;
+	}
+
+	scan_entry *entry = &list->entries[list->count++];
+	snprintf(entry->path, BUFLEN, "%s", path);
+	entry->size = st->st_size;
+	entry->mtime = st->st_mtime;
+	entry->original = -1;
+	entry->next_duplicate = -1;
+	return true;
+}
+
+static int _compare_paths(const void *a, const void *b) {
+	return strcmp(((const scan_entry *) a)->path,
+			((const scan_entry *) b)->path);
+}
+
+/**
+ * @brief Expands one pattern into the list.
+ * @details A directory stands for the files directly inside it.
+ */
+static int _scan_pattern(const char *pattern, scan_list *list) {
+	char directory[BUFLEN];
+	struct stat st;
+	glob_t matches;
+
+	if (stat(pattern, &st) == 0 && S_ISDIR(st.st_mode)) {
+		snprintf(directory, BUFLEN, "%s/*", pattern);
+		pattern = directory;
+	}
+
+	int ret = glob(pattern, 0, NULL, &matches);
+	if (ret == GLOB_NOMATCH) {
+		dlog_print(DLOG_WARN, LOG_TAG, "No input matches %s", pattern);
+		return IMAGE_UTIL_ERROR_NONE;
+	}
+	if (ret != 0)
+		return (ret == GLOB_NOSPACE) ?
+				IMAGE_UTIL_ERROR_OUT_OF_MEMORY :
+				IMAGE_UTIL_ERROR_INVALID_OPERATION;
+
+	int error_code = IMAGE_UTIL_ERROR_NONE;
+	for (size_t i = 0; i < matches.gl_pathc; ++i) {
+		if (stat(matches.gl_pathv[i], &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		if (!_append(list, matches.gl_pathv[i], &st)) {
+			error_code = IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+			break;
+		}
+	}
+	globfree(&matches);
+	return error_code;
+}
+
+/**
+ * @brief Lists the regular files matching glob patterns.
+ * @details Files matched by several patterns are listed once. The list is
+ *          sorted by path.
+ *
+ * @param patterns The glob patterns or directories
+ * @param count The number of patterns
+ * @param list The list receiving the files; clear it with scan_list_clear()
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int scan_inputs(const char (*patterns)[BUFLEN], unsigned int count,
+		scan_list *list) {
+	memset(list, 0, sizeof(scan_list));
+
+	for (unsigned int i = 0; i < count; ++i) {
+		int error_code = _scan_pattern(patterns[i], list);
+		if (error_code != IMAGE_UTIL_ERROR_NONE) {
+			scan_list_clear(list);
+			return error_code;
+		}
+	}
+
+	if (list->count == 0)
+		return IMAGE_UTIL_ERROR_NONE;
+
+	qsort(list->entries, list->count, sizeof(scan_entry), _compare_paths);
+
+	unsigned int unique = 1;
+	for (unsigned int i = 1; i < list->count; ++i)
+		if (strcmp(list->entries[i].path, list->entries[unique - 1].path) != 0)
+			list->entries[unique++] = list->entries[i];
+	list->count = unique;
+
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/* Where a file stands when looking for copies. */
+typedef struct {
+	int index;
+	off_t size;
+	/* Only files sharing their size with another one are hashed. */
+	bool hashed;
+	uint64_t digest;
+} scan_key;
+
+static int _compare_keys(const void *a, const void *b) {
+	const scan_key *first = a, *second = b;
+
+	if (first->size != second->size)
+		return (first->size < second->size) ? -1 : 1;
+	if (first->hashed != second->hashed)
+		return first->hashed ? -1 : 1;
+	if (first->digest != second->digest)
+		return (first->digest < second->digest) ? -1 : 1;
+	return first->index - second->index;
+}
+
+/**
+ * @brief Makes an entry, with its own duplicates, duplicates of another.
+ */
+static void _link(scan_list *list, int original, int duplicate) {
+	scan_entry *entries = list->entries;
+	int last = original;
+
+	while (entries[last].next_duplicate >= 0)
+		last = entries[last].next_duplicate;
+	entries[last].next_duplicate = duplicate;
+
+	for (int i = duplicate; i >= 0; i = entries[i].next_duplicate)
+		entries[i].original = original;
+}
+
+/**
+ * @brief Links the files holding the same bytes.
+ * @details Only files sharing their size are hashed, and matching digests
+ *          are confirmed byte for byte.
+ */
+static bool _find_copies(scan_list *list) {
+	scan_key *keys = malloc(list->count * sizeof(scan_key));
+	if (keys == NULL)
+		return false;
+
+	for (unsigned int i = 0; i < list->count; ++i)
+		keys[i] = (scan_key) { .index = i, .size = list->entries[i].size };
+	qsort(keys, list->count, sizeof(scan_key), _compare_keys);
+
+	for (unsigned int i = 0; i < list->count; ++i) {
+		bool shared = (i > 0 && keys[i - 1].size == keys[i].size)
+				|| (i + 1 < list->count && keys[i + 1].size == keys[i].size);
+
+		if (shared)
+			keys[i].hashed = hash_file(list->entries[keys[i].index].path,
+					&keys[i].digest) == IMAGE_UTIL_ERROR_NONE;
+	}
+	qsort(keys, list->count, sizeof(scan_key), _compare_keys);
+
+	/* Runs of equal digests, each key in increasing path order. */
+	for (unsigned int start = 0, end; start < list->count; start = end) {
+		for (end = start + 1; end < list->count && keys[end].hashed
+				&& keys[end].size == keys[start].size
+				&& keys[end].digest == keys[start].digest; ++end)
+			;
+		if (!keys[start].hashed)
+			continue;
+
+		for (unsigned int i = start + 1; i < end; ++i) {
+			const char *path = list->entries[keys[i].index].path;
+
+			for (unsigned int j = start; j < i; ++j) {
+				const scan_entry *candidate = &list->entries[keys[j].index];
+
+				if (candidate->original < 0
+						&& hash_same_content(candidate->path, path)) {
+					_link(list, keys[j].index, keys[i].index);
+					break;
+				}
+			}
+		}
+	}
+
+	free(keys);
+	return true;
+}
+
+/**
+ * @brief Links the JPEGs that look the same.
+ */
+static bool _find_similar(scan_list *list) {
+	uint64_t *dhashes = malloc(list->count * sizeof(uint64_t));
+	bool *hashed = malloc(list->count * sizeof(bool));
+
+	if (dhashes == NULL || hashed == NULL) {
+		free(dhashes);
+		free(hashed);
+		return false;
+	}
+
+	for (unsigned int i = 0; i < list->count; ++i)
+		hashed[i] = list->entries[i].original < 0
+				&& hash_perceptual(list->entries[i].path, &dhashes[i])
+						== IMAGE_UTIL_ERROR_NONE;
+
+	for (unsigned int i = 0; i < list->count; ++i) {
+		if (!hashed[i] || list->entries[i].original >= 0)
+			continue;
+
+		for (unsigned int j = i + 1; j < list->count; ++j)
+			if (hashed[j] && list->entries[j].original < 0
+					&& hash_distance(dhashes[i], dhashes[j])
+							<= HASH_SIMILAR_DISTANCE)
+				_link(list, i, j);
+	}
+
+	free(dhashes);
+	free(hashed);
+	return true;
+}
+
+/**
+ * @brief Finds the files holding the same image.
+ * @details Sets the original and next_duplicate of every entry. The first
+ *          file of a group in path order is its original; a batch only
+ *          needs to transform the originals and copy the results.
+ *
+ * @param list The files, as listed by scan_inputs()
+ * @param dedupe What counts as the same image
+ * @return The number of duplicates, that is files with an original
+ */
+unsigned int scan_find_duplicates(scan_list *list, scan_dedupe dedupe) {
+	unsigned int duplicates = 0;
+
+	for (unsigned int i = 0; i < list->count; ++i) {
+		list->entries[i].original = -1;
+		list->entries[i].next_duplicate = -1;
+	}
+	if (dedupe == SCAN_DEDUPE_NONE || list->count < 2)
+		return 0;
+
+	bool found = _find_copies(list);
+	if (found && dedupe == SCAN_DEDUPE_SIMILAR)
+		found = _find_similar(list);
+	if (!found)
+		dlog_print(DLOG_WARN, LOG_TAG, "Out of memory looking for duplicates");
+
+	for (unsigned int i = 0; i < list->count; ++i)
+		if (list->entries[i].original >= 0)
+			duplicates++;
+
+	dlog_print(DLOG_INFO, LOG_TAG, "Scan: %u files, %u duplicates",
+			list->count, duplicates);
+	hash_log_stats();
+	return duplicates;
+}
+
+void scan_list_clear(scan_list *list) {
+	free(list->entries);
+	memset(list, 0, sizeof(scan_list));
+}
@@ -0,0 +1,581 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "scheduler.h"
+#include "arena.h"
+#include "memgov.h"
+#include "trace.h"
+#include <tizen.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SCHEDULER_MAX_WORKERS 8
+/* Finished entries kept for reuse by later submissions. */
+#define SCHEDULER_SPARE_ENTRIES 256
+
+typedef struct sched_entry sched_entry;
+
+struct sched_entry {
+	transform_job job;
+	/* Decoded source pixels of a probed batch job, 0 otherwise. */
+	uint64_t cost;
+	/* Memory the job is expected to hold while it runs. */
+	size_t bytes;
+	uint64_t seq;
+	uint64_t submitted_us;
+	scheduler_done_cb done_cb;
+	void *user_data;
+	/* Links the spare entries. */
+	sched_entry *next;
+};
+
+/* Binary min-heap of queued entries, see _entry_before(). */
+typedef struct {
+	sched_entry **items;
+	unsigned int count;
+	unsigned int size;
+} sched_heap;
+
+typedef struct {
+	unsigned int submitted;
+	unsigned int completed;
+	unsigned int failed;
+	unsigned int cancelled;
+	unsigned int missed_deadline;
+} sched_stats;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	sched_heap queues[JOB_PRIORITY_COUNT];
+	pthread_t *threads;
+	unsigned int thread_count;
+	/* General workers, and how many of them may run batch jobs at once. */
+	unsigned int workers;
+	unsigned int batch_limit;
+	unsigned int batch_running;
+	/* Memory of the batch jobs running, and how much they may hold. */
+	size_t batch_bytes;
+	size_t memory_budget;
+	/* Whether a batch job waits for memory to be freed. */
+	bool memory_held;
+	unsigned int memory_holds;
+	bool running;
+	uint64_t seq;
+	sched_entry *spare;
+	unsigned int spare_count;
+	sched_stats stats[JOB_PRIORITY_COUNT];
+	/* Batch jobs run to the end, for scheduler_sample(). */
+	uint64_t batch_finished;
+	uint64_t batch_run_us;
+	uint64_t batch_pixels;
+} sched = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond =
+		PTHREAD_COND_INITIALIZER };
+
+/**
+ * @brief Orders queued entries: earliest deadline first, then first
+ *        attempts before retries, then largest first, then FIFO.
+ * @details Starting the largest batch jobs first keeps one big image from
+ *          running alone on one worker at the end of a batch. Retries wait
+ *          behind the jobs already queued, so that a transient failure,
+ *          such as running out of memory, has time to clear.
+ *
+ * @return @c true if a should run before b
+ */
+static bool _entry_before(const sched_entry *a, const sched_entry *b) {
+	uint64_t da = a->job.deadline_us ? a->job.deadline_us : UINT64_MAX;
+	uint64_t db = b->job.deadline_us ? b->job.deadline_us : UINT64_MAX;
+
+	if (da != db)
+		return da < db;
+	if ((a->job.attempt > 0) != (b->job.attempt > 0))
+		return b->job.attempt > 0;
+	if (a->cost != b->cost)
+		return a->cost > b->cost;
+	return a->seq < b->seq;
+}
+
+static bool _heap_push(sched_heap *heap, sched_entry *entry) {
+	if (heap->count == heap->size) {
+		unsigned int size = heap->size ? heap->size * 2 : 64;
+		sched_entry **items = realloc(heap->items, size * sizeof(*items));
+
+		if (items == NULL)
+			return false;
+		heap->items = items;
+		heap->size = size;
+	}
+
+	unsigned int i = heap->count++;
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+
+		if (!_entry_before(entry, heap->items[parent]))
+			break;
+		heap->items[i] = heap->items[parent];
+		i = parent;
+	}
+	heap->items[i] = entry;
+	return true;
+}
+
+static sched_entry *_heap_pop(sched_heap *heap) {
+	if (heap->count == 0)
+		return NULL;
+
+	sched_entry *top = heap->items[0];
+	sched_entry *last = heap->items[--heap->count];
+	unsigned int i = 0;
+
+	for (;;) {
+		unsigned int child = 2 * i + 1;
+
+		if (child >= heap->count)
+			break;
+		if (child + 1 < heap->count
+				&& _entry_before(heap->items[child + 1], heap->items[child]))
+			child++;
+		if (!_entry_before(heap->items[child], last))
+			break;
+		heap->items[i] = heap->items[child];
+		i = child;
+	}
+	if (heap->count > 0)
+		heap->items[i] = last;
+	return top;
+}
+
+/**
+ * @brief Checks whether the next batch job fits in the memory budget.
+ * @details A job always fits when no other batch job runs, so one larger
+ *          than the whole budget still runs, alone.
+ * @remarks Must be called with sched.lock held.
+ */
+static bool _batch_fits(void) {
+	const sched_heap *heap = &sched.queues[JOB_PRIORITY_BATCH];
+
+	if (sched.memory_budget == 0 || sched.batch_running == 0 || heap->count == 0
+			|| sched.batch_bytes + heap->items[0]->bytes <= sched.memory_budget)
+		return true;
+
+	if (!sched.memory_held)
+		sched.memory_holds++;
+	sched.memory_held = true;
+	return false;
+}
+
+/**
+ * @brief Records the number of queued jobs in the trace.
+ * @remarks Must be called with sched.lock held.
+ */
+static void _trace_queued(void) {
+	unsigned int queued = 0;
+
+	for (job_priority p = 0; p < JOB_PRIORITY_COUNT; ++p)
+		queued += sched.queues[p].count;
+	trace_counter("queued jobs", queued);
+}
+
+/**
+ * @brief Takes the next entry a worker may run.
+ * @details Batch jobs are only taken while fewer than the batch limit run
+ *          and the memory they hold stays within the budget.
+ * @remarks Must be called with sched.lock held.
+ *
+ * @param interactive_only Whether the worker is reserved for interactive jobs
+ * @return The entry, or NULL if there is nothing to run
+ */
+static sched_entry *_next_entry(bool interactive_only) {
+	for (job_priority p = 0; p < JOB_PRIORITY_COUNT; ++p) {
+		if (interactive_only && p != JOB_PRIORITY_INTERACTIVE)
+			break;
+		if (p == JOB_PRIORITY_BATCH && (sched.batch_running >= sched.batch_limit
+				|| !_batch_fits()))
+			break;
+
+		sched_entry *entry = _heap_pop(&sched.queues[p]);
+		if (entry != NULL) {
+			_trace_queued();
+			if (p == JOB_PRIORITY_BATCH) {
+				sched.batch_running++;
+				sched.batch_bytes += entry->bytes;
+			}
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Takes a spare entry, or allocates one.
+ */
+static sched_entry *_alloc_entry(void) {
+	pthread_mutex_lock(&sched.lock);
+	sched_entry *entry = sched.spare;
+	if (entry != NULL) {
+		sched.spare = entry->next;
+		sched.spare_count--;
+	}
+	pthread_mutex_unlock(&sched.lock);
+
+	return (entry != NULL) ? entry : malloc(sizeof(sched_entry));
+}
+
+/**
+ * @brief Keeps an entry for reuse, or frees it if there are enough spares.
+ * @remarks Must be called with sched.lock held.
+ */
+static void _free_entry(sched_entry *entry) {
+	if (sched.spare_count >= SCHEDULER_SPARE_ENTRIES) {
+		free(entry);
+		return;
+	}
+	entry->next = sched.spare;
+	sched.spare = entry;
+	sched.spare_count++;
+}
+
+/**
+ * @brief Reports the entry's result to its owner and frees it.
+ */
+static void _finish_entry(sched_entry *entry, pipeline_result *result) {
+	sched_stats *stats = &sched.stats[entry->job.priority];
+	uint64_t now = monotonic_us();
+
+	pthread_mutex_lock(&sched.lock);
+	if (result->cancelled)
+		stats->cancelled++;
+	else if (result->error_code != IMAGE_UTIL_ERROR_NONE)
+		stats->failed++;
+	else
+		stats->completed++;
+	if (entry->job.deadline_us != 0 && now > entry->job.deadline_us)
+		stats->missed_deadline++;
+	if (entry->job.priority == JOB_PRIORITY_BATCH && result->run_us > 0) {
+		sched.batch_finished++;
+		sched.batch_run_us += result->run_us;
+		sched.batch_pixels += entry->cost;
+	}
+	pthread_mutex_unlock(&sched.lock);
+
+	if (entry->done_cb != NULL) {
+		uint64_t span = trace_begin();
+
+		entry->done_cb(&entry->job, result, entry->user_data);
+		trace_end("done callback", span, entry->job.input_path);
+	}
+	pipeline_result_clear(result);
+
+	cancel_token_unref(entry->job.cancel);
+
+	pthread_mutex_lock(&sched.lock);
+	_free_entry(entry);
+	pthread_mutex_unlock(&sched.lock);
+}
+
+/**
+ * @brief Runs an entry, or drops it if it was cancelled while queued.
+ */
+static void _run_entry(sched_entry *entry) {
+	pipeline_result result = { .error_code = IMAGE_UTIL_ERROR_NONE, .stage =
+			PIPELINE_STAGE_QUEUE };
+
+	result.queued_us = monotonic_us() - entry->submitted_us;
+
+	if (cancel_token_is_cancelled(entry->job.cancel)) {
+		result.cancelled = true;
+		result.error_code = TIZEN_ERROR_CANCELED;
+	} else {
+		pipeline_run(&entry->job, &result);
+	}
+
+	_finish_entry(entry, &result);
+}
+
+/**
+ * @brief Worker thread main loop.
+ * @details Each worker owns an arena for the scratch memory of its jobs,
+ *          reset after every job.
+ *
+ * @param data Non-NULL for the worker reserved for interactive jobs
+ */
+static void *_worker(void *data) {
+	bool interactive_only = (data != NULL);
+	arena *scratch = arena_create(0);
+
+	arena_set_current(scratch);
+	trace_thread_name(interactive_only ? "interactive worker" : "worker");
+
+	pthread_mutex_lock(&sched.lock);
+	while (sched.running) {
+		sched_entry *entry = _next_entry(interactive_only);
+
+		if (entry == NULL) {
+			pthread_cond_wait(&sched.cond, &sched.lock);
+			continue;
+		}
+
+		job_priority priority = entry->job.priority;
+		size_t bytes = entry->bytes;
+
+		pthread_mutex_unlock(&sched.lock);
+		_run_entry(entry);
+		arena_reset(scratch);
+		pthread_mutex_lock(&sched.lock);
+		if (priority == JOB_PRIORITY_BATCH) {
+			sched.batch_running--;
+			sched.batch_bytes -= bytes;
+			/* Jobs held for memory may fit now, on other workers too. */
+			if (sched.memory_held) {
+				sched.memory_held = false;
+				pthread_cond_broadcast(&sched.cond);
+			}
+		}
+	}
+	pthread_mutex_unlock(&sched.lock);
+
+	arena_destroy(scratch);
+	return NULL;
+}
+
+/**
+ * @brief Starts the worker threads.
+ * @details Besides the general workers, which prefer interactive jobs over
+ *          batch jobs, one extra worker only runs interactive jobs, so an
+ *          interactive request never waits for a batch job to finish.
+ *
+ * @param workers The number of general workers, 0 for one per CPU core
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int scheduler_init(unsigned int workers) {
+	pthread_mutex_lock(&sched.lock);
+	if (sched.running) {
+		pthread_mutex_unlock(&sched.lock);
+		return IMAGE_UTIL_ERROR_NONE;
+	}
+
+	if (workers == 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = (cores > 0) ? cores : 1;
+	}
+	if (workers > SCHEDULER_MAX_WORKERS)
+		workers = SCHEDULER_MAX_WORKERS;
+
+	sched.threads = calloc(workers + 1, sizeof(pthread_t));
+	if (sched.threads == NULL) {
+		pthread_mutex_unlock(&sched.lock);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+
+	sched.running = true;
+	sched.thread_count = 0;
+	sched.workers = workers;
+	sched.batch_limit = workers;
+	for (unsigned int i = 0; i <= workers; ++i) {
+		/* The last worker is the interactive one. */
+		void *interactive_only = (i == workers) ? &sched : NULL;
+
+		if (pthread_create(&sched.threads[sched.thread_count], NULL, _worker,
+				interactive_only) != 0) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "pthread_create() failed");
+			break;
+		}
+		sched.thread_count++;
+	}
+	pthread_mutex_unlock(&sched.lock);
+
+	if (sched.thread_count == 0) {
+		scheduler_shutdown();
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	}
+
+	dlog_print(DLOG_INFO, LOG_TAG, "Scheduler started with %u workers",
+			sched.thread_count);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Stops the workers. Queued jobs are reported as cancelled.
+ * @details Jobs already running are finished first; cancel their tokens
+ *          beforehand to make this quick.
+ */
+void scheduler_shutdown(void) {
+	pthread_mutex_lock(&sched.lock);
+	sched.running = false;
+	pthread_cond_broadcast(&sched.cond);
+	pthread_mutex_unlock(&sched.lock);
+
+	for (unsigned int i = 0; i < sched.thread_count; ++i)
+		pthread_join(sched.threads[i], NULL);
+
+	free(sched.threads);
+	sched.threads = NULL;
+	sched.thread_count = 0;
+	sched.workers = 0;
+
+	for (job_priority p = 0; p < JOB_PRIORITY_COUNT; ++p) {
+		sched_entry *entry;
+
+		pthread_mutex_lock(&sched.lock);
+		entry = _heap_pop(&sched.queues[p]);
+		pthread_mutex_unlock(&sched.lock);
+
+		while (entry != NULL) {
+			pipeline_result result = { .error_code = TIZEN_ERROR_CANCELED,
+					.stage = PIPELINE_STAGE_QUEUE, .cancelled = true };
+
+			_finish_entry(entry, &result);
+
+			pthread_mutex_lock(&sched.lock);
+			entry = _heap_pop(&sched.queues[p]);
+			pthread_mutex_unlock(&sched.lock);
+		}
+	}
+
+	pthread_mutex_lock(&sched.lock);
+	while (sched.spare != NULL) {
+		sched_entry *entry = sched.spare;
+
+		sched.spare = entry->next;
+		free(entry);
+	}
+	sched.spare_count = 0;
+	pthread_mutex_unlock(&sched.lock);
+}
+
+/**
+ * @brief Queues a job.
+ * @details The job is copied and a reference to its cancellation token is
+ *          taken. done_cb is always called exactly once, on a worker thread,
+ *          unless this function fails. Batch jobs with a known source size,
+ *          see probe_job(), run largest first.
+ *
+ * @param job The job
+ * @param done_cb The function called when the job is over, may be NULL
+ * @param user_data The user data passed to done_cb
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int scheduler_submit(const transform_job *job, scheduler_done_cb done_cb,
+		void *user_data) {
+	if (job == NULL || job->priority >= JOB_PRIORITY_COUNT)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	sched_entry *entry = _alloc_entry();
+	if (entry == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	entry->job = *job;
+	entry->cost = (job->priority == JOB_PRIORITY_BATCH) ?
+			(uint64_t) job->src_width * job->src_height : 0;
+	entry->bytes = memgov_job_bytes(job);
+	entry->done_cb = done_cb;
+	entry->user_data = user_data;
+	entry->submitted_us = monotonic_us();
+
+	pthread_mutex_lock(&sched.lock);
+	if (!sched.running) {
+		_free_entry(entry);
+		pthread_mutex_unlock(&sched.lock);
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	}
+
+	entry->seq = sched.seq++;
+	if (!_heap_push(&sched.queues[job->priority], entry)) {
+		_free_entry(entry);
+		pthread_mutex_unlock(&sched.lock);
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+	}
+	cancel_token_ref(entry->job.cancel);
+	sched.stats[job->priority].submitted++;
+	_trace_queued();
+
+	/* Wake everyone: only some workers may take interactive jobs. */
+	pthread_cond_broadcast(&sched.cond);
+	pthread_mutex_unlock(&sched.lock);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Sets how many batch jobs may run at once.
+ * @details Workers above the limit finish their job and then only take
+ *          interactive jobs; the interactive worker is never limited.
+ *
+ * @param limit The limit, clamped to between 1 and the general workers
+ */
+void scheduler_set_batch_limit(unsigned int limit) {
+	pthread_mutex_lock(&sched.lock);
+	if (limit > sched.workers)
+		limit = sched.workers;
+	if (limit < 1)
+		limit = 1;
+	if (limit > sched.batch_limit)
+		pthread_cond_broadcast(&sched.cond);
+	sched.batch_limit = limit;
+	pthread_mutex_unlock(&sched.lock);
+}
+
+/**
+ * @brief Sets how much memory the batch jobs running at once may hold.
+ * @details Running jobs are not interrupted; new ones wait until they fit.
+ *
+ * @param budget The budget in bytes, 0 for none
+ */
+void scheduler_set_memory_budget(size_t budget) {
+	pthread_mutex_lock(&sched.lock);
+	if (budget == 0 || budget > sched.memory_budget)
+		pthread_cond_broadcast(&sched.cond);
+	sched.memory_budget = budget;
+	pthread_mutex_unlock(&sched.lock);
+}
+
+/**
+ * @brief Gets the load of the batch jobs and how many have run so far.
+ */
+void scheduler_sample(scheduler_load *load) {
+	pthread_mutex_lock(&sched.lock);
+	load->workers = sched.workers;
+	load->batch_limit = sched.batch_limit;
+	load->batch_running = sched.batch_running;
+	load->batch_queued = sched.queues[JOB_PRIORITY_BATCH].count;
+	load->batch_bytes = sched.batch_bytes;
+	load->memory_budget = sched.memory_budget;
+	load->memory_holds = sched.memory_holds;
+	load->finished = sched.batch_finished;
+	load->run_us = sched.batch_run_us;
+	load->pixels = sched.batch_pixels;
+	pthread_mutex_unlock(&sched.lock);
+}
+
+/**
+ * @brief Prints the per-priority statistics to the log.
+ */
+void scheduler_log_stats(void) {
+	static const char *names[JOB_PRIORITY_COUNT] = { "interactive", "batch" };
+
+	pthread_mutex_lock(&sched.lock);
+	for (job_priority p = 0; p < JOB_PRIORITY_COUNT; ++p) {
+		const sched_stats *stats = &sched.stats[p];
+
+		dlog_print(DLOG_INFO, LOG_TAG,
+				"Scheduler %s: submitted %u completed %u failed %u cancelled %u missed deadline %u queued %u",
+				names[p], stats->submitted, stats->completed, stats->failed,
+				stats->cancelled, stats->missed_deadline,
+				sched.queues[p].count);
+	}
+	pthread_mutex_unlock(&sched.lock);
+}
@@ -0,0 +1,605 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* For accept4(), pipe2(), mkostemp() and struct ucred. */
+#define _GNU_SOURCE
+
+#include "main.h"
+#include "service.h"
+#include "batch.h"
+#include "lazy.h"
+#include <tizen.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#if !defined(MFD_CLOEXEC)
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+/* Where shared memory files are made when memfd_create() is missing. */
+#define SERVICE_SHM_TEMPLATE "/dev/shm/imageutil-XXXXXX"
+
+/* A connection thread waiting for its lazy request. */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+	service_reply *reply;
+	int image_fd;
+} service_waiter;
+
+static struct {
+	pthread_mutex_t lock;
+	/* Signalled when the last client is gone. */
+	pthread_cond_t idle;
+	bool running;
+	int listen_fd;
+	/* Written to by service_stop() to wake the accepting thread. */
+	int wake[2];
+	pthread_t accept_thread;
+	int clients[SERVICE_MAX_CLIENTS];
+	unsigned int client_count;
+	/* Parent of every request; cancelled by service_stop(). */
+	cancel_token *cancel;
+	char socket_path[BUFLEN];
+	/* The directory requested paths must be in; empty for the app's own. */
+	char root[BUFLEN];
+	unsigned int connections;
+	unsigned int requests;
+	unsigned int failures;
+	uint64_t bytes;
+} service = { .lock = PTHREAD_MUTEX_INITIALIZER, .idle =
+		PTHREAD_COND_INITIALIZER, .listen_fd = -1, .wake = { -1, -1 } };
+
+/**
+ * @brief Creates an anonymous shared memory file.
+ * @details Uses memfd_create() where the kernel has it, otherwise an
+ *          unlinked file in /dev/shm.
+ *
+ * @return The file descriptor, or -1
+ */
+static int _create_shared_fd(void) {
+#if defined(SYS_memfd_create)
+	int fd = syscall(SYS_memfd_create, "imageutil-result",
+			MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0)
+		return fd;
+#endif
+	char path[] = SERVICE_SHM_TEMPLATE;
+	int tmp = mkostemp(path, O_CLOEXEC);
+
+	if (tmp >= 0)
+		unlink(path);
+	return tmp;
+}
+
+/**
+ * @brief Copies an image into a new shared memory file.
+ * @details Where supported, the file is sealed, so the client can map it
+ *          without fearing that it changes or shrinks under it.
+ *
+ * @return The file descriptor, or -1
+ */
+static int _share_image(const image_buffer *image) {
+	int fd = _create_shared_fd();
+	if (fd < 0)
+		return -1;
+
+	size_t done = 0;
+	while (done < image->size) {
+		ssize_t written = write(fd, image->data + done, image->size - done);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0) {
+			close(fd);
+			return -1;
+		}
+		done += written;
+	}
+
+#if defined(F_ADD_SEALS)
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE
+			| F_SEAL_SEAL);
+#endif
+	return fd;
+}
+
+/**
+ * @brief Shares a result and wakes the connection thread.
+ * @remarks This function matches the lazy_result_cb() type signature.
+ */
+static void _result_cb(int error_code, const image_buffer *image,
+		void *user_data) {
+	service_waiter *waiter = user_data;
+	service_reply *reply = waiter->reply;
+
+	if (error_code == IMAGE_UTIL_ERROR_NONE) {
+		waiter->image_fd = _share_image(image);
+		if (waiter->image_fd < 0) {
+			error_code = IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+		} else {
+			reply->width = image->width;
+			reply->height = image->height;
+			reply->colorspace = image->colorspace;
+			reply->size = image->size;
+		}
+	}
+
+	pthread_mutex_lock(&waiter->lock);
+	reply->error_code = error_code;
+	waiter->done = true;
+	pthread_cond_signal(&waiter->cond);
+	pthread_mutex_unlock(&waiter->lock);
+}
+
+/**
+ * @brief Computes one request, usually from the warm result cache.
+ *
+ * @return The shared memory file holding the result, or -1
+ */
+static int _serve(const service_request *request, service_reply *reply) {
+	service_waiter waiter = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond =
+			PTHREAD_COND_INITIALIZER, .reply = reply, .image_fd = -1 };
+
+	if (request->version != SERVICE_PROTOCOL_VERSION
+			|| request->path[0] != '/'
+			|| memchr(request->path, '\0', BUFLEN) == NULL) {
+		reply->error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+		return -1;
+	}
+	if (!batch_path_confined(request->path,
+			(service.root[0] != '\0') ? service.root : NULL, true)) {
+		reply->error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+		return -1;
+	}
+
+	lazy_spec spec = { .path = request->path, .width = request->width,
+			.height = request->height, .colorspace = request->colorspace,
+			.encoded = request->encoded != 0, .priority =
+					JOB_PRIORITY_INTERACTIVE, .cancel = service.cancel };
+	if (request->deadline_ms > 0)
+		spec.deadline_us = monotonic_us() + request->deadline_ms * 1000ULL;
+
+	reply->error_code = lazy_request(&spec, _result_cb, &waiter);
+	if (reply->error_code != IMAGE_UTIL_ERROR_NONE)
+		return -1;
+
+	pthread_mutex_lock(&waiter.lock);
+	while (!waiter.done)
+		pthread_cond_wait(&waiter.cond, &waiter.lock);
+	pthread_mutex_unlock(&waiter.lock);
+
+	return waiter.image_fd;
+}
+
+/**
+ * @brief Sends a message, with a file descriptor attached if fd >= 0.
+ */
+static bool _send_with_fd(int socket, const void *data, size_t size, int fd) {
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { .iov_base = (void *) data, .iov_len = size };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if (fd >= 0) {
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.buffer;
+		msg.msg_controllen = sizeof(control.buffer);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	ssize_t sent;
+	do
+		sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
+	while (sent < 0 && errno == EINTR);
+	return sent == (ssize_t) size;
+}
+
+/**
+ * @brief Receives a message and the file descriptor attached to it, if any.
+ *
+ * @return The size of the message, 0 when the peer is gone, -1 on error
+ */
+static ssize_t _receive_with_fd(int socket, void *data, size_t size, int *fd) {
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { .iov_base = data, .iov_len = size };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control =
+			control.buffer, .msg_controllen = sizeof(control.buffer) };
+	ssize_t received;
+
+	do
+		received = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+	while (received < 0 && errno == EINTR);
+
+	if (fd != NULL)
+		*fd = -1;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg =
+			CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		int passed;
+		memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+		if (fd != NULL && *fd < 0)
+			*fd = passed;
+		else
+			close(passed);
+	}
+	return received;
+}
+
+/**
+ * @brief Answers the requests of one client until it disconnects.
+ * @details Requests of a connection are served in order; clients wanting
+ *          parallelism open several connections.
+ *
+ * @param data The socket of the client
+ */
+static void *_client_thread(void *data) {
+	int fd = (intptr_t) data;
+	service_request request;
+
+	for (;;) {
+		ssize_t received = _receive_with_fd(fd, &request, sizeof(request),
+				NULL);
+		if (received <= 0)
+			break;
+
+		uint64_t start_us = monotonic_us();
+		service_reply reply = { .error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER };
+		int image_fd = -1;
+
+		if (received == sizeof(request))
+			image_fd = _serve(&request, &reply);
+
+		__atomic_add_fetch(&service.requests, 1, __ATOMIC_RELAXED);
+		if (image_fd < 0)
+			__atomic_add_fetch(&service.failures, 1, __ATOMIC_RELAXED);
+		else
+			__atomic_add_fetch(&service.bytes, reply.size, __ATOMIC_RELAXED);
+
+		reply.service_us = monotonic_us() - start_us;
+		bool sent = _send_with_fd(fd, &reply, sizeof(reply), image_fd);
+		if (image_fd >= 0)
+			close(image_fd);
+		if (!sent)
+			break;
+	}
+
+	pthread_mutex_lock(&service.lock);
+	for (unsigned int i = 0; i < service.client_count; ++i) {
+		if (service.clients[i] == fd) {
+			service.clients[i] = service.clients[--service.client_count];
+			break;
+		}
+	}
+	close(fd);
+	if (service.client_count == 0)
+		pthread_cond_broadcast(&service.idle);
+	pthread_mutex_unlock(&service.lock);
+	return NULL;
+}
+
+/**
+ * @brief Checks that a client runs as the same user as the service.
+ */
+static bool _peer_allowed(int fd) {
+	struct ucred cred;
+	socklen_t length = sizeof(cred);
+
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0
+			&& cred.uid == getuid();
+}
+
+/**
+ * @brief Accepts clients, one thread each, until service_stop().
+ * @details Clients of other users are refused.
+ */
+static void *_accept_thread(void *data) {
+	struct pollfd fds[2] = { { .fd = service.listen_fd, .events = POLLIN }, {
+			.fd = service.wake[0], .events = POLLIN } };
+
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents != 0)
+			break;
+
+		int fd = accept4(service.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0)
+			continue;
+		if (!_peer_allowed(fd)) {
+			dlog_print(DLOG_WARN, LOG_TAG,
+					"Service client of another user refused");
+			close(fd);
+			continue;
+		}
+
+		pthread_attr_t attr;
+		pthread_t thread;
+		bool started = false;
+
+		pthread_mutex_lock(&service.lock);
+		if (service.running && service.client_count < SERVICE_MAX_CLIENTS) {
+			pthread_attr_init(&attr);
+			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+			started = pthread_create(&thread, &attr, _client_thread,
+					(void *) (intptr_t) fd) == 0;
+			pthread_attr_destroy(&attr);
+		}
+		if (started) {
+			service.clients[service.client_count++] = fd;
+			service.connections++;
+		}
+		pthread_mutex_unlock(&service.lock);
+
+		if (!started) {
+			dlog_print(DLOG_WARN, LOG_TAG, "Service client refused");
+			close(fd);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Removes the socket file of a service that is gone.
+ * @details Nothing is removed unless the path is a socket nobody listens
+ *          on, so neither a running service nor some other file is lost.
+ *
+ * @param address The address of the socket
+ * @return IMAGE_UTIL_ERROR_NONE if the path is free now, otherwise an error
+ *         code
+ */
+static int _remove_stale_socket(const struct sockaddr_un *address) {
+	struct stat buf;
+
+	if (lstat(address->sun_path, &buf) != 0)
+		return (errno == ENOENT) ?
+				IMAGE_UTIL_ERROR_NONE : IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	if (!S_ISSOCK(buf.st_mode)) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "%s is not a socket",
+				address->sun_path);
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	int connected = connect(fd, (const struct sockaddr *) address,
+			sizeof(*address));
+	int error = errno;
+	close(fd);
+
+	if (connected == 0 || error != ECONNREFUSED) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "%s is in use", address->sun_path);
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	}
+	unlink(address->sun_path);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Starts serving transform requests on a Unix domain socket.
+ * @details Requests go through the lazy result cache and the scheduler,
+ *          which stay warm for as long as the service runs; start them with
+ *          batch_init() first. The socket file of a service that is gone
+ *          is replaced, but not a running service's socket nor any other
+ *          file. Only the
+ *          user of the service may connect, and requests may only read
+ *          files below root, see batch_path_confined().
+ *
+ * @param socket_path The path of the socket
+ * @param root The absolute directory requested files must be in, or NULL
+ *             for the data, shared and resource directories of the app
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int service_start(const char *socket_path, const char *root) {
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+	if (socket_path == NULL
+			|| strlen(socket_path) >= sizeof(address.sun_path)
+			|| (root != NULL && (root[0] != '/' || strlen(root) >= BUFLEN)))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	if (service.running)
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+	int error_code = _remove_stale_socket(&address);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+
+	service.listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (service.listen_fd < 0)
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+
+	bool bound = bind(service.listen_fd, (struct sockaddr *) &address,
+			sizeof(address)) == 0;
+	if (!bound || chmod(socket_path, S_IRUSR | S_IWUSR) != 0
+			|| listen(service.listen_fd, SERVICE_MAX_CLIENTS) != 0
+			|| pipe2(service.wake, O_CLOEXEC) != 0) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "Cannot listen on %s: %s",
+				socket_path, strerror(errno));
+		close(service.listen_fd);
+		service.listen_fd = -1;
+		if (bound)
+			unlink(socket_path);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+
+	snprintf(service.socket_path, BUFLEN, "%s", socket_path);
+	snprintf(service.root, BUFLEN, "%s", (root != NULL) ? root : "");
+
+	/* Only once the socket is up, so a failure leaves no cache behind. */
+	error_code = lazy_init(LAZY_CACHE_BUDGET);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		service_stop();
+		return error_code;
+	}
+
+	service.cancel = cancel_token_create(NULL);
+	service.running = true;
+
+	if (pthread_create(&service.accept_thread, NULL, _accept_thread, NULL)
+			!= 0) {
+		service.running = false;
+		service_stop();
+		lazy_shutdown();
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	}
+
+	dlog_print(DLOG_INFO, LOG_TAG, "Service listening on %s", socket_path);
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Stops accepting clients, disconnects them and removes the socket.
+ * @details Requests in progress are cancelled; returns once every client
+ *          thread is gone.
+ */
+void service_stop(void) {
+	pthread_mutex_lock(&service.lock);
+	bool was_running = service.running;
+	service.running = false;
+	pthread_mutex_unlock(&service.lock);
+
+	if (was_running) {
+		char byte = 0;
+
+		if (write(service.wake[1], &byte, 1) == 1)
+			pthread_join(service.accept_thread, NULL);
+	}
+
+	cancel_token_cancel(service.cancel);
+
+	pthread_mutex_lock(&service.lock);
+	for (unsigned int i = 0; i < service.client_count; ++i)
+		shutdown(service.clients[i], SHUT_RDWR);
+	while (service.client_count > 0)
+		pthread_cond_wait(&service.idle, &service.lock);
+	pthread_mutex_unlock(&service.lock);
+
+	if (service.listen_fd >= 0) {
+		close(service.listen_fd);
+		unlink(service.socket_path);
+		service.listen_fd = -1;
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (service.wake[i] >= 0)
+			close(service.wake[i]);
+		service.wake[i] = -1;
+	}
+	cancel_token_unref(service.cancel);
+	service.cancel = NULL;
+}
+
+/**
+ * @brief Prints the service statistics to the log.
+ */
+void service_log_stats(void) {
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Service: %u connections, %u requests, %u failed, %llu bytes shared",
+			service.connections, service.requests, service.failures,
+			(unsigned long long) service.bytes);
+}
+
+/**
+ * @brief Connects to a running service.
+ *
+ * @param socket_path The path of the socket
+ * @param fd Receives the connection, to be closed with close()
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int service_connect(const char *socket_path, int *fd) {
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+	if (socket_path == NULL
+			|| strlen(socket_path) >= sizeof(address.sun_path))
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+
+	*fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (*fd < 0)
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+
+	if (connect(*fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+		int error_code = (errno == ENOENT || errno == ECONNREFUSED) ?
+				IMAGE_UTIL_ERROR_NO_SUCH_FILE :
+				IMAGE_UTIL_ERROR_INVALID_OPERATION;
+
+		close(*fd);
+		*fd = -1;
+		return error_code;
+	}
+	return IMAGE_UTIL_ERROR_NONE;
+}
+
+/**
+ * @brief Sends a request and waits for its reply.
+ *
+ * @param fd The connection from service_connect()
+ * @param request The request
+ * @param reply Receives the reply
+ * @param image_fd Receives the shared memory file holding the result, to be
+ *                 mapped with mmap() and closed by the caller
+ * @return IMAGE_UTIL_ERROR_NONE on success, the error of the service, or
+ *         IMAGE_UTIL_ERROR_INVALID_OPERATION if the connection failed
+ */
+int service_call(int fd, const service_request *request, service_reply *reply,
+		int *image_fd) {
+	*image_fd = -1;
+	if (!_send_with_fd(fd, request, sizeof(service_request), -1))
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+
+	if (_receive_with_fd(fd, reply, sizeof(service_reply), image_fd)
+			!= sizeof(service_reply)) {
+		if (*image_fd >= 0)
+			close(*image_fd);
+		*image_fd = -1;
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	}
+
+	if (reply->error_code == IMAGE_UTIL_ERROR_NONE && *image_fd < 0)
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	if (reply->error_code != IMAGE_UTIL_ERROR_NONE && *image_fd >= 0) {
+		close(*image_fd);
+		*image_fd = -1;
+	}
+	return reply->error_code;
+}
@@ -0,0 +1,698 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "supervisor.h"
+#include "backend.h"
+#include "frame_cache.h"
+#include "arena.h"
+#include "scan.h"
+#include "report.h"
+#include "probe.h"
+#include <tizen.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* How often the supervisor checks on its workers. */
+#define SUPERVISOR_POLL_US (20 * 1000)
+
+typedef enum {
+	SLOT_PENDING,
+	SLOT_RUNNING,
+	SLOT_DONE,
+	SLOT_QUARANTINED,
+	/* Not run: takes the outcome of the slot before it, see _fan_out(). */
+	SLOT_DUPLICATE
+} slot_state;
+
+/* The outcome of one size of an input, for the report. */
+typedef struct {
+	int error_code;
+	pipeline_stage stage;
+	bool cancelled;
+	char backend[16];
+	unsigned int attempts;
+	uint64_t run_us;
+} supervisor_outcome;
+
+/* One input file and all its sizes, in memory shared with the workers. */
+typedef struct {
+	char path[BUFLEN];
+	/* A slot_state, changed atomically. */
+	int state;
+	/* Published after started_us, see _kill_stuck(). */
+	pid_t owner;
+	/* Source pixels from the header, 0 if unknown. */
+	uint64_t pixels;
+	/* The scan index of the first input with the same image. */
+	unsigned int group;
+	bool duplicate;
+	/* Workers that died on this input. */
+	unsigned int attempts;
+	uint64_t started_us;
+	unsigned int succeeded;
+	unsigned int failed;
+	unsigned int cancelled;
+	unsigned int retried;
+	supervisor_outcome outcomes[BATCH_MAX_SIZES];
+} supervisor_slot;
+
+/* The inputs quarantined by earlier runs, sorted for bsearch(). */
+typedef struct {
+	char (*paths)[BUFLEN];
+	unsigned int count;
+} quarantine_set;
+
+/*
+ * The work queue, shared by the supervisor and its workers. Workers take
+ * slots in order through next, then look for slots put back after a crash.
+ */
+typedef struct {
+	unsigned int next;
+	unsigned int count;
+	/* Set by the supervisor to stop the workers after their current input. */
+	int stopping;
+	supervisor_slot slots[];
+} supervisor_queue;
+
+/**
+ * @brief Takes the next pending slot of the queue.
+ *
+ * @return The slot, now running and owned by the caller, or NULL
+ */
+static supervisor_slot *_claim(supervisor_queue *queue) {
+	int pending = SLOT_PENDING;
+
+	while (!__atomic_load_n(&queue->stopping, __ATOMIC_ACQUIRE)) {
+		unsigned int i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+		if (i >= queue->count)
+			break;
+
+		supervisor_slot *slot = &queue->slots[i];
+		if (__atomic_compare_exchange_n(&slot->state, &pending, SLOT_RUNNING,
+				false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			return slot;
+		pending = SLOT_PENDING;
+	}
+
+	/* Past the end: only inputs put back after a crash are left. */
+	for (unsigned int i = 0; i < queue->count; ++i) {
+		if (__atomic_load_n(&queue->stopping, __ATOMIC_ACQUIRE))
+			return NULL;
+
+		supervisor_slot *slot = &queue->slots[i];
+		if (__atomic_compare_exchange_n(&slot->state, &pending, SLOT_RUNNING,
+				false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			return slot;
+		pending = SLOT_PENDING;
+	}
+	return NULL;
+}
+
+/**
+ * @brief The body of a worker process: transforms inputs until none is left.
+ * @details Jobs run one at a time on the calling thread, so a crash only
+ *          loses the input in progress. Never returns.
+ */
+static void _worker(supervisor_queue *queue, const batch_request *req,
+		batch_job_cb job_cb, void *user_data) {
+	static const batch_size source_size = { 0, 0 };
+	const batch_size *sizes = (req->size_count > 0) ? req->sizes : &source_size;
+	unsigned int size_count = (req->size_count > 0) ? req->size_count : 1;
+	supervisor_slot *slot;
+	transform_job job;
+
+	/* A terminal interrupt is for the supervisor, which stops the queue. */
+	signal(SIGINT, SIG_IGN);
+	/* Keep the lines of the workers whole. */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	backend_init();
+	frame_cache_init(FRAME_CACHE_BUDGET);
+	/* Like a scheduler worker, the process owns an arena for job scratch. */
+	arena *scratch = arena_create(0);
+	arena_set_current(scratch);
+
+	while ((slot = _claim(queue)) != NULL) {
+		/* The start time first, so the owner is never paired with an old one. */
+		__atomic_store_n(&slot->started_us, monotonic_us(), __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->owner, getpid(), __ATOMIC_RELEASE);
+		slot->succeeded = slot->failed = slot->cancelled = slot->retried = 0;
+
+		for (unsigned int s = 0; s < size_count; ++s) {
+			supervisor_outcome *outcome = &slot->outcomes[s];
+			pipeline_result result;
+
+			batch_job_init(req, &job);
+			snprintf(job.input_path, BUFLEN, "%s", slot->path);
+			job.width = sizes[s].width;
+			job.height = sizes[s].height;
+
+			int error_code = probe_job(&job);
+			if (error_code == IMAGE_UTIL_ERROR_NONE
+					&& !batch_output_path(req, slot->path, &sizes[s],
+							job.output_path))
+				error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+			if (error_code != IMAGE_UTIL_ERROR_NONE) {
+				memset(&result, 0, sizeof(pipeline_result));
+				result.error_code = error_code;
+				result.stage = PIPELINE_STAGE_QUEUE;
+			} else {
+				pipeline_run(&job, &result);
+				while (!result.cancelled
+						&& report_is_transient(result.error_code)
+						&& job.attempt < req->retries) {
+					pipeline_result_clear(&result);
+					job.attempt++;
+					slot->retried++;
+					pipeline_run(&job, &result);
+				}
+			}
+			arena_reset(scratch);
+
+			if (result.cancelled)
+				slot->cancelled++;
+			else if (result.error_code != IMAGE_UTIL_ERROR_NONE)
+				slot->failed++;
+			else
+				slot->succeeded++;
+
+			outcome->error_code = result.error_code;
+			outcome->stage = result.stage;
+			outcome->cancelled = result.cancelled;
+			snprintf(outcome->backend, sizeof(outcome->backend), "%s",
+					(result.backend != NULL) ? result.backend : "");
+			outcome->attempts = job.attempt + 1;
+			outcome->run_us = result.run_us;
+
+			if (outcome->error_code != IMAGE_UTIL_ERROR_NONE
+					&& !outcome->cancelled && req->stop_on_error)
+				__atomic_store_n(&queue->stopping, 1, __ATOMIC_RELEASE);
+
+			if (job_cb != NULL)
+				job_cb(&job, &result, user_data);
+			pipeline_result_clear(&result);
+		}
+
+		__atomic_store_n(&slot->state, SLOT_DONE, __ATOMIC_RELEASE);
+	}
+
+	fflush(stdout);
+	_exit(0);
+}
+
+/**
+ * @brief Starts a worker process.
+ *
+ * @return @c true if the worker was started
+ */
+static bool _spawn(supervisor_queue *queue, const batch_request *req,
+		batch_job_cb job_cb, void *user_data) {
+	fflush(stdout);
+
+	pid_t pid = fork();
+	if (pid == 0)
+		_worker(queue, req, job_cb, user_data);
+	if (pid < 0) {
+		dlog_print(DLOG_ERROR, LOG_TAG, "fork() failed: %s", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static unsigned int _count_pending(const supervisor_queue *queue) {
+	unsigned int pending = 0;
+
+	for (unsigned int i = 0; i < queue->count; ++i)
+		if (__atomic_load_n(&queue->slots[i].state, __ATOMIC_ACQUIRE)
+				== SLOT_PENDING)
+			pending++;
+	return pending;
+}
+
+static int _compare_paths(const void *a, const void *b) {
+	return strcmp(a, b);
+}
+
+/**
+ * @brief Reads the inputs quarantined by earlier runs.
+ * @details A missing or unreadable file quarantines nothing.
+ *
+ * @param set Receives the inputs, to be freed with free(set->paths)
+ */
+static void _load_quarantine(const batch_request *req, quarantine_set *set) {
+	char path[BUFLEN];
+	char line[BUFLEN + 1];
+	unsigned int size = 0;
+	FILE *quarantine = NULL;
+
+	set->paths = NULL;
+	set->count = 0;
+	if (snprintf(path, BUFLEN, "%s/" SUPERVISOR_QUARANTINE_FILE,
+			req->output_dir) < BUFLEN)
+		quarantine = fopen(path, "r");
+	if (quarantine == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), quarantine) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if (line[0] == '\0' || strlen(line) >= BUFLEN)
+			continue;
+
+		if (set->count == size) {
+			unsigned int grown = size ? 2 * size : 16;
+			char (*paths)[BUFLEN] = realloc(set->paths, grown * sizeof(*paths));
+
+			if (paths == NULL)
+				break;
+			set->paths = paths;
+			size = grown;
+		}
+		snprintf(set->paths[set->count++], BUFLEN, "%s", line);
+	}
+	fclose(quarantine);
+
+	if (set->count > 1)
+		qsort(set->paths, set->count, BUFLEN, _compare_paths);
+}
+
+/**
+ * @brief Checks whether an input was quarantined by an earlier run.
+ */
+static bool _is_quarantined(const quarantine_set *set, const char *path) {
+	return set->count > 0
+			&& bsearch(path, set->paths, set->count, BUFLEN, _compare_paths)
+					!= NULL;
+}
+
+/* Largest first; the duplicates of an input right after it. */
+static int _compare_slots(const void *a, const void *b) {
+	const supervisor_slot *first = a, *second = b;
+
+	if (first->pixels != second->pixels)
+		return (first->pixels < second->pixels) ? 1 : -1;
+	if (first->group != second->group)
+		return (first->group < second->group) ? -1 : 1;
+	if (first->duplicate != second->duplicate)
+		return first->duplicate ? 1 : -1;
+	return strcmp(first->path, second->path);
+}
+
+/**
+ * @brief Creates the shared queue of the inputs not quarantined yet.
+ * @details Duplicates found by scan_find_duplicates() get a slot that no
+ *          worker takes; so do the duplicates of a quarantined input.
+ *
+ * @return The queue, to be unmapped with munmap(), or NULL
+ */
+static supervisor_queue *_create_queue(const batch_request *req,
+		const scan_list *files, size_t *size, unsigned int *skipped) {
+	quarantine_set quarantine;
+
+	*size = sizeof(supervisor_queue) + files->count * sizeof(supervisor_slot);
+	supervisor_queue *queue = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (queue == MAP_FAILED)
+		return NULL;
+
+	_load_quarantine(req, &quarantine);
+
+	*skipped = 0;
+	for (unsigned int i = 0; i < files->count; ++i) {
+		const scan_entry *entry = &files->entries[i];
+		int group = (entry->original >= 0) ? entry->original : (int) i;
+		const char *group_path = files->entries[group].path;
+
+		if (_is_quarantined(&quarantine, entry->path)
+				|| (entry->original >= 0
+						&& _is_quarantined(&quarantine, group_path))) {
+			dlog_print(DLOG_WARN, LOG_TAG, "Skipping quarantined %s",
+					entry->path);
+			(*skipped)++;
+			continue;
+		}
+
+		supervisor_slot *slot = &queue->slots[queue->count++];
+		probe_info info;
+
+		snprintf(slot->path, BUFLEN, "%s", entry->path);
+		slot->group = group;
+		slot->duplicate = (entry->original >= 0);
+		if (slot->duplicate)
+			slot->state = SLOT_DUPLICATE;
+		/* The pixels of the group keep the duplicates with their original. */
+		if (probe_file(group_path, &info) == IMAGE_UTIL_ERROR_NONE)
+			slot->pixels = (uint64_t) info.width * info.height;
+	}
+
+	free(quarantine.paths);
+
+	/* Largest first, so that no big image is left alone at the end. */
+	qsort(queue->slots, queue->count, sizeof(supervisor_slot),
+			_compare_slots);
+	return queue;
+}
+
+/**
+ * @brief Sets aside the inputs of a crashed worker.
+ * @details An input is put back in the queue until it has crashed
+ *          SUPERVISOR_MAX_ATTEMPTS workers, then quarantined: recorded in
+ *          the quarantine file and skipped by later runs.
+ */
+static void _recover(supervisor_queue *queue, const batch_request *req,
+		pid_t pid) {
+	char path[BUFLEN];
+
+	for (unsigned int i = 0; i < queue->count; ++i) {
+		supervisor_slot *slot = &queue->slots[i];
+
+		if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != SLOT_RUNNING
+				|| __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE) != pid)
+			continue;
+
+		if (++slot->attempts < SUPERVISOR_MAX_ATTEMPTS) {
+			dlog_print(DLOG_WARN, LOG_TAG, "Retrying %s", slot->path);
+			__atomic_store_n(&slot->owner, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&slot->state, SLOT_PENDING, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		dlog_print(DLOG_ERROR, LOG_TAG, "Quarantining %s", slot->path);
+		__atomic_store_n(&slot->state, SLOT_QUARANTINED, __ATOMIC_RELEASE);
+
+		if (snprintf(path, BUFLEN, "%s/" SUPERVISOR_QUARANTINE_FILE,
+				req->output_dir) < BUFLEN) {
+			FILE *quarantine = fopen(path, "a");
+
+			if (quarantine != NULL) {
+				fprintf(quarantine, "%s\n", slot->path);
+				fclose(quarantine);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Kills workers stuck on one input for too long.
+ * @details A worker stores the start time of an input before it publishes
+ *          itself as the owner, so the owner read here is never paired with
+ *          the start time of the worker that hung on the input before.
+ */
+static void _kill_stuck(supervisor_queue *queue) {
+	uint64_t now_us = monotonic_us();
+
+	for (unsigned int i = 0; i < queue->count; ++i) {
+		supervisor_slot *slot = &queue->slots[i];
+
+		if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != SLOT_RUNNING)
+			continue;
+
+		pid_t owner = __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE);
+		uint64_t started_us = __atomic_load_n(&slot->started_us,
+				__ATOMIC_RELAXED);
+		/* An input started after now_us was taken is not stuck either. */
+		if (owner > 0 && now_us > started_us
+				&& now_us - started_us > SUPERVISOR_INPUT_TIMEOUT_US) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Worker %d stuck on %s",
+					(int) owner, slot->path);
+			kill(owner, SIGKILL);
+		}
+	}
+}
+
+/**
+ * @brief Gives the outcomes of the inputs run to their duplicates.
+ * @details Successful results are copied to the outputs of the duplicates,
+ *          in the supervisor process; job_cb is called for each of them.
+ */
+static void _fan_out(supervisor_queue *queue, const batch_request *req,
+		batch_job_cb job_cb, void *user_data) {
+	static const batch_size source_size = { 0, 0 };
+	const batch_size *sizes = (req->size_count > 0) ? req->sizes : &source_size;
+	unsigned int size_count = (req->size_count > 0) ? req->size_count : 1;
+	const supervisor_slot *original = NULL;
+	char from[BUFLEN];
+
+	for (unsigned int i = 0; i < queue->count; ++i) {
+		supervisor_slot *slot = &queue->slots[i];
+
+		if (slot->state != SLOT_DUPLICATE) {
+			original = slot;
+			continue;
+		}
+		if (original == NULL)
+			continue;
+
+		slot->state = original->state;
+		slot->attempts = original->attempts;
+		if (slot->state != SLOT_DONE)
+			continue;
+
+		for (unsigned int s = 0; s < size_count; ++s) {
+			supervisor_outcome *outcome = &slot->outcomes[s];
+			transform_job job;
+
+			*outcome = original->outcomes[s];
+			batch_job_init(req, &job);
+			snprintf(job.input_path, BUFLEN, "%s", slot->path);
+			job.width = sizes[s].width;
+			job.height = sizes[s].height;
+
+			if (!batch_output_path(req, slot->path, &sizes[s], job.output_path)
+					|| !batch_output_path(req, original->path, &sizes[s],
+							from)) {
+				outcome->error_code = IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+				outcome->stage = PIPELINE_STAGE_QUEUE;
+			} else if (!outcome->cancelled
+					&& outcome->error_code == IMAGE_UTIL_ERROR_NONE) {
+				uint64_t start_us = monotonic_us();
+
+				outcome->error_code = batch_copy_output(from, job.output_path);
+				snprintf(outcome->backend, sizeof(outcome->backend), "%s",
+						BATCH_COPY_BACKEND);
+				outcome->run_us = monotonic_us() - start_us;
+			}
+
+			if (outcome->cancelled)
+				slot->cancelled++;
+			else if (outcome->error_code != IMAGE_UTIL_ERROR_NONE)
+				slot->failed++;
+			else
+				slot->succeeded++;
+
+			pipeline_result result = { .error_code = outcome->error_code,
+					.stage = outcome->stage, .cancelled = outcome->cancelled,
+					.backend = outcome->backend, .run_us = outcome->run_us };
+			job.attempt = outcome->attempts - 1;
+			if (job_cb != NULL)
+				job_cb(&job, &result, user_data);
+		}
+	}
+}
+
+/**
+ * @brief Writes the JSON report of a supervised batch.
+ * @details Inputs that were quarantined or never run have one entry per
+ *          size, without timings.
+ */
+static void _write_report(batch_report *report,
+		const supervisor_queue *queue, const batch_request *req,
+		const batch_summary *summary) {
+	static const batch_size source_size = { 0, 0 };
+	const batch_size *sizes = (req->size_count > 0) ? req->sizes : &source_size;
+	unsigned int size_count = (req->size_count > 0) ? req->size_count : 1;
+	char path[BUFLEN];
+
+	if (report == NULL || !batch_report_path(req, path))
+		return;
+
+	for (unsigned int i = 0; i < queue->count; ++i) {
+		const supervisor_slot *slot = &queue->slots[i];
+
+		for (unsigned int s = 0; s < size_count; ++s) {
+			const supervisor_outcome *outcome = &slot->outcomes[s];
+			report_entry entry = { .stage = PIPELINE_STAGE_QUEUE };
+
+			snprintf(entry.input_path, BUFLEN, "%s", slot->path);
+			batch_output_path(req, slot->path, &sizes[s], entry.output_path);
+
+			if (slot->state == SLOT_QUARANTINED) {
+				entry.status = REPORT_QUARANTINED;
+				entry.error_code = IMAGE_UTIL_ERROR_INVALID_OPERATION;
+				entry.attempts = slot->attempts;
+			} else if (slot->state != SLOT_DONE || outcome->cancelled) {
+				entry.status = REPORT_CANCELLED;
+				entry.error_code = TIZEN_ERROR_CANCELED;
+			} else {
+				entry.status = (outcome->error_code == IMAGE_UTIL_ERROR_NONE) ?
+						REPORT_OK : REPORT_FAILED;
+				entry.error_code = outcome->error_code;
+				entry.stage = outcome->stage;
+				entry.backend = outcome->backend;
+				entry.attempts = outcome->attempts;
+				entry.run_us = outcome->run_us;
+			}
+			report_add(report, &entry);
+		}
+	}
+
+	int error_code = report_write_json(report, summary, path);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		DLOG_PRINT_ERROR("report_write_json", error_code);
+}
+
+/**
+ * @brief Runs a batch in worker processes, isolating crashes.
+ * @details The input files are shared by req->processes workers through a
+ *          queue in shared memory; each worker runs its jobs one at a time.
+ *          A worker that crashes or hangs is replaced, and the input it was
+ *          on is retried, then quarantined. Inputs holding the same image
+ *          as another are not run; the results are copied instead. Call
+ *          before starting any thread: the workers are forked.
+ *
+ * @param req The batch
+ * @param cancel Stops the batch after the inputs in progress; may be NULL
+ * @param job_cb The function called for every finished job, in the worker
+ *               process, may be NULL
+ * @param user_data The user data passed to job_cb
+ * @param summary Receives the outcome of the batch
+ * @return IMAGE_UTIL_ERROR_NONE if the batch ran, otherwise an error code
+ */
+int supervisor_run(const batch_request *req, cancel_token *cancel,
+		batch_job_cb job_cb, void *user_data, batch_summary *summary) {
+	unsigned int processes = req->processes ? req->processes : 1;
+	unsigned int size_count = req->size_count ? req->size_count : 1;
+	unsigned int live = 0, restarts = 0, skipped, duplicates = 0;
+	scan_list files;
+	size_t size;
+
+	memset(summary, 0, sizeof(batch_summary));
+
+	int error_code = batch_request_validate(req);
+	if (error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = scan_inputs((const char (*)[BUFLEN]) req->inputs,
+				req->input_count, &files);
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		return error_code;
+
+	error_code = batch_make_output_dir(req);
+	if (error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = batch_prepare_outputs(req, &files);
+	if (error_code != IMAGE_UTIL_ERROR_NONE) {
+		scan_list_clear(&files);
+		return error_code;
+	}
+
+	scan_find_duplicates(&files, req->dedupe);
+	supervisor_queue *queue = _create_queue(req, &files, &size, &skipped);
+	scan_list_clear(&files);
+	if (queue == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	batch_report *report = report_create();
+
+	for (unsigned int i = 0; i < queue->count; ++i)
+		if (queue->slots[i].duplicate)
+			duplicates++;
+	if (processes > queue->count - duplicates)
+		processes = queue->count - duplicates;
+	while (live < processes && _spawn(queue, req, job_cb, user_data))
+		live++;
+	if (live == 0 && processes > 0) {
+		report_destroy(report);
+		munmap(queue, size);
+		return IMAGE_UTIL_ERROR_INVALID_OPERATION;
+	}
+
+	while (live > 0) {
+		int status;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+
+		if (pid == 0) {
+			if (cancel_token_is_cancelled(cancel))
+				__atomic_store_n(&queue->stopping, 1, __ATOMIC_RELEASE);
+			_kill_stuck(queue);
+			usleep(SUPERVISOR_POLL_US);
+			continue;
+		}
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		live--;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			dlog_print(DLOG_ERROR, LOG_TAG, "Worker %d died (status %d)",
+					(int) pid, status);
+			_recover(queue, req, pid);
+		}
+
+		/* Replace the worker while inputs are left for it. */
+		if (!__atomic_load_n(&queue->stopping, __ATOMIC_ACQUIRE)
+				&& live < processes && _count_pending(queue) > live
+				&& _spawn(queue, req, job_cb, user_data)) {
+			live++;
+			restarts++;
+		}
+	}
+
+	_fan_out(queue, req, job_cb, user_data);
+
+	for (unsigned int i = 0; i < queue->count; ++i) {
+		const supervisor_slot *slot = &queue->slots[i];
+
+		if (slot->duplicate)
+			summary->deduplicated += size_count;
+
+		switch (slot->state) {
+		case SLOT_DONE:
+			summary->succeeded += slot->succeeded;
+			summary->failed += slot->failed;
+			summary->cancelled += slot->cancelled;
+			summary->retried += slot->retried;
+			break;
+
+		case SLOT_QUARANTINED:
+			summary->quarantined++;
+			summary->failed += size_count;
+			break;
+
+		default:
+			summary->cancelled += size_count;
+			break;
+		}
+	}
+	summary->submitted = queue->count * size_count;
+
+	_write_report(report, queue, req, summary);
+	report_destroy(report);
+
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Supervisor: %u inputs (%u duplicates), %u processes, %u restarts, %u quarantined, %u skipped",
+			queue->count, duplicates, processes, restarts, summary->quarantined,
+			skipped);
+
+	munmap(queue, size);
+	return IMAGE_UTIL_ERROR_NONE;
+}
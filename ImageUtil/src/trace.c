@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd
+ *
+ * Licensed under the Flora License, Version 1.1 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://floralicense.org/license/
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "main.h"
+#include "trace.h"
+#include "report.h"
+#include <tizen.h>
+#include <image_util.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef enum {
+	TRACE_SPAN,
+	TRACE_COUNTER
+} trace_kind;
+
+typedef struct {
+	uint64_t start_us;
+	/* The duration of a span, the value of a counter. */
+	int64_t value;
+	/* A string literal. */
+	const char *name;
+	trace_kind kind;
+	char detail[TRACE_DETAIL_LEN];
+} trace_event;
+
+/*
+ * The events of one thread. Only the thread writes; it publishes an event
+ * by moving the head past it, so exporting takes no lock.
+ */
+typedef struct {
+	unsigned int head;
+	int tid;
+	char name[32];
+	trace_event events[TRACE_RING_SPANS];
+} trace_ring;
+
+unsigned int trace_sessions = 0;
+
+/* Rings are kept once claimed, so the spans of ended threads are exported. */
+static struct {
+	trace_ring *rings[TRACE_MAX_THREADS];
+	unsigned int ring_count;
+	unsigned int overwritten;
+	unsigned int untraced_threads;
+} trace;
+
+static __thread trace_ring *local_ring;
+static __thread bool local_claimed;
+static __thread char local_name[32];
+
+/**
+ * @brief Starts a tracing session. Sessions nest; spans are recorded while
+ *        any is open.
+ */
+void trace_start(void) {
+	__atomic_add_fetch(&trace_sessions, 1, __ATOMIC_RELAXED);
+}
+
+void trace_stop(void) {
+	__atomic_sub_fetch(&trace_sessions, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Gets the ring of the calling thread, claiming one on first use.
+ * @return The ring, or NULL if every ring is taken or out of memory
+ */
+static trace_ring *_ring(void) {
+	if (local_claimed)
+		return local_ring;
+	local_claimed = true;
+
+	unsigned int slot = __atomic_fetch_add(&trace.ring_count, 1,
+			__ATOMIC_RELAXED);
+	if (slot >= TRACE_MAX_THREADS) {
+		__atomic_add_fetch(&trace.untraced_threads, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	trace_ring *ring = calloc(1, sizeof(trace_ring));
+	if (ring == NULL)
+		return NULL;
+	ring->tid = syscall(SYS_gettid);
+	if (local_name[0] != '\0')
+		snprintf(ring->name, sizeof(ring->name), "%s", local_name);
+	else
+		snprintf(ring->name, sizeof(ring->name), "thread %d", ring->tid);
+
+	__atomic_store_n(&trace.rings[slot], ring, __ATOMIC_RELEASE);
+	local_ring = ring;
+	return ring;
+}
+
+static trace_event *_next_event(trace_ring *ring) {
+	unsigned int head = ring->head;
+
+	if (head >= TRACE_RING_SPANS)
+		__atomic_add_fetch(&trace.overwritten, 1, __ATOMIC_RELAXED);
+	return &ring->events[head & (TRACE_RING_SPANS - 1)];
+}
+
+static void _publish(trace_ring *ring) {
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Ends a span started with trace_begin().
+ *
+ * @param name The name of the span, a string literal
+ * @param start_us What trace_begin() returned; 0 records nothing
+ * @param detail Shown with the span, may be NULL; a path is shortened to
+ *               its file name
+ */
+void trace_end(const char *name, uint64_t start_us, const char *detail) {
+	if (start_us == 0)
+		return;
+
+	uint64_t end_us = monotonic_us();
+	trace_ring *ring = _ring();
+	if (ring == NULL)
+		return;
+
+	trace_event *event = _next_event(ring);
+	event->start_us = start_us;
+	event->value = end_us - start_us;
+	event->name = name;
+	event->kind = TRACE_SPAN;
+	event->detail[0] = '\0';
+	if (detail != NULL) {
+		const char *slash = strrchr(detail, '/');
+
+		snprintf(event->detail, TRACE_DETAIL_LEN, "%s",
+				(slash != NULL) ? slash + 1 : detail);
+	}
+	_publish(ring);
+}
+
+/**
+ * @brief Records the value of a counter, such as a queue length.
+ *
+ * @param name The name of the counter, a string literal
+ * @param value The value from now on
+ */
+void trace_counter(const char *name, int64_t value) {
+	if (!__atomic_load_n(&trace_sessions, __ATOMIC_RELAXED))
+		return;
+
+	trace_ring *ring = _ring();
+	if (ring == NULL)
+		return;
+
+	trace_event *event = _next_event(ring);
+	event->start_us = monotonic_us();
+	event->value = value;
+	event->name = name;
+	event->kind = TRACE_COUNTER;
+	event->detail[0] = '\0';
+	_publish(ring);
+}
+
+/**
+ * @brief Names the calling thread in traces.
+ * @details May be called before tracing starts; the name is kept until the
+ *          thread records its first event.
+ */
+void trace_thread_name(const char *name) {
+	snprintf(local_name, sizeof(local_name), "%s", name);
+	if (local_ring != NULL)
+		snprintf(local_ring->name, sizeof(local_ring->name), "%s", name);
+}
+
+/**
+ * @brief Copies the events of a ring still being written.
+ * @details Events the thread may have overwritten while they were copied
+ *          are left out.
+ *
+ * @param ring The ring
+ * @param events The buffer of TRACE_RING_SPANS events receiving the copy
+ * @return The number of events copied, oldest first
+ */
+static unsigned int _copy_ring(const trace_ring *ring, trace_event *events) {
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	unsigned int first = (head > TRACE_RING_SPANS) ?
+			head - TRACE_RING_SPANS : 0;
+
+	for (unsigned int i = first; i < head; ++i)
+		events[i - first] = ring->events[i & (TRACE_RING_SPANS - 1)];
+
+	/* The slot being written holds the event TRACE_RING_SPANS before it. */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	unsigned int now = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	unsigned int valid = (now >= TRACE_RING_SPANS) ?
+			now - TRACE_RING_SPANS + 1 : 0;
+	if (valid <= first)
+		return head - first;
+	if (valid >= head)
+		return 0;
+
+	memmove(events, events + (valid - first),
+			(head - valid) * sizeof(trace_event));
+	return head - valid;
+}
+
+static void _write_event(FILE *file, int pid, const trace_ring *ring,
+		const trace_event *event, bool *first) {
+	fprintf(file, "%s\n{\"name\":", *first ? "" : ",");
+	*first = false;
+	report_write_string(file, event->name);
+
+	if (event->kind == TRACE_COUNTER) {
+		fprintf(file, ",\"ph\":\"C\",\"ts\":%llu,\"pid\":%d,\"tid\":%d,"
+				"\"args\":{\"value\":%lld}}",
+				(unsigned long long) event->start_us, pid, ring->tid,
+				(long long) event->value);
+		return;
+	}
+
+	fprintf(file, ",\"cat\":\"imageutil\",\"ph\":\"X\",\"ts\":%llu,"
+			"\"dur\":%lld,\"pid\":%d,\"tid\":%d",
+			(unsigned long long) event->start_us, (long long) event->value,
+			pid, ring->tid);
+	if (event->detail[0] != '\0') {
+		fputs(",\"args\":{\"file\":", file);
+		report_write_string(file, event->detail);
+		fputc('}', file);
+	}
+	fputc('}', file);
+}
+
+/**
+ * @brief Writes the recorded events as Chrome trace-event JSON.
+ * @details The file opens in Perfetto or chrome://tracing, with one track
+ *          per thread. Tracing goes on while the events are written. The
+ *          file is written next to its final path and renamed.
+ *
+ * @param path The path of the JSON file
+ * @param since_us Leaves out events started before this monotonic_us()
+ *                 time; 0 for all
+ * @return IMAGE_UTIL_ERROR_NONE on success, otherwise an error code
+ */
+int trace_write_json(const char *path, uint64_t since_us) {
+	char partial[BUFLEN];
+	int pid = getpid();
+	bool first = true;
+	unsigned int written = 0;
+
+	if (snprintf(partial, BUFLEN, "%s.part", path) >= BUFLEN)
+		return IMAGE_UTIL_ERROR_INVALID_PARAMETER;
+
+	trace_event *events = malloc(TRACE_RING_SPANS * sizeof(trace_event));
+	if (events == NULL)
+		return IMAGE_UTIL_ERROR_OUT_OF_MEMORY;
+
+	FILE *file = fopen(partial, "w");
+	if (file == NULL) {
+		free(events);
+		return IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	}
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+
+	unsigned int count = __atomic_load_n(&trace.ring_count, __ATOMIC_RELAXED);
+	for (unsigned int r = 0; r < count && r < TRACE_MAX_THREADS; ++r) {
+		const trace_ring *ring = __atomic_load_n(&trace.rings[r],
+				__ATOMIC_ACQUIRE);
+		if (ring == NULL)
+			continue;
+
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+				"\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", pid,
+				ring->tid);
+		first = false;
+		report_write_string(file, ring->name);
+		fputs("}}", file);
+
+		unsigned int copied = _copy_ring(ring, events);
+		for (unsigned int i = 0; i < copied; ++i) {
+			if (events[i].start_us < since_us)
+				continue;
+			_write_event(file, pid, ring, &events[i], &first);
+			written++;
+		}
+	}
+	fputs("\n]}\n", file);
+	free(events);
+
+	int error_code = IMAGE_UTIL_ERROR_NONE;
+	if (ferror(file))
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	if (fclose(file) != 0 && error_code == IMAGE_UTIL_ERROR_NONE)
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	if (error_code == IMAGE_UTIL_ERROR_NONE && rename(partial, path) != 0)
+		error_code = IMAGE_UTIL_ERROR_PERMISSION_DENIED;
+	if (error_code != IMAGE_UTIL_ERROR_NONE)
+		remove(partial);
+	else
+		dlog_print(DLOG_INFO, LOG_TAG, "Trace: %u events written to %s",
+				written, path);
+	return error_code;
+}
+
+/**
+ * @brief Prints the tracing statistics to the log.
+ */
+void trace_log_stats(void) {
+	unsigned int count = __atomic_load_n(&trace.ring_count, __ATOMIC_RELAXED);
+
+	if (count == 0)
+		return;
+
+	dlog_print(DLOG_INFO, LOG_TAG,
+			"Trace: %u threads traced, %u untraced, %u events overwritten",
+			(count < TRACE_MAX_THREADS) ? count : TRACE_MAX_THREADS,
+			trace.untraced_threads, trace.overwritten);
+}